@@ -0,0 +1,48 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "sleipner/http/client.hpp"
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+
+// Poll an endpoint over one keep-alive connection, in pipelined batches, and report the rate
+// e.g. `http-pipelined-poll metrics.internal 8080 /health 10000 32`
+int main(int argc, char* argv[]) {
+    if ( argc < 3 )
+        throw std::runtime_error("Please input the hostname and port to poll!");
+
+    std::string host   = argv[1];
+    uint16_t    port   = (uint16_t) std::stoi(argv[2]);
+    std::string target = argc > 3 ? argv[3] : "/";
+    size_t      polls  = argc > 4 ? std::stoul(argv[4]) : 10000;
+    size_t      batch  = argc > 5 ? std::stoul(argv[5]) : 32;
+
+    sleipner::transport::TcpClient socket;
+    socket.connect(sleipner::net::resolve_ip(host, port));
+
+    sleipner::http::Client client(socket, host + ":" + std::to_string(port));
+
+    auto start = std::chrono::steady_clock::now();
+    size_t ok    = 0;
+    size_t bytes = 0;
+
+    for ( size_t sent = 0; sent < polls && client.reusable(); ) {
+        size_t count = 0;
+        for ( ; count < batch && sent < polls; count++, sent++ )
+            client.send("GET", target);
+
+        // One write for the batch, then the responses in order
+        for ( size_t i = 0; i < count; i++ ) {
+            const sleipner::http::Response& response = client.receive(5000);
+            ok    += response.status == 200;
+            bytes += response.body.size();
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << ok << "/" << polls << " polls OK, " << bytes << " body bytes, "
+              << polls / seconds << " requests/s over 1 connection" << std::endl;
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "sleipner/http/websocket.hpp"
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+
+// Send messages to a WebSocket echo server, check the echoes, and report the payload throughput
+// e.g. `http-websocket-echo 127.0.0.1 8765 / 1000 65536`
+int main(int argc, char* argv[]) {
+    if ( argc < 3 )
+        throw std::runtime_error("Please input the hostname and port of a WebSocket echo server!");
+
+    std::string host     = argv[1];
+    uint16_t    port     = (uint16_t) std::stoi(argv[2]);
+    std::string path     = argc > 3 ? argv[3] : "/";
+    size_t      messages = argc > 4 ? std::stoul(argv[4]) : 1000;
+    size_t      size     = argc > 5 ? std::stoul(argv[5]) : 65536;
+
+    sleipner::transport::TcpClient socket;
+    socket.connect(sleipner::net::resolve_ip(host, port));
+
+    sleipner::http::WebSocketClient ws(socket);
+    ws.handshake(host + ":" + std::to_string(port), path, 5000);
+
+    std::string payload(size, '\0');
+    for ( size_t i = 0; i < size; i++ )
+        payload[i] = (char) (i * 31);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t mismatched = 0;
+    std::string echo;
+
+    for ( size_t i = 0; i < messages; i++ ) {
+        ws.send(payload);
+        if ( ws.receive_message(echo, 5000) == sleipner::http::WebSocketClient::Continuation )
+            throw std::runtime_error("No echo within 5 seconds!");
+        mismatched += echo != payload;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ws.close();
+
+    std::cout << messages << " echoes of " << size << " bytes, " << mismatched << " mismatched: "
+              << 2.0 * messages * size / seconds / 1e6 << " MB/s of payload" << std::endl;
+    return 0;
+}
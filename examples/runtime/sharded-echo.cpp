@@ -0,0 +1,62 @@
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/runtime/sharded.hpp"
+#include "sleipner/transport/error.hpp"
+
+using sleipner::runtime::Reactor;
+using sleipner::runtime::ShardedRuntime;
+using sleipner::runtime::TimerWheel;
+
+static constexpr std::chrono::seconds IDLE_TIMEOUT(30);
+
+// Echo server with one shard per core - connections stay on the core that receives their packets
+int main(int argc, char* argv[]) {
+    if ( argc < 2 )
+        throw std::runtime_error("Please input a port to listen on!");
+
+    uint16_t port = (uint16_t) std::stoi(argv[1]);
+
+    ShardedRuntime runtime;
+
+    runtime.on_error([](ShardedRuntime::Shard& shard, std::exception_ptr error) {
+        try {
+            std::rethrow_exception(error);
+        } catch ( std::exception& e ) {
+            std::cerr << "Handler failed on shard " << shard.index() << ": " << e.what() << std::endl;
+        } catch ( ... ) {
+            std::cerr << "Handler failed on shard " << shard.index() << std::endl;
+        }
+    });
+
+    runtime.listen(sleipner::net::resolve_ip("localhost", port).front(), [](ShardedRuntime::Shard& shard, std::shared_ptr<sleipner::transport::TcpClient> client) {
+        std::cout << "Connection on shard " << shard.index() << " (cpu " << shard.cpu() << ")" << std::endl;
+
+        Reactor& reactor = shard.reactor();
+        sleipner::sys::native_socket_t handle = client->native_handle();
+
+        // Drop connections that have been idle for 30 seconds - dropping the handler releases the client
+        auto idle = std::make_shared<sleipner::runtime::TimerHandle>();
+        *idle = reactor.timers().add(TimerWheel::clock::now() + IDLE_TIMEOUT, [&reactor, handle] {
+            reactor.remove(handle);
+        });
+
+        reactor.add(handle, Reactor::Readable, [&reactor, handle, client, idle](int) {
+            char buf[4096];
+            try {
+                size_t r = client->receive(buf, sizeof(buf), 0);
+                client->send(buf, r);
+                reactor.timers().reschedule(*idle, TimerWheel::clock::now() + IDLE_TIMEOUT);
+            } catch ( sleipner::error::SocketDisconnection& ) {
+                reactor.timers().cancel(*idle);
+                reactor.remove(handle);
+            }
+        });
+    });
+
+    std::cout << "Listening on port " << port << " with " << runtime.size() << " shards, press enter to stop..." << std::endl;
+    std::cin.get();
+}
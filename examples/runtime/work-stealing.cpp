@@ -0,0 +1,62 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sleipner/runtime/executor.hpp"
+
+using sleipner::runtime::ExecutorOptions;
+using sleipner::runtime::Strand;
+using sleipner::runtime::WorkStealingExecutor;
+
+// Simulates handling messages from many connections, where a few hot connections get most of the work
+static void busy(std::chrono::microseconds duration) {
+    auto until = std::chrono::steady_clock::now() + duration;
+    while ( std::chrono::steady_clock::now() < until ) {}
+}
+
+static void run(size_t threads, size_t connections, size_t messages) {
+    ExecutorOptions options;
+    options.threads = threads;
+    WorkStealingExecutor executor(options);
+
+    std::vector<Strand> strands;
+    std::vector<std::unique_ptr<std::atomic<size_t>>> next(connections);
+    for ( size_t c = 0; c < connections; c++ ) {
+        strands.emplace_back(executor);
+        next[c].reset(new std::atomic<size_t>(0));
+    }
+
+    std::atomic<size_t> out_of_order = {0};
+    auto start = std::chrono::steady_clock::now();
+
+    for ( size_t m = 0; m < messages; m++ ) {
+        // Every 8th connection is hot, and its messages take 20 times longer to handle
+        size_t c = m % connections;
+        std::chrono::microseconds cost(c % 8 == 0 ? 200 : 10);
+        std::atomic<size_t>* expected = next[c].get();
+        size_t sequence = m / connections;
+
+        strands[c].post([cost, expected, sequence, &out_of_order] {
+            if ( expected->fetch_add(1) != sequence )
+                out_of_order++;
+            busy(cost);
+        });
+    }
+
+    executor.wait_idle();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << executor.size() << " workers: " << messages / seconds << " messages/s, "
+              << out_of_order.load() << " out of order" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t connections = argc > 1 ? std::stoul(argv[1]) : 64;
+    size_t messages    = argc > 2 ? std::stoul(argv[2]) : 20000;
+
+    run(1, connections, messages);
+    run(0, connections, messages);
+}
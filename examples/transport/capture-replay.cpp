@@ -0,0 +1,55 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/capture.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+
+// Record the traffic of a connection, then replay it as fast as possible to measure the handler alone
+// e.g. `transport-capture-replay feed.cap feed.example.com 9000` to record until the peer disconnects,
+//      and `transport-capture-replay feed.cap` to replay
+static size_t handle(sleipner::transport::ISocket& socket) {
+    // Stand-in for a protocol handler - count the lines
+    size_t lines = 0;
+    char buf[4096];
+
+    try {
+        for ( ;; ) {
+            size_t received = socket.receive(buf, sizeof(buf), 1000);
+            for ( size_t i = 0; i < received; i++ )
+                lines += buf[i] == '\n';
+        }
+    } catch ( sleipner::error::SocketDisconnection& ) {
+        /* Done */
+    }
+
+    return lines;
+}
+
+int main(int argc, char* argv[]) {
+    if ( argc < 2 )
+        throw std::runtime_error("Please input the capture file, and the hostname and port to record from!");
+
+    std::string path = argv[1];
+
+    if ( argc > 3 ) {
+        sleipner::transport::TcpClient client;
+        client.connect(sleipner::net::resolve_ip(argv[2], (uint16_t) std::stoi(argv[3])));
+
+        sleipner::transport::RecordingSocket recording(client, path);
+        size_t lines = handle(recording);
+        std::cout << "Recorded " << lines << " lines, " << recording.recorded() << " bytes" << std::endl;
+        return 0;
+    }
+
+    sleipner::transport::ReplaySocket replay(path);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t lines = handle(replay);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Replayed " << lines << " lines in " << seconds * 1e3 << "ms" << std::endl;
+    return 0;
+}
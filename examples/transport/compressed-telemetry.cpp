@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/compressed.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/tcplistener.hpp"
+
+using sleipner::transport::CompressedSocket;
+using sleipner::transport::CompressionOptions;
+using sleipner::transport::CompressionStats;
+
+// One telemetry record, as a JSON line - most of it repeats from record to record
+static std::string make_record(std::mt19937& random, uint64_t timestamp) {
+    char line[256];
+    int length = std::snprintf(line, sizeof(line),
+        "{\"ts\":%llu,\"device\":\"pump-%03u\",\"site\":\"north-basin\",\"temperature\":%.2f,"
+        "\"pressure\":%.3f,\"flow\":%.1f,\"status\":\"%s\"}\n",
+        (unsigned long long) timestamp, (unsigned) (random() % 64), 40.0 + (random() % 500) / 100.0,
+        3.0 + (random() % 100) / 1000.0, 120.0 + (random() % 200) / 10.0, random() % 100 ? "ok" : "degraded");
+    return std::string(line, (size_t) length);
+}
+
+// Stream telemetry records through a compressed connection, and report the ratio and throughput
+// e.g. `transport-compressed-telemetry 0.0.0.0 9000 lz4` on the receiver, and
+//      `transport-compressed-telemetry 0.0.0.0 9000 lz4 collector.example.com 256` on the sender
+int main(int argc, char* argv[]) {
+    if ( argc < 4 )
+        throw std::runtime_error("Please input the local address and port to listen on, and the codec (lz4 or zstd)!");
+
+    CompressionOptions options;
+    options.codec = std::string(argv[3]) == "zstd" ? CompressionOptions::Zstd : CompressionOptions::Lz4;
+    if ( !CompressedSocket::supports(options.codec) )
+        throw std::runtime_error("The codec was not available when the library was built!");
+
+    if ( argc < 5 ) {
+        sleipner::transport::TcpListener listener;
+        listener.listen(sleipner::net::resolve_ip(argv[1], (uint16_t) std::stoi(argv[2])).front());
+
+        for ( ;; ) {
+            sleipner::transport::TcpClient client;
+            if ( !listener.accept(client, 60000) )
+                continue;
+
+            CompressedSocket link(client, options);
+            std::string buffer(256 << 10, '\0');
+            auto start = std::chrono::steady_clock::now();
+            try {
+                while ( link.receive(&buffer[0], buffer.size(), UINT64_MAX) > 0 ) {}
+            } catch ( sleipner::error::SocketDisconnection& ) {}
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            CompressionStats stats = link.stats();
+            std::cout << "Received " << stats.raw_received << " bytes in " << stats.wire_received << " on the wire, "
+                      << stats.raw_received / seconds / 1e6 << " MB/s" << std::endl;
+        }
+    }
+
+    size_t megabytes = argc > 5 ? std::stoul(argv[5]) : 256;
+    std::mt19937 random(42);
+
+    // Formatting is slower than compressing, so the records are made up front
+    std::vector<std::string> records;
+    for ( uint64_t timestamp = 1700000000000; records.size() < 100000; timestamp++ )
+        records.push_back(make_record(random, timestamp));
+
+    sleipner::transport::TcpClient client;
+    client.connect(sleipner::net::resolve_ip(argv[4], (uint16_t) std::stoi(argv[2])));
+    CompressedSocket link(client, options);
+
+    auto start = std::chrono::steady_clock::now();
+    for ( size_t sent = 0, i = 0; sent < (megabytes << 20); i = (i + 1) % records.size() )
+        sent += link.send(records[i]);
+    link.flush();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CompressionStats stats = link.stats();
+    std::cout << "Sent " << stats.raw_sent << " bytes in " << stats.wire_sent << " on the wire, ratio "
+              << (double) stats.raw_sent / stats.wire_sent << ", " << stats.raw_sent / seconds / 1e6 << " MB/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/tcplistener.hpp"
+
+// Count every heap allocation of the process
+static std::atomic<size_t> allocations = {0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if ( void* ptr = std::malloc(size ? size : 1) )
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Connect and close against a local listener over and over, counting the allocations of the client
+// e.g. `transport-connect-cycle 7100 10000`
+int main(int argc, char* argv[]) {
+    if ( argc < 2 )
+        throw std::runtime_error("Please input a free port to listen on!");
+
+    uint16_t port   = (uint16_t) std::stoi(argv[1]);
+    size_t   cycles = argc > 2 ? std::stoul(argv[2]) : 10000;
+
+    sleipner::net::IpAddress address = sleipner::net::resolve_ip("127.0.0.1", port).front();
+
+    sleipner::transport::TcpListener listener;
+    listener.listen(address);
+
+    sleipner::transport::TcpClient client;
+    sleipner::transport::TcpClient server;
+
+    size_t client_allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for ( size_t i = 0; i < cycles; i++ ) {
+        size_t before = allocations.load();
+        client.connect(address);
+        client_allocations += allocations.load() - before;
+
+        listener.accept(server, 1000);
+        server.close();
+
+        before = allocations.load();
+        client.close();
+        client_allocations += allocations.load() - before;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << cycles << " cycles: " << (double) client_allocations / cycles << " allocations per connect/close"
+              << ", " << seconds * 1e6 / cycles << "us per cycle" << std::endl;
+    return 0;
+}
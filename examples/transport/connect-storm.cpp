@@ -0,0 +1,31 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+
+// Open many connections to one server at once, as when reconnecting a fleet after a restart
+// e.g. `transport-connect-storm 127.0.0.1 7100 1000 256`
+int main(int argc, char* argv[]) {
+    if ( argc < 3 )
+        throw std::runtime_error("Please input the hostname and port to connect to!");
+
+    sleipner::net::IpAddress address = sleipner::net::resolve_ip(argv[1], (uint16_t) std::stoi(argv[2])).front();
+    size_t count       = argc > 3 ? std::stoul(argv[3]) : 1000;
+    size_t concurrency = argc > 4 ? std::stoul(argv[4]) : 256;
+
+    std::vector<sleipner::net::IpAddress> endpoints(count, address);
+
+    auto start = std::chrono::steady_clock::now();
+    auto results = sleipner::transport::connect_all(endpoints, concurrency, start + std::chrono::seconds(10));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t connected = 0;
+    for ( auto& result: results )
+        connected += !result.error;
+
+    std::cout << connected << "/" << count << " connected in " << seconds * 1e3 << "ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/transport/fanout.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/tcplistener.hpp"
+
+// Publish to many local subscribers, one of which never reads, and report how the others fared
+// e.g. `transport-fan-out 7100 20 20000`
+int main(int argc, char* argv[]) {
+    if ( argc < 2 )
+        throw std::runtime_error("Please input a free port to listen on!");
+
+    uint16_t port        = (uint16_t) std::stoi(argv[1]);
+    size_t   subscribers = argc > 2 ? std::stoul(argv[2]) : 20;
+    size_t   messages    = argc > 3 ? std::stoul(argv[3]) : 20000;
+
+    sleipner::net::IpAddress address = sleipner::net::resolve_ip("127.0.0.1", port).front();
+
+    sleipner::transport::TcpListener listener;
+    listener.listen(address);
+
+    std::vector<std::unique_ptr<sleipner::transport::TcpClient>> readers;
+    std::vector<std::unique_ptr<sleipner::transport::TcpClient>> connections;
+
+    for ( size_t i = 0; i < subscribers; i++ ) {
+        readers.emplace_back(new sleipner::transport::TcpClient());
+        readers.back()->connect(address);
+        connections.emplace_back(new sleipner::transport::TcpClient());
+        listener.accept(*connections.back(), 1000);
+    }
+
+    sleipner::runtime::Reactor reactor;
+    sleipner::transport::FanOutOptions options;
+    options.policy = sleipner::transport::SlowConsumerPolicy::Disconnect;
+
+    sleipner::transport::FanOutPublisher publisher(reactor, options);
+    publisher.on_drop([](sleipner::transport::TcpClient& client) {
+        std::cout << "Dropped a slow subscriber" << std::endl;
+        client.close();
+    });
+
+    for ( auto& connection: connections )
+        publisher.subscribe(*connection);
+
+    std::thread loop([&] { reactor.run(); });
+
+    // Every reader but the first keeps up
+    std::atomic<bool> done = {false};
+    std::atomic<uint64_t> received = {0};
+    std::thread consumer([&] {
+        char buf[65536];
+        while ( !done.load() ) {
+            for ( size_t i = 1; i < readers.size(); i++ ) {
+                try {
+                    received += readers[i]->receive(buf, sizeof(buf), 0);
+                } catch ( sleipner::error::SocketDisconnection& ) {
+                    readers[i]->close();
+                } catch ( sleipner::error::SetupError& ) {
+                    /* Closed above */
+                }
+            }
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    sleipner::transport::Payload payload = sleipner::transport::make_payload(std::string(1024, 'x'));
+
+    // A steady feed rather than one burst, which would overflow every backlog before anyone could read
+    for ( size_t i = 0; i < messages; i++ ) {
+        publisher.publish(payload);
+        if ( i % 64 == 63 )
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    uint64_t expected = (uint64_t) messages * payload->size() * (subscribers - 1);
+    while ( received.load() < expected && std::chrono::steady_clock::now() - start < std::chrono::seconds(30) )
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    done = true;
+    consumer.join();
+    reactor.post([&] { reactor.stop(); });
+    loop.join();
+
+    std::cout << received.load() << "/" << expected << " bytes delivered to the fast subscribers in "
+              << seconds * 1e3 << "ms" << std::endl;
+    return 0;
+}
@@ -1,11 +1,10 @@
 #include <iostream>
 #include <string>
 
+#include "sleipner/http/client.hpp"
 #include "sleipner/net/ip.hpp"
 #include "sleipner/transport/tcpclient.hpp"
 
-#include <Windows.h>
-
 int main(int argc, char* argv[]) {
     if ( argc < 2 )
         throw std::runtime_error("Please input a valid hostname, such as www.example.com, to GET!");
@@ -22,16 +21,15 @@ int main(int argc, char* argv[]) {
 
     std::cout << "Sending..." << std::endl;
 
-    std::string packet = "GET / HTTP/1.1\r\nHost: " + hostname + "\r\nUser-Agent: cpp-sleipner/2.29.0\r\nAccept: */*\r\nConnection: keep-alive\r\n\r\n";
-    client.send(packet);
-
-    std::string res;
-
-    do {
-        Sleep(500);
-        std::cout << "Receiving more data..." << std::endl;
-        res = client.receive(1024, 5000);
-    } while ( client.bytes_available() > 0 );
-
-    std::cout << "--- Response: ---" << std::endl << res << std::endl;
+    // The client knows from the response itself when it is complete - no guessing by polling
+    sleipner::http::Client http(client, hostname);
+    const sleipner::http::Response& res = http.request("GET", "/", 5000, {
+        {"User-Agent", "cpp-sleipner/2.29.0"},
+        {"Accept", "*/*"}
+    });
+
+    std::cout << "--- Response: " << res.status << " " << res.reason << " ---" << std::endl;
+    for ( const sleipner::http::Header& header: res.headers )
+        std::cout << header.name << ": " << header.value << std::endl;
+    std::cout << std::endl << res.body << std::endl;
 }
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/transport/multiplexer.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/tcplistener.hpp"
+
+// Run many requests at once over a single connection to a local echo service, and report the rate
+// e.g. `transport-multiplexed-rpc 7100 100000 1000`
+int main(int argc, char* argv[]) {
+    if ( argc < 2 )
+        throw std::runtime_error("Please input a free port to listen on!");
+
+    uint16_t port     = (uint16_t) std::stoi(argv[1]);
+    size_t   requests = argc > 2 ? std::stoul(argv[2]) : 100000;
+    size_t   window   = argc > 3 ? std::stoul(argv[3]) : 1000;
+
+    sleipner::net::IpAddress address = sleipner::net::resolve_ip("127.0.0.1", port).front();
+
+    sleipner::transport::TcpListener listener;
+    listener.listen(address);
+
+    sleipner::transport::TcpClient client;
+    sleipner::transport::TcpClient server;
+    client.connect(address);
+    listener.accept(server, 1000);
+
+    // Both ends share one loop here, but would usually live in different processes
+    sleipner::runtime::Reactor reactor;
+    sleipner::transport::Multiplexer service(reactor, server);
+    sleipner::transport::Multiplexer rpc(reactor, client);
+
+    service.on_request([&](sleipner::transport::Multiplexer::RequestId id, std::string request) {
+        service.reply(id, std::move(request));
+    });
+
+    std::thread loop([&] { reactor.run(); });
+
+    auto start = std::chrono::steady_clock::now();
+    size_t failed = 0;
+
+    std::vector<std::future<std::string>> replies;
+    for ( size_t sent = 0; sent < requests; ) {
+        replies.clear();
+        for ( size_t i = 0; i < window && sent < requests; i++, sent++ )
+            replies.push_back(rpc.request("request " + std::to_string(sent)));
+
+        for ( auto& reply: replies ) {
+            try {
+                reply.get();
+            } catch ( std::exception& ) {
+                failed++;
+            }
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    reactor.stop();
+    loop.join();
+
+    std::cout << requests << " requests over 1 connection, " << window << " in flight, " << failed << " failed: "
+              << requests / seconds << " requests/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+
+// Ping-pong against an echo server, comparing the round-trip latency and CPU cost of the receive policies
+// e.g. run `ncat -l 7000 -k -e /bin/cat` and `transport-receive-latency 127.0.0.1 7000`
+static void run(const std::string& name, sleipner::transport::TcpClient& client, size_t rounds) {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<uint64_t> samples;
+    samples.reserve(rounds);
+
+    char buf[64];
+    std::clock_t cpu_start = std::clock();
+    clock::time_point wall_start = clock::now();
+
+    for ( size_t i = 0; i < rounds; i++ ) {
+        clock::time_point start = clock::now();
+        client.send("ping", 4);
+
+        size_t received = 0;
+        while ( received < 4 )
+            received += client.receive(buf, 4 - received, 1000);
+
+        samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+    }
+
+    double wall = std::chrono::duration<double>(clock::now() - wall_start).count();
+    double cpu  = double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << name
+              << ": p50 " << samples[samples.size() / 2] / 1000.0 << "us"
+              << ", p99 " << samples[samples.size() * 99 / 100] / 1000.0 << "us"
+              << ", cpu " << 100.0 * cpu / wall << "%" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if ( argc < 3 )
+        throw std::runtime_error("Please input the hostname and port of an echo server!");
+
+    std::string hostname = argv[1];
+    uint16_t port        = (uint16_t) std::stoi(argv[2]);
+    uint32_t spin        = argc > 3 ? (uint32_t) std::stoul(argv[3]) : 50;
+    size_t rounds        = argc > 4 ? std::stoul(argv[4]) : 10000;
+
+    sleipner::transport::TcpClient client;
+    client.connect( sleipner::net::resolve_ip(hostname, port) );
+
+    run("blocking", client, rounds);
+
+    sleipner::transport::ReceivePolicy policy;
+    policy.spin_budget = spin;
+    client.set_receive_policy(policy);
+    run("spin", client, rounds);
+
+    policy.adaptive = true;
+    client.set_receive_policy(policy);
+    run("adaptive", client, rounds);
+}
@@ -0,0 +1,89 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/transport/serialport.hpp"
+
+using sleipner::runtime::Reactor;
+using sleipner::runtime::TimerWheel;
+using sleipner::transport::SerialOptions;
+using sleipner::transport::SerialPort;
+
+static constexpr std::chrono::seconds POLL_INTERVAL(1);
+
+struct Instrument {
+    std::string path;
+    SerialPort  port;
+    std::string line;
+};
+
+// Query instruments on many serial ports from one thread, printing each reply line - POSIX only,
+// as the ports are watched by the reactor
+// e.g. `transport-serial-gateway 9600 "MEAS?" /dev/ttyUSB0 /dev/ttyUSB1`
+int main(int argc, char* argv[]) {
+    if ( argc < 4 )
+        throw std::runtime_error("Please input the baud rate, the query to send, and the ports!");
+
+    SerialOptions options;
+    options.baud_rate = (uint32_t) std::stoul(argv[1]);
+    std::string query = std::string(argv[2]) + "\r\n";
+
+    Reactor reactor;
+    std::vector<std::unique_ptr<Instrument>> instruments;
+
+    for ( int i = 3; i < argc; i++ ) {
+        auto instrument = std::make_unique<Instrument>();
+        instrument->path = argv[i];
+        instrument->port.open(argv[i], options);
+        instruments.push_back(std::move(instrument));
+    }
+
+    for ( auto& ptr: instruments ) {
+        Instrument* instrument = ptr.get();
+        sleipner::sys::native_socket_t handle = instrument->port.native_handle();
+
+        // Woken only when a port has data - nothing spins while the instruments are quiet
+        reactor.add(handle, Reactor::Readable, [&reactor, instrument, handle](int) {
+            try {
+                char buf[256];
+                size_t r = instrument->port.receive(buf, sizeof(buf), 0);
+                instrument->line.append(buf, r);
+            } catch ( sleipner::error::SocketDisconnection& ) {
+                std::cout << instrument->path << ": disconnected" << std::endl;
+                reactor.remove(handle);
+                return;
+            }
+
+            for ( size_t end; (end = instrument->line.find('\n')) != std::string::npos; ) {
+                std::cout << instrument->path << ": " << instrument->line.substr(0, end) << std::endl;
+                instrument->line.erase(0, end + 1);
+            }
+        });
+    }
+
+    // Send the query to every port on each tick
+    std::function<void()> poll = [&] {
+        for ( auto& instrument: instruments ) {
+            try {
+                instrument->port.send(query);
+            } catch ( sleipner::error::SocketDisconnection& ) {}
+        }
+        reactor.timers().add(TimerWheel::clock::now() + POLL_INTERVAL, poll);
+    };
+    reactor.post(poll);
+
+    std::thread loop([&] { reactor.run(); });
+
+    std::cout << "Polling " << instruments.size() << " ports, press enter to stop..." << std::endl;
+    std::cin.get();
+
+    reactor.stop();
+    loop.join();
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/basicsocket.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+
+using sleipner::transport::BasicSocket;
+using sleipner::transport::ISocket;
+using sleipner::transport::NoLock;
+using sleipner::transport::SpinLock;
+using sleipner::transport::TcpBackend;
+
+// Time a tight loop of small sends, as done by a market data or telemetry publisher
+template <typename Socket>
+static void run(const std::string& name, Socket& socket, size_t messages) {
+    char message[64] = {};
+    auto start = std::chrono::steady_clock::now();
+
+    for ( size_t i = 0; i < messages; i++ )
+        socket.send(message, sizeof(message));
+
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": " << ns / messages << " ns per send" << std::endl;
+}
+
+// Compare the cost of a send through ISocket and through BasicSocket with each lock policy
+// e.g. run `ncat -l 9000 -k > /dev/null` and `transport-static-dispatch 127.0.0.1 9000`
+int main(int argc, char* argv[]) {
+    if ( argc < 3 )
+        throw std::runtime_error("Please input the hostname and port of a server that discards what it receives!");
+
+    auto addresses  = sleipner::net::resolve_ip(argv[1], (uint16_t) std::stoi(argv[2]));
+    size_t messages = argc > 3 ? std::stoul(argv[3]) : 1000000;
+
+    sleipner::transport::TcpClient client;
+    client.connect(addresses);
+    ISocket& erased = client;
+    run("ISocket (TcpClient)", erased, messages);
+
+    BasicSocket<TcpBackend, std::mutex> with_mutex;
+    with_mutex.connect(addresses);
+    run("BasicSocket<TcpBackend, std::mutex>", with_mutex, messages);
+
+    BasicSocket<TcpBackend, SpinLock> with_spin;
+    with_spin.connect(addresses);
+    run("BasicSocket<TcpBackend, SpinLock>", with_spin, messages);
+
+    BasicSocket<TcpBackend, NoLock> unlocked;
+    unlocked.connect(addresses);
+    run("BasicSocket<TcpBackend, NoLock>", unlocked, messages);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/stripedtransfer.hpp"
+#include "sleipner/transport/tcplistener.hpp"
+
+// Send a buffer over a striped transfer, and report the throughput and connections used
+// e.g. `transport-striped-transfer 0.0.0.0 9000` on the receiver, and
+//      `transport-striped-transfer 0.0.0.0 9000 backup.example.com 256` on the sender
+int main(int argc, char* argv[]) {
+    if ( argc < 3 )
+        throw std::runtime_error("Please input the local address and port to listen on!");
+
+    sleipner::transport::StripedTransfer transfer;
+
+    if ( argc < 4 ) {
+        sleipner::transport::TcpListener listener;
+        listener.listen(sleipner::net::resolve_ip(argv[1], (uint16_t) std::stoi(argv[2])).front());
+
+        for ( ;; ) {
+            std::string data;
+            auto start = std::chrono::steady_clock::now();
+            if ( !transfer.receive(listener, data, 60000) )
+                continue;
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Received " << data.size() << " bytes at " << data.size() / seconds / 1e6 << " MB/s" << std::endl;
+        }
+    }
+
+    size_t megabytes = argc > 4 ? std::stoul(argv[4]) : 256;
+    std::string data(megabytes << 20, 'x');
+
+    sleipner::transport::TransferStats stats = transfer.send(
+        sleipner::net::resolve_ip(argv[3], (uint16_t) std::stoi(argv[2])).front(), data);
+
+    double seconds = std::chrono::duration<double>(stats.elapsed).count();
+    std::cout << "Sent " << stats.bytes << " bytes at " << stats.bytes / seconds / 1e6 << " MB/s"
+              << ", streams peak " << stats.peak_streams << " final " << stats.final_streams
+              << ", retries " << stats.retries << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/transport/tlsclient.hpp"
+
+using sleipner::transport::TlsClient;
+using sleipner::transport::TlsContext;
+using sleipner::transport::TlsOptions;
+
+using clock_type = std::chrono::steady_clock;
+
+static double elapsed_ms(clock_type::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+// Time full and resumed handshakes, then the bulk throughput of one connection
+// e.g. against `openssl s_server -accept 4433 -cert cert.pem -key key.pem -quiet > /dev/null`:
+// `transport-tls-benchmark 127.0.0.1 4433 localhost cert.pem 100 1024`
+int main(int argc, char* argv[]) {
+    if ( argc < 4 )
+        throw std::runtime_error("Please input the host, port and server name of a TLS server that discards what it receives!");
+
+    std::string host        = argv[1];
+    uint16_t    port        = (uint16_t) std::stoi(argv[2]);
+    std::string server_name = argv[3];
+    std::string ca_file     = argc > 4 ? argv[4] : "";
+    size_t      connections = argc > 5 ? std::stoul(argv[5]) : 100;
+    size_t      megabytes   = argc > 6 ? std::stoul(argv[6]) : 1024;
+
+    TlsOptions options;
+    options.ca_file = ca_file;
+    auto context = std::make_shared<TlsContext>(options);
+    auto address = sleipner::net::resolve_ip(host, port);
+
+    // Forgetting the session before every connect forces full handshakes
+    for ( int resume = 0; resume < 2; resume++ ) {
+        size_t resumed = 0;
+        double total_ms = 0;
+
+        for ( size_t i = 0; i < connections; i++ ) {
+            if ( !resume )
+                context->clear_sessions();
+
+            TlsClient client(context);
+            clock_type::time_point start = clock_type::now();
+            client.connect(address, server_name);
+            total_ms += elapsed_ms(start);
+            resumed += client.resumed();
+
+            // The tickets of TLS 1.3 arrive after the handshake - give them a moment, as a real exchange would
+            client.receive(1, 2);
+        }
+
+        std::cout << (resume ? "Resumed" : "Full") << " handshakes: " << total_ms / connections
+                  << " ms per connect, " << resumed << "/" << connections << " resumed" << std::endl;
+    }
+
+    TlsClient client(context);
+    client.connect(address, server_name);
+    std::cout << "Kernel TLS: send " << (client.kernel_tls_send() ? "on" : "off")
+              << ", receive " << (client.kernel_tls_receive() ? "on" : "off") << std::endl;
+
+    std::string chunk(256 << 10, 'x');
+    size_t total = megabytes << 20;
+    clock_type::time_point start = clock_type::now();
+
+    for ( size_t sent = 0; sent < total; sent += chunk.size() )
+        client.send(chunk);
+
+    std::cout << "Bulk send: " << total / elapsed_ms(start) / 1e3 << " MB/s" << std::endl;
+    return 0;
+}
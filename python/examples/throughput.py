@@ -0,0 +1,84 @@
+"""
+Measure the bytes per second the sleipner module sends and receives over loopback,
+next to the standard socket module doing the same.
+
+e.g. `PYTHONPATH=build/python python3 python/examples/throughput.py 1024 262144`
+"""
+import socket
+import sys
+import threading
+import time
+
+import sleipner
+
+
+def serve(listener, total, chunk, upload):
+    # The far end, draining what is uploaded or sourcing what is downloaded
+    conn, _ = listener.accept()
+    with conn:
+        buffer = bytearray(chunk)
+        view = memoryview(buffer)
+        left = total
+        while left:
+            if upload:
+                n = conn.recv_into(view[:min(chunk, left)])
+                if not n:
+                    break
+            else:
+                n = min(chunk, left)
+                conn.sendall(view[:n])
+            left -= n
+        if upload:
+            conn.sendall(b"k")
+        else:
+            conn.recv(1)
+
+
+def run(name, connect, total, chunk, upload):
+    listener = socket.create_server(("127.0.0.1", 0))
+    port = listener.getsockname()[1]
+    server = threading.Thread(target=serve, args=(listener, total, chunk, upload))
+    server.start()
+
+    client, send, recv_into = connect(port)
+    buffer = bytearray(chunk)
+    view = memoryview(buffer)
+    left = total
+
+    start = time.perf_counter()
+    if upload:
+        while left:
+            n = min(chunk, left)
+            send(view[:n])
+            left -= n
+        recv_into(view[:1])
+    else:
+        while left:
+            left -= recv_into(view[:min(chunk, left)])
+        send(b"k")
+    seconds = time.perf_counter() - start
+
+    server.join()
+    client.close()
+    listener.close()
+    print(f"{name:8} {'send' if upload else 'recv':4}: {total / seconds / 1e6:9.1f} MB/s")
+
+
+def connect_sleipner(port):
+    client = sleipner.TcpClient()
+    client.connect(sleipner.resolve_ip("127.0.0.1", port))
+    return client, client.send, client.recv_into
+
+
+def connect_socket(port):
+    client = socket.create_connection(("127.0.0.1", port))
+    return client, client.sendall, client.recv_into
+
+
+if __name__ == "__main__":
+    megabytes = int(sys.argv[1]) if len(sys.argv) > 1 else 1024
+    chunk = int(sys.argv[2]) if len(sys.argv) > 2 else 256 * 1024
+
+    for upload in (True, False):
+        run("sleipner", connect_sleipner, megabytes << 20, chunk, upload)
+        run("socket", connect_socket, megabytes << 20, chunk, upload)
@@ -0,0 +1,528 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file module.cpp
+ * @brief Python bindings for the TCP client and address resolution
+ * @author Ferdinand Tonby-Strandborg
+ *
+ * Written against the CPython API directly, so the data paths do no more than the C++ ones:
+ * @b send reads any buffer-protocol object in place, @b recv_into writes straight into the
+ * caller's buffer, and @b recv receives into the bytes object it returns. Every call that may
+ * block runs with the GIL released.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "sleipner/net/error.hpp"
+#include "sleipner/net/ip.hpp"
+#include "sleipner/sys/error.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+
+using namespace sleipner;
+
+// Longest a receive blocks without the GIL before checking for signals, e.g. Ctrl+C
+#define SIGNAL_CHECK_MS 200
+
+/********************************************/
+/* Errors                                   */
+/********************************************/
+static PyObject* _error                = nullptr;
+static PyObject* _setup_error          = nullptr;
+static PyObject* _socket_disconnection = nullptr;
+static PyObject* _connection_failure   = nullptr;
+static PyObject* _resolution_failure   = nullptr;
+static PyObject* _system_api_error     = nullptr;
+
+// Set the Python error matching the C++ exception - call with the GIL held
+static void _raise(std::exception_ptr failure) {
+    try {
+        std::rethrow_exception(failure);
+    } catch ( const error::SystemApiError& e ) {
+        PyObject* args = Py_BuildValue("(is)", e.error_code, e.what());
+        if ( args ) {
+            PyErr_SetObject(_system_api_error, args);
+            Py_DECREF(args);
+        }
+    } catch ( const error::SetupError& e ) {
+        PyErr_SetString(_setup_error, e.what());
+    } catch ( const error::SocketDisconnection& e ) {
+        PyErr_SetString(_socket_disconnection, e.what());
+    } catch ( const error::ConnectionFailure& e ) {
+        PyErr_SetString(_connection_failure, e.what());
+    } catch ( const error::ResolutionFailure& e ) {
+        PyErr_SetString(_resolution_failure, e.what());
+    } catch ( const std::invalid_argument& e ) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    } catch ( const std::overflow_error& e ) {
+        PyErr_SetString(PyExc_OverflowError, e.what());
+    } catch ( const std::bad_alloc& ) {
+        PyErr_NoMemory();
+    } catch ( const std::exception& e ) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    } catch ( ... ) {
+        PyErr_SetString(PyExc_RuntimeError, "Unknown C++ exception");
+    }
+}
+
+// Run the call with the GIL released, false with the Python error set if it threw
+template<typename Call>
+static bool _without_gil(Call&& call) {
+    std::exception_ptr failure;
+
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        call();
+    } catch ( ... ) {
+        failure = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+
+    if ( failure ) {
+        _raise(failure);
+        return false;
+    }
+    return true;
+}
+
+// None to wait forever, otherwise milliseconds
+static bool _timeout(PyObject* value, uint64_t& timeout) {
+    if ( !value || value == Py_None ) {
+        timeout = UINT64_MAX;
+        return true;
+    }
+
+    unsigned long long ms = PyLong_AsUnsignedLongLong(value);
+    if ( ms == (unsigned long long) -1 && PyErr_Occurred() )
+        return false;
+
+    timeout = (uint64_t) ms;
+    return true;
+}
+
+
+/********************************************/
+/* IpAddress                                */
+/********************************************/
+struct PyIpAddress {
+    PyObject_HEAD
+    net::IpAddress address;
+};
+
+static PyTypeObject PyIpAddressType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+static PyObject* _ip_address_wrap(net::IpAddress&& address) {
+    PyIpAddress* self = PyObject_New(PyIpAddress, &PyIpAddressType);
+    if ( !self )
+        return nullptr;
+
+    new (&self->address) net::IpAddress(std::move(address));
+    return (PyObject*) self;
+}
+
+static void _ip_address_dealloc(PyIpAddress* self) {
+    self->address.~IpAddress();
+    PyObject_Free(self);
+}
+
+static PyObject* _ip_address_host(PyIpAddress* self, void*) {
+    try {
+        std::string host = net::get_ip_address(self->address);
+        return PyUnicode_FromStringAndSize(host.data(), (Py_ssize_t) host.size());
+    } catch ( ... ) {
+        _raise(std::current_exception());
+        return nullptr;
+    }
+}
+
+static PyObject* _ip_address_port(PyIpAddress* self, void*) {
+    try {
+        return PyLong_FromLong(net::get_port(self->address));
+    } catch ( ... ) {
+        _raise(std::current_exception());
+        return nullptr;
+    }
+}
+
+static PyObject* _ip_address_family(PyIpAddress* self, void*) {
+    return PyLong_FromLong(self->address.family);
+}
+
+static PyObject* _ip_address_repr(PyIpAddress* self) {
+    try {
+        std::string host = net::get_ip_address(self->address);
+        return PyUnicode_FromFormat("IpAddress('%s', %u)", host.c_str(), (unsigned) net::get_port(self->address));
+    } catch ( ... ) {
+        _raise(std::current_exception());
+        return nullptr;
+    }
+}
+
+static PyGetSetDef _ip_address_getset[] = {
+    {"host",   (getter) _ip_address_host,   nullptr, "The IP address, as text", nullptr},
+    {"port",   (getter) _ip_address_port,   nullptr, "The port number", nullptr},
+    {"family", (getter) _ip_address_family, nullptr, "The address family, e.g. socket.AF_INET", nullptr},
+    {nullptr}
+};
+
+
+/********************************************/
+/* TcpClient                                */
+/********************************************/
+struct PyTcpClient {
+    PyObject_HEAD
+    transport::TcpClient client;
+};
+
+static PyTypeObject PyTcpClientType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+static PyObject* _tcp_client_new(PyTypeObject* type, PyObject*, PyObject*) {
+    PyTcpClient* self = (PyTcpClient*) type->tp_alloc(type, 0);
+    if ( !self )
+        return nullptr;
+
+    new (&self->client) transport::TcpClient();
+    return (PyObject*) self;
+}
+
+static void _tcp_client_dealloc(PyTcpClient* self) {
+    // Closing may block, e.g. with a linger time set - no other reference is left to race with it
+    Py_BEGIN_ALLOW_THREADS
+    self->client.~TcpClient();
+    Py_END_ALLOW_THREADS
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static PyObject* _tcp_client_connect(PyTcpClient* self, PyObject* target) {
+    if ( PyObject_TypeCheck(target, &PyIpAddressType) ) {
+        net::IpAddress& address = ((PyIpAddress*) target)->address;
+        if ( !_without_gil([&] { self->client.connect(address); }) )
+            return nullptr;
+        Py_RETURN_NONE;
+    }
+
+    // Any sequence of addresses, e.g. the list from resolve_ip
+    PyObject* sequence = PySequence_Fast(target, "connect expects an IpAddress or a sequence of them");
+    if ( !sequence )
+        return nullptr;
+
+    std::vector<net::IpAddress> addresses;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+    for ( Py_ssize_t i = 0; i < count; i++ ) {
+        PyObject* item = PySequence_Fast_GET_ITEM(sequence, i);
+        if ( !PyObject_TypeCheck(item, &PyIpAddressType) ) {
+            Py_DECREF(sequence);
+            PyErr_SetString(PyExc_TypeError, "connect expects an IpAddress or a sequence of them");
+            return nullptr;
+        }
+        addresses.push_back(((PyIpAddress*) item)->address);
+    }
+    Py_DECREF(sequence);
+
+    if ( !_without_gil([&] { self->client.connect(addresses); }) )
+        return nullptr;
+    Py_RETURN_NONE;
+}
+
+static PyObject* _tcp_client_close(PyTcpClient* self, PyObject*) {
+    if ( !_without_gil([&] { self->client.close(); }) )
+        return nullptr;
+    Py_RETURN_NONE;
+}
+
+static PyObject* _tcp_client_connected(PyTcpClient* self, PyObject*) {
+    bool connected = false;
+    if ( !_without_gil([&] { connected = self->client.connected(); }) )
+        return nullptr;
+    return PyBool_FromLong(connected);
+}
+
+static PyObject* _tcp_client_bytes_available(PyTcpClient* self, PyObject*) {
+    size_t available = 0;
+    if ( !_without_gil([&] { available = self->client.bytes_available(); }) )
+        return nullptr;
+    return PyLong_FromSize_t(available);
+}
+
+static PyObject* _tcp_client_fileno(PyTcpClient* self, PyObject*) {
+    try {
+        return PyLong_FromLongLong((long long) self->client.native_handle());
+    } catch ( ... ) {
+        _raise(std::current_exception());
+        return nullptr;
+    }
+}
+
+static PyObject* _tcp_client_send(PyTcpClient* self, PyObject* data) {
+    // Holding the buffer keeps its memory in place, e.g. a bytearray cannot be resized
+    Py_buffer view;
+    if ( PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) < 0 )
+        return nullptr;
+
+    size_t sent = 0;
+    bool ok = _without_gil([&] { sent = self->client.send((const char*) view.buf, (size_t) view.len); });
+    PyBuffer_Release(&view);
+
+    if ( !ok )
+        return nullptr;
+    return PyLong_FromSize_t(sent);
+}
+
+// Receive with the GIL released, in slices so a pending signal is raised within SIGNAL_CHECK_MS
+static bool _receive(PyTcpClient* self, char* buf, size_t size, uint64_t timeout, bool peek, size_t& received) {
+    received = 0;
+
+    while ( true ) {
+        uint64_t slice = std::min<uint64_t>(timeout, SIGNAL_CHECK_MS);
+        bool ok = _without_gil([&] {
+            received = peek ? self->client.peek(buf, size, slice) : self->client.receive(buf, size, slice);
+        });
+
+        if ( !ok )
+            return false;
+        if ( received || !size || timeout == slice )
+            return true;
+
+        if ( PyErr_CheckSignals() < 0 )
+            return false;
+        if ( timeout != UINT64_MAX )
+            timeout -= slice;
+    }
+}
+
+static PyObject* _tcp_client_recv_bytes(PyTcpClient* self, PyObject* args, PyObject* kwargs, bool peek) {
+    static const char* keywords[] = {"size", "timeout", nullptr};
+    Py_ssize_t size;
+    PyObject*  timeout_arg = Py_None;
+    uint64_t   timeout;
+
+    if ( !PyArg_ParseTupleAndKeywords(args, kwargs, "n|O", (char**) keywords, &size, &timeout_arg) )
+        return nullptr;
+    if ( size < 0 ) {
+        PyErr_SetString(PyExc_ValueError, "negative buffersize in recv");
+        return nullptr;
+    }
+    if ( !_timeout(timeout_arg, timeout) )
+        return nullptr;
+
+    // Received straight into the bytes object, then shrunk to what arrived
+    PyObject* bytes = PyBytes_FromStringAndSize(nullptr, size);
+    if ( !bytes )
+        return nullptr;
+
+    size_t received;
+    if ( !_receive(self, PyBytes_AS_STRING(bytes), (size_t) size, timeout, peek, received) ) {
+        Py_DECREF(bytes);
+        return nullptr;
+    }
+
+    if ( received != (size_t) size && _PyBytes_Resize(&bytes, (Py_ssize_t) received) < 0 )
+        return nullptr;
+    return bytes;
+}
+
+static PyObject* _tcp_client_recv(PyTcpClient* self, PyObject* args, PyObject* kwargs) {
+    return _tcp_client_recv_bytes(self, args, kwargs, false);
+}
+
+static PyObject* _tcp_client_peek(PyTcpClient* self, PyObject* args, PyObject* kwargs) {
+    return _tcp_client_recv_bytes(self, args, kwargs, true);
+}
+
+static PyObject* _tcp_client_recv_into(PyTcpClient* self, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"buffer", "nbytes", "timeout", nullptr};
+    Py_buffer  view;
+    Py_ssize_t nbytes = 0;
+    PyObject*  timeout_arg = Py_None;
+    uint64_t   timeout;
+
+    if ( !PyArg_ParseTupleAndKeywords(args, kwargs, "w*|nO", (char**) keywords, &view, &nbytes, &timeout_arg) )
+        return nullptr;
+
+    if ( nbytes < 0 || nbytes > view.len ) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "nbytes is negative or larger than the buffer");
+        return nullptr;
+    }
+    if ( !_timeout(timeout_arg, timeout) ) {
+        PyBuffer_Release(&view);
+        return nullptr;
+    }
+
+    size_t received;
+    bool ok = _receive(self, (char*) view.buf, (size_t) (nbytes ? nbytes : view.len), timeout, false, received);
+    PyBuffer_Release(&view);
+
+    if ( !ok )
+        return nullptr;
+    return PyLong_FromSize_t(received);
+}
+
+static PyObject* _tcp_client_enter(PyTcpClient* self, PyObject*) {
+    Py_INCREF(self);
+    return (PyObject*) self;
+}
+
+static PyObject* _tcp_client_exit(PyTcpClient* self, PyObject*) {
+    if ( !_without_gil([&] { self->client.close(); }) )
+        return nullptr;
+    Py_RETURN_FALSE;
+}
+
+static PyMethodDef _tcp_client_methods[] = {
+    {"connect", (PyCFunction) _tcp_client_connect, METH_O,
+        "connect(address)\n--\n\nConnect to an IpAddress, or to the first reachable of a sequence of them."},
+    {"close", (PyCFunction) _tcp_client_close, METH_NOARGS,
+        "close()\n--\n\nClose the connection. The client may connect again."},
+    {"connected", (PyCFunction) _tcp_client_connected, METH_NOARGS,
+        "connected()\n--\n\nWhether the connection is still open."},
+    {"bytes_available", (PyCFunction) _tcp_client_bytes_available, METH_NOARGS,
+        "bytes_available()\n--\n\nBytes that can be received without blocking."},
+    {"fileno", (PyCFunction) _tcp_client_fileno, METH_NOARGS,
+        "fileno()\n--\n\nThe native socket handle, e.g. for select."},
+    {"send", (PyCFunction) _tcp_client_send, METH_O,
+        "send(data)\n--\n\nSend all of a bytes-like object, without copying it. Returns the bytes sent."},
+    {"recv", (PyCFunction) _tcp_client_recv, METH_VARARGS | METH_KEYWORDS,
+        "recv(size, timeout=None)\n--\n\nReceive up to size bytes, waiting up to timeout milliseconds, or "
+        "forever if None. Returns b'' on timeout."},
+    {"recv_into", (PyCFunction) _tcp_client_recv_into, METH_VARARGS | METH_KEYWORDS,
+        "recv_into(buffer, nbytes=0, timeout=None)\n--\n\nReceive into a writable bytes-like object, up to "
+        "nbytes or its whole length if 0. Returns the bytes received, 0 on timeout."},
+    {"peek", (PyCFunction) _tcp_client_peek, METH_VARARGS | METH_KEYWORDS,
+        "peek(size, timeout=None)\n--\n\nAs recv, but the data is still there for the next recv."},
+    {"__enter__", (PyCFunction) _tcp_client_enter, METH_NOARGS, nullptr},
+    {"__exit__", (PyCFunction) _tcp_client_exit, METH_VARARGS, nullptr},
+    {nullptr}
+};
+
+
+/********************************************/
+/* Module                                   */
+/********************************************/
+static PyObject* _resolve_ip(PyObject*, PyObject* args) {
+    const char* hostname;
+    int port;
+    if ( !PyArg_ParseTuple(args, "si", &hostname, &port) )
+        return nullptr;
+    if ( port < 0 || port > 0xFFFF ) {
+        PyErr_SetString(PyExc_ValueError, "port must be 0-65535");
+        return nullptr;
+    }
+
+    std::string host = hostname;
+    std::vector<net::IpAddress> addresses;
+    if ( !_without_gil([&] { addresses = net::resolve_ip(host, (uint16_t) port); }) )
+        return nullptr;
+
+    PyObject* list = PyList_New((Py_ssize_t) addresses.size());
+    if ( !list )
+        return nullptr;
+
+    for ( size_t i = 0; i < addresses.size(); i++ ) {
+        PyObject* address = _ip_address_wrap(std::move(addresses[i]));
+        if ( !address ) {
+            Py_DECREF(list);
+            return nullptr;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t) i, address);
+    }
+    return list;
+}
+
+static PyMethodDef _module_methods[] = {
+    {"resolve_ip", _resolve_ip, METH_VARARGS,
+        "resolve_ip(hostname, port)\n--\n\nResolve a hostname and port into a list of IpAddress."},
+    {nullptr}
+};
+
+static PyModuleDef _module = {
+    PyModuleDef_HEAD_INIT,
+    "sleipner",
+    "Sleipner TCP transport.\n\n"
+    "Sends read bytes-like objects in place, and recv_into fills caller buffers in place. "
+    "Blocking calls release the GIL.",
+    -1,
+    _module_methods
+};
+
+// Add a new exception class, subclassing the given bases
+static PyObject* _add_error(PyObject* module, const char* name, PyObject* bases, const char* doc) {
+    std::string qualified = std::string("sleipner.") + name;
+    PyObject* type = PyErr_NewExceptionWithDoc(qualified.c_str(), doc, bases, nullptr);
+    if ( !type )
+        return nullptr;
+
+    Py_INCREF(type);
+    if ( PyModule_AddObject(module, name, type) < 0 ) {
+        Py_DECREF(type);
+        Py_DECREF(type);
+        return nullptr;
+    }
+    return type;
+}
+
+PyMODINIT_FUNC PyInit_sleipner(void) {
+    PyIpAddressType.tp_name      = "sleipner.IpAddress";
+    PyIpAddressType.tp_doc       = "A resolved address, from resolve_ip";
+    PyIpAddressType.tp_basicsize = sizeof(PyIpAddress);
+    PyIpAddressType.tp_flags     = Py_TPFLAGS_DEFAULT;
+    PyIpAddressType.tp_dealloc   = (destructor) _ip_address_dealloc;
+    PyIpAddressType.tp_repr      = (reprfunc) _ip_address_repr;
+    PyIpAddressType.tp_getset    = _ip_address_getset;
+
+    PyTcpClientType.tp_name      = "sleipner.TcpClient";
+    PyTcpClientType.tp_doc       = "TcpClient()\n--\n\nClient for TCP network communication";
+    PyTcpClientType.tp_basicsize = sizeof(PyTcpClient);
+    PyTcpClientType.tp_flags     = Py_TPFLAGS_DEFAULT;
+    PyTcpClientType.tp_new       = _tcp_client_new;
+    PyTcpClientType.tp_dealloc   = (destructor) _tcp_client_dealloc;
+    PyTcpClientType.tp_methods   = _tcp_client_methods;
+
+    if ( PyType_Ready(&PyIpAddressType) < 0 || PyType_Ready(&PyTcpClientType) < 0 )
+        return nullptr;
+
+    PyObject* module = PyModule_Create(&_module);
+    if ( !module )
+        return nullptr;
+
+    Py_INCREF(&PyIpAddressType);
+    Py_INCREF(&PyTcpClientType);
+    if ( PyModule_AddObject(module, "IpAddress", (PyObject*) &PyIpAddressType) < 0
+      || PyModule_AddObject(module, "TcpClient", (PyObject*) &PyTcpClientType) < 0 ) {
+        Py_DECREF(module);
+        return nullptr;
+    }
+
+    // Errors are OSErrors, and the connection errors are ConnectionErrors as well, as the socket module's
+    PyObject* connection_bases = nullptr;
+    bool ok = (_error = _add_error(module, "Error", PyExc_OSError, "Base of the errors raised by sleipner"))
+        && (connection_bases = PyTuple_Pack(2, _error, PyExc_ConnectionError))
+        && (_setup_error = _add_error(module, "SetupError", _error,
+                "The client is not set up for the operation, e.g. not connected"))
+        && (_socket_disconnection = _add_error(module, "SocketDisconnection", connection_bases,
+                "The connection was closed or lost"))
+        && (_connection_failure = _add_error(module, "ConnectionFailure", connection_bases,
+                "Failed to connect to a valid target"))
+        && (_resolution_failure = _add_error(module, "ResolutionFailure", _error,
+                "The hostname could not be resolved"))
+        && (_system_api_error = _add_error(module, "SystemApiError", _error,
+                "The system failed a valid request; errno is the system's error code"));
+    Py_XDECREF(connection_bases);
+
+    if ( !ok ) {
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
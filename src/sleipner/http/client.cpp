@@ -0,0 +1,285 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/http/client.hpp"
+#include "sleipner/transport/error.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+
+namespace sleipner::http {
+// Room kept free in the receive buffer for every read
+static constexpr size_t READ_SIZE      = 16 << 10;
+// Longest chunk size or trailer line accepted
+static constexpr size_t MAX_CHUNK_LINE = 4 << 10;
+
+enum ChunkState { CHUNK_SIZE, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILERS };
+
+static std::string_view _rebased(std::string_view view, const char* old_base, const char* new_base) noexcept {
+    if ( view.data() == nullptr )
+        return view;
+    return std::string_view(new_base + (view.data() - old_base), view.size());
+}
+
+static uint64_t _content_length(std::string_view value) {
+    uint64_t length = 0;
+    auto result = std::from_chars(value.data(), value.data() + value.size(), length);
+    if ( value.empty() || result.ec != std::errc() || result.ptr != value.data() + value.size() )
+        throw error::ProtocolError("Malformed Content-Length!");
+    return length;
+}
+
+/********************************************/
+/* Client                                   */
+/********************************************/
+Client::Client(transport::ISocket& socket, std::string host, const ClientOptions& options):
+        socket(socket), host(std::move(host)), options(options) {}
+
+void Client::send(std::string_view method, std::string_view target, std::initializer_list<Header> headers, std::string_view body) {
+    if ( closed )
+        throw error::SocketDisconnection("Server closed the connection!");
+
+    output.append(method).append(" ", 1).append(target).append(" HTTP/1.1\r\nHost: ", 17).append(host).append("\r\n", 2);
+    for ( const Header& field: headers )
+        output.append(field.name).append(": ", 2).append(field.value).append("\r\n", 2);
+
+    if ( !body.empty() || method == "POST" || method == "PUT" || method == "PATCH" ) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), body.size());
+        output.append("Content-Length: ", 16).append(digits, (size_t) (result.ptr - digits)).append("\r\n", 2);
+    }
+
+    output.append("\r\n", 2).append(body);
+    expecting.push_back(method == "HEAD");
+
+    if ( output.size() >= options.flush_threshold )
+        flush();
+}
+
+void Client::flush() {
+    for ( size_t sent = 0; sent < output.size(); )
+        sent += socket.send(output.data() + sent, output.size() - sent);
+    output.clear();
+}
+
+const Response& Client::request(std::string_view method, std::string_view target, uint64_t timeout,
+                                std::initializer_list<Header> headers, std::string_view body) {
+    send(method, target, headers, body);
+    return receive(timeout);
+}
+
+size_t Client::pending() const noexcept {
+    return expecting.size();
+}
+
+bool Client::reusable() const noexcept {
+    return !closed;
+}
+
+const Response& Client::receive(uint64_t timeout) {
+    if ( expecting.empty() )
+        throw error::SetupError("No request awaiting a response!");
+
+    flush();
+    transport::Deadline deadline = transport::Deadline::clock::now() + std::chrono::milliseconds(timeout);
+
+    // The previous response is done with - only keep what was received after it
+    if ( start ) {
+        std::memmove(&input[0], &input[start], used - start);
+        used -= start;
+        start = 0;
+    }
+
+    if ( closed && used == 0 )
+        throw error::SocketDisconnection("Server closed the connection!");
+
+    size_t head;
+    for ( ;; ) {
+        while ( (head = parse_response(input.data() + start, used - start, response, options.limits)) == 0 )
+            read_more(deadline);
+
+        // Interim responses precede the final one
+        if ( response.status >= 200 || response.status == 101 )
+            break;
+        start += head;
+    }
+
+    std::string_view connection = response.header("Connection");
+    response.keep_alive = response.minor_version >= 1 ? !has_token(connection, "close") : has_token(connection, "keep-alive");
+
+    Framing framing = Framing::UntilClose;
+    uint64_t length = 0;
+    if ( expecting.front() || response.status == 204 || response.status == 304 || response.status == 101 ) {
+        framing = Framing::None;
+    } else if ( has_token(response.header("Transfer-Encoding"), "chunked") ) {
+        framing = Framing::Chunked;
+    } else if ( !response.header("Content-Length").empty() ) {
+        framing = Framing::Length;
+        length  = _content_length(response.header("Content-Length"));
+        if ( length > options.max_body )
+            throw error::ProtocolError("Response body exceeds " + std::to_string(options.max_body) + " bytes!");
+    }
+
+    body_start = start + head;
+    size_t next;
+
+    switch ( framing ) {
+        case Framing::None:
+            next = body_start;
+            break;
+
+        case Framing::Length:
+            // Make room for the whole body up front, so it is received straight into place
+            if ( input.size() < body_start + length + READ_SIZE )
+                grow(body_start + (size_t) length + READ_SIZE);
+            while ( used - body_start < length )
+                read_more(deadline);
+            next = body_start + (size_t) length;
+            break;
+
+        case Framing::Chunked:
+            chunk_in    = body_start;
+            chunk_out   = body_start;
+            chunk_left  = 0;
+            chunk_state = CHUNK_SIZE;
+            while ( !decode_chunked() )
+                read_more(deadline);
+            length = chunk_out - body_start;
+            next   = chunk_in;
+            break;
+
+        default:
+            response.keep_alive = false;
+            while ( read_more(deadline, true) )
+                if ( used - body_start > options.max_body )
+                    throw error::ProtocolError("Response body exceeds " + std::to_string(options.max_body) + " bytes!");
+            length = used - body_start;
+            next   = used;
+            break;
+    }
+
+    response.body = std::string_view(input.data() + body_start, (size_t) length);
+    start = next;
+    expecting.pop_front();
+
+    if ( !response.keep_alive )
+        closed = true;
+
+    return response;
+}
+
+bool Client::read_more(transport::Deadline deadline, bool until_close) {
+    if ( input.size() - used < READ_SIZE )
+        grow(std::max(used + READ_SIZE, input.size() * 2));
+
+    size_t received;
+    try {
+        received = socket.receive(&input[used], input.size() - used, deadline);
+    } catch ( error::SocketDisconnection& ) {
+        closed = true;
+        if ( until_close )
+            return false;
+        throw;
+    }
+
+    if ( received == 0 && transport::Deadline::clock::now() >= deadline )
+        throw error::RequestTimeout("Response not complete within the timeout!");
+
+    used += received;
+    return true;
+}
+
+void Client::grow(size_t size) {
+    std::string grown;
+    grown.reserve(size);
+    grown.append(input, 0, used);
+    grown.resize(size);
+
+    // Point the views of the response being parsed into the new buffer
+    response.reason = _rebased(response.reason, input.data(), grown.data());
+    for ( Header& field: response.headers ) {
+        field.name  = _rebased(field.name, input.data(), grown.data());
+        field.value = _rebased(field.value, input.data(), grown.data());
+    }
+
+    input.swap(grown);
+}
+
+bool Client::decode_chunked() {
+    // Decoded in place - chunk data is moved down over the chunk framing before it
+    char* data = &input[0];
+
+    for ( ;; ) {
+        switch ( chunk_state ) {
+            case CHUNK_SIZE: {
+                const char* lf = static_cast<const char*>(std::memchr(data + chunk_in, '\n', used - chunk_in));
+                if ( lf == nullptr ) {
+                    if ( used - chunk_in > MAX_CHUNK_LINE )
+                        throw error::ProtocolError("Chunk size line too long!");
+                    return false;
+                }
+
+                uint64_t size = 0;
+                auto result = std::from_chars(data + chunk_in, lf, size, 16);
+                if ( result.ec != std::errc() || (*result.ptr != ';' && *result.ptr != '\r' && *result.ptr != '\n'
+                                                  && *result.ptr != ' ' && *result.ptr != '\t') )
+                    throw error::ProtocolError("Malformed chunk size!");
+                if ( size > options.max_body - (chunk_out - body_start) )
+                    throw error::ProtocolError("Response body exceeds " + std::to_string(options.max_body) + " bytes!");
+
+                chunk_in    = (size_t) (lf + 1 - data);
+                chunk_left  = size;
+                chunk_state = size == 0 ? CHUNK_TRAILERS : CHUNK_DATA;
+                break;
+            }
+
+            case CHUNK_DATA: {
+                size_t count = (size_t) std::min<uint64_t>(chunk_left, used - chunk_in);
+                if ( count && chunk_out != chunk_in )
+                    std::memmove(data + chunk_out, data + chunk_in, count);
+                chunk_out  += count;
+                chunk_in   += count;
+                chunk_left -= count;
+
+                if ( chunk_left )
+                    return false;
+                chunk_state = CHUNK_DATA_END;
+                break;
+            }
+
+            case CHUNK_DATA_END: {
+                if ( used - chunk_in < 2 && !(used > chunk_in && data[chunk_in] == '\n') )
+                    return false;
+                if ( data[chunk_in] == '\n' )
+                    chunk_in += 1;
+                else if ( data[chunk_in] == '\r' && data[chunk_in + 1] == '\n' )
+                    chunk_in += 2;
+                else
+                    throw error::ProtocolError("Chunk data not followed by a line break!");
+                chunk_state = CHUNK_SIZE;
+                break;
+            }
+
+            default: {
+                // Trailer fields are skipped, up to the blank line ending the body
+                const char* lf = static_cast<const char*>(std::memchr(data + chunk_in, '\n', used - chunk_in));
+                if ( lf == nullptr ) {
+                    if ( used - chunk_in > MAX_CHUNK_LINE )
+                        throw error::ProtocolError("Trailer line too long!");
+                    return false;
+                }
+
+                bool blank = lf == data + chunk_in || (lf == data + chunk_in + 1 && data[chunk_in] == '\r');
+                chunk_in = (size_t) (lf + 1 - data);
+                if ( blank )
+                    return true;
+                break;
+            }
+        }
+    }
+}
+}
@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file client.hpp
+ * @brief Pipelining HTTP/1.1 client over a persistent connection
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_HTTP_CLIENT_HPP_
+#define _SLEIPNER_HTTP_CLIENT_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+#include "sleipner/http/parser.hpp"
+#include "sleipner/transport/isocket.hpp"
+
+namespace sleipner::http {
+/**
+ * @brief Options for @b Client
+ */
+struct ClientOptions {
+    /// @brief Bounds on the status line and headers of a response
+    ParserLimits limits;
+
+    /// @brief Bytes of a response body, beyond which the response is rejected
+    size_t max_body = 64 << 20;
+
+    /// @brief Bytes of requests buffered before they are sent without waiting for @b receive
+    size_t flush_threshold = 64 << 10;
+};
+
+/**
+ * @brief HTTP/1.1 client keeping one connection open for any number of requests
+ *
+ * Requests are written into a buffer by @b send, and go out in a single write when a
+ * response is received, or when the buffer grows large. Any number of requests can be
+ * sent before receiving the first response - pipelining - which takes one round trip for
+ * a batch instead of one per request. Responses are received in the order of the requests.
+ *
+ * Responses are parsed in place: the status line, headers and body of a @b Response are
+ * views into the receive buffer of the client, so receiving a response does not allocate
+ * once the buffer has grown to fit. Bodies are delimited by Content-Length, chunked
+ * transfer coding - decoded in place - or the server closing the connection.
+ *
+ * The client speaks HTTP on a socket connected by the caller, e.g. a @b TcpClient, so it
+ * works over any @b ISocket.
+ *
+ * Basic usage example:
+ * @code
+ * TcpClient socket;
+ * socket.connect(resolve_ip("metrics.internal", 80));
+ * Client client(socket, "metrics.internal");
+ *
+ * for ( auto& target: targets )
+ *     client.send("GET", target);
+ *
+ * for ( size_t i = 0; i < targets.size(); i++ ) {
+ *     const Response& response = client.receive(5000);
+ *     handle(response.status, response.body); // Valid until the next receive
+ * }
+ * @endcode
+ *
+ * @note Not thread-safe
+ */
+class Client {
+public:
+    /**
+     * @param [in] socket A connected socket, must outlive the client
+     * @param [in] host The value of the Host header of every request, e.g. "example.com:8080"
+     * @param [in] options Limits and buffering
+     */
+    Client(transport::ISocket& socket, std::string host, const ClientOptions& options = ClientOptions());
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    /**
+     * @brief Queue a request to be sent
+     *
+     * Host is always set, and Content-Length whenever there is a body.
+     *
+     * @param [in] method E.g. "GET"
+     * @param [in] target E.g. "/metrics?format=json"
+     * @param [in] headers Further header fields
+     * @param [in] body The body, if any
+     * @throws SocketDisconnection If the server has closed the connection
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    void send(std::string_view method, std::string_view target, std::initializer_list<Header> headers = {},
+              std::string_view body = std::string_view());
+
+    /**
+     * @brief Send the requests queued so far, without waiting for their responses
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    void flush();
+
+    /**
+     * @brief Receive the response to the oldest request that has not had its response yet
+     *
+     * Queued requests are sent first. Interim 1xx responses are skipped. The views of the
+     * previous response become invalid.
+     *
+     * @param [in] timeout Milliseconds to wait for the whole response
+     * @throws RequestTimeout If the response is not complete within the timeout
+     * @throws ProtocolError If the response is malformed, or exceeds the limits
+     * @throws SocketDisconnection If the connection closed before the response was complete
+     * @throws SetupError If there is no request awaiting a response
+     * @throws SystemApiError
+     * @return const Response& The response, valid until the next call to @b receive
+     */
+    const Response& receive(uint64_t timeout);
+
+    /**
+     * @brief Send a request, and receive its response
+     *
+     * @see send, receive
+     */
+    const Response& request(std::string_view method, std::string_view target, uint64_t timeout,
+                            std::initializer_list<Header> headers = {}, std::string_view body = std::string_view());
+
+    /**
+     * @brief Retrieve the number of requests sent or queued, whose responses have not been received
+     */
+    size_t pending() const noexcept;
+
+    /**
+     * @brief Check if further requests can be sent - false once the server has closed the connection
+     */
+    bool reusable() const noexcept;
+
+protected:
+    enum class Framing { None, Length, Chunked, UntilClose };
+
+    transport::ISocket&  socket;
+    const std::string    host;
+    const ClientOptions  options;
+
+    std::string          output;
+    // Whether each request awaiting a response was a HEAD, whose response has no body
+    std::deque<bool>     expecting;
+    bool                 closed = false;
+
+    // Received data in [start, used), the front of it being parsed
+    std::string          input;
+    size_t               start = 0;
+    size_t               used  = 0;
+
+    Response             response;
+    size_t               body_start = 0;
+
+    // State of chunked decoding, as positions in the input
+    size_t               chunk_in    = 0;
+    size_t               chunk_out   = 0;
+    uint64_t             chunk_left  = 0;
+    int                  chunk_state = 0;
+
+    bool read_more(transport::Deadline deadline, bool until_close = false);
+    void grow(size_t size);
+    bool decode_chunked();
+};
+}
+
+#endif
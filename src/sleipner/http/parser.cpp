@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/http/parser.hpp"
+#include "sleipner/transport/error.hpp"
+
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+    #define SLEIPNER_HTTP_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #include <arm_neon.h>
+    #define SLEIPNER_HTTP_NEON
+#endif
+
+namespace sleipner::http {
+/********************************************/
+/* Scanning                                 */
+/********************************************/
+// Find the first byte that is either a or b, or end
+static const char* _find_either(const char* p, const char* end, char a, char b) noexcept {
+    #if defined(SLEIPNER_HTTP_SSE2)
+        const __m128i va = _mm_set1_epi8(a);
+        const __m128i vb = _mm_set1_epi8(b);
+        for ( ; end - p >= 16; p += 16 ) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb)));
+            if ( mask ) {
+                #ifdef _MSC_VER
+                    unsigned long index;
+                    _BitScanForward(&index, (unsigned long) mask);
+                    return p + index;
+                #else
+                    return p + __builtin_ctz((unsigned) mask);
+                #endif
+            }
+        }
+    #elif defined(SLEIPNER_HTTP_NEON)
+        const uint8x16_t va = vdupq_n_u8((uint8_t) a);
+        const uint8x16_t vb = vdupq_n_u8((uint8_t) b);
+        for ( ; end - p >= 16; p += 16 ) {
+            uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+            if ( vmaxvq_u8(vorrq_u8(vceqq_u8(block, va), vceqq_u8(block, vb))) )
+                break;
+        }
+    #endif
+
+    for ( ; p < end; p++ )
+        if ( *p == a || *p == b )
+            return p;
+    return end;
+}
+
+static const char* _find(const char* p, const char* end, char c) noexcept {
+    return _find_either(p, end, c, c);
+}
+
+static char _lower(char c) noexcept {
+    return c >= 'A' && c <= 'Z' ? (char) (c + ('a' - 'A')) : c;
+}
+
+static bool _is_space(char c) noexcept {
+    return c == ' ' || c == '\t';
+}
+
+static std::string_view _trim(const char* begin, const char* end) noexcept {
+    while ( begin < end && _is_space(*begin) )
+        begin++;
+    while ( end > begin && _is_space(end[-1]) )
+        end--;
+    return std::string_view(begin, (size_t) (end - begin));
+}
+
+// Line without its CR, given the position of its LF
+static const char* _line_end(const char* begin, const char* lf) noexcept {
+    return lf > begin && lf[-1] == '\r' ? lf - 1 : lf;
+}
+
+/********************************************/
+/* Parsing                                  */
+/********************************************/
+size_t parse_response(const char* data, size_t size, Response& response, const ParserLimits& limits) {
+    const char* end = data + size;
+    if ( size > limits.max_head )
+        end = data + limits.max_head;
+
+    // Status line - HTTP/1.x SSS reason
+    const char* lf = _find(data, end, '\n');
+    if ( lf == end ) {
+        if ( size >= limits.max_head )
+            throw error::ProtocolError("Response head exceeds " + std::to_string(limits.max_head) + " bytes!");
+        return 0;
+    }
+
+    const char* line = data;
+    const char* eol  = _line_end(line, lf);
+    if ( eol - line < 12 || std::string_view(line, 7) != "HTTP/1." || line[7] < '0' || line[7] > '9' || line[8] != ' '
+         || line[9] < '1' || line[9] > '9' || line[10] < '0' || line[10] > '9' || line[11] < '0' || line[11] > '9'
+         || (eol - line > 12 && line[12] != ' ') )
+        throw error::ProtocolError("Malformed status line!");
+
+    response.minor_version = line[7] - '0';
+    response.status        = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    response.reason        = eol - line > 12 ? std::string_view(line + 13, (size_t) (eol - line - 13)) : std::string_view();
+    response.headers.clear();
+    response.body       = std::string_view();
+    response.keep_alive = true;
+
+    // Header fields, until a blank line
+    for ( line = lf + 1; ; line = lf + 1 ) {
+        const char* colon = _find_either(line, end, ':', '\n');
+        lf = colon == end || *colon == '\n' ? colon : _find(colon, end, '\n');
+        if ( lf == end ) {
+            if ( size >= limits.max_head )
+                throw error::ProtocolError("Response head exceeds " + std::to_string(limits.max_head) + " bytes!");
+            return 0;
+        }
+
+        eol = _line_end(line, lf);
+        if ( eol == line )
+            return (size_t) (lf + 1 - data);
+
+        if ( colon == lf )
+            throw error::ProtocolError("Header line without a colon!");
+        if ( colon == line || _is_space(colon[-1]) || _is_space(*line) )
+            throw error::ProtocolError("Malformed header name!");
+        if ( response.headers.size() >= limits.max_headers )
+            throw error::ProtocolError("Response has more than " + std::to_string(limits.max_headers) + " headers!");
+
+        response.headers.push_back(Header{std::string_view(line, (size_t) (colon - line)), _trim(colon + 1, eol)});
+    }
+}
+
+/********************************************/
+/* Header values                            */
+/********************************************/
+std::string_view Response::header(std::string_view name) const noexcept {
+    for ( const Header& field: headers )
+        if ( equals_ignore_case(field.name, name) )
+            return field.value;
+    return std::string_view();
+}
+
+bool equals_ignore_case(std::string_view a, std::string_view b) noexcept {
+    if ( a.size() != b.size() )
+        return false;
+    for ( size_t i = 0; i < a.size(); i++ )
+        if ( _lower(a[i]) != _lower(b[i]) )
+            return false;
+    return true;
+}
+
+bool has_token(std::string_view value, std::string_view token) noexcept {
+    while ( !value.empty() ) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        // Drop parameters, e.g. "chunked;foo=bar"
+        item = item.substr(0, item.find(';'));
+
+        if ( equals_ignore_case(_trim(item.data(), item.data() + item.size()), token) )
+            return true;
+        if ( comma == std::string_view::npos )
+            break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+}
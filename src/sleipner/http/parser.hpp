@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file parser.hpp
+ * @brief Zero-copy parsing of HTTP/1.x response heads
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_HTTP_PARSER_HPP_
+#define _SLEIPNER_HTTP_PARSER_HPP_
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace sleipner::http {
+/**
+ * @brief A header field, viewing the buffer it was parsed from or built with
+ */
+struct Header {
+    std::string_view name;
+    std::string_view value;
+};
+
+/**
+ * @brief A response, viewing the receive buffer it was parsed from
+ *
+ * Nothing is copied out of the buffer, so the views are only valid as long as it is.
+ * The header list keeps its capacity when reused, so parsing into the same response
+ * over and over does not allocate.
+ */
+struct Response {
+    /// @brief Minor version of HTTP/1.x
+    int minor_version = 1;
+
+    int status = 0;
+
+    std::string_view reason;
+
+    std::vector<Header> headers;
+
+    /// @brief Body, with any chunked transfer coding removed
+    std::string_view body;
+
+    /// @brief Whether the server keeps the connection open after this response
+    bool keep_alive = true;
+
+    /**
+     * @brief Retrieve the value of the first header with the name, compared case-insensitively
+     *
+     * @return std::string_view The value, or empty if there is no such header
+     */
+    std::string_view header(std::string_view name) const noexcept;
+};
+
+/**
+ * @brief Limits of @b parse_response
+ */
+struct ParserLimits {
+    /// @brief Bytes of status line and headers, beyond which the response is rejected
+    size_t max_head = 64 << 10;
+
+    /// @brief Header fields, beyond which the response is rejected
+    size_t max_headers = 128;
+};
+
+/**
+ * @brief Parse the status line and headers of a response
+ *
+ * Lines are found with SSE2 or NEON where available, 16 bytes per step. Lines ending in a
+ * bare LF are accepted, as is common practice. The body and @b keep_alive of the response
+ * are not set - they depend on the request, see @b Client.
+ *
+ * @param [in] data Received data, starting at the status line
+ * @param [in] size Bytes of data
+ * @param [out] response Set to view the data, when the head is complete
+ * @param [in] limits Bounds on the size of the head
+ * @throws ProtocolError If the data is not a valid response head, or exceeds the limits
+ * @return size_t Bytes of the head including the blank line ending it, 0 if it is incomplete
+ */
+size_t parse_response(const char* data, size_t size, Response& response, const ParserLimits& limits = ParserLimits());
+
+/**
+ * @brief Compare two header names, or tokens, ignoring ASCII case
+ */
+bool equals_ignore_case(std::string_view a, std::string_view b) noexcept;
+
+/**
+ * @brief Check if a comma-separated header value lists the token, ignoring ASCII case
+ *
+ * E.g. "chunked" in "gzip, chunked", or "close" in "Close".
+ */
+bool has_token(std::string_view value, std::string_view token) noexcept;
+}
+
+#endif
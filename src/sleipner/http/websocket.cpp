@@ -0,0 +1,603 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/http/websocket.hpp"
+#include "sleipner/transport/error.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define SLEIPNER_WS_AVX2
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    // Built for the baseline, but the AVX2 kernel is compiled in and picked at runtime
+    #define SLEIPNER_WS_AVX2
+    #define SLEIPNER_WS_AVX2_DISPATCH
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SLEIPNER_WS_SSE2
+#endif
+
+namespace sleipner::http {
+// Receive buffer - holds the handshake response, frame headers and control frames
+static constexpr size_t BUFFER_SIZE = 64 << 10;
+// Payload masked and sent per write
+static constexpr size_t SEND_CHUNK  = 256 << 10;
+static constexpr size_t MAX_HEADER  = 14;
+static const char       GUID[]      = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/********************************************/
+/* Masking                                  */
+/********************************************/
+#ifdef SLEIPNER_WS_AVX2
+    #ifdef SLEIPNER_WS_AVX2_DISPATCH
+        __attribute__((target("avx2")))
+    #endif
+    static size_t _mask_avx2(char* dst, const char* src, size_t size, uint32_t key) noexcept {
+        const __m256i mask = _mm256_set1_epi32((int) key);
+        size_t i = 0;
+        for ( ; i + 32 <= size; i += 32 ) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(block, mask));
+        }
+        return i;
+    }
+#endif
+
+#ifdef SLEIPNER_WS_SSE2
+    static size_t _mask_sse2(char* dst, const char* src, size_t size, uint32_t key) noexcept {
+        const __m128i mask = _mm_set1_epi32((int) key);
+        size_t i = 0;
+        for ( ; i + 16 <= size; i += 16 ) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(block, mask));
+        }
+        return i;
+    }
+#endif
+
+static bool _has_avx2() noexcept {
+    #if defined(SLEIPNER_WS_AVX2_DISPATCH)
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    #elif defined(SLEIPNER_WS_AVX2)
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+void apply_mask(char* dst, const char* src, size_t size, const uint8_t key[4], size_t offset) noexcept {
+    // Rotate the key so it lines up with the start of this piece
+    uint8_t rotated[8];
+    for ( size_t i = 0; i < 8; i++ )
+        rotated[i] = key[(offset + i) & 3];
+
+    uint32_t key32;
+    uint64_t key64;
+    std::memcpy(&key32, rotated, 4);
+    std::memcpy(&key64, rotated, 8);
+
+    size_t i = 0;
+    #ifdef SLEIPNER_WS_AVX2
+        if ( _has_avx2() )
+            i = _mask_avx2(dst, src, size, key32);
+    #endif
+    #ifdef SLEIPNER_WS_SSE2
+        i += _mask_sse2(dst + i, src + i, size - i, key32);
+    #endif
+
+    // Blocks end on a multiple of 4, so the key stays lined up
+    for ( ; i + 8 <= size; i += 8 ) {
+        uint64_t word;
+        std::memcpy(&word, src + i, 8);
+        word ^= key64;
+        std::memcpy(dst + i, &word, 8);
+    }
+    for ( ; i < size; i++ )
+        dst[i] = (char) (src[i] ^ rotated[i & 3]);
+}
+
+/********************************************/
+/* Framing                                  */
+/********************************************/
+static size_t _frame_header(char* header, uint8_t opcode, bool fin, size_t size, const uint8_t key[4]) noexcept {
+    size_t length = 2;
+    header[0] = (char) ((fin ? 0x80 : 0x00) | opcode);
+    if ( size < 126 ) {
+        header[1] = (char) (0x80 | size);
+    } else if ( size <= 0xFFFF ) {
+        header[1] = (char) (0x80 | 126);
+        header[2] = (char) (size >> 8);
+        header[3] = (char) size;
+        length = 4;
+    } else {
+        header[1] = (char) (0x80 | 127);
+        for ( size_t i = 0; i < 8; i++ )
+            header[2 + i] = (char) ((uint64_t) size >> (56 - 8 * i));
+        length = 10;
+    }
+
+    std::memcpy(header + length, key, 4);
+    return length + 4;
+}
+
+/********************************************/
+/* Handshake helpers                        */
+/********************************************/
+static uint32_t _rotate(uint32_t value, int bits) noexcept {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void _sha1(const std::string& message, uint8_t digest[20]) noexcept {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    std::string data = message;
+    uint64_t bits = (uint64_t) message.size() * 8;
+    data.push_back((char) 0x80);
+    while ( data.size() % 64 != 56 )
+        data.push_back('\0');
+    for ( int i = 7; i >= 0; i-- )
+        data.push_back((char) (bits >> (8 * i)));
+
+    for ( size_t block = 0; block < data.size(); block += 64 ) {
+        uint32_t w[80];
+        for ( size_t i = 0; i < 16; i++ )
+            w[i] = (uint32_t) (uint8_t) data[block + 4 * i] << 24 | (uint32_t) (uint8_t) data[block + 4 * i + 1] << 16
+                 | (uint32_t) (uint8_t) data[block + 4 * i + 2] << 8 | (uint32_t) (uint8_t) data[block + 4 * i + 3];
+        for ( size_t i = 16; i < 80; i++ )
+            w[i] = _rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for ( size_t i = 0; i < 80; i++ ) {
+            uint32_t f, k;
+            if ( i < 20 )      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if ( i < 40 ) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if ( i < 60 ) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else               { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+            uint32_t temp = _rotate(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = _rotate(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    for ( size_t i = 0; i < 5; i++ )
+        for ( size_t j = 0; j < 4; j++ )
+            digest[4 * i + j] = (uint8_t) (h[i] >> (24 - 8 * j));
+}
+
+static std::string _base64(const uint8_t* data, size_t size) {
+    static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string encoded;
+    for ( size_t i = 0; i < size; i += 3 ) {
+        uint32_t group = (uint32_t) data[i] << 16;
+        if ( i + 1 < size ) group |= (uint32_t) data[i + 1] << 8;
+        if ( i + 2 < size ) group |= data[i + 2];
+
+        encoded.push_back(ALPHABET[(group >> 18) & 63]);
+        encoded.push_back(ALPHABET[(group >> 12) & 63]);
+        encoded.push_back(i + 1 < size ? ALPHABET[(group >> 6) & 63] : '=');
+        encoded.push_back(i + 2 < size ? ALPHABET[group & 63] : '=');
+    }
+    return encoded;
+}
+
+/********************************************/
+/* WebSocketClient                          */
+/********************************************/
+WebSocketClient::WebSocketClient(transport::ISocket& socket, const WebSocketOptions& options):
+        socket(socket), options(options), rng(std::random_device()()), input(BUFFER_SIZE, '\0') {}
+
+WebSocketClient::~WebSocketClient() {
+    if ( !upgraded || close_sent || closed )
+        return;
+
+    try {
+        // 1001 - going away
+        const char payload[2] = {(char) 0x03, (char) 0xE9};
+        send_frame(Close, true, payload, sizeof(payload));
+    } catch ( std::exception& ) {
+        /* The connection is gone either way */
+    }
+}
+
+void WebSocketClient::handshake(std::string_view host, std::string_view path, uint64_t timeout, std::initializer_list<Header> headers) {
+    if ( upgraded )
+        throw error::SetupError("WebSocket handshake already done!");
+
+    transport::Deadline deadline = transport::Deadline::clock::now() + std::chrono::milliseconds(timeout);
+
+    uint8_t nonce[16];
+    for ( size_t i = 0; i < sizeof(nonce); i++ )
+        nonce[i] = (uint8_t) rng();
+    std::string key = _base64(nonce, sizeof(nonce));
+
+    std::string request;
+    request.append("GET ").append(path).append(" HTTP/1.1\r\nHost: ").append(host)
+           .append("\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: ").append(key)
+           .append("\r\nSec-WebSocket-Version: 13\r\n");
+    for ( const Header& field: headers )
+        request.append(field.name).append(": ").append(field.value).append("\r\n");
+    request.append("\r\n");
+    send_all(request.data(), request.size());
+
+    Response response;
+    ParserLimits limits;
+    limits.max_head = BUFFER_SIZE;
+
+    size_t head;
+    while ( (head = parse_response(input.data() + start, used - start, response, limits)) == 0 )
+        if ( !fill(deadline) )
+            throw error::RequestTimeout("No WebSocket handshake response within the timeout!");
+
+    if ( response.status != 101 )
+        throw error::ConnectionFailure("WebSocket upgrade refused: " + std::to_string(response.status) + " " + std::string(response.reason));
+
+    uint8_t digest[20];
+    _sha1(key + GUID, digest);
+
+    if ( !equals_ignore_case(response.header("Upgrade"), "websocket") || !has_token(response.header("Connection"), "upgrade") )
+        throw error::ProtocolError("Server did not upgrade to WebSocket!");
+    if ( response.header("Sec-WebSocket-Accept") != _base64(digest, sizeof(digest)) )
+        throw error::ProtocolError("Server answered the handshake with the wrong key!");
+    if ( !response.header("Sec-WebSocket-Extensions").empty() )
+        throw error::ProtocolError("Server enabled an extension that was not offered!");
+
+    // Frames sent right after the response stay in the buffer
+    start   += head;
+    upgraded = true;
+}
+
+void WebSocketClient::send_message(const char* data, size_t size, Opcode opcode) {
+    check_open();
+    if ( opcode != Text && opcode != Binary )
+        throw std::invalid_argument("Messages are either text or binary!");
+
+    if ( options.fragment_size == 0 || size <= options.fragment_size ) {
+        send_frame(opcode, true, data, size);
+        return;
+    }
+
+    for ( size_t offset = 0; offset < size; offset += options.fragment_size ) {
+        size_t fragment = std::min(options.fragment_size, size - offset);
+        send_frame(offset == 0 ? opcode : Continuation, offset + fragment == size, data + offset, fragment);
+    }
+}
+
+WebSocketClient::Opcode WebSocketClient::receive_message(std::string& message, uint64_t timeout) {
+    check_open();
+    transport::Deadline deadline = transport::Deadline::clock::now() + std::chrono::milliseconds(timeout);
+
+    for ( ;; ) {
+        if ( frame_left == 0 ) {
+            if ( !next_frame() ) {
+                if ( !fill(deadline) )
+                    return Continuation;
+                continue;
+            }
+            if ( frame_left > 0 || !frame_fin )
+                continue;
+        } else {
+            size_t offset = assembling.size();
+            if ( frame_left > options.max_message - offset )
+                throw error::ProtocolError("Message exceeds " + std::to_string(options.max_message) + " bytes!");
+
+            assembling.resize(offset + (size_t) frame_left);
+            size_t received = take(&assembling[offset], (size_t) frame_left, deadline, false);
+            assembling.resize(offset + received);
+
+            // Timed out - the message is resumed by the next call
+            if ( received == 0 )
+                return Continuation;
+            if ( in_message )
+                continue;
+        }
+
+        in_message = false;
+        message.swap(assembling);
+        assembling.clear();
+        return message_opcode;
+    }
+}
+
+void WebSocketClient::ping(std::string_view payload) {
+    check_open();
+    if ( payload.size() > 125 )
+        throw std::invalid_argument("Ping payload can't exceed 125 bytes!");
+    send_frame(Ping, true, payload.data(), payload.size());
+}
+
+void WebSocketClient::close(uint16_t code, std::string_view reason, uint64_t timeout) {
+    if ( !upgraded || closed )
+        return;
+
+    transport::Deadline deadline = transport::Deadline::clock::now() + std::chrono::milliseconds(timeout);
+
+    if ( !close_sent ) {
+        std::string payload;
+        payload.push_back((char) (code >> 8));
+        payload.push_back((char) code);
+        payload.append(reason.substr(0, 123));
+
+        try {
+            send_frame(Close, true, payload.data(), payload.size());
+        } catch ( error::SocketDisconnection& ) {
+            closed = true;
+            return;
+        }
+        close_sent = true;
+    }
+
+    // Drain until the server's close frame, which ends in SocketDisconnection
+    char discard[4096];
+    try {
+        while ( take(discard, sizeof(discard), deadline, false) > 0 ) {}
+    } catch ( error::SocketDisconnection& ) {
+        /* Closed */
+    } catch ( error::ProtocolError& ) {
+        /* Closing anyway */
+    }
+    closed = true;
+}
+
+bool WebSocketClient::connected() const {
+    return upgraded && !closed && !close_sent && socket.connected();
+}
+
+size_t WebSocketClient::bytes_available() const {
+    check_open();
+    if ( frame_left == 0 )
+        return 0;
+    return (size_t) std::min<uint64_t>(frame_left, used - start + socket.bytes_available());
+}
+
+size_t WebSocketClient::send(const char* buf, size_t size) {
+    send_message(buf, size, options.binary ? Binary : Text);
+    return size;
+}
+
+size_t WebSocketClient::send(const std::string& packet) {
+    return send(packet.data(), packet.size());
+}
+
+size_t WebSocketClient::receive(char* buf, size_t size, uint64_t timeout) {
+    return take(buf, size, transport::Deadline::clock::now() + std::chrono::milliseconds(timeout), false);
+}
+
+std::string WebSocketClient::receive(size_t size, uint64_t timeout) {
+    std::string data(size, '\0');
+    data.resize(receive(&data[0], size, timeout));
+    return data;
+}
+
+size_t WebSocketClient::peek(char* buf, size_t size, uint64_t timeout) {
+    return take(buf, size, transport::Deadline::clock::now() + std::chrono::milliseconds(timeout), true);
+}
+
+std::string WebSocketClient::peek(size_t size, uint64_t timeout) {
+    std::string data(size, '\0');
+    data.resize(peek(&data[0], size, timeout));
+    return data;
+}
+
+void WebSocketClient::check_open() const {
+    if ( !upgraded )
+        throw error::SetupError("WebSocket handshake not done!");
+    if ( closed || close_sent )
+        throw error::SocketDisconnection("WebSocket closed!");
+}
+
+void WebSocketClient::send_frame(Opcode opcode, bool fin, const char* data, size_t size) {
+    uint8_t key[4];
+    uint32_t bits = rng();
+    std::memcpy(key, &bits, 4);
+
+    // Pongs waiting to go out lead the frame, in the same write
+    size_t prefix = control_out.size();
+    size_t chunk  = std::min(size, SEND_CHUNK);
+    if ( scratch.size() < prefix + MAX_HEADER + chunk )
+        scratch.resize(prefix + MAX_HEADER + chunk);
+    if ( prefix )
+        std::memcpy(&scratch[0], control_out.data(), prefix);
+
+    char*  header = &scratch[prefix];
+    size_t length = _frame_header(header, opcode, fin, size, key);
+
+    apply_mask(header + length, data, chunk, key, 0);
+    send_all(scratch.data(), prefix + length + chunk);
+    control_out.clear();
+
+    for ( size_t offset = chunk; offset < size; offset += chunk ) {
+        chunk = std::min(SEND_CHUNK, size - offset);
+        apply_mask(&scratch[0], data + offset, chunk, key, offset);
+        send_all(scratch.data(), chunk);
+    }
+}
+
+void WebSocketClient::queue_control(Opcode opcode, const char* data, size_t size) {
+    uint8_t key[4];
+    uint32_t bits = rng();
+    std::memcpy(key, &bits, 4);
+
+    size_t offset = control_out.size();
+    control_out.resize(offset + MAX_HEADER + size);
+    size_t length = _frame_header(&control_out[offset], opcode, true, size, key);
+    apply_mask(&control_out[offset + length], data, size, key, 0);
+    control_out.resize(offset + length + size);
+}
+
+void WebSocketClient::send_all(const char* data, size_t size) {
+    for ( size_t sent = 0; sent < size; )
+        sent += socket.send(data + sent, size - sent);
+}
+
+bool WebSocketClient::fill(transport::Deadline deadline) {
+    // Nothing was sent to carry the pongs - send them before waiting
+    if ( !control_out.empty() ) {
+        send_all(control_out.data(), control_out.size());
+        control_out.clear();
+    }
+
+    if ( start > 0 ) {
+        std::memmove(&input[0], &input[start], used - start);
+        used -= start;
+        start = 0;
+    }
+
+    size_t received = socket.receive(&input[used], input.size() - used, deadline);
+    used += received;
+    return received > 0;
+}
+
+bool WebSocketClient::next_frame() {
+    for ( ;; ) {
+        size_t available = used - start;
+        if ( available < 2 )
+            return false;
+
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(input.data() + start);
+        bool   fin    = p[0] & 0x80;
+        Opcode opcode = (Opcode) (p[0] & 0x0F);
+
+        if ( p[0] & 0x70 )
+            throw error::ProtocolError("Reserved bits set without an extension!");
+        if ( p[1] & 0x80 )
+            throw error::ProtocolError("Frames from the server must not be masked!");
+
+        uint64_t length = p[1] & 0x7F;
+        size_t   header = 2;
+        if ( length == 126 ) {
+            if ( available < 4 )
+                return false;
+            length = (uint64_t) p[2] << 8 | p[3];
+            header = 4;
+        } else if ( length == 127 ) {
+            if ( available < 10 )
+                return false;
+            length = 0;
+            for ( size_t i = 0; i < 8; i++ )
+                length = length << 8 | p[2 + i];
+            if ( length >> 63 )
+                throw error::ProtocolError("Frame length out of range!");
+            header = 10;
+        }
+
+        // Control frames are handled whole, as they arrive, even in the middle of a message
+        if ( opcode & 0x08 ) {
+            if ( opcode != Close && opcode != Ping && opcode != Pong )
+                throw error::ProtocolError("Unknown opcode!");
+            if ( !fin || length > 125 )
+                throw error::ProtocolError("Malformed control frame!");
+            if ( available < header + length )
+                return false;
+
+            start += header + (size_t) length;
+            handle_control(opcode, reinterpret_cast<const char*>(p + header), (size_t) length);
+            continue;
+        }
+
+        if ( opcode != Continuation && opcode != Text && opcode != Binary )
+            throw error::ProtocolError("Unknown opcode!");
+        if ( (opcode == Continuation) != in_message )
+            throw error::ProtocolError(in_message ? "New message before the last one ended!" : "Continuation without a message!");
+
+        if ( opcode != Continuation )
+            message_opcode = opcode;
+
+        start     += header;
+        frame_left = length;
+        frame_fin  = fin;
+        in_message = !(fin && length == 0);
+        return true;
+    }
+}
+
+void WebSocketClient::handle_control(Opcode opcode, const char* payload, size_t size) {
+    if ( opcode == Ping ) {
+        // Held back to share a write with what is sent next, rather than leaving a small
+        // write in flight for the next one to queue behind
+        if ( !close_sent )
+            queue_control(Pong, payload, size);
+        return;
+    }
+    if ( opcode == Pong )
+        return;
+
+    if ( size == 1 )
+        throw error::ProtocolError("Malformed close frame!");
+
+    uint16_t code = size >= 2 ? (uint16_t) ((uint8_t) payload[0] << 8 | (uint8_t) payload[1]) : 1005;
+    std::string reason(size > 2 ? payload + 2 : "", size > 2 ? size - 2 : 0);
+
+    // Echo the status code, completing the closing handshake
+    if ( !close_sent ) {
+        try {
+            send_frame(Close, true, payload, std::min<size_t>(size, 2));
+        } catch ( error::SocketDisconnection& ) {
+            /* Already gone */
+        }
+        close_sent = true;
+    }
+    closed = true;
+
+    throw error::SocketDisconnection("WebSocket closed by the server (" + std::to_string(code) + ")"
+                                     + (reason.empty() ? "" : ": " + reason));
+}
+
+size_t WebSocketClient::take(char* buf, size_t size, transport::Deadline deadline, bool peek) {
+    if ( !upgraded )
+        throw error::SetupError("WebSocket handshake not done!");
+    if ( closed )
+        throw error::SocketDisconnection("WebSocket closed!");
+    if ( size == 0 )
+        return 0;
+
+    for ( ;; ) {
+        if ( frame_left > 0 ) {
+            size_t wanted   = (size_t) std::min<uint64_t>(size, frame_left);
+            size_t buffered = used - start;
+            size_t received;
+
+            if ( buffered ) {
+                received = std::min(wanted, buffered);
+                std::memcpy(buf, &input[start], received);
+                if ( peek )
+                    return received;
+                start += received;
+            } else if ( peek ) {
+                if ( !fill(deadline) )
+                    return 0;
+                continue;
+            } else {
+                // Nothing buffered - receive the payload straight into the caller's buffer
+                received = socket.receive(buf, wanted, deadline);
+                if ( received == 0 )
+                    return 0;
+            }
+
+            frame_left -= received;
+            if ( frame_left == 0 && frame_fin )
+                in_message = false;
+            return received;
+        }
+
+        if ( !next_frame() && !fill(deadline) )
+            return 0;
+    }
+}
+}
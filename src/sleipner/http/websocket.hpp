@@ -0,0 +1,251 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file websocket.hpp
+ * @brief WebSocket client (RFC 6455) as a socket
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_HTTP_WEBSOCKET_HPP_
+#define _SLEIPNER_HTTP_WEBSOCKET_HPP_
+
+#include <cstdint>
+#include <initializer_list>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "sleipner/http/parser.hpp"
+#include "sleipner/transport/isocket.hpp"
+
+namespace sleipner::http {
+/**
+ * @brief Options for @b WebSocketClient
+ */
+struct WebSocketOptions {
+    /// @brief Send the data of @b send as binary messages, or as text messages
+    bool binary = true;
+
+    /// @brief Split sent messages into frames of at most this many bytes, 0 to send every message as one frame
+    size_t fragment_size = 0;
+
+    /// @brief Bytes of a received message, beyond which @b receive_message fails the connection
+    size_t max_message = 64 << 20;
+};
+
+/**
+ * @brief XOR data with a WebSocket masking key
+ *
+ * Runs 32 bytes per step with AVX2 where the processor supports it, 16 with SSE2, and 8
+ * otherwise. Masking is its own inverse, so the same call unmasks.
+ *
+ * @param [out] dst Where to write the masked data, may be the same as src
+ * @param [in] src Data to mask
+ * @param [in] size Bytes of data
+ * @param [in] key The 4 bytes of the masking key, in the order they are sent
+ * @param [in] offset Bytes of the payload already masked, when masking it in pieces
+ */
+void apply_mask(char* dst, const char* src, size_t size, const uint8_t key[4], size_t offset = 0) noexcept;
+
+/**
+ * @brief WebSocket client, sending and receiving message payloads through the socket interface
+ *
+ * Wraps a connected socket, e.g. a @b TcpClient, and upgrades it with @b handshake. From
+ * then on, @b send sends every call as one message, and @b receive returns the payload of
+ * data messages as a stream of bytes, as a TCP socket would. Use @b receive_message to
+ * receive whole messages, fragmented or not.
+ *
+ * Pings from the server are answered with the next frame sent, or before the client next
+ * waits for data, whichever comes first. A close from the server is answered, and
+ * reported as @b SocketDisconnection.
+ *
+ * Sent payloads are masked into a scratch buffer right behind the frame header, so each
+ * frame goes out in one send. Received payloads larger than the receive buffer are read
+ * straight into the caller's buffer, which keeps throughput close to that of the socket.
+ *
+ * Basic usage example:
+ * @code
+ * TcpClient socket;
+ * socket.connect(resolve_ip("feed.example.com", 80));
+ *
+ * WebSocketClient ws(socket);
+ * ws.handshake("feed.example.com", "/ticks", 5000);
+ * ws.send(R"({"subscribe": "EURUSD"})");
+ *
+ * std::string message;
+ * while ( ws.receive_message(message, 1000) )
+ *     handle(message);
+ * @endcode
+ *
+ * @note Not thread-safe
+ */
+class WebSocketClient: public transport::ISocket {
+public:
+    /// @brief Frame opcodes
+    enum Opcode : uint8_t {
+        Continuation = 0x0,
+        Text         = 0x1,
+        Binary       = 0x2,
+        Close        = 0x8,
+        Ping         = 0x9,
+        Pong         = 0xA
+    };
+
+    /**
+     * @param [in] socket A connected socket, must outlive the client
+     * @param [in] options Message type, fragmentation and limits
+     */
+    explicit WebSocketClient(transport::ISocket& socket, const WebSocketOptions& options = WebSocketOptions());
+
+    /**
+     * @brief Sends a close frame if the connection is still open, without waiting for the reply
+     */
+    ~WebSocketClient();
+
+    WebSocketClient(const WebSocketClient&) = delete;
+    WebSocketClient& operator=(const WebSocketClient&) = delete;
+
+    /**
+     * @brief Upgrade the connection to WebSocket
+     *
+     * @param [in] host The value of the Host header, e.g. "example.com:8080"
+     * @param [in] path The resource, e.g. "/ticks"
+     * @param [in] timeout Milliseconds to wait for the server to accept
+     * @param [in] headers Further header fields, e.g. Sec-WebSocket-Protocol or Authorization
+     * @throws ConnectionFailure If the server refuses the upgrade
+     * @throws ProtocolError If the server's response is not a valid upgrade
+     * @throws RequestTimeout If the server does not respond within the timeout
+     * @throws SocketDisconnection
+     * @throws SetupError If the handshake was already done
+     * @throws SystemApiError
+     */
+    void handshake(std::string_view host, std::string_view path, uint64_t timeout, std::initializer_list<Header> headers = {});
+
+    /**
+     * @brief Send a message
+     *
+     * @param [in] data The payload
+     * @param [in] size Bytes of payload
+     * @param [in] opcode @b Text or @b Binary
+     * @throws SocketDisconnection
+     * @throws SetupError If the handshake was not done, or the connection was closed
+     * @throws SystemApiError
+     */
+    void send_message(const char* data, size_t size, Opcode opcode);
+
+    /**
+     * @brief Receive the next whole message, joining its fragments
+     *
+     * A message timing out part way is kept, and completed by the next call. Do not mix
+     * with @b receive in the middle of a message.
+     *
+     * @param [out] message The payload, replaced
+     * @param [in] timeout Milliseconds to wait for the whole message
+     * @throws ProtocolError If the server breaks the protocol, or the message exceeds the limit
+     * @throws SocketDisconnection If the server closed the connection
+     * @throws SetupError If the handshake was not done
+     * @throws SystemApiError
+     * @return Opcode @b Text or @b Binary, or @b Continuation if no message was complete within the timeout
+     */
+    Opcode receive_message(std::string& message, uint64_t timeout);
+
+    /**
+     * @brief Send a ping - the server's pong is consumed by the receive methods
+     *
+     * @param [in] payload Up to 125 bytes to be echoed
+     * @throws std::invalid_argument If the payload is too long
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    void ping(std::string_view payload = std::string_view());
+
+    /**
+     * @brief Close the connection, waiting for the server to acknowledge
+     *
+     * Data received while waiting is discarded. Does nothing if already closed.
+     *
+     * @param [in] code Status code, e.g. 1000 for a normal closure
+     * @param [in] reason Up to 123 bytes explaining the closure
+     * @param [in] timeout Milliseconds to wait for the server's close frame
+     * @throws SystemApiError
+     */
+    void close(uint16_t code = 1000, std::string_view reason = std::string_view(), uint64_t timeout = 1000);
+
+    // Deadline and memory resource overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
+    /// @copydoc ISocket::connected()
+    bool connected() const override;
+
+    /**
+     * @brief Retrieve the bytes of the current data frame that can be received without blocking
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    size_t bytes_available() const override;
+
+    /**
+     * @brief Send the data as one message, of the type set in the options
+     *
+     * @see send_message
+     */
+    size_t send(const char* buf, size_t size) override;
+
+    /// @copydoc send(const char*, size_t)
+    size_t send(const std::string& packet) override;
+
+    /// @copydoc ISocket::receive(char*, size_t, uint64_t)
+    size_t receive(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::receive(size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(char*, size_t, uint64_t)
+    size_t peek(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) override;
+
+protected:
+    transport::ISocket&    socket;
+    const WebSocketOptions options;
+    std::mt19937           rng;
+
+    bool                   upgraded    = false;
+    bool                   close_sent  = false;
+    bool                   closed      = false;
+
+    // Received data in [start, used)
+    std::string            input;
+    size_t                 start = 0;
+    size_t                 used  = 0;
+
+    // Payload left of the current data frame, and whether it ends its message
+    uint64_t               frame_left  = 0;
+    bool                   frame_fin   = true;
+    bool                   in_message  = false;
+    Opcode                 message_opcode = Binary;
+    std::string            assembling;
+
+    // Header and masked payload of frames being sent, and pongs not sent yet
+    std::string            scratch;
+    std::string            control_out;
+
+    void check_open() const;
+    void send_frame(Opcode opcode, bool fin, const char* data, size_t size);
+    void queue_control(Opcode opcode, const char* data, size_t size);
+    void send_all(const char* data, size_t size);
+    bool fill(transport::Deadline deadline);
+    bool next_frame();
+    void handle_control(Opcode opcode, const char* payload, size_t size);
+    size_t take(char* buf, size_t size, transport::Deadline deadline, bool peek);
+};
+}
+
+#endif
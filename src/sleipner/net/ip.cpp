@@ -13,20 +13,21 @@
 
     #include "sleipner/sys/winsock.hpp"
 #else
-    #error "ip.cpp yet to be implemented..."
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <netdb.h>
+    #include <cerrno>
 #endif
 
 namespace sleipner::net {
-    static IpAddress translate_addrinfo(const ::addrinfo& info) {
-        IpAddress new_addr{};
-
+    static void translate_addrinfo(const ::addrinfo& info, IpAddress& new_addr) {
         new_addr.family = info.ai_family;
 
         // If this is invalid, delay error...
         if ( info.ai_addr )
-            new_addr.addr = {reinterpret_cast<char*>(const_cast<::sockaddr*>(info.ai_addr)), info.ai_addrlen};
-
-        return new_addr;
+            new_addr.addr.assign(reinterpret_cast<char*>(const_cast<::sockaddr*>(info.ai_addr)), info.ai_addrlen);
     }
 
     static ::sockaddr_in* expose_in(const IpAddress& address) {
@@ -41,9 +42,11 @@ namespace sleipner::net {
         return reinterpret_cast<::sockaddr_in6*>(const_cast<char*>(address.addr.data()));
     }
 
-    std::vector<IpAddress> resolve_ip(const std::string& hostname, uint16_t port) {
+    // Fill any vector of addresses - the addresses are emplaced so an allocator-aware vector passes its resource on
+    template<typename Addresses>
+    static void resolve_into(const std::string& hostname, uint16_t port, Addresses& addresses) {
         #ifdef _WIN32
-            sys::WinsockLoader wsl;
+            sys::winsock_init();
         #endif
 
         ::addrinfo hints {0};
@@ -60,6 +63,7 @@ namespace sleipner::net {
 
         int err = ::getaddrinfo(hostname.c_str(), port_str.c_str(), &hints, &resolved);
 
+        #ifdef _WIN32
         if ( err ) {
             err = ::WSAGetLastError();
 
@@ -80,15 +84,54 @@ namespace sleipner::net {
                     throw error::SystemApiError(err);
             }
         }
+        #else
+        // getaddrinfo reports its own codes, not errno values
+        switch ( err ) {
+            case 0:
+                break;
+
+            case EAI_NONAME:
+            #ifdef EAI_NODATA
+            case EAI_NODATA:
+            #endif
+            case EAI_AGAIN:
+            case EAI_FAIL:
+                throw error::ResolutionFailure(::gai_strerror(err));
+
+            case EAI_SYSTEM:
+                throw error::SystemApiError(errno);
+
+            // case EAI_FAMILY:
+            // case EAI_SOCKTYPE:
+            // case EAI_SERVICE:
+            // case EAI_MEMORY:
+            default:
+                throw error::SystemApiError(err, ::gai_strerror(err));
+        }
+        #endif
 
-        std::vector<IpAddress> addresses;
-
-        // Though all should be AF_INET or AF_INET6, check just in case of an unexpected result...
-        for ( ::addrinfo* curr = resolved; curr; curr = curr->ai_next )
-            if ( curr->ai_family == AF_INET || curr->ai_family == AF_INET6 )
-                addresses.push_back(translate_addrinfo(*curr));
+        try {
+            // Though all should be AF_INET or AF_INET6, check just in case of an unexpected result...
+            for ( ::addrinfo* curr = resolved; curr; curr = curr->ai_next )
+                if ( curr->ai_family == AF_INET || curr->ai_family == AF_INET6 )
+                    translate_addrinfo(*curr, addresses.emplace_back());
+        } catch ( ... ) {
+            ::freeaddrinfo(resolved);
+            throw;
+        }
 
         ::freeaddrinfo(resolved);
+    }
+
+    std::vector<IpAddress> resolve_ip(const std::string& hostname, uint16_t port) {
+        std::vector<IpAddress> addresses;
+        resolve_into(hostname, port, addresses);
+        return addresses;
+    }
+
+    std::pmr::vector<IpAddress> resolve_ip(const std::string& hostname, uint16_t port, std::pmr::memory_resource* resource) {
+        std::pmr::vector<IpAddress> addresses(resource);
+        resolve_into(hostname, port, addresses);
         return addresses;
     }
 
@@ -12,6 +12,7 @@
 #ifndef _SLEIPNER_NET_IP_HPP_
 #define _SLEIPNER_NET_IP_HPP_
 
+#include <memory_resource>
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -20,14 +21,29 @@ namespace sleipner::net {
     /**
      * @brief Used to simplify working with the system-specific socket addresses
      *
+     * Allocator-aware, so the addresses in a @b std::pmr::vector are allocated from its
+     * memory resource as well.
+     *
      * @warning You should never directly work with this, use instead the methods provided in @b ip.hpp
      */
     struct IpAddress {
+        typedef std::pmr::polymorphic_allocator<char> allocator_type;
+
         int family     = 0;
         // int sockettype = 0; // Alwasy SOCK_STREAM
         // int protocol   = 0; // Always 0
-        std::string addr;
+        std::pmr::string addr;
         // std::string canonical_name; // Never referenced...
+
+        IpAddress() = default;
+        IpAddress(const IpAddress&) = default;
+        IpAddress(IpAddress&&) = default;
+        IpAddress& operator=(const IpAddress&) = default;
+        IpAddress& operator=(IpAddress&&) = default;
+
+        explicit IpAddress(const allocator_type& alloc): addr(alloc) {}
+        IpAddress(const IpAddress& other, const allocator_type& alloc): family(other.family), addr(other.addr, alloc) {}
+        IpAddress(IpAddress&& other, const allocator_type& alloc): family(other.family), addr(std::move(other.addr), alloc) {}
     };
 
     /**
@@ -42,6 +58,21 @@ namespace sleipner::net {
      */
     std::vector<IpAddress> resolve_ip(const std::string& hostname, uint16_t port);
 
+    /**
+     * @brief Resolve the desired IP address from the hostname and port, allocating the result from the memory resource
+     *
+     * @note The system resolver still allocates internally
+     *
+     * @param [in] hostname Target host (DNS name or IP address)
+     * @param [in] port Target port number
+     * @param [in] resource Memory resource for the list and the addresses in it
+     * @throw std::invalid_argument if hostname is empty or port is 0
+     * @throws ResolutionFailure
+     * @throws SystemApiError
+     * @returns A list of resolved addresses
+     */
+    std::pmr::vector<IpAddress> resolve_ip(const std::string& hostname, uint16_t port, std::pmr::memory_resource* resource);
+
     /**
      * @brief Get the IP address of the target
      *
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file arena.hpp
+ * @brief Monotonic memory arena with inline storage, for per-request allocations
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_RUNTIME_ARENA_HPP_
+#define _SLEIPNER_RUNTIME_ARENA_HPP_
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace sleipner::runtime {
+/**
+ * @brief Memory resource handing out memory from an inline buffer, freed all at once
+ *
+ * Allocating is a pointer bump, and deallocating does nothing - the memory is reclaimed
+ * by @b reset, e.g. once a request has been handled. When the inline buffer runs out,
+ * further memory comes from the upstream resource, and is returned to it by @b reset.
+ *
+ * Basic usage example:
+ * @code
+ * runtime::Arena<16384> arena;
+ *
+ * for ( ;; ) {
+ *     std::pmr::string request = client.receive(4096, 1000, &arena);
+ *     handle(request, &arena);
+ *     arena.reset();
+ * }
+ * @endcode
+ *
+ * @note Not thread-safe - an arena belongs to one thread, or one request at a time
+ *
+ * @tparam Size Bytes of inline storage
+ */
+template<size_t Size>
+class Arena: public std::pmr::memory_resource {
+protected:
+    alignas(std::max_align_t) std::byte buffer[Size];
+    std::pmr::monotonic_buffer_resource resource;
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        return resource.allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+        resource.deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+    /**
+     * @param [in] upstream Resource to take memory from once the inline buffer is used up,
+     *                      e.g. @b std::pmr::null_memory_resource to fail with @b std::bad_alloc instead
+     */
+    explicit Arena(std::pmr::memory_resource* upstream = std::pmr::get_default_resource()):
+        resource(buffer, Size, upstream) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * @brief Reclaim everything allocated, starting over from the inline buffer
+     *
+     * @warning Everything allocated from the arena must be gone, or at least no longer used
+     */
+    void reset() noexcept {
+        resource.release();
+    }
+};
+}
+
+#endif
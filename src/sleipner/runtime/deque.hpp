@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file deque.hpp
+ * @brief Chase-Lev work-stealing deque
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_RUNTIME_DEQUE_HPP_
+#define _SLEIPNER_RUNTIME_DEQUE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace sleipner::runtime {
+/**
+ * @brief Lock-free deque owned by one thread, from which other threads can steal
+ *
+ * The owner pushes and pops at the bottom, in LIFO order to keep its caches warm, while
+ * thieves take from the top, in FIFO order. Only the last element is ever contended.
+ * The buffer grows as needed, and the old buffers are kept until destruction, as a thief
+ * may still be reading from them.
+ *
+ * Based on "Correct and Efficient Work-Stealing for Weak Memory Models", Lê et al. 2013.
+ *
+ * @note @b push and @b pop may only be called from the owning thread, @b steal from any thread.
+ *
+ * @tparam T Trivially copyable element type, typically a pointer
+ */
+template<typename T>
+class ChaseLevDeque {
+    static_assert(std::is_trivially_copyable<T>::value, "ChaseLevDeque elements must be trivially copyable");
+
+protected:
+    struct Buffer {
+        int64_t capacity;
+        std::unique_ptr<std::atomic<T>[]> items;
+
+        explicit Buffer(int64_t capacity): capacity(capacity), items(new std::atomic<T>[capacity]) {}
+
+        T get(int64_t i) const noexcept {
+            return items[i & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T value) noexcept {
+            items[i & (capacity - 1)].store(value, std::memory_order_relaxed);
+        }
+    };
+
+    alignas(64) std::atomic<int64_t> top    = {0};
+    alignas(64) std::atomic<int64_t> bottom = {0};
+    std::atomic<Buffer*> buffer;
+
+    // Owner only - every buffer ever used, as thieves may hold on to an old one
+    std::vector<std::unique_ptr<Buffer>> buffers;
+
+public:
+    /**
+     * @param [in] capacity Initial capacity, rounded up to a power of 2
+     */
+    explicit ChaseLevDeque(int64_t capacity = 256) {
+        int64_t size = 1;
+        while ( size < capacity )
+            size <<= 1;
+
+        buffers.emplace_back(new Buffer(size));
+        buffer.store(buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    ChaseLevDeque(const ChaseLevDeque&) = delete;
+    ChaseLevDeque& operator=(const ChaseLevDeque&) = delete;
+
+    /**
+     * @brief Push an element at the bottom - owner only
+     */
+    void push(T value) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Buffer* a = buffer.load(std::memory_order_relaxed);
+
+        if ( b - t > a->capacity - 1 ) {
+            Buffer* grown = new Buffer(a->capacity * 2);
+            buffers.emplace_back(grown);
+
+            for ( int64_t i = t; i < b; i++ )
+                grown->put(i, a->get(i));
+
+            buffer.store(grown, std::memory_order_release);
+            a = grown;
+        }
+
+        a->put(b, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Pop the element at the bottom - owner only
+     *
+     * @param [out] value Assigned the element, if any
+     * @return bool False if the deque was empty, or the last element was stolen
+     */
+    bool pop(T& value) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if ( t > b ) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = a->get(b);
+
+        if ( t == b ) {
+            // Last element - race the thieves for it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Steal the element at the top - any thread
+     *
+     * @param [out] value Assigned the element, if any
+     * @return bool False if the deque was empty, or another thread took the element first
+     */
+    bool steal(T& value) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+
+        if ( t >= b )
+            return false;
+
+        T item = buffer.load(std::memory_order_acquire)->get(t);
+
+        if ( !top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+            return false;
+
+        value = item;
+        return true;
+    }
+
+    /**
+     * @brief Approximate number of elements - exact only when called by the owner with no thieves
+     */
+    int64_t size() const noexcept {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/runtime/executor.hpp"
+#include "sleipner/sys/affinity.hpp"
+
+#include <exception>
+
+namespace sleipner::runtime {
+static thread_local WorkStealingExecutor* current_executor = nullptr;
+static thread_local size_t                current_worker   = 0;
+
+// Spins before a worker without work goes to sleep - waking a sleeping thread costs far more
+static constexpr unsigned IDLE_SPINS = 64;
+
+/********************************************/
+/* WorkStealingExecutor                     */
+/********************************************/
+WorkStealingExecutor::WorkStealingExecutor(const ExecutorOptions& options) {
+    size_t count = options.threads ? options.threads : sys::cpu_count();
+    bool   pin   = options.pin;
+
+    for ( size_t i = 0; i < count; i++ )
+        workers.emplace_back(new Worker());
+
+    try {
+        for ( size_t i = 0; i < count; i++ )
+            workers[i]->thread = std::thread([this, i, pin] {
+                if ( pin ) {
+                    try {
+                        sys::pin_thread((unsigned) (i % sys::cpu_count()));
+                    } catch ( std::exception& ) {
+                        /* Pinning is only an optimisation - run unpinned */
+                    }
+                }
+                run(i);
+            });
+    } catch ( ... ) {
+        stopping.store(true);
+        {
+            std::lock_guard lock(sleep_mutex);
+            sleep_cv.notify_all();
+        }
+        for ( auto& worker: workers )
+            if ( worker->thread.joinable() )
+                worker->thread.join();
+        throw;
+    }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+    stopping.store(true);
+    {
+        std::lock_guard lock(sleep_mutex);
+        sleep_cv.notify_all();
+    }
+
+    for ( auto& worker: workers )
+        worker->thread.join();
+}
+
+size_t WorkStealingExecutor::size() const noexcept {
+    return workers.size();
+}
+
+void WorkStealingExecutor::post(Task task) {
+    Job* job = new Job{std::move(task)};
+
+    pending.fetch_add(1);
+    queued.fetch_add(1);
+
+    if ( current_executor == this ) {
+        workers[current_worker]->deque.push(job);
+    } else {
+        std::lock_guard lock(inject_mutex);
+        injected.push_back(job);
+    }
+
+    // Pairs with the sleeping worker incrementing sleeping before checking queued
+    if ( sleeping.load() ) {
+        std::lock_guard lock(sleep_mutex);
+        sleep_cv.notify_one();
+    }
+}
+
+void WorkStealingExecutor::wait_idle() {
+    std::unique_lock lock(sleep_mutex);
+    idle_cv.wait(lock, [this] { return pending.load() == 0; });
+}
+
+bool WorkStealingExecutor::take(size_t index, Job*& job) {
+    if ( workers[index]->deque.pop(job) )
+        return true;
+
+    {
+        std::lock_guard lock(inject_mutex);
+        if ( !injected.empty() ) {
+            job = injected.front();
+            injected.pop_front();
+            return true;
+        }
+    }
+
+    // Start at a different victim each time, so thieves spread out over the workers
+    static thread_local uint32_t seed = (uint32_t) (index * 2654435761u + 1);
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    size_t count = workers.size();
+    for ( size_t i = 0; i < count; i++ ) {
+        size_t victim = (seed + i) % count;
+        if ( victim != index && workers[victim]->deque.steal(job) )
+            return true;
+    }
+
+    return false;
+}
+
+void WorkStealingExecutor::finish(Job* job) {
+    delete job;
+
+    if ( pending.fetch_sub(1) == 1 ) {
+        std::lock_guard lock(sleep_mutex);
+        idle_cv.notify_all();
+    }
+}
+
+void WorkStealingExecutor::run(size_t index) {
+    current_executor = this;
+    current_worker   = index;
+
+    unsigned idle = 0;
+
+    for ( ;; ) {
+        Job* job = nullptr;
+
+        if ( take(index, job) ) {
+            queued.fetch_sub(1);
+            idle = 0;
+            job->task();
+            finish(job);
+            continue;
+        }
+
+        if ( ++idle < IDLE_SPINS ) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock lock(sleep_mutex);
+        sleeping.fetch_add(1);
+        sleep_cv.wait(lock, [this] { return queued.load() > 0 || stopping.load(); });
+        sleeping.fetch_sub(1);
+
+        // Everything posted before stopping still runs
+        if ( stopping.load() && queued.load() == 0 )
+            break;
+
+        idle = 0;
+    }
+
+    current_executor = nullptr;
+}
+
+/********************************************/
+/* Strand                                   */
+/********************************************/
+Strand::Strand(WorkStealingExecutor& executor, size_t batch):
+        state(std::make_shared<State>(executor, batch ? batch : 1)) {}
+
+void Strand::post(Task task) {
+    bool schedule;
+    {
+        std::lock_guard lock(state->mutex);
+        state->tasks.push_back(std::move(task));
+        schedule = !state->scheduled;
+        state->scheduled = true;
+    }
+
+    if ( schedule ) {
+        std::shared_ptr<State> s = state;
+        state->executor.post([s] { run(s); });
+    }
+}
+
+void Strand::run(const std::shared_ptr<State>& state) {
+    for ( size_t n = 0; n < state->batch; n++ ) {
+        Task task;
+        {
+            std::lock_guard lock(state->mutex);
+            if ( state->tasks.empty() ) {
+                state->scheduled = false;
+                return;
+            }
+            task = std::move(state->tasks.front());
+            state->tasks.pop_front();
+        }
+        task();
+    }
+
+    // Batch done - requeue behind the other work instead of hogging the worker
+    {
+        std::lock_guard lock(state->mutex);
+        if ( state->tasks.empty() ) {
+            state->scheduled = false;
+            return;
+        }
+    }
+
+    std::shared_ptr<State> s = state;
+    state->executor.post([s] { run(s); });
+}
+}
@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file executor.hpp
+ * @brief Work-stealing thread pool, and strands to run tasks of one connection in order
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_RUNTIME_EXECUTOR_HPP_
+#define _SLEIPNER_RUNTIME_EXECUTOR_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sleipner/runtime/deque.hpp"
+
+namespace sleipner::runtime {
+/**
+ * @brief Options for @b WorkStealingExecutor
+ */
+struct ExecutorOptions {
+    /// @brief Number of worker threads, 0 for one per CPU
+    size_t threads = 0;
+
+    /// @brief Pin worker @a n to CPU @a n
+    bool pin = false;
+};
+
+/**
+ * @brief Thread pool balancing uneven work by letting idle workers steal tasks
+ *
+ * Every worker has its own Chase-Lev deque. Tasks posted from a worker go to its own deque,
+ * while tasks posted from other threads, such as reactors completing I/O, are spread
+ * through a shared injection queue. Idle workers steal from the top of the other workers'
+ * deques, so a burst on a few hot connections ends up using every core.
+ *
+ * Tasks posted directly to the executor run in no particular order. Post through a
+ * @b Strand to run the tasks of one connection one at a time, in order.
+ *
+ * Basic usage example:
+ * @code
+ * WorkStealingExecutor executor;
+ * Strand strand(executor); // One per connection
+ *
+ * reactor.add(client.native_handle(), Reactor::Readable, [&](int) {
+ *     std::string data = client.receive(4096, 0);
+ *     strand.post([data] { handle(data); });
+ * });
+ * @endcode
+ *
+ * @note Exceptions escaping a task terminate the program, as they would on a @b std::thread
+ */
+class WorkStealingExecutor {
+public:
+    typedef std::function<void()> Task;
+
+    /**
+     * @brief Start the worker threads
+     *
+     * @throws std::system_error if a thread could not be started
+     */
+    explicit WorkStealingExecutor(const ExecutorOptions& options = ExecutorOptions());
+
+    /**
+     * @brief Runs all tasks already posted, then stops the workers
+     */
+    ~WorkStealingExecutor();
+
+    WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+    /**
+     * @brief Run the task on any worker - safe to call from any thread
+     */
+    void post(Task task);
+
+    /**
+     * @brief Retrieve the number of worker threads
+     */
+    size_t size() const noexcept;
+
+    /**
+     * @brief Block until every task posted so far, and every task they posted, has run
+     *
+     * @warning Must not be called from a worker, as it would wait for itself
+     */
+    void wait_idle();
+
+protected:
+    struct Job {
+        Task task;
+    };
+
+    struct Worker {
+        ChaseLevDeque<Job*> deque;
+        std::thread         thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex        inject_mutex;
+    std::deque<Job*>  injected;
+
+    // Number of posted tasks not yet taken, to decide when workers may sleep
+    std::atomic<size_t> queued   = {0};
+    // Number of posted tasks not yet finished, for wait_idle
+    std::atomic<size_t> pending  = {0};
+    std::atomic<size_t> sleeping = {0};
+    std::atomic<bool>   stopping = {false};
+
+    std::mutex              sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::condition_variable idle_cv;
+
+    void run(size_t index);
+    bool take(size_t index, Job*& job);
+    void finish(Job* job);
+};
+
+/**
+ * @brief Runs the posted tasks one at a time, in the order they were posted
+ *
+ * A strand is a handle - copies refer to the same sequence of tasks. Its state is kept
+ * alive by the tasks that are queued, so the strand itself may be destroyed at any time.
+ */
+class Strand {
+public:
+    typedef std::function<void()> Task;
+
+    /**
+     * @param [in] executor The executor to run the tasks on, must outlive the tasks
+     * @param [in] batch Maximum number of tasks to run before yielding the worker to other strands
+     */
+    explicit Strand(WorkStealingExecutor& executor, size_t batch = 64);
+
+    /**
+     * @brief Run the task after all tasks previously posted to this strand
+     */
+    void post(Task task);
+
+protected:
+    struct State {
+        WorkStealingExecutor& executor;
+        size_t                batch;
+        std::mutex            mutex;
+        std::deque<Task>      tasks;
+        bool                  scheduled = false;
+
+        State(WorkStealingExecutor& executor, size_t batch): executor(executor), batch(batch) {}
+    };
+
+    std::shared_ptr<State> state;
+
+    static void run(const std::shared_ptr<State>& state);
+};
+}
+
+#endif
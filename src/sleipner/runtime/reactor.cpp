@@ -0,0 +1,348 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/sys/error.hpp"
+#include "sleipner/sys/native.hpp"
+
+#include <iterator>
+#include <stdexcept>
+
+#ifdef _WIN32
+    #include "sleipner/sys/winsock.hpp"
+#endif
+
+namespace sleipner::runtime {
+static short _to_poll(int events) {
+    short res = 0;
+    if ( events & Reactor::Readable )
+        res |= POLLIN;
+    if ( events & Reactor::Writable )
+        res |= POLLOUT;
+    return res;
+}
+
+static int _from_poll(short revents) {
+    int res = 0;
+    if ( revents & POLLIN )
+        res |= Reactor::Readable;
+    if ( revents & POLLOUT )
+        res |= Reactor::Writable;
+    if ( revents & (POLLERR | POLLHUP | POLLNVAL) )
+        res |= Reactor::Error;
+    return res;
+}
+
+/********************************************/
+/* Reactor::Impl                            */
+/********************************************/
+struct Reactor::Impl {
+    // A pipe, or on Windows a loopback UDP socket connected to itself, as Windows can only poll sockets
+    sys::socket_t wake_read  = INVALID_SOCKET;
+    sys::socket_t wake_write = INVALID_SOCKET;
+
+    std::vector<sys::pollfd_t> fds;
+
+    Impl() {
+        #ifdef _WIN32
+            sys::winsock_init();
+
+            wake_read = ::socket(AF_INET, SOCK_DGRAM, 0);
+            if ( !VALIDATE_SOCKET(wake_read) )
+                throw error::SystemApiError(sys::last_socket_error());
+
+            ::sockaddr_in addr {0};
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port        = 0;
+            int len = sizeof(addr);
+            u_long non_blocking = 1;
+
+            if ( SOCKET_FAILURE(::bind(wake_read, reinterpret_cast<::sockaddr*>(&addr), sizeof(addr)))
+              || SOCKET_FAILURE(::getsockname(wake_read, reinterpret_cast<::sockaddr*>(&addr), &len))
+              || SOCKET_FAILURE(::connect(wake_read, reinterpret_cast<::sockaddr*>(&addr), sizeof(addr)))
+              || SOCKET_FAILURE(::ioctlsocket(wake_read, FIONBIO, &non_blocking)) ) {
+                int err = sys::last_socket_error();
+                sys::close_socket(wake_read);
+                throw error::SystemApiError(err);
+            }
+
+            wake_write = wake_read;
+        #else
+            int pipe_fds[2];
+            if ( ::pipe(pipe_fds) )
+                throw error::SystemApiError(errno);
+
+            wake_read  = pipe_fds[0];
+            wake_write = pipe_fds[1];
+
+            for ( int fd: pipe_fds )
+                if ( ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK) < 0 || ::fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 ) {
+                    int err = errno;
+                    close();
+                    throw error::SystemApiError(err);
+                }
+        #endif
+    }
+
+    ~Impl() {
+        close();
+    }
+
+    void close() noexcept {
+        if ( wake_write != wake_read )
+            sys::close_socket(wake_write);
+        sys::close_socket(wake_read);
+        wake_write = INVALID_SOCKET;
+    }
+
+    void signal() noexcept {
+        char byte = 0;
+        // A full pipe/buffer already guarantees a wake-up - ignore errors
+        #ifdef _WIN32
+            ::send(wake_write, &byte, 1, 0);
+        #else
+            ssize_t res = ::write(wake_write, &byte, 1);
+            (void) res;
+        #endif
+    }
+
+    void consume() noexcept {
+        char buf[64];
+        #ifdef _WIN32
+            while ( ::recv(wake_read, buf, sizeof(buf), 0) > 0 ) {}
+        #else
+            while ( ::read(wake_read, buf, sizeof(buf)) > 0 ) {}
+        #endif
+    }
+};
+
+void Reactor::ImplCleanup::operator()(Impl* ptr) const {
+    if ( ptr )
+        delete ptr;
+}
+
+/********************************************/
+/* Reactor                                  */
+/********************************************/
+Reactor::Reactor(): pimpl(new Impl()) {}
+
+Reactor::~Reactor() = default;
+
+void Reactor::add(sys::native_socket_t socket, int events, Handler handler) {
+    if ( index.count(socket) )
+        throw std::invalid_argument("Socket already watched!");
+
+    std::unique_ptr<Watch> watch(new Watch{socket, events, std::move(handler)});
+    watches.push_back(std::move(watch));
+    index[socket] = watches.size() - 1;
+}
+
+void Reactor::modify(sys::native_socket_t socket, int events) {
+    auto it = index.find(socket);
+    if ( it == index.end() )
+        throw std::invalid_argument("Socket not watched!");
+    watches[it->second]->events = events;
+}
+
+void Reactor::remove(sys::native_socket_t socket) noexcept {
+    auto it = index.find(socket);
+    if ( it == index.end() )
+        return;
+
+    size_t pos = it->second;
+    index.erase(it);
+
+    // Handlers may be running - defer the erase until the dispatch is done
+    if ( dispatching ) {
+        watches[pos]->removed = true;
+        compact = true;
+        return;
+    }
+
+    if ( pos != watches.size() - 1 ) {
+        watches[pos] = std::move(watches.back());
+        index[watches[pos]->socket] = pos;
+    }
+    watches.pop_back();
+}
+
+bool Reactor::watching(sys::native_socket_t socket) const {
+    return index.count(socket) > 0;
+}
+
+void Reactor::remove_compacted() noexcept {
+    size_t keep = 0;
+    for ( size_t i = 0; i < watches.size(); i++ )
+        if ( !watches[i]->removed ) {
+            if ( keep != i )
+                watches[keep] = std::move(watches[i]);
+            index[watches[keep]->socket] = keep;
+            keep++;
+        }
+
+    watches.resize(keep);
+    compact = false;
+}
+
+TimerWheel& Reactor::timers() noexcept {
+    return wheel;
+}
+
+void Reactor::post(Task task) {
+    {
+        std::lock_guard lock(task_mutex);
+        tasks.push_back(std::move(task));
+    }
+    wake();
+}
+
+void Reactor::on_wake(Task hook) {
+    wake_hook = std::move(hook);
+}
+
+void Reactor::wake() noexcept {
+    if ( !notified.exchange(true) )
+        pimpl->signal();
+}
+
+size_t Reactor::drain() {
+    if ( !notified.load() )
+        return 0;
+
+    // Consume the signal before clearing the flag, so a wake after this point always signals again
+    pimpl->consume();
+    notified.store(false);
+
+    size_t count = 0;
+
+    if ( wake_hook ) {
+        try {
+            wake_hook();
+        } catch ( ... ) {
+            // The posted tasks still run, on the next pass
+            wake();
+            throw;
+        }
+        count++;
+    }
+
+    {
+        std::lock_guard lock(task_mutex);
+        running_tasks.swap(tasks);
+    }
+
+    size_t ran = 0;
+    try {
+        while ( ran < running_tasks.size() ) {
+            running_tasks[ran++]();
+            count++;
+        }
+    } catch ( ... ) {
+        // The failed task and those before it have run - hand the rest back, ahead of any posted since
+        {
+            std::lock_guard lock(task_mutex);
+            tasks.insert(tasks.begin(), std::make_move_iterator(running_tasks.begin() + ran),
+                         std::make_move_iterator(running_tasks.end()));
+        }
+        running_tasks.clear();
+        wake();
+        throw;
+    }
+
+    running_tasks.clear();
+    return count;
+}
+
+size_t Reactor::run_once(int timeout) {
+    loop_thread = std::this_thread::get_id();
+
+    std::vector<sys::pollfd_t>& fds = pimpl->fds;
+    size_t watched = watches.size();
+
+    fds.resize(watched + 1);
+    fds[0].fd      = pimpl->wake_read;
+    fds[0].events  = POLLIN;
+    fds[0].revents = 0;
+
+    for ( size_t i = 0; i < watched; i++ ) {
+        fds[i + 1].fd      = watches[i]->socket;
+        fds[i + 1].events  = _to_poll(watches[i]->events);
+        fds[i + 1].revents = 0;
+    }
+
+    // Tasks posted while nothing was waiting must not wait out the timeout
+    if ( notified.load() )
+        timeout = 0;
+
+    int due = wheel.next_timeout(TimerWheel::clock::now());
+    if ( due >= 0 && (timeout < 0 || due < timeout) )
+        timeout = due;
+
+    int res = sys::poll(fds.data(), fds.size(), timeout);
+
+    if ( SOCKET_FAILURE(res) ) {
+        int err = sys::last_socket_error();
+        #ifndef _WIN32
+            if ( err == EINTR )
+                return wheel.advance(TimerWheel::clock::now()) + drain();
+        #endif
+        throw error::SystemApiError(err);
+    }
+
+    size_t count = 0;
+
+    // Handlers may add and remove sockets - only those polled are dispatched, and erasing is deferred
+    struct DispatchGuard {
+        Reactor& reactor;
+        DispatchGuard(Reactor& r): reactor(r) { reactor.dispatching = true; }
+        ~DispatchGuard() {
+            reactor.dispatching = false;
+            if ( reactor.compact )
+                reactor.remove_compacted();
+        }
+    };
+
+    {
+        DispatchGuard guard(*this);
+
+        for ( size_t i = 0; i < watched && res > 0; i++ ) {
+            if ( !fds[i + 1].revents )
+                continue;
+            res--;
+
+            Watch* watch = watches[i].get();
+            int events = _from_poll(fds[i + 1].revents) & (watch->events | Error);
+
+            if ( watch->removed || !events )
+                continue;
+
+            watch->handler(events);
+            count++;
+        }
+    }
+
+    count += wheel.advance(TimerWheel::clock::now());
+
+    return count + drain();
+}
+
+void Reactor::run() {
+    while ( !stopped.load() )
+        run_once(-1);
+
+    stopped.store(false);
+    loop_thread = std::thread::id();
+}
+
+void Reactor::stop() noexcept {
+    stopped.store(true);
+    wake();
+}
+
+bool Reactor::in_loop_thread() const noexcept {
+    return loop_thread.load() == std::this_thread::get_id();
+}
+}
@@ -0,0 +1,200 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file reactor.hpp
+ * @brief Single-threaded event loop dispatching socket readiness and posted tasks
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_RUNTIME_REACTOR_HPP_
+#define _SLEIPNER_RUNTIME_REACTOR_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "sleipner/runtime/timer.hpp"
+#include "sleipner/sys/socket.hpp"
+
+namespace sleipner::runtime {
+/**
+ * @brief Event loop waiting for readiness of many sockets in one thread
+ *
+ * The reactor calls a handler whenever a watched socket becomes readable or writable,
+ * fires the timers of its @b TimerWheel, and runs tasks posted to it from any thread.
+ * All handlers, timers and tasks run on the thread calling @b run, so they never need to
+ * synchronise with each other.
+ *
+ * Basic usage example:
+ * @code
+ * Reactor reactor;
+ *
+ * reactor.add(client.native_handle(), Reactor::Readable, [&](int events) {
+ *     std::cout << client.receive(1024, 0) << std::endl;
+ * });
+ *
+ * std::thread loop([&] { reactor.run(); });
+ * // ...
+ * reactor.stop();
+ * loop.join();
+ * @endcode
+ *
+ * @note @b add, @b modify, @b remove and @b timers may only be used from the loop thread,
+ *       or while the loop is not running. Use @b post to reach the loop from other threads.
+ */
+class Reactor {
+public:
+    /// @brief Events to wait for and report - combine with bitwise or
+    enum Event : int {
+        Readable = 1 << 0,
+        Writable = 1 << 1,
+        /// @brief Only reported - the socket has failed or was hung up
+        Error    = 1 << 2
+    };
+
+    /// @brief Called on the loop thread with the events that occurred
+    typedef std::function<void(int events)> Handler;
+
+    /// @brief Called on the loop thread
+    typedef std::function<void()> Task;
+
+    /**
+     * @brief Set up the loop and its wake-up mechanism
+     *
+     * @throws SystemApiError
+     */
+    Reactor();
+
+    /**
+     * @brief Destructor does not close the watched sockets, and drops pending tasks
+     */
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    /**
+     * @brief Start watching the socket for the events
+     *
+     * @param [in] socket The socket to watch
+     * @param [in] events Events to wait for, a combination of @b Readable and @b Writable
+     * @param [in] handler Called when any of the events, or an error, occurs
+     * @throws std::invalid_argument if the socket is already watched
+     */
+    void add(sys::native_socket_t socket, int events, Handler handler);
+
+    /**
+     * @brief Change the events to wait for on a watched socket
+     *
+     * @throws std::invalid_argument if the socket is not watched
+     */
+    void modify(sys::native_socket_t socket, int events);
+
+    /**
+     * @brief Stop watching the socket, does nothing if it is not watched
+     *
+     * It is safe to remove any socket from within a handler, including its own.
+     */
+    void remove(sys::native_socket_t socket) noexcept;
+
+    /**
+     * @brief Check if the socket is watched
+     */
+    bool watching(sys::native_socket_t socket) const;
+
+    /**
+     * @brief Retrieve the timers fired by the loop, e.g. for per-connection idle and read timeouts
+     */
+    TimerWheel& timers() noexcept;
+
+    /**
+     * @brief Run the task on the loop thread - safe to call from any thread
+     */
+    void post(Task task);
+
+    /**
+     * @brief Set a hook run on the loop thread every time the loop is woken up
+     *
+     * Used to drain queues that are fed by other threads, which call @b wake after pushing.
+     *
+     * @note Must be set before the loop is running
+     */
+    void on_wake(Task hook);
+
+    /**
+     * @brief Interrupt the wait of the loop - safe to call from any thread
+     *
+     * Repeated calls before the loop gets to run are coalesced into a single wake-up.
+     */
+    void wake() noexcept;
+
+    /**
+     * @brief Run the loop on the calling thread until @b stop is called
+     *
+     * @throws SystemApiError
+     */
+    void run();
+
+    /**
+     * @brief Wait for events once, and dispatch them
+     *
+     * The wait is cut short when the next timer is due.
+     *
+     * @param [in] timeout Milliseconds to wait if nothing is ready, negative to wait indefinitely
+     * @throws SystemApiError
+     * @return size_t Number of handlers, timers and tasks that were run
+     */
+    size_t run_once(int timeout);
+
+    /**
+     * @brief Make @b run return - safe to call from any thread
+     */
+    void stop() noexcept;
+
+    /**
+     * @brief Check if the calling thread is the one running the loop
+     */
+    bool in_loop_thread() const noexcept;
+
+protected:
+    struct Watch {
+        sys::native_socket_t socket;
+        int     events;
+        Handler handler;
+        bool    removed = false;
+    };
+
+    struct Impl;
+    struct ImplCleanup { void operator()(Impl* ptr) const; };
+
+    std::unique_ptr<Impl, ImplCleanup> pimpl;
+
+    TimerWheel wheel;
+
+    std::vector<std::unique_ptr<Watch>> watches;
+    std::unordered_map<sys::native_socket_t, size_t> index;
+    bool dispatching = false;
+    bool compact     = false;
+
+    std::mutex        task_mutex;
+    std::vector<Task> tasks;
+    std::vector<Task> running_tasks;
+    Task              wake_hook;
+
+    std::atomic<bool>            notified = {false};
+    std::atomic<bool>            stopped  = {false};
+    std::atomic<std::thread::id> loop_thread;
+
+    void remove_compacted() noexcept;
+    size_t drain();
+};
+}
+
+#endif
@@ -0,0 +1,230 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/runtime/sharded.hpp"
+#include "sleipner/sys/affinity.hpp"
+#include "sleipner/sys/native.hpp"
+
+#include <stdexcept>
+
+namespace sleipner::runtime {
+static thread_local ShardedRuntime::Shard* current_shard = nullptr;
+
+static int _incoming_cpu(sys::native_socket_t socket) noexcept {
+    #ifdef SO_INCOMING_CPU
+        int cpu = -1;
+        ::socklen_t len = sizeof(cpu);
+
+        if ( SOCKET_FAILURE(::getsockopt(socket, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len)) )
+            return -1;
+
+        return cpu;
+    #else
+        (void) socket;
+        return -1;
+    #endif
+}
+
+/********************************************/
+/* ShardedRuntime::Shard                    */
+/********************************************/
+ShardedRuntime::Shard::Shard(ShardedRuntime& owner, size_t position, unsigned core):
+        owner(owner), position(position), core(core) {}
+
+/********************************************/
+/* ShardedRuntime                           */
+/********************************************/
+ShardedRuntime::ShardedRuntime(const ShardOptions& options) {
+    size_t   count = options.shards ? options.shards : sys::cpu_count();
+    unsigned cpus  = sys::cpu_count();
+
+    for ( size_t i = 0; i < count; i++ )
+        shards.emplace_back(new Shard(*this, i, (unsigned) (i % cpus)));
+
+    for ( size_t i = 0; i < count * count; i++ )
+        channels.emplace_back(new SpscQueue<Message>());
+
+    bool pin = options.pin;
+
+    try {
+        for ( auto& s: shards ) {
+            Shard* shard = s.get();
+            shard->loop.on_wake([this, shard] { drain(*shard); });
+
+            shard->thread = std::thread([this, shard, pin] {
+                current_shard = shard;
+
+                if ( pin ) {
+                    try {
+                        sys::pin_thread(shard->core);
+                    } catch ( std::exception& ) {
+                        /* Pinning is only an optimisation - run unpinned */
+                    }
+                }
+
+                // A failing handler must not take the whole shard down
+                for ( bool done = false; !done; ) {
+                    try {
+                        shard->loop.run();
+                        done = true;
+                    } catch ( ... ) {
+                        report(*shard, std::current_exception());
+                    }
+                }
+
+                current_shard = nullptr;
+            });
+        }
+    } catch ( ... ) {
+        stop();
+        throw;
+    }
+}
+
+ShardedRuntime::~ShardedRuntime() {
+    stop();
+    listeners.clear();
+}
+
+size_t ShardedRuntime::size() const noexcept {
+    return shards.size();
+}
+
+ShardedRuntime::Shard& ShardedRuntime::shard(size_t index) {
+    if ( index >= shards.size() )
+        throw std::out_of_range("Shard index out of range!");
+    return *shards[index];
+}
+
+ShardedRuntime::Shard* ShardedRuntime::current() noexcept {
+    return current_shard;
+}
+
+ShardedRuntime::Shard& ShardedRuntime::shard_for_cpu(unsigned cpu) noexcept {
+    return *shards[cpu % shards.size()];
+}
+
+ShardedRuntime::Shard& ShardedRuntime::shard_for(const transport::TcpClient& client) {
+    int cpu = _incoming_cpu(client.native_handle());
+
+    if ( cpu >= 0 )
+        return shard_for_cpu((unsigned) cpu);
+
+    return *shards[next_shard.fetch_add(1, std::memory_order_relaxed) % shards.size()];
+}
+
+void ShardedRuntime::send(size_t to, Message message) {
+    if ( to >= shards.size() )
+        throw std::out_of_range("Shard index out of range!");
+
+    Shard* from = current_shard;
+
+    if ( from && &from->owner == this ) {
+        channels[from->position * shards.size() + to]->push(std::move(message));
+        shards[to]->loop.wake();
+    } else {
+        shards[to]->loop.post(std::move(message));
+    }
+}
+
+void ShardedRuntime::drain(Shard& shard) {
+    size_t count = shards.size();
+    Message message;
+
+    for ( size_t from = 0; from < count; from++ ) {
+        SpscQueue<Message>& channel = *channels[from * count + shard.position];
+        while ( channel.pop(message) )
+            message();
+    }
+}
+
+void ShardedRuntime::listen(const net::IpAddress& address, AcceptHandler on_accept, const transport::ListenOptions& options) {
+    std::shared_ptr<AcceptHandler> handler = std::make_shared<AcceptHandler>(std::move(on_accept));
+    size_t first = listeners.size();
+
+    #if defined(__linux__) && defined(SO_REUSEPORT)
+        size_t count = shards.size();
+    #else
+        size_t count = 1;
+    #endif
+
+    transport::ListenOptions grouped = options;
+    // The caller may also want to share the port with listeners of its own
+    grouped.reuse_port = options.reuse_port || count > 1;
+
+    for ( size_t i = 0; i < count; i++ ) {
+        std::unique_ptr<transport::TcpListener> listener(new transport::TcpListener());
+
+        // Every listener in the group must bind the port the first one got
+        listener->listen(i == 0 ? address : listeners[first]->local_address(), grouped);
+        listeners.push_back(std::move(listener));
+    }
+
+    if ( count > 1 )
+        listeners[first]->steer_by_cpu((unsigned) count);
+
+    for ( size_t i = 0; i < count; i++ ) {
+        Shard* shard = shards[i].get();
+        transport::TcpListener* listener = listeners[first + i].get();
+
+        shard->loop.post([this, shard, listener, handler] {
+            shard->loop.add(listener->native_handle(), Reactor::Readable, [this, shard, listener, handler](int) {
+                accept_ready(*shard, *listener, handler);
+            });
+        });
+    }
+}
+
+void ShardedRuntime::accept_ready(Shard& shard, transport::TcpListener& listener, const std::shared_ptr<AcceptHandler>& on_accept) {
+    for ( ;; ) {
+        std::shared_ptr<transport::TcpClient> client = std::make_shared<transport::TcpClient>();
+
+        if ( !listener.accept(*client, 0) )
+            return;
+
+        Shard& target = shard_for(*client);
+
+        if ( &target == &shard ) {
+            (*on_accept)(shard, std::move(client));
+        } else {
+            Shard* owner = &target;
+            send(target.position, [owner, client, on_accept] { (*on_accept)(*owner, client); });
+        }
+    }
+}
+
+void ShardedRuntime::on_error(ErrorHandler handler) {
+    std::shared_ptr<ErrorHandler> replacement = handler ? std::make_shared<ErrorHandler>(std::move(handler)) : nullptr;
+
+    std::lock_guard lock(error_mutex);
+    error_handler = std::move(replacement);
+}
+
+void ShardedRuntime::report(Shard& shard, std::exception_ptr error) noexcept {
+    std::shared_ptr<ErrorHandler> handler;
+    {
+        std::lock_guard lock(error_mutex);
+        handler = error_handler;
+    }
+
+    if ( !handler )
+        return;
+
+    try {
+        (*handler)(shard, error);
+    } catch ( ... ) {
+        /* The shard keeps running either way */
+    }
+}
+
+void ShardedRuntime::stop() noexcept {
+    for ( auto& shard: shards )
+        shard->loop.stop();
+
+    for ( auto& shard: shards )
+        if ( shard->thread.joinable() && shard->thread.get_id() != std::this_thread::get_id() )
+            shard->thread.join();
+}
+}
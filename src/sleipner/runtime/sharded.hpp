@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file sharded.hpp
+ * @brief Thread-per-core runtime, with one pinned reactor per core and connections assigned to shards
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_RUNTIME_SHARDED_HPP_
+#define _SLEIPNER_RUNTIME_SHARDED_HPP_
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/runtime/spsc.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/tcplistener.hpp"
+#include "sleipner/net/ip.hpp"
+
+namespace sleipner::runtime {
+/**
+ * @brief Options for @b ShardedRuntime
+ */
+struct ShardOptions {
+    /// @brief Number of shards, 0 for one per CPU
+    size_t shards = 0;
+
+    /// @brief Pin shard @a n to CPU @a n
+    bool pin = true;
+};
+
+/**
+ * @brief Runs one reactor per core, each on its own thread pinned to the core
+ *
+ * The shards share no state: every connection belongs to exactly one shard, and is only
+ * ever touched from that shard's thread. Shards talk to each other through @b send, which
+ * uses a dedicated lock-free queue per pair of shards.
+ *
+ * Connections are placed on the shard of the CPU that processes their packets, as reported
+ * by @b SO_INCOMING_CPU, so the protocol handling runs on the core that already has the
+ * socket's data in cache. Where that is not supported, they are spread round-robin.
+ *
+ * Basic usage example:
+ * @code
+ * ShardedRuntime runtime;
+ *
+ * runtime.listen(resolve_ip("localhost", 8080).front(), [](ShardedRuntime::Shard& shard, std::shared_ptr<TcpClient> client) {
+ *     shard.reactor().add(client->native_handle(), Reactor::Readable, [client](int) {
+ *         client->send(client->receive(1024, 0));
+ *     });
+ * });
+ * @endcode
+ */
+class ShardedRuntime {
+public:
+    /// @brief A message to run on the receiving shard's thread
+    typedef std::function<void()> Message;
+
+    /**
+     * @brief A single reactor and thread of the runtime
+     */
+    class Shard {
+    public:
+        /// @brief Position of the shard in the runtime
+        size_t index() const noexcept { return position; }
+
+        /// @brief The CPU the shard's thread is pinned to
+        unsigned cpu() const noexcept { return core; }
+
+        /// @brief The reactor of the shard - only use from the shard's own thread, except for @b post
+        Reactor& reactor() noexcept { return loop; }
+
+        /// @brief The runtime the shard belongs to
+        ShardedRuntime& runtime() noexcept { return owner; }
+
+        Shard(ShardedRuntime& owner, size_t position, unsigned core);
+
+    protected:
+        friend ShardedRuntime;
+
+        ShardedRuntime& owner;
+        size_t          position;
+        unsigned        core;
+        Reactor         loop;
+        std::thread     thread;
+    };
+
+    /// @brief Called on the owning shard's thread for every accepted connection
+    typedef std::function<void(Shard&, std::shared_ptr<transport::TcpClient>)> AcceptHandler;
+
+    /// @brief Called on a shard's thread with the exception a handler let escape its reactor
+    typedef std::function<void(Shard&, std::exception_ptr)> ErrorHandler;
+
+    /**
+     * @brief Start the shards, one thread per shard
+     *
+     * @throws SystemApiError
+     */
+    explicit ShardedRuntime(const ShardOptions& options = ShardOptions());
+
+    /**
+     * @brief Stops all shards, and waits for their threads to finish
+     */
+    ~ShardedRuntime();
+
+    ShardedRuntime(const ShardedRuntime&) = delete;
+    ShardedRuntime& operator=(const ShardedRuntime&) = delete;
+
+    /**
+     * @brief Retrieve the number of shards
+     */
+    size_t size() const noexcept;
+
+    /**
+     * @brief Retrieve a shard by its index
+     *
+     * @throws std::out_of_range
+     */
+    Shard& shard(size_t index);
+
+    /**
+     * @brief Retrieve the shard running on the calling thread
+     *
+     * @return The shard, or nullptr if called from a thread that is not a shard
+     */
+    static Shard* current() noexcept;
+
+    /**
+     * @brief Retrieve the shard responsible for connections handled by the CPU - shard @a cpu % @b size()
+     */
+    Shard& shard_for_cpu(unsigned cpu) noexcept;
+
+    /**
+     * @brief Choose the shard for a connection - the one of the CPU processing its packets
+     *
+     * Falls back to round-robin if the CPU can not be determined.
+     *
+     * @throws SetupError if the client is not connected
+     */
+    Shard& shard_for(const transport::TcpClient& client);
+
+    /**
+     * @brief Run the message on the target shard's thread
+     *
+     * Messages from one shard to another are delivered in order through a lock-free queue
+     * dedicated to the pair. Messages from threads outside of the runtime go through the
+     * target reactor's @b post.
+     *
+     * @param [in] to Index of the target shard
+     * @param [in] message The message to run
+     * @throws std::out_of_range
+     */
+    void send(size_t to, Message message);
+
+    /**
+     * @brief Accept connections on the address, and hand each to its shard
+     *
+     * Where supported, every shard gets its own listener in an @b SO_REUSEPORT group, and the
+     * system steers each connection to the listener of the shard whose CPU received it.
+     * Otherwise, a single listener on the first shard places connections with @b shard_for.
+     *
+     * @param [in] address The local address to listen on
+     * @param [in] on_accept Called on the owning shard's thread for every connection
+     * @param [in] options Options for the listeners - @b reuse_port is turned on for a group
+     * @throws ConnectionFailure
+     * @throws SystemApiError
+     */
+    void listen(const net::IpAddress& address, AcceptHandler on_accept, const transport::ListenOptions& options = transport::ListenOptions());
+
+    /**
+     * @brief Set the handler called when an exception escapes a handler run by a shard's reactor
+     *
+     * The shard's reactor keeps running once the handler returns, so one failing connection
+     * does not take down the others on its shard. Without a handler, such exceptions are
+     * dropped.
+     */
+    void on_error(ErrorHandler handler);
+
+    /**
+     * @brief Stop all shards and wait for their threads to finish - further messages are dropped
+     */
+    void stop() noexcept;
+
+protected:
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    // channels[from * size() + to]
+    std::vector<std::unique_ptr<SpscQueue<Message>>> channels;
+
+    std::vector<std::unique_ptr<transport::TcpListener>> listeners;
+
+    std::atomic<size_t> next_shard = {0};
+
+    // Set from any thread, called from the shards' threads
+    std::mutex                    error_mutex;
+    std::shared_ptr<ErrorHandler> error_handler;
+
+    void drain(Shard& shard);
+    void report(Shard& shard, std::exception_ptr error) noexcept;
+    void accept_ready(Shard& shard, transport::TcpListener& listener, const std::shared_ptr<AcceptHandler>& on_accept);
+};
+}
+
+#endif
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file spsc.hpp
+ * @brief Unbounded lock-free queue between exactly one producer and one consumer thread
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_RUNTIME_SPSC_HPP_
+#define _SLEIPNER_RUNTIME_SPSC_HPP_
+
+#include <atomic>
+#include <utility>
+
+namespace sleipner::runtime {
+/**
+ * @brief Unbounded single-producer/single-consumer queue
+ *
+ * The producer only touches the tail and the consumer only the head, each on their own
+ * cache line, so neither ever waits for or invalidates the other beyond the handed-over node.
+ *
+ * @note @b push may only be called from one thread, and @b pop from one (other) thread.
+ *
+ * @tparam T Default constructible, movable element type
+ */
+template<typename T>
+class SpscQueue {
+protected:
+    struct Node {
+        std::atomic<Node*> next = {nullptr};
+        T value;
+    };
+
+    // The head is a sentinel - the front element is in head->next
+    alignas(64) Node* head;
+    alignas(64) Node* tail;
+
+public:
+    SpscQueue(): head(new Node()), tail(head) {}
+
+    ~SpscQueue() {
+        while ( head ) {
+            Node* next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+        }
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * @brief Append an element - producer thread only
+     */
+    void push(T value) {
+        Node* node = new Node();
+        node->value = std::move(value);
+        tail->next.store(node, std::memory_order_release);
+        tail = node;
+    }
+
+    /**
+     * @brief Take the front element - consumer thread only
+     *
+     * @param [out] value Assigned the front element, if any
+     * @return bool False if the queue was empty
+     */
+    bool pop(T& value) {
+        Node* next = head->next.load(std::memory_order_acquire);
+        if ( !next )
+            return false;
+
+        value = std::move(next->value);
+        next->value = T();
+
+        delete head;
+        head = next;
+        return true;
+    }
+
+    /**
+     * @brief Check if the queue is empty - consumer thread only
+     */
+    bool empty() const {
+        return head->next.load(std::memory_order_acquire) == nullptr;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/runtime/timer.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+namespace sleipner::runtime {
+TimerWheel::TimerWheel(clock::duration resolution): resolution(resolution), origin(clock::now()) {
+    if ( resolution <= clock::duration::zero() )
+        throw std::invalid_argument("Timer resolution must be positive!");
+
+    std::fill(std::begin(heads), std::end(heads), NIL);
+}
+
+uint64_t TimerWheel::to_tick(clock::time_point time) const noexcept {
+    if ( time <= origin )
+        return 0;
+
+    // Round up, so a timer never fires before its deadline
+    return (uint64_t) ((time - origin + resolution - clock::duration(1)) / resolution);
+}
+
+void TimerWheel::link(uint32_t index, uint32_t bucket) noexcept {
+    Node& node  = nodes[index];
+    node.bucket = bucket;
+    node.prev   = NIL;
+    node.next   = heads[bucket];
+
+    if ( node.next != NIL )
+        nodes[node.next].prev = index;
+    heads[bucket] = index;
+
+    if ( bucket < FIRING )
+        level_count[bucket / SLOTS]++;
+}
+
+void TimerWheel::unlink(uint32_t index) noexcept {
+    Node& node = nodes[index];
+
+    if ( node.prev != NIL )
+        nodes[node.prev].next = node.next;
+    else
+        heads[node.bucket] = node.next;
+
+    if ( node.next != NIL )
+        nodes[node.next].prev = node.prev;
+
+    if ( node.bucket < FIRING )
+        level_count[node.bucket / SLOTS]--;
+
+    node.prev = node.next = NIL;
+}
+
+void TimerWheel::place(uint32_t index, uint64_t earliest) noexcept {
+    uint64_t expires = std::max(nodes[index].expires, earliest);
+    uint64_t delta   = expires - current;
+
+    unsigned level = 0;
+    while ( level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))) )
+        level++;
+
+    // Beyond the range of the wheel - park in the last slot of the coarsest level, it is re-placed when cascaded
+    uint64_t range = uint64_t(1) << (SLOT_BITS * LEVELS);
+    if ( delta >= range )
+        expires = current + range - 1;
+
+    uint32_t slot = (uint32_t) ((expires >> (SLOT_BITS * level)) & (SLOTS - 1));
+    link(index, level * SLOTS + slot);
+}
+
+void TimerWheel::cascade(unsigned level) noexcept {
+    uint32_t bucket = level * SLOTS + (uint32_t) ((current >> (SLOT_BITS * level)) & (SLOTS - 1));
+    uint32_t index  = heads[bucket];
+    heads[bucket]   = NIL;
+
+    while ( index != NIL ) {
+        uint32_t next = nodes[index].next;
+        nodes[index].prev = nodes[index].next = NIL;
+        level_count[level]--;
+        // The current tick is fired right after cascading
+        place(index, current);
+        index = next;
+    }
+}
+
+void TimerWheel::release(uint32_t index) noexcept {
+    Node& node = nodes[index];
+    node.callback = nullptr;
+    node.generation++;
+    node.bucket = FREE;
+    node.prev   = NIL;
+    node.next   = free_list;
+    free_list   = index;
+}
+
+TimerHandle TimerWheel::add(clock::time_point deadline, Callback callback) {
+    uint32_t index;
+
+    if ( free_list != NIL ) {
+        index     = free_list;
+        free_list = nodes[index].next;
+    } else {
+        nodes.emplace_back();
+        index = (uint32_t) (nodes.size() - 1);
+    }
+
+    nodes[index].expires  = to_tick(deadline);
+    nodes[index].callback = std::move(callback);
+    place(index, current + 1);
+    count++;
+
+    return TimerHandle{index, nodes[index].generation};
+}
+
+bool TimerWheel::active(const TimerHandle& timer) const noexcept {
+    return timer.index < nodes.size()
+        && nodes[timer.index].generation == timer.generation
+        && nodes[timer.index].bucket != FREE;
+}
+
+bool TimerWheel::reschedule(const TimerHandle& timer, clock::time_point deadline) {
+    if ( !active(timer) )
+        return false;
+
+    unlink(timer.index);
+    nodes[timer.index].expires = to_tick(deadline);
+    place(timer.index, current + 1);
+    return true;
+}
+
+bool TimerWheel::cancel(const TimerHandle& timer) noexcept {
+    if ( !active(timer) )
+        return false;
+
+    unlink(timer.index);
+    release(timer.index);
+    count--;
+    return true;
+}
+
+size_t TimerWheel::advance(clock::time_point now) {
+    uint64_t target = now <= origin ? 0 : (uint64_t) ((now - origin) / resolution);
+    size_t fired = 0;
+
+    while ( current < target ) {
+        if ( count == 0 ) {
+            current = target;
+            break;
+        }
+
+        current++;
+
+        // Move the coarser levels down as the finer ones wrap around
+        for ( unsigned level = 1; level < LEVELS; level++ ) {
+            if ( (current >> (SLOT_BITS * (level - 1))) & (SLOTS - 1) )
+                break;
+            cascade(level);
+        }
+
+        uint32_t bucket = (uint32_t) (current & (SLOTS - 1));
+        heads[FIRING]   = heads[bucket];
+        heads[bucket]   = NIL;
+
+        for ( uint32_t index = heads[FIRING]; index != NIL; index = nodes[index].next ) {
+            nodes[index].bucket = FIRING;
+            level_count[0]--;
+        }
+
+        // Callbacks may cancel timers still in the batch, so take them off one at a time
+        while ( heads[FIRING] != NIL ) {
+            uint32_t next = heads[FIRING];
+            unlink(next);
+
+            Callback callback = std::move(nodes[next].callback);
+            release(next);
+            count--;
+
+            try {
+                callback();
+            } catch ( ... ) {
+                // Leave the rest of the batch to fire on the next tick, rather than stranded in the firing list
+                while ( heads[FIRING] != NIL ) {
+                    uint32_t rest = heads[FIRING];
+                    unlink(rest);
+                    place(rest, current + 1);
+                }
+                throw;
+            }
+            fired++;
+        }
+    }
+
+    return fired;
+}
+
+int TimerWheel::next_timeout(clock::time_point now) const noexcept {
+    if ( count == 0 )
+        return -1;
+
+    if ( heads[FIRING] != NIL )
+        return 0;
+
+    uint64_t target = UINT64_MAX;
+
+    if ( level_count[0] ) {
+        for ( uint64_t tick = current + 1; tick <= current + SLOTS; tick++ )
+            if ( heads[tick & (SLOTS - 1)] != NIL ) {
+                target = tick;
+                break;
+            }
+    }
+
+    // Timers in the coarser levels need to be moved down at the next wrap-around
+    bool coarse = false;
+    for ( unsigned level = 1; level < LEVELS; level++ )
+        coarse = coarse || level_count[level] > 0;
+
+    if ( coarse )
+        target = std::min(target, ((current >> SLOT_BITS) + 1) << SLOT_BITS);
+
+    clock::time_point when = origin + resolution * target;
+    if ( when <= now )
+        return 0;
+
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(when - now + std::chrono::milliseconds(1) - clock::duration(1));
+    return wait.count() > INT_MAX ? INT_MAX : (int) wait.count();
+}
+
+size_t TimerWheel::size() const noexcept {
+    return count;
+}
+}
@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file timer.hpp
+ * @brief Hierarchical timing wheel for large numbers of timeouts and deadlines
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_RUNTIME_TIMER_HPP_
+#define _SLEIPNER_RUNTIME_TIMER_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace sleipner::runtime {
+/**
+ * @brief Refers to a timer of a @b TimerWheel
+ *
+ * A handle stays safe to use after its timer fired or was cancelled - it is then simply
+ * no longer @b active, and cancelling it does nothing.
+ */
+struct TimerHandle {
+    uint32_t index      = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+/**
+ * @brief Hierarchical timing wheel with O(1) add, reschedule and cancel
+ *
+ * Timers are kept in 4 levels of 64 slots, with a resolution of one tick. Timers far in
+ * the future sit in the coarse levels, and are moved down a level every time the finer
+ * level wraps around. Timers are stored in a reusable pool, so once warmed up, setting a
+ * timer does not allocate - cheap enough to reset an idle timeout on every read.
+ *
+ * Timers fire at most one tick late, and never early. Timers further away than 64^4 ticks
+ * are held in the coarsest level until they come within range.
+ *
+ * Basic usage example:
+ * @code
+ * TimerWheel wheel;
+ * TimerHandle idle = wheel.add(TimerWheel::clock::now() + std::chrono::seconds(30), [&] { client.close(); });
+ *
+ * // On every read, push the idle timeout back
+ * wheel.reschedule(idle, TimerWheel::clock::now() + std::chrono::seconds(30));
+ *
+ * // In the event loop
+ * wheel.advance(TimerWheel::clock::now());
+ * @endcode
+ *
+ * @note Not thread-safe - a wheel belongs to one thread, typically a @b Reactor's
+ */
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock clock;
+    typedef std::function<void()>     Callback;
+
+    /**
+     * @param [in] resolution Length of a tick
+     * @throws std::invalid_argument if the resolution is not positive
+     */
+    explicit TimerWheel(clock::duration resolution = std::chrono::milliseconds(1));
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /**
+     * @brief Call the callback once the deadline has passed
+     *
+     * @param [in] deadline When to fire - a deadline already passed fires on the next tick
+     * @param [in] callback Called from @b advance
+     * @return TimerHandle Handle to reschedule or cancel the timer
+     */
+    TimerHandle add(clock::time_point deadline, Callback callback);
+
+    /**
+     * @brief Move the deadline of an active timer, keeping its callback
+     *
+     * @return bool False if the timer already fired or was cancelled
+     */
+    bool reschedule(const TimerHandle& timer, clock::time_point deadline);
+
+    /**
+     * @brief Cancel the timer, so it never fires
+     *
+     * @return bool False if the timer already fired or was cancelled
+     */
+    bool cancel(const TimerHandle& timer) noexcept;
+
+    /**
+     * @brief Check if the timer is still waiting to fire
+     */
+    bool active(const TimerHandle& timer) const noexcept;
+
+    /**
+     * @brief Fire all timers whose deadline has passed
+     *
+     * Callbacks may add, reschedule and cancel timers, including other timers due to fire.
+     *
+     * @param [in] now The current time
+     * @return size_t Number of timers fired
+     * @throws Whatever a callback throws - the timers not yet fired are kept, and fire on the next tick
+     */
+    size_t advance(clock::time_point now);
+
+    /**
+     * @brief Milliseconds until @b advance next has to be called
+     *
+     * Exact for timers within 64 ticks, otherwise the time until the next coarse level is
+     * moved down, which is never later than the first timer.
+     *
+     * @param [in] now The current time
+     * @return int Milliseconds, rounded up, or -1 if there are no timers
+     */
+    int next_timeout(clock::time_point now) const noexcept;
+
+    /**
+     * @brief Retrieve the number of active timers
+     */
+    size_t size() const noexcept;
+
+protected:
+    static constexpr unsigned LEVELS     = 4;
+    static constexpr unsigned SLOT_BITS  = 6;
+    static constexpr unsigned SLOTS      = 1u << SLOT_BITS;
+    static constexpr uint32_t NIL        = UINT32_MAX;
+    // Bucket of the timers being fired, so callbacks can cancel them like any other
+    static constexpr uint32_t FIRING     = LEVELS * SLOTS;
+    static constexpr uint32_t FREE       = FIRING + 1;
+
+    struct Node {
+        uint64_t expires    = 0;
+        Callback callback;
+        uint32_t prev       = NIL;
+        uint32_t next       = NIL;
+        uint32_t bucket     = FREE;
+        uint32_t generation = 0;
+    };
+
+    clock::duration   resolution;
+    clock::time_point origin;
+    uint64_t          current = 0;
+    size_t            count   = 0;
+
+    std::vector<Node>     nodes;
+    uint32_t              free_list = NIL;
+    uint32_t              heads[FIRING + 1];
+    size_t                level_count[LEVELS] = {0};
+
+    uint64_t to_tick(clock::time_point time) const noexcept;
+    void link(uint32_t index, uint32_t bucket) noexcept;
+    void unlink(uint32_t index) noexcept;
+    void place(uint32_t index, uint64_t earliest) noexcept;
+    void cascade(unsigned level) noexcept;
+    void release(uint32_t index) noexcept;
+};
+}
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/sys/affinity.hpp"
+#include "sleipner/sys/error.hpp"
+
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace sleipner::sys {
+unsigned cpu_count() noexcept {
+    unsigned count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+int current_cpu() noexcept {
+    #ifdef _WIN32
+        return (int) ::GetCurrentProcessorNumber();
+    #elif defined(__linux__)
+        return ::sched_getcpu();
+    #else
+        return -1;
+    #endif
+}
+
+void pin_thread(unsigned cpu) {
+    #ifdef _WIN32
+        if ( cpu >= sizeof(DWORD_PTR) * 8 )
+            throw std::invalid_argument("CPU index out of range!");
+
+        if ( ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR(1) << cpu) == 0 )
+            throw error::SystemApiError(::GetLastError());
+    #elif defined(__linux__)
+        if ( cpu >= CPU_SETSIZE )
+            throw std::invalid_argument("CPU index out of range!");
+
+        ::cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        if ( err )
+            throw error::SystemApiError(err);
+    #else
+        (void) cpu;
+    #endif
+}
+}
@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file affinity.hpp
+ * @brief Query CPUs and pin threads to them
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_SYS_AFFINITY_HPP_
+#define _SLEIPNER_SYS_AFFINITY_HPP_
+
+namespace sleipner::sys {
+/**
+ * @brief Retrieve the number of CPUs available to the process
+ *
+ * @return Number of CPUs, at least 1
+ */
+unsigned cpu_count() noexcept;
+
+/**
+ * @brief Retrieve the CPU the calling thread is currently running on
+ *
+ * @return The CPU index, or -1 if it can not be determined on this system
+ */
+int current_cpu() noexcept;
+
+/**
+ * @brief Restrict the calling thread to only run on the given CPU
+ *
+ * @note Has no effect on systems without thread affinity support
+ *
+ * @param [in] cpu Index of the CPU
+ * @throws std::invalid_argument if the CPU index is out of range for the system
+ * @throws SystemApiError
+ */
+void pin_thread(unsigned cpu);
+}
+
+#endif
@@ -8,7 +8,7 @@
 #ifdef _WIN32
     #include <Windows.h>
 #else
-    #error "system/error.cpp Not yet implemented..."
+    #include <cstring>
 #endif
 
 namespace sleipner::error {
@@ -54,7 +54,9 @@ std::string error_message(int code) noexcept {
         #else
             char* err = strerror(code);
         #endif
-        return err ? err : "";
+
+        // Same format as on Windows
+        return "(" + std::to_string(code) + "): " + (err ? err : "");
     #endif
 }
 }
@@ -0,0 +1,224 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/sys/mmap.hpp"
+#include "sleipner/sys/error.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace sleipner::sys {
+/********************************************/
+/* System specific mapping methods          */
+/********************************************/
+#ifdef _WIN32
+    typedef HANDLE file_t;
+    static const file_t INVALID_FILE = INVALID_HANDLE_VALUE;
+
+    static int _last_error() noexcept {
+        return (int) ::GetLastError();
+    }
+#else
+    typedef int file_t;
+    static const file_t INVALID_FILE = -1;
+
+    static int _last_error() noexcept {
+        return errno;
+    }
+#endif
+
+static file_t _open(const std::string& path, MappedFile::Mode mode) {
+    #ifdef _WIN32
+        file_t file = mode == MappedFile::ReadOnly
+            ? ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr)
+            : ::CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    #else
+        file_t file = mode == MappedFile::ReadOnly
+            ? ::open(path.c_str(), O_RDONLY | O_CLOEXEC)
+            : ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    #endif
+
+    if ( file == INVALID_FILE )
+        throw error::SystemApiError(_last_error());
+    return file;
+}
+
+static void _close(file_t& file) noexcept {
+    if ( file == INVALID_FILE )
+        return;
+
+    #ifdef _WIN32
+        ::CloseHandle(file);
+    #else
+        ::close(file);
+    #endif
+    file = INVALID_FILE;
+}
+
+static size_t _file_size(file_t file) {
+    #ifdef _WIN32
+        LARGE_INTEGER size;
+        if ( !::GetFileSizeEx(file, &size) )
+            throw error::SystemApiError(_last_error());
+        return (size_t) size.QuadPart;
+    #else
+        struct ::stat info;
+        if ( ::fstat(file, &info) != 0 )
+            throw error::SystemApiError(_last_error());
+        return (size_t) info.st_size;
+    #endif
+}
+
+static void _set_file_size(file_t file, size_t size) {
+    #ifdef _WIN32
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG) size;
+        if ( !::SetFilePointerEx(file, position, nullptr, FILE_BEGIN) || !::SetEndOfFile(file) )
+            throw error::SystemApiError(_last_error());
+    #else
+        if ( ::ftruncate(file, (off_t) size) != 0 )
+            throw error::SystemApiError(_last_error());
+    #endif
+}
+
+// An empty file can not be mapped - it is left unmapped, with data() null
+static char* _map(file_t file, size_t size, bool writable) {
+    if ( size == 0 )
+        return nullptr;
+
+    #ifdef _WIN32
+        HANDLE mapping = ::CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                              (DWORD) ((uint64_t) size >> 32), (DWORD) size, nullptr);
+        if ( mapping == nullptr )
+            throw error::SystemApiError(_last_error());
+
+        void* view = ::MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+        int err = _last_error();
+        // The view keeps the mapping alive
+        ::CloseHandle(mapping);
+
+        if ( view == nullptr )
+            throw error::SystemApiError(err);
+        return static_cast<char*>(view);
+    #else
+        void* view = ::mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+        if ( view == MAP_FAILED )
+            throw error::SystemApiError(_last_error());
+        return static_cast<char*>(view);
+    #endif
+}
+
+static void _unmap(char*& view, size_t size) noexcept {
+    if ( view == nullptr )
+        return;
+
+    #ifdef _WIN32
+        (void) size;
+        ::UnmapViewOfFile(view);
+    #else
+        ::munmap(view, size);
+    #endif
+    view = nullptr;
+}
+
+static void _flush(char* view, size_t size) {
+    if ( view == nullptr )
+        return;
+
+    #ifdef _WIN32
+        if ( !::FlushViewOfFile(view, size) )
+            throw error::SystemApiError(_last_error());
+    #else
+        if ( ::msync(view, size, MS_ASYNC) != 0 )
+            throw error::SystemApiError(_last_error());
+    #endif
+}
+
+/********************************************/
+/* MappedFile::Impl                         */
+/********************************************/
+struct MappedFile::Impl {
+    file_t file     = INVALID_FILE;
+    char*  view     = nullptr;
+    size_t size     = 0;
+    bool   writable = false;
+
+    ~Impl() {
+        _unmap(view, size);
+        _close(file);
+    }
+};
+
+void MappedFile::ImplCleanup::operator()(Impl* ptr) const {
+    if ( ptr )
+        delete ptr;
+}
+
+/********************************************/
+/* MappedFile                               */
+/********************************************/
+MappedFile::~MappedFile() = default;
+
+void MappedFile::open(const std::string& path, Mode mode, size_t size) {
+    if ( pimpl )
+        throw std::logic_error("MappedFile already open!");
+
+    std::unique_ptr<Impl, ImplCleanup> impl(new Impl());
+    impl->file     = _open(path, mode);
+    impl->writable = mode == ReadWrite;
+
+    if ( impl->writable )
+        _set_file_size(impl->file, size);
+    else
+        size = _file_size(impl->file);
+
+    impl->view = _map(impl->file, size, impl->writable);
+    impl->size = size;
+    pimpl = std::move(impl);
+}
+
+void MappedFile::close() noexcept {
+    pimpl.reset(nullptr);
+}
+
+void MappedFile::resize(size_t size) {
+    if ( !pimpl || !pimpl->writable )
+        throw std::logic_error("MappedFile not open for writing!");
+
+    _unmap(pimpl->view, pimpl->size);
+    pimpl->size = 0;
+
+    _set_file_size(pimpl->file, size);
+    pimpl->view = _map(pimpl->file, size, true);
+    pimpl->size = size;
+}
+
+void MappedFile::flush() {
+    if ( pimpl && pimpl->writable )
+        _flush(pimpl->view, pimpl->size);
+}
+
+char* MappedFile::data() const noexcept {
+    return pimpl ? pimpl->view : nullptr;
+}
+
+size_t MappedFile::size() const noexcept {
+    return pimpl ? pimpl->size : 0;
+}
+
+bool MappedFile::is_open() const noexcept {
+    return (bool) pimpl;
+}
+}
@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file mmap.hpp
+ * @brief Memory-mapped files
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_SYS_MMAP_HPP_
+#define _SLEIPNER_SYS_MMAP_HPP_
+
+#include <memory>
+#include <string>
+
+namespace sleipner::sys {
+/**
+ * @brief A file mapped into memory, read through and written to as a plain buffer
+ *
+ * Writing to a mapping only copies into the page cache, without a system call, so a
+ * mapping is a cheap way to stream data to disk from a hot path.
+ *
+ * @note Not thread-safe
+ */
+class MappedFile {
+public:
+    enum Mode {
+        /// @brief Map an existing file for reading
+        ReadOnly,
+        /// @brief Create or truncate the file, and map it for writing
+        ReadWrite
+    };
+
+    /**
+     * @brief Default constructor does not map any file
+     */
+    MappedFile() = default;
+
+    /**
+     * @brief Unmaps and closes the file - the contents written are kept
+     */
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief Open and map the file
+     *
+     * @param [in] path The file to open
+     * @param [in] mode How to open the file
+     * @param [in] size Initial size of a file opened @b ReadWrite, ignored otherwise
+     * @throws std::logic_error If a file is already open
+     * @throws SystemApiError If the file can not be opened or mapped
+     */
+    void open(const std::string& path, Mode mode, size_t size = 0);
+
+    /**
+     * @brief Unmap and close the file
+     */
+    void close() noexcept;
+
+    /**
+     * @brief Grow or shrink a file opened @b ReadWrite, and map the new size
+     *
+     * @warning Moves the mapping - pointers from @b data are invalidated
+     * @throws std::logic_error If no file is open for writing
+     * @throws SystemApiError
+     */
+    void resize(size_t size);
+
+    /**
+     * @brief Start writing the modified pages to disk, without waiting for it to finish
+     *
+     * @throws SystemApiError
+     */
+    void flush();
+
+    /**
+     * @brief Retrieve the mapped contents, or null if nothing is mapped
+     */
+    char* data() const noexcept;
+
+    /**
+     * @brief Retrieve the size of the mapping
+     */
+    size_t size() const noexcept;
+
+    /**
+     * @brief Check if a file is open
+     */
+    bool is_open() const noexcept;
+
+protected:
+    struct Impl;
+    struct ImplCleanup { void operator()(Impl* ptr) const; };
+
+    std::unique_ptr<Impl, ImplCleanup> pimpl;
+};
+}
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file native.hpp
+ * @brief System socket headers and helpers shared by the implementation files
+ * @author Ferdinand Tonby-Strandborg
+ *
+ * @warning Internal header, it is not installed. Never include it from a public header, as that
+ *          would leak the system-specific libraries, such as @b WinSock, to the users.
+ */
+#ifndef _SLEIPNER_SYS_NATIVE_HPP_
+#define _SLEIPNER_SYS_NATIVE_HPP_
+
+#include "sleipner/sys/socket.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+    #include <WinSock2.h>
+    #include <WS2tcpip.h>
+
+    #ifndef VALIDATE_SOCKET
+    #define VALIDATE_SOCKET(socket) (socket != INVALID_SOCKET)
+    #endif
+
+    #ifndef SOCKET_FAILURE
+    #define SOCKET_FAILURE(res) (res == SOCKET_ERROR)
+    #endif
+#else
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <sys/ioctl.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <netdb.h>
+    #include <poll.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <cerrno>
+
+    #ifndef INVALID_SOCKET
+    #define INVALID_SOCKET -1
+    #endif
+
+    #ifndef VALIDATE_SOCKET
+    #define VALIDATE_SOCKET(socket) (socket >= 0)
+    #endif
+
+    #ifndef SOCKET_FAILURE
+    #define SOCKET_FAILURE(res) (res < 0)
+    #endif
+
+    // The WinSock names of the errno values, so the error handling is shared between the systems
+    #define WSAEWOULDBLOCK   EWOULDBLOCK
+    #define WSAEINPROGRESS   EINPROGRESS
+    #define WSAEALREADY      EALREADY
+    #define WSAENOTSOCK      ENOTSOCK
+    #define WSAEMSGSIZE      EMSGSIZE
+    #define WSAEOPNOTSUPP    EOPNOTSUPP
+    #define WSAEAFNOSUPPORT  EAFNOSUPPORT
+    #define WSAEADDRINUSE    EADDRINUSE
+    #define WSAEADDRNOTAVAIL EADDRNOTAVAIL
+    #define WSAENETDOWN      ENETDOWN
+    #define WSAENETUNREACH   ENETUNREACH
+    #define WSAENETRESET     ENETRESET
+    #define WSAECONNABORTED  ECONNABORTED
+    #define WSAECONNRESET    ECONNRESET
+    #define WSAENOTCONN      ENOTCONN
+    #define WSAETIMEDOUT     ETIMEDOUT
+    #define WSAECONNREFUSED  ECONNREFUSED
+    #define WSAEHOSTUNREACH  EHOSTUNREACH
+    #define WSAEINTR         EINTR
+    #define WSAEFAULT        EFAULT
+    #define WSAEINVAL        EINVAL
+    #define WSAEACCES        EACCES
+
+    inline int WSAGetLastError() noexcept {
+        return errno;
+    }
+#endif
+
+namespace sleipner::sys {
+#ifdef _WIN32
+    typedef SOCKET    socket_t;
+    typedef WSAPOLLFD pollfd_t;
+#else
+    typedef int      socket_t;
+    typedef ::pollfd pollfd_t;
+#endif
+
+static_assert(sizeof(socket_t) == sizeof(native_socket_t), "native_socket_t must hold a system socket");
+
+/**
+ * @brief Error code of the last failed socket call on this thread
+ */
+inline int last_socket_error() noexcept {
+    #ifdef _WIN32
+        return ::WSAGetLastError();
+    #else
+        return errno;
+    #endif
+}
+
+/**
+ * @brief Wait for events on the sockets, as @b poll
+ *
+ * @return Number of sockets with events, or a negative value on failure
+ */
+inline int poll(pollfd_t* fds, size_t count, int timeout) noexcept {
+    #ifdef _WIN32
+        return ::WSAPoll(fds, (ULONG) count, timeout);
+    #else
+        return ::poll(fds, (nfds_t) count, timeout);
+    #endif
+}
+
+/**
+ * @brief Switch the socket between blocking and non-blocking mode
+ *
+ * @return False on failure, with the error in @b last_socket_error
+ */
+inline bool set_non_blocking(socket_t socket, bool enable) noexcept {
+    #ifdef _WIN32
+        u_long mode = enable ? 1 : 0;
+        return !SOCKET_FAILURE(::ioctlsocket(socket, FIONBIO, &mode));
+    #else
+        int flags = ::fcntl(socket, F_GETFL);
+        if ( flags < 0 )
+            return false;
+        flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+        return ::fcntl(socket, F_SETFL, flags) >= 0;
+    #endif
+}
+
+/**
+ * @brief Check if the socket is in non-blocking mode, e.g. to restore the mode after switching it
+ *
+ * Windows can not report the mode of a socket, so there it is assumed blocking, as sockets
+ * are created.
+ */
+inline bool is_non_blocking(socket_t socket) noexcept {
+    #ifdef _WIN32
+        (void) socket;
+        return false;
+    #else
+        int flags = ::fcntl(socket, F_GETFL);
+        return flags >= 0 && (flags & O_NONBLOCK);
+    #endif
+}
+
+#ifdef _WIN32
+    typedef WSABUF iobuf_t;
+#else
+    typedef ::iovec iobuf_t;
+#endif
+
+/**
+ * @brief Point the buffer descriptor at the data, for @b send_buffers
+ */
+inline void set_iobuf(iobuf_t& buffer, const char* data, size_t size) noexcept {
+    #ifdef _WIN32
+        buffer.buf = const_cast<char*>(data);
+        buffer.len = (ULONG) size;
+    #else
+        buffer.iov_base = const_cast<char*>(data);
+        buffer.iov_len  = size;
+    #endif
+}
+
+/**
+ * @brief Send the buffers in order with one system call, as far as the socket buffer allows
+ *
+ * @return Bytes sent, or a negative value on failure, with the error in @b last_socket_error
+ */
+inline int64_t send_buffers(socket_t socket, iobuf_t* buffers, size_t count) noexcept {
+    #ifdef _WIN32
+        DWORD sent = 0;
+        if ( SOCKET_FAILURE(::WSASend(socket, buffers, (DWORD) count, &sent, 0, nullptr, nullptr)) )
+            return -1;
+        return sent;
+    #else
+        ::msghdr message {};
+        message.msg_iov    = buffers;
+        message.msg_iovlen = count;
+        return ::sendmsg(socket, &message, MSG_NOSIGNAL);
+    #endif
+}
+
+/**
+ * @brief Check if the error only means a non-blocking call would have blocked, and can be retried later
+ */
+inline bool would_block(int err) noexcept {
+    #ifdef _WIN32
+        return err == WSAEWOULDBLOCK;
+    #else
+        return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+    #endif
+}
+
+/**
+ * @brief Close the socket, ignoring errors, and invalidate the handle
+ */
+inline void close_socket(socket_t& socket) noexcept {
+    if ( VALIDATE_SOCKET(socket) )
+        #ifdef _WIN32
+            ::closesocket(socket);
+        #else
+            ::close(socket);
+        #endif
+    socket = INVALID_SOCKET;
+}
+}
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file socket.hpp
+ * @brief System socket handle type, without including the system headers
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_SYS_SOCKET_HPP_
+#define _SLEIPNER_SYS_SOCKET_HPP_
+
+#include <cstdint>
+
+namespace sleipner::sys {
+#ifdef _WIN32
+    /// @brief The system socket handle - @b SOCKET on Windows
+    typedef uintptr_t native_socket_t;
+
+    /// @brief Value of a handle that does not refer to a socket - @b INVALID_SOCKET on Windows
+    constexpr native_socket_t invalid_native_socket = ~native_socket_t(0);
+#else
+    /// @brief The system socket handle - a file descriptor on POSIX
+    typedef int native_socket_t;
+
+    /// @brief Value of a handle that does not refer to a socket
+    constexpr native_socket_t invalid_native_socket = -1;
+#endif
+}
+
+#endif
@@ -61,4 +61,10 @@ uint8_t WinsockLoader::version_minor() const {
         return 0;
     #endif
 }
+
+void winsock_init() {
+    // Constructed by the first call to succeed, destroyed at exit
+    static WinsockLoader loader;
+    (void) loader;
+}
 }
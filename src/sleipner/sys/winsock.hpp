@@ -97,6 +97,16 @@ public:
      */
     uint8_t version_minor() const;
 };
+
+/**
+ * @brief Start up WinSock once for the whole process, keeping it loaded until exit
+ *
+ * Unlike a @b WinsockLoader per object, only the first call takes the lock - later calls
+ * cost a check of a static initialisation guard. Does nothing on non-Windows devices.
+ *
+ * @throws SystemApiError if WSA startup failed - the next call tries again
+ */
+void winsock_init();
 }
 
 #endif
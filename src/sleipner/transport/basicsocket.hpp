@@ -0,0 +1,482 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file basicsocket.hpp
+ * @brief Statically dispatched socket, for hot paths where the virtual calls and locking of @b ISocket show
+ * @author Ferdinand Tonby-Strandborg
+ *
+ * @note On POSIX the send and receive fast paths are defined here, so this header includes the system's
+ *       socket header. On Windows they are out of line, and WinSock stays out of the users' code.
+ */
+#ifndef _SLEIPNER_TRANSPORT_BASICSOCKET_HPP_
+#define _SLEIPNER_TRANSPORT_BASICSOCKET_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "sleipner/transport/isocket.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/net/ip.hpp"
+#include "sleipner/sys/socket.hpp"
+
+#ifndef _WIN32
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <cerrno>
+#endif
+
+namespace sleipner::transport {
+/********************************************/
+/* Lock policies                            */
+/********************************************/
+/**
+ * @brief Lock policy for a socket used by one thread at a time - locking compiles away
+ */
+struct NoLock {
+    void lock() noexcept {}
+    void unlock() noexcept {}
+};
+
+/**
+ * @brief Lock policy spinning on an atomic flag, for short critical sections between pinned threads
+ *
+ * @note Use @b std::mutex as the lock policy where the threads may be descheduled while holding it
+ */
+class SpinLock {
+public:
+    void lock() noexcept {
+        while ( flag.test_and_set(std::memory_order_acquire) ) {
+            #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+                __builtin_ia32_pause();
+            #else
+                std::this_thread::yield();
+            #endif
+        }
+    }
+
+    void unlock() noexcept {
+        flag.clear(std::memory_order_release);
+    }
+
+protected:
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+};
+
+/********************************************/
+/* Timeout policies                         */
+/********************************************/
+/**
+ * @brief Timeout policy providing the timeout and deadline overloads of receive and peek
+ */
+struct WithTimeout {
+    static constexpr bool enabled = true;
+};
+
+/**
+ * @brief Timeout policy for sockets that always block until data arrives - no clock is read
+ */
+struct NoTimeout {
+    static constexpr bool enabled = false;
+};
+
+/********************************************/
+/* TcpBackend                               */
+/********************************************/
+/**
+ * @brief Backend for @b BasicSocket over a TCP connection
+ *
+ * Owns a non-blocking TCP socket. @b send_some and @b receive_some are a single system call,
+ * and return 0 where the call would block; waiting is left to @b wait. Errors are thrown as by
+ * @b TcpClient.
+ *
+ * A backend is any type with the members @b send_some, @b receive_some, @b wait, @b connected
+ * and @b bytes_available, with the signatures of this one.
+ */
+class TcpBackend {
+public:
+    TcpBackend() noexcept = default;
+
+    /**
+     * @brief Take over the socket of a connected client
+     *
+     * @throws SetupError If the client is not connected
+     */
+    explicit TcpBackend(TcpClient&& client);
+
+    /**
+     * @brief Closes the socket
+     */
+    ~TcpBackend();
+
+    TcpBackend(TcpBackend&& other) noexcept;
+    TcpBackend& operator=(TcpBackend&& other) noexcept;
+
+    TcpBackend(const TcpBackend&) = delete;
+    TcpBackend& operator=(const TcpBackend&) = delete;
+
+    /**
+     * @brief Connect to the address
+     *
+     * @throws std::invalid_argument If the address is malformed
+     * @throws SetupError If already connected
+     * @throws ConnectionFailure
+     * @throws SystemApiError
+     */
+    void connect(const net::IpAddress& address);
+
+    /**
+     * @brief Connect to the first connectable address
+     *
+     * @see connect(const net::IpAddress&)
+     */
+    void connect(const std::vector<net::IpAddress>& addresses);
+
+    /**
+     * @brief Close the socket, if open
+     */
+    void close() noexcept;
+
+    /**
+     * @brief Retrieve the socket handle, or @b sys::invalid_native_socket if not connected
+     */
+    sys::native_socket_t native_handle() const noexcept {
+        return socket;
+    }
+
+    /// @copydoc ISocket::connected()
+    bool connected() const;
+
+    /// @copydoc ISocket::bytes_available()
+    size_t bytes_available() const;
+
+    /**
+     * @brief Wait until the socket is readable, or writable
+     *
+     * @param [in] write Wait for room to send rather than for data to receive
+     * @param [in] timeout Milliseconds to wait, UINT64_MAX to wait indefinitely
+     * @throws SetupError If not connected
+     * @throws SystemApiError
+     * @return bool False on timeout
+     */
+    bool wait(bool write, uint64_t timeout) const;
+
+    /**
+     * @brief Send as much as fits in the send buffer without blocking
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError If not connected
+     * @throws SystemApiError
+     * @return size_t Number of bytes sent, 0 if the send buffer is full
+     */
+    size_t send_some(const char* buf, size_t size) {
+        #ifdef _WIN32
+            return send_native(buf, size);
+        #else
+            // A peer gone must not raise SIGPIPE
+            ssize_t res = ::send(socket, buf, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if ( res >= 0 )
+                return (size_t) res;
+            return send_failed(errno);
+        #endif
+    }
+
+    /**
+     * @brief Receive or peek at what has arrived, without blocking
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError If not connected
+     * @throws SystemApiError
+     * @return size_t Number of bytes received, 0 if nothing has arrived
+     */
+    size_t receive_some(char* buf, size_t size, bool peek) {
+        #ifdef _WIN32
+            return receive_native(buf, size, peek);
+        #else
+            ssize_t res = ::recv(socket, buf, size, (peek ? MSG_PEEK : 0) | MSG_DONTWAIT);
+            if ( res > 0 )
+                return (size_t) res;
+            return receive_failed(res < 0 ? errno : 0, size);
+        #endif
+    }
+
+protected:
+    sys::native_socket_t socket = sys::invalid_native_socket;
+
+    // The slow paths - map the error, returning 0 where the call would block, and throwing otherwise
+    size_t send_failed(int err) const;
+    size_t receive_failed(int err, size_t size) const;
+
+    #ifdef _WIN32
+        size_t send_native(const char* buf, size_t size);
+        size_t receive_native(char* buf, size_t size, bool peek);
+    #endif
+};
+
+/********************************************/
+/* BasicSocket                              */
+/********************************************/
+/**
+ * @brief Socket resolved at compile time - no virtual calls, no allocation, and only the locking asked for
+ *
+ * Every call is inlined down to the backend, so with @b NoLock a send loop over a @b TcpBackend
+ * compiles to the @b send system call and a branch on its result. The lock policy is any type
+ * with @b lock and @b unlock - @b NoLock, @b SpinLock or @b std::mutex. With @b NoTimeout,
+ * receive and peek only block until data arrives, and take no timeout.
+ *
+ * Pass a @b SocketAdapter where an @b ISocket is needed, e.g. to wrap it in a decorator.
+ *
+ * Basic usage example:
+ * @code
+ * BasicSocket<TcpBackend> socket;
+ * socket.connect(resolve_ip("feed.example.com", 9000));
+ *
+ * for ( const Quote& quote: quotes )
+ *     socket.send(reinterpret_cast<const char*>(&quote), sizeof(quote));
+ * @endcode
+ *
+ * @tparam Backend The transport, e.g. @b TcpBackend
+ * @tparam LockPolicy Lock held for each operation
+ * @tparam TimeoutPolicy @b WithTimeout or @b NoTimeout
+ */
+template <typename Backend, typename LockPolicy = NoLock, typename TimeoutPolicy = WithTimeout>
+class BasicSocket {
+public:
+    /// @brief True if receive and peek take a timeout or deadline
+    static constexpr bool has_timeouts = TimeoutPolicy::enabled;
+
+    BasicSocket() = default;
+
+    /**
+     * @param [in] backend A connected backend
+     */
+    explicit BasicSocket(Backend&& backend): io(std::move(backend)) {}
+
+    BasicSocket(const BasicSocket&) = delete;
+    BasicSocket& operator=(const BasicSocket&) = delete;
+
+    /**
+     * @brief Retrieve the backend, e.g. to connect or close it - not synchronised by the lock
+     */
+    Backend& backend() noexcept {
+        return io;
+    }
+
+    /// @copydoc backend()
+    const Backend& backend() const noexcept {
+        return io;
+    }
+
+    /**
+     * @brief Connect the backend, forwarding the arguments to its @b connect
+     */
+    template <typename... Args>
+    void connect(Args&&... args) {
+        std::lock_guard<LockPolicy> lock(mutex);
+        io.connect(std::forward<Args>(args)...);
+    }
+
+    /// @copydoc ISocket::connected()
+    bool connected() const {
+        std::lock_guard<LockPolicy> lock(mutex);
+        return io.connected();
+    }
+
+    /// @copydoc ISocket::bytes_available()
+    size_t bytes_available() const {
+        std::lock_guard<LockPolicy> lock(mutex);
+        return io.bytes_available();
+    }
+
+    /**
+     * @brief Send all of the data, blocking while the send buffer is full
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return size_t Number of bytes sent, always all of them
+     */
+    size_t send(const char* buf, size_t size) {
+        std::lock_guard<LockPolicy> lock(mutex);
+
+        size_t sent = io.send_some(buf, size);
+        while ( sent < size ) {
+            io.wait(true, UINT64_MAX);
+            sent += io.send_some(buf + sent, size - sent);
+        }
+        return sent;
+    }
+
+    /// @copydoc send(const char*, size_t)
+    size_t send(const std::string& packet) {
+        return send(packet.data(), packet.size());
+    }
+
+    /**
+     * @brief Receive data, blocking until some arrives
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return size_t Number of bytes received
+     */
+    size_t receive(char* buf, size_t size) {
+        return take(buf, size, UINT64_MAX, false);
+    }
+
+    /**
+     * @brief Peek at data, blocking until some arrives
+     *
+     * @see receive(char*, size_t)
+     */
+    size_t peek(char* buf, size_t size) {
+        return take(buf, size, UINT64_MAX, true);
+    }
+
+    /// @copydoc ISocket::receive(char*, size_t, uint64_t)
+    size_t receive(char* buf, size_t size, uint64_t timeout) {
+        static_assert(has_timeouts, "Timeouts disabled by the NoTimeout policy");
+        return take(buf, size, timeout, false);
+    }
+
+    /// @copydoc ISocket::receive(size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) {
+        std::string buffer(size, '\0');
+        buffer.resize(receive(&buffer[0], size, timeout));
+        return buffer;
+    }
+
+    /// @copydoc ISocket::receive(char*, size_t, Deadline)
+    size_t receive(char* buf, size_t size, Deadline deadline) {
+        return receive(buf, size, ISocket::timeout_until(deadline));
+    }
+
+    /// @copydoc ISocket::peek(char*, size_t, uint64_t)
+    size_t peek(char* buf, size_t size, uint64_t timeout) {
+        static_assert(has_timeouts, "Timeouts disabled by the NoTimeout policy");
+        return take(buf, size, timeout, true);
+    }
+
+    /// @copydoc ISocket::peek(size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) {
+        std::string buffer(size, '\0');
+        buffer.resize(peek(&buffer[0], size, timeout));
+        return buffer;
+    }
+
+    /// @copydoc ISocket::peek(char*, size_t, Deadline)
+    size_t peek(char* buf, size_t size, Deadline deadline) {
+        return peek(buf, size, ISocket::timeout_until(deadline));
+    }
+
+protected:
+    Backend            io;
+    mutable LockPolicy mutex;
+
+    size_t take(char* buf, size_t size, uint64_t timeout, bool peek) {
+        std::lock_guard<LockPolicy> lock(mutex);
+
+        // Data has usually arrived already - only wait if the read would block
+        size_t received = io.receive_some(buf, size, peek);
+        if ( received || size == 0 )
+            return received;
+
+        // Readable with nothing to receive is a spurious wake-up, e.g. a bad checksum - wait again
+        if constexpr ( has_timeouts ) {
+            if ( timeout != UINT64_MAX ) {
+                Deadline deadline = Deadline::clock::now() + std::chrono::milliseconds(std::min<uint64_t>(timeout, INT32_MAX));
+                do {
+                    if ( !io.wait(false, ISocket::timeout_until(deadline)) )
+                        return 0;
+                } while ( !(received = io.receive_some(buf, size, peek)) );
+                return received;
+            }
+        }
+
+        do {
+            io.wait(false, UINT64_MAX);
+        } while ( !(received = io.receive_some(buf, size, peek)) );
+        return received;
+    }
+};
+
+/********************************************/
+/* SocketAdapter                            */
+/********************************************/
+/**
+ * @brief Presents a @b BasicSocket as an @b ISocket, for the code taking any socket
+ *
+ * The virtual call is paid by the users of the adapter only - code holding the @b BasicSocket
+ * itself still calls it directly.
+ *
+ * @tparam Socket A @b BasicSocket with timeouts
+ */
+template <typename Socket>
+class SocketAdapter: public ISocket {
+    static_assert(Socket::has_timeouts, "ISocket needs the timeout overloads");
+
+public:
+    /**
+     * @param [in] socket The socket to forward to, must outlive the adapter
+     */
+    explicit SocketAdapter(Socket& socket) noexcept: socket(socket) {}
+
+    // Deadline and memory resource overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
+    /// @copydoc ISocket::connected()
+    bool connected() const override {
+        return socket.connected();
+    }
+
+    /// @copydoc ISocket::bytes_available()
+    size_t bytes_available() const override {
+        return socket.bytes_available();
+    }
+
+    /// @copydoc ISocket::send(const char*, size_t)
+    size_t send(const char* buf, size_t size) override {
+        return socket.send(buf, size);
+    }
+
+    /// @copydoc ISocket::send(const std::string&)
+    size_t send(const std::string& packet) override {
+        return socket.send(packet.data(), packet.size());
+    }
+
+    /// @copydoc ISocket::receive(char*, size_t, uint64_t)
+    size_t receive(char* buf, size_t size, uint64_t timeout) override {
+        return socket.receive(buf, size, timeout);
+    }
+
+    /// @copydoc ISocket::receive(size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) override {
+        return socket.receive(size, timeout);
+    }
+
+    /// @copydoc ISocket::peek(char*, size_t, uint64_t)
+    size_t peek(char* buf, size_t size, uint64_t timeout) override {
+        return socket.peek(buf, size, timeout);
+    }
+
+    /// @copydoc ISocket::peek(size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) override {
+        return socket.peek(size, timeout);
+    }
+
+protected:
+    Socket& socket;
+};
+}
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/capture.hpp"
+#include "sleipner/transport/error.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace sleipner::transport {
+/********************************************/
+/* Capture format                           */
+/********************************************/
+static constexpr char     MAGIC[4]         = {'S', 'L', 'C', 'P'};
+static constexpr uint32_t VERSION          = 1;
+static constexpr size_t   FILE_HEADER      = 16;
+static constexpr size_t   RECORD_HEADER    = 16;
+static constexpr uint8_t  SENT             = 0;
+static constexpr uint8_t  RECEIVED         = 1;
+static constexpr size_t   INITIAL_CAPACITY = 1 << 20;
+static constexpr uint64_t MAX_RECORD       = UINT32_MAX;  // Largest length in a record header
+
+static void _put(char* p, uint64_t value, size_t bytes) noexcept {
+    for ( size_t i = 0; i < bytes; i++ )
+        p[i] = (char) (value >> (8 * i));
+}
+
+static uint64_t _get(const char* p, size_t bytes) noexcept {
+    uint64_t value = 0;
+    for ( size_t i = 0; i < bytes; i++ )
+        value |= (uint64_t) (unsigned char) p[i] << (8 * i);
+    return value;
+}
+
+/********************************************/
+/* RecordingSocket                          */
+/********************************************/
+RecordingSocket::RecordingSocket(ISocket& socket, const std::string& path):
+        socket(socket), used(FILE_HEADER), origin(std::chrono::steady_clock::now()) {
+    file.open(path, sys::MappedFile::ReadWrite, INITIAL_CAPACITY);
+
+    std::memcpy(file.data(), MAGIC, 4);
+    _put(file.data() + 4, VERSION, 4);
+    _put(file.data() + 8, used, 8);
+}
+
+RecordingSocket::~RecordingSocket() {
+    try {
+        file.resize(used);
+    } catch ( std::exception& ) {
+        /* The header still marks the end of the data */
+    }
+}
+
+void RecordingSocket::record(uint8_t direction, const char* data, size_t size) {
+    if ( size == 0 )
+        return;
+
+    std::lock_guard lock(mutex);
+
+    // Taken under the lock, so concurrent sends and receives are recorded in time order
+    uint64_t time = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+
+    // Data too large for one record is split over several with the same time, which replay joins
+    uint64_t records = (size + MAX_RECORD - 1) / MAX_RECORD;
+    uint64_t next    = used + records * RECORD_HEADER + size;
+
+    if ( next > file.size() )
+        file.resize((size_t) std::max<uint64_t>(next, file.size() * 2));
+
+    for ( size_t written = 0; written < size; ) {
+        size_t length = (size_t) std::min<uint64_t>(size - written, MAX_RECORD);
+
+        char* record = file.data() + used;
+        _put(record, time, 8);
+        _put(record + 8, length, 4);
+        _put(record + 12, direction, 4);
+        std::memcpy(record + RECORD_HEADER, data + written, length);
+
+        used    += RECORD_HEADER + length;
+        written += length;
+    }
+
+    _put(file.data() + 8, used, 8);
+}
+
+void RecordingSocket::flush() {
+    std::lock_guard lock(mutex);
+    file.flush();
+}
+
+uint64_t RecordingSocket::recorded() const {
+    std::lock_guard lock(mutex);
+    return used;
+}
+
+bool RecordingSocket::connected() const {
+    return socket.connected();
+}
+
+size_t RecordingSocket::bytes_available() const {
+    return socket.bytes_available();
+}
+
+size_t RecordingSocket::send(const char* buf, size_t size) {
+    size_t sent = socket.send(buf, size);
+    record(SENT, buf, sent);
+    return sent;
+}
+
+size_t RecordingSocket::send(const std::string& packet) {
+    size_t sent = socket.send(packet);
+    record(SENT, packet.data(), sent);
+    return sent;
+}
+
+size_t RecordingSocket::receive(char* buf, size_t size, uint64_t timeout) {
+    size_t received = socket.receive(buf, size, timeout);
+    record(RECEIVED, buf, received);
+    return received;
+}
+
+std::string RecordingSocket::receive(size_t size, uint64_t timeout) {
+    std::string data = socket.receive(size, timeout);
+    record(RECEIVED, data.data(), data.size());
+    return data;
+}
+
+size_t RecordingSocket::peek(char* buf, size_t size, uint64_t timeout) {
+    return socket.peek(buf, size, timeout);
+}
+
+std::string RecordingSocket::peek(size_t size, uint64_t timeout) {
+    return socket.peek(size, timeout);
+}
+
+/********************************************/
+/* ReplaySocket                             */
+/********************************************/
+ReplaySocket::ReplaySocket(const std::string& path, const ReplayOptions& options):
+        options(options), end(0), position(FILE_HEADER), offset(0), sent_bytes(0) {
+    if ( !(options.speed > 0) )
+        throw std::invalid_argument("Replay speed must be positive!");
+
+    file.open(path, sys::MappedFile::ReadOnly);
+    const char* data = file.data();
+
+    if ( file.size() < FILE_HEADER || std::memcmp(data, MAGIC, 4) != 0 || _get(data + 4, 4) != VERSION )
+        throw std::invalid_argument("Not a capture file: " + path);
+
+    end = _get(data + 8, 8);
+    if ( end < FILE_HEADER || end > file.size() )
+        throw std::invalid_argument("Corrupt capture file: " + path);
+
+    // Check the records once, so the replay itself can trust them
+    for ( uint64_t record = FILE_HEADER; record < end; ) {
+        if ( end - record < RECORD_HEADER )
+            throw std::invalid_argument("Corrupt capture file: " + path);
+
+        uint64_t length = _get(data + record + 8, 4);
+        if ( end - record - RECORD_HEADER < length || _get(data + record + 12, 1) > RECEIVED )
+            throw std::invalid_argument("Corrupt capture file: " + path);
+
+        record += RECORD_HEADER + length;
+    }
+
+    origin = std::chrono::steady_clock::now();
+}
+
+void ReplaySocket::rewind() {
+    std::lock_guard lock(mutex);
+    position   = FILE_HEADER;
+    offset     = 0;
+    sent_bytes = 0;
+    origin     = std::chrono::steady_clock::now();
+}
+
+uint64_t ReplaySocket::sent() const {
+    std::lock_guard lock(mutex);
+    return sent_bytes;
+}
+
+void ReplaySocket::skip_sent() noexcept {
+    const char* data = file.data();
+    while ( position < end && (uint8_t) data[position + 12] == SENT ) {
+        position += RECORD_HEADER + _get(data + position + 8, 4);
+        offset    = 0;
+    }
+}
+
+std::chrono::steady_clock::time_point ReplaySocket::release_time(uint64_t record) const noexcept {
+    std::chrono::duration<double, std::nano> time((double) _get(file.data() + record, 8) / options.speed);
+    return origin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(time);
+}
+
+bool ReplaySocket::due(uint64_t record) const noexcept {
+    return !options.paced || std::chrono::steady_clock::now() >= release_time(record);
+}
+
+size_t ReplaySocket::take(char* buf, size_t size, uint64_t timeout, bool peek) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::min<uint64_t>(timeout, INT_MAX));
+    std::unique_lock lock(mutex);
+
+    for ( ;; ) {
+        skip_sent();
+        if ( position >= end )
+            throw error::SocketDisconnection("End of capture!");
+        if ( due(position) )
+            break;
+
+        // Sleep without the lock, then look again - a rewind or another reader may have moved on meanwhile
+        auto release = release_time(position);
+        lock.unlock();
+        if ( release > deadline ) {
+            std::this_thread::sleep_until(deadline);
+            return 0;
+        }
+        std::this_thread::sleep_until(release);
+        lock.lock();
+    }
+
+    const char* data = file.data();
+    uint64_t record = position;
+    size_t   skip   = offset;
+    size_t   copied = 0;
+
+    // Join the records that are due, as a socket would return everything that arrived
+    while ( copied < size && record < end ) {
+        size_t length = (size_t) _get(data + record + 8, 4);
+
+        if ( (uint8_t) data[record + 12] == RECEIVED ) {
+            if ( !due(record) )
+                break;
+
+            size_t count = std::min(length - skip, size - copied);
+            std::memcpy(buf + copied, data + record + RECORD_HEADER + skip, count);
+            copied += count;
+            skip   += count;
+
+            if ( skip < length )
+                break;
+        }
+
+        record += RECORD_HEADER + length;
+        skip    = 0;
+    }
+
+    if ( !peek ) {
+        position = record;
+        offset   = skip;
+    }
+
+    return copied;
+}
+
+bool ReplaySocket::connected() const {
+    std::lock_guard lock(mutex);
+    const char* data = file.data();
+
+    for ( uint64_t record = position; record < end; record += RECORD_HEADER + _get(data + record + 8, 4) )
+        if ( (uint8_t) data[record + 12] == RECEIVED )
+            return true;
+
+    return false;
+}
+
+size_t ReplaySocket::bytes_available() const {
+    std::lock_guard lock(mutex);
+    const char* data = file.data();
+    size_t available = 0;
+    size_t skip      = offset;
+    bool   any       = false;
+
+    for ( uint64_t record = position; record < end; record += RECORD_HEADER + _get(data + record + 8, 4) ) {
+        if ( (uint8_t) data[record + 12] != RECEIVED )
+            continue;
+
+        any = true;
+        if ( !due(record) )
+            break;
+
+        available += (size_t) _get(data + record + 8, 4) - skip;
+        skip = 0;
+    }
+
+    if ( !any )
+        throw error::SocketDisconnection("End of capture!");
+
+    return available;
+}
+
+size_t ReplaySocket::send(const char* buf, size_t size) {
+    (void) buf;
+    std::lock_guard lock(mutex);
+    sent_bytes += size;
+    return size;
+}
+
+size_t ReplaySocket::send(const std::string& packet) {
+    return send(packet.data(), packet.size());
+}
+
+size_t ReplaySocket::receive(char* buf, size_t size, uint64_t timeout) {
+    return take(buf, size, timeout, false);
+}
+
+std::string ReplaySocket::receive(size_t size, uint64_t timeout) {
+    std::string data(size, '\0');
+    data.resize(take(&data[0], size, timeout, false));
+    return data;
+}
+
+size_t ReplaySocket::peek(char* buf, size_t size, uint64_t timeout) {
+    return take(buf, size, timeout, true);
+}
+
+std::string ReplaySocket::peek(size_t size, uint64_t timeout) {
+    std::string data(size, '\0');
+    data.resize(take(&data[0], size, timeout, true));
+    return data;
+}
+}
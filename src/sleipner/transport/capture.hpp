@@ -0,0 +1,217 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file capture.hpp
+ * @brief Recording of socket traffic to capture files, and replay of captures as a socket
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_CAPTURE_HPP_
+#define _SLEIPNER_TRANSPORT_CAPTURE_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "sleipner/transport/isocket.hpp"
+#include "sleipner/sys/mmap.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Records the traffic of a socket to a capture file
+ *
+ * Decorates another socket, forwarding every call to it, and appending the data sent
+ * and received to a memory-mapped capture file, stamped with the time since recording
+ * started. Appending is a copy into the mapping - no system call on the data path,
+ * except when the file has to grow, which doubles its size.
+ *
+ * Data peeked at is not recorded, as it is recorded when received.
+ *
+ * Capture file format, all integers little-endian:
+ *  - Header: "SLCP", version (4 bytes), bytes of the file in use (8 bytes)
+ *  - Records: nanoseconds since start (8 bytes), length (4 bytes), direction (1 byte,
+ *    0 sent, 1 received), padding (3 bytes), data - a send or receive of 4 GiB or more
+ *    is split over several records with the same time
+ *
+ * The header is updated after each record, so a capture is readable up to the last
+ * complete record even if the process dies.
+ *
+ * Basic usage example:
+ * @code
+ * TcpClient client;
+ * client.connect(resolve_ip("feed.example.com", 9000));
+ *
+ * RecordingSocket socket(client, "feed.cap");
+ * run_handler(socket);
+ * @endcode
+ */
+class RecordingSocket: public ISocket {
+public:
+    /**
+     * @brief Start recording the traffic of the socket
+     *
+     * @param [in] socket The socket to record, must outlive the recording
+     * @param [in] path The capture file to create, replaced if it exists
+     * @throws SystemApiError If the capture file can not be created
+     */
+    RecordingSocket(ISocket& socket, const std::string& path);
+
+    /**
+     * @brief Trims the capture file to the data recorded, and closes it
+     */
+    ~RecordingSocket();
+
+    RecordingSocket(const RecordingSocket&) = delete;
+    RecordingSocket& operator=(const RecordingSocket&) = delete;
+
+    /**
+     * @brief Start writing the recorded data to disk, without waiting for it to finish
+     *
+     * @throws SystemApiError
+     */
+    void flush();
+
+    /**
+     * @brief Retrieve the bytes of the capture file in use
+     */
+    uint64_t recorded() const;
+
+    // Deadline overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
+    /// @copydoc ISocket::connected()
+    bool connected() const override;
+
+    /// @copydoc ISocket::bytes_available()
+    size_t bytes_available() const override;
+
+    /// @copydoc ISocket::send(const char*, size_t)
+    size_t send(const char* buf, size_t size) override;
+
+    /// @copydoc ISocket::send(const std::string&)
+    size_t send(const std::string& packet) override;
+
+    /// @copydoc ISocket::receive(char*, size_t, uint64_t)
+    size_t receive(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::receive(size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(char*, size_t, uint64_t)
+    size_t peek(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) override;
+
+protected:
+    ISocket&                              socket;
+    sys::MappedFile                       file;
+    uint64_t                              used;
+    std::chrono::steady_clock::time_point origin;
+    mutable std::mutex                    mutex;
+
+    void record(uint8_t direction, const char* data, size_t size);
+};
+
+/**
+ * @brief Options for @b ReplaySocket
+ */
+struct ReplayOptions {
+    /// @brief Deliver the received data at the pace it was recorded, instead of as fast as possible
+    bool paced = false;
+
+    /// @brief Speed-up of a paced replay, e.g. 2 replays twice as fast as recorded
+    double speed = 1.0;
+};
+
+/**
+ * @brief Socket feeding the data received in a capture file back to its user
+ *
+ * Intended for benchmarking protocol handlers against real traffic, without a network.
+ * Data sent is discarded, and only counted. Data received is delivered as fast as
+ * possible, or at its recorded pace counted from opening the capture or @b rewind.
+ * Consecutive records are joined as the buffer allows, as a TCP socket would. Once the
+ * capture is exhausted, the socket behaves as if the peer had disconnected.
+ *
+ * Basic usage example:
+ * @code
+ * ReplaySocket socket("feed.cap");
+ *
+ * auto start = std::chrono::steady_clock::now();
+ * run_handler(socket); // Until SocketDisconnection
+ * auto elapsed = std::chrono::steady_clock::now() - start;
+ * @endcode
+ */
+class ReplaySocket: public ISocket {
+public:
+    /**
+     * @brief Open the capture file for replay
+     *
+     * @param [in] path The capture file, as written by @b RecordingSocket
+     * @param [in] options How to replay the capture
+     * @throws std::invalid_argument If the file is not a valid capture, or the options are invalid
+     * @throws SystemApiError If the capture file can not be opened
+     */
+    explicit ReplaySocket(const std::string& path, const ReplayOptions& options = ReplayOptions());
+
+    /**
+     * @brief Start the replay over from the beginning
+     */
+    void rewind();
+
+    /**
+     * @brief Retrieve the number of bytes sent to the socket since the replay started
+     */
+    uint64_t sent() const;
+
+    // Deadline overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
+    /// @copydoc ISocket::connected()
+    bool connected() const override;
+
+    /// @copydoc ISocket::bytes_available()
+    size_t bytes_available() const override;
+
+    /// @copydoc ISocket::send(const char*, size_t)
+    size_t send(const char* buf, size_t size) override;
+
+    /// @copydoc ISocket::send(const std::string&)
+    size_t send(const std::string& packet) override;
+
+    /// @copydoc ISocket::receive(char*, size_t, uint64_t)
+    size_t receive(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::receive(size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(char*, size_t, uint64_t)
+    size_t peek(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) override;
+
+protected:
+    const ReplayOptions                   options;
+    sys::MappedFile                       file;
+    uint64_t                              end;
+    // Next record, and bytes of it already received
+    uint64_t                              position;
+    size_t                                offset;
+    uint64_t                              sent_bytes;
+    std::chrono::steady_clock::time_point origin;
+    mutable std::mutex                    mutex;
+
+    void skip_sent() noexcept;
+    std::chrono::steady_clock::time_point release_time(uint64_t record) const noexcept;
+    bool due(uint64_t record) const noexcept;
+    size_t take(char* buf, size_t size, uint64_t timeout, bool peek);
+};
+}
+
+#endif
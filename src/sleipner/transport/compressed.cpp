@@ -0,0 +1,592 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/compressed.hpp"
+#include "sleipner/transport/error.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef SLEIPNER_HAS_LZ4
+    #include <lz4.h>
+    #include <lz4hc.h>
+#endif
+
+#ifdef SLEIPNER_HAS_ZSTD
+    #include <zstd.h>
+#endif
+
+namespace sleipner::transport {
+// Sent once, before the first block - 'S' 'L' 'C' and the codec
+static constexpr size_t   PREAMBLE_SIZE = 4;
+static const char         MAGIC[3]      = { 'S', 'L', 'C' };
+// Every block: compressed size, with STORED_BIT if sent uncompressed, then the decompressed size
+static constexpr size_t   HEADER_SIZE   = 8;
+static constexpr uint32_t STORED_BIT    = 0x80000000u;
+// Larger blocks are taken as a corrupt stream, rather than allocated for
+static constexpr size_t   MAX_BLOCK     = 64 << 20;
+// Bytes read from the wrapped socket at a time
+static constexpr size_t   READ_SIZE     = 64 << 10;
+#ifdef SLEIPNER_HAS_LZ4
+    // LZ4 matches reach back at most 64KiB, so that much history is kept on both ends
+    static constexpr size_t LZ4_HISTORY = 64 << 10;
+#endif
+
+static void _put_u32(char* p, uint32_t value) noexcept {
+    p[0] = (char) (value >> 24);
+    p[1] = (char) (value >> 16);
+    p[2] = (char) (value >> 8);
+    p[3] = (char) value;
+}
+
+static uint32_t _get_u32(const char* p) noexcept {
+    const uint8_t* u = reinterpret_cast<const uint8_t*>(p);
+    return ((uint32_t) u[0] << 24) | ((uint32_t) u[1] << 16) | ((uint32_t) u[2] << 8) | u[3];
+}
+
+/********************************************/
+/* Encoder                                  */
+/********************************************/
+struct CompressedSocket::Encoder {
+    CompressionOptions::Codec codec;
+
+    #ifdef SLEIPNER_HAS_LZ4
+        LZ4_stream_t*   lz4    = nullptr;
+        LZ4_streamHC_t* lz4_hc = nullptr;
+        int             acceleration = 1;
+        // The tail of the data compressed so far, matched against by the next block
+        std::string     history;
+    #endif
+    #ifdef SLEIPNER_HAS_ZSTD
+        ZSTD_CCtx*      zstd   = nullptr;
+    #endif
+
+    Encoder(const CompressionOptions& options);
+    ~Encoder();
+
+    // Append the compressed block to out - false if it did not shrink, and should be sent stored
+    bool compress(const char* data, size_t size, std::string& out);
+};
+
+CompressedSocket::Encoder::Encoder(const CompressionOptions& options): codec(options.codec) {
+    switch ( codec ) {
+        #ifdef SLEIPNER_HAS_LZ4
+        case CompressionOptions::Lz4: {
+            history.resize(LZ4_HISTORY);
+            size_t dict = std::min(options.dictionary.size(), LZ4_HISTORY);
+            std::memcpy(&history[0], options.dictionary.data() + options.dictionary.size() - dict, dict);
+
+            if ( options.level > 0 ) {
+                lz4_hc = LZ4_createStreamHC();
+                if ( !lz4_hc )
+                    throw std::bad_alloc();
+                LZ4_resetStreamHC_fast(lz4_hc, std::min(options.level, LZ4HC_CLEVEL_MAX));
+                LZ4_loadDictHC(lz4_hc, history.data(), (int) dict);
+            } else {
+                lz4 = LZ4_createStream();
+                if ( !lz4 )
+                    throw std::bad_alloc();
+                acceleration = std::max(1, -options.level);
+                LZ4_loadDict(lz4, history.data(), (int) dict);
+            }
+            break;
+        }
+        #endif
+        #ifdef SLEIPNER_HAS_ZSTD
+        case CompressionOptions::Zstd: {
+            zstd = ZSTD_createCCtx();
+            if ( !zstd )
+                throw std::bad_alloc();
+
+            size_t res = ZSTD_CCtx_setParameter(zstd, ZSTD_c_compressionLevel,
+                                                options.level ? options.level : ZSTD_CLEVEL_DEFAULT);
+            if ( !ZSTD_isError(res) && !options.dictionary.empty() )
+                res = ZSTD_CCtx_loadDictionary(zstd, options.dictionary.data(), options.dictionary.size());
+            if ( ZSTD_isError(res) ) {
+                ZSTD_freeCCtx(zstd);
+                throw std::invalid_argument(std::string("Zstandard: ") + ZSTD_getErrorName(res));
+            }
+            break;
+        }
+        #endif
+        default:
+            throw std::invalid_argument("Compression codec not available in this build!");
+    }
+}
+
+CompressedSocket::Encoder::~Encoder() {
+    #ifdef SLEIPNER_HAS_LZ4
+        if ( lz4 )
+            LZ4_freeStream(lz4);
+        if ( lz4_hc )
+            LZ4_freeStreamHC(lz4_hc);
+    #endif
+    #ifdef SLEIPNER_HAS_ZSTD
+        if ( zstd )
+            ZSTD_freeCCtx(zstd);
+    #endif
+}
+
+bool CompressedSocket::Encoder::compress(const char* data, size_t size, std::string& out) {
+    size_t offset = out.size();
+
+    #ifdef SLEIPNER_HAS_LZ4
+        if ( codec == CompressionOptions::Lz4 ) {
+            int bound = LZ4_compressBound((int) size);
+            out.resize(offset + bound);
+
+            int written;
+            if ( lz4_hc ) {
+                written = LZ4_compress_HC_continue(lz4_hc, data, &out[offset], (int) size, bound);
+                LZ4_saveDictHC(lz4_hc, &history[0], (int) LZ4_HISTORY);
+            } else {
+                written = LZ4_compress_fast_continue(lz4, data, &out[offset], (int) size, bound, acceleration);
+                LZ4_saveDict(lz4, &history[0], (int) LZ4_HISTORY);
+            }
+
+            // The block is in the history either way, and the peer adds it to its own when stored
+            if ( written <= 0 || (size_t) written >= size ) {
+                out.resize(offset);
+                return false;
+            }
+            out.resize(offset + written);
+            return true;
+        }
+    #endif
+
+    #ifdef SLEIPNER_HAS_ZSTD
+        // One frame for the whole stream, flushed at the end of each block, so history carries over
+        ZSTD_inBuffer input = { data, size, 0 };
+        for ( ;; ) {
+            size_t capacity = ZSTD_compressBound(size) + 64;
+            out.resize(offset + capacity);
+
+            ZSTD_outBuffer output = { &out[offset], capacity, 0 };
+            size_t left = ZSTD_compressStream2(zstd, &output, &input, ZSTD_e_flush);
+            if ( ZSTD_isError(left) )
+                throw std::runtime_error(std::string("Zstandard: ") + ZSTD_getErrorName(left));
+
+            offset += output.pos;
+            out.resize(offset);
+            if ( left == 0 )
+                return true;
+        }
+    #else
+        (void) data;
+        (void) size;
+        (void) offset;
+        return false;
+    #endif
+}
+
+void CompressedSocket::EncoderCleanup::operator()(Encoder* ptr) const {
+    delete ptr;
+}
+
+/********************************************/
+/* Decoder                                  */
+/********************************************/
+struct CompressedSocket::Decoder {
+    CompressionOptions::Codec codec;
+
+    // Received and not yet decoded - start..used
+    std::string input;
+    size_t      start = 0;
+    size_t      used  = 0;
+    bool        preamble = false;
+
+    // The decompressed block being received
+    const char* output      = nullptr;
+    size_t      output_size = 0;
+
+    #ifdef SLEIPNER_HAS_LZ4
+        // Blocks are decoded in sequence into the window, after the history they refer to
+        LZ4_streamDecode_t lz4;
+        std::string        window;
+        size_t             window_used = 0;
+    #endif
+    #ifdef SLEIPNER_HAS_ZSTD
+        ZSTD_DCtx*         zstd = nullptr;
+        std::string        plain;
+    #endif
+
+    Decoder(const CompressionOptions& options);
+    ~Decoder();
+
+    // Read more of the stream, waiting up to the timeout - false if nothing arrived
+    bool fill(ISocket& socket, uint64_t timeout, CompressionStats& counters);
+    // Decode the next complete block into output - false if it has not all arrived
+    bool next_block(CompressionStats& counters);
+    void decompress(const char* src, size_t size, size_t raw, bool stored);
+};
+
+CompressedSocket::Decoder::Decoder(const CompressionOptions& options): codec(options.codec), input(READ_SIZE, '\0') {
+    switch ( codec ) {
+        #ifdef SLEIPNER_HAS_LZ4
+        case CompressionOptions::Lz4: {
+            size_t dict = std::min(options.dictionary.size(), LZ4_HISTORY);
+            window.assign(options.dictionary.data() + options.dictionary.size() - dict, dict);
+            window_used = dict;
+            break;
+        }
+        #endif
+        #ifdef SLEIPNER_HAS_ZSTD
+        case CompressionOptions::Zstd: {
+            zstd = ZSTD_createDCtx();
+            if ( !zstd )
+                throw std::bad_alloc();
+
+            if ( !options.dictionary.empty() ) {
+                size_t res = ZSTD_DCtx_loadDictionary(zstd, options.dictionary.data(), options.dictionary.size());
+                if ( ZSTD_isError(res) ) {
+                    ZSTD_freeDCtx(zstd);
+                    throw std::invalid_argument(std::string("Zstandard: ") + ZSTD_getErrorName(res));
+                }
+            }
+            break;
+        }
+        #endif
+        default:
+            throw std::invalid_argument("Compression codec not available in this build!");
+    }
+}
+
+CompressedSocket::Decoder::~Decoder() {
+    #ifdef SLEIPNER_HAS_ZSTD
+        if ( zstd )
+            ZSTD_freeDCtx(zstd);
+    #endif
+}
+
+bool CompressedSocket::Decoder::fill(ISocket& socket, uint64_t timeout, CompressionStats& counters) {
+    if ( start > 0 ) {
+        std::memmove(&input[0], &input[start], used - start);
+        used -= start;
+        start = 0;
+    }
+
+    // Room for the whole of a large block, so it arrives in as few receives as possible
+    size_t wanted = READ_SIZE;
+    if ( preamble && used >= HEADER_SIZE )
+        wanted = std::max(wanted, HEADER_SIZE + (_get_u32(input.data()) & ~STORED_BIT) - used);
+    if ( input.size() < used + wanted )
+        input.resize(used + wanted);
+
+    size_t received = socket.receive(&input[used], wanted, timeout);
+    used += received;
+    counters.wire_received += received;
+    return received > 0;
+}
+
+bool CompressedSocket::Decoder::next_block(CompressionStats& counters) {
+    if ( !preamble ) {
+        if ( used - start < PREAMBLE_SIZE )
+            return false;
+        if ( std::memcmp(&input[start], MAGIC, sizeof(MAGIC)) != 0 )
+            throw error::ProtocolError("Not a compressed stream!");
+        if ( (uint8_t) input[start + 3] != codec )
+            throw error::ProtocolError("Compressed stream uses another codec!");
+        preamble = true;
+        start += PREAMBLE_SIZE;
+    }
+
+    if ( used - start < HEADER_SIZE )
+        return false;
+
+    uint32_t length = _get_u32(&input[start]);
+    uint32_t raw    = _get_u32(&input[start + 4]);
+    bool     stored = length & STORED_BIT;
+    length &= ~STORED_BIT;
+
+    if ( raw == 0 || raw > MAX_BLOCK || length > MAX_BLOCK || (stored && length != raw) )
+        throw error::ProtocolError("Malformed compressed block!");
+    if ( used - start < HEADER_SIZE + length )
+        return false;
+
+    decompress(&input[start + HEADER_SIZE], length, raw, stored);
+    start += HEADER_SIZE + length;
+    counters.raw_received += raw;
+    return true;
+}
+
+void CompressedSocket::Decoder::decompress(const char* src, size_t size, size_t raw, bool stored) {
+    #ifdef SLEIPNER_HAS_LZ4
+        if ( codec == CompressionOptions::Lz4 ) {
+            // Out of room - slide the history to the front, then make room for the block after it
+            if ( window_used + raw > window.size() ) {
+                size_t keep = std::min(window_used, LZ4_HISTORY);
+                std::memmove(&window[0], &window[window_used - keep], keep);
+                window_used = keep;
+                if ( window.size() < keep + raw )
+                    window.resize(std::max(keep + raw, 2 * LZ4_HISTORY));
+            }
+
+            char*  dst  = &window[window_used];
+            size_t dict = std::min(window_used, LZ4_HISTORY);
+            if ( stored ) {
+                std::memcpy(dst, src, raw);
+            } else {
+                LZ4_setStreamDecode(&lz4, dst - dict, (int) dict);
+                int res = LZ4_decompress_safe_continue(&lz4, src, dst, (int) size, (int) raw);
+                if ( res < 0 || (size_t) res != raw )
+                    throw error::ProtocolError("Corrupt LZ4 block!");
+            }
+
+            window_used += raw;
+            output      = dst;
+            output_size = raw;
+            return;
+        }
+    #endif
+
+    #ifdef SLEIPNER_HAS_ZSTD
+        if ( stored )
+            throw error::ProtocolError("Stored block in a Zstandard stream!");
+
+        plain.resize(raw);
+        ZSTD_inBuffer  in  = { src, size, 0 };
+        ZSTD_outBuffer out = { &plain[0], raw, 0 };
+        while ( in.pos < in.size ) {
+            size_t before = in.pos + out.pos;
+            size_t res = ZSTD_decompressStream(zstd, &out, &in);
+            if ( ZSTD_isError(res) )
+                throw error::ProtocolError(std::string("Corrupt Zstandard block: ") + ZSTD_getErrorName(res));
+            if ( in.pos + out.pos == before )
+                break;
+        }
+        if ( in.pos != in.size || out.pos != raw )
+            throw error::ProtocolError("Corrupt Zstandard block!");
+
+        output      = plain.data();
+        output_size = raw;
+    #else
+        (void) src;
+        (void) size;
+        (void) raw;
+        (void) stored;
+    #endif
+}
+
+void CompressedSocket::DecoderCleanup::operator()(Decoder* ptr) const {
+    delete ptr;
+}
+
+/********************************************/
+/* CompressedSocket                         */
+/********************************************/
+CompressedSocket::CompressedSocket(ISocket& socket, const CompressionOptions& options):
+    socket(socket),
+    options(options) {
+    if ( options.block_size == 0 || options.block_size > MAX_BLOCK )
+        throw std::invalid_argument("Compression block size must be between 1 byte and 64MiB!");
+
+    encoder.reset(new Encoder(options));
+    decoder.reset(new Decoder(options));
+    block.reserve(options.block_size);
+
+    if ( options.flush_interval > 0 )
+        flusher = std::thread(&CompressedSocket::flush_loop, this);
+}
+
+CompressedSocket::~CompressedSocket() {
+    if ( flusher.joinable() ) {
+        {
+            std::lock_guard<std::mutex> lock(send_mutex);
+            stopping = true;
+        }
+        send_wake.notify_all();
+        flusher.join();
+    }
+
+    try {
+        flush();
+    } catch ( ... ) {}
+}
+
+bool CompressedSocket::supports(CompressionOptions::Codec codec) noexcept {
+    switch ( codec ) {
+        #ifdef SLEIPNER_HAS_LZ4
+        case CompressionOptions::Lz4:
+            return true;
+        #endif
+        #ifdef SLEIPNER_HAS_ZSTD
+        case CompressionOptions::Zstd:
+            return true;
+        #endif
+        default:
+            return false;
+    }
+}
+
+void CompressedSocket::flush() {
+    std::lock_guard<std::mutex> lock(send_mutex);
+    flush_locked();
+}
+
+void CompressedSocket::flush_locked() {
+    if ( failure )
+        std::rethrow_exception(failure);
+    if ( block.empty() )
+        return;
+
+    frame.clear();
+    if ( !started ) {
+        frame.append(MAGIC, sizeof(MAGIC));
+        frame.push_back((char) options.codec);
+    }
+
+    size_t header = frame.size();
+    frame.resize(header + HEADER_SIZE);
+
+    uint32_t length;
+    if ( encoder->compress(block.data(), block.size(), frame) ) {
+        length = (uint32_t) (frame.size() - header - HEADER_SIZE);
+    } else {
+        frame.append(block);
+        length = (uint32_t) block.size() | STORED_BIT;
+    }
+    _put_u32(&frame[header], length);
+    _put_u32(&frame[header + 4], (uint32_t) block.size());
+    block.clear();
+
+    // The block is in the encoder's history now - if it does not all go out, the stream is broken
+    try {
+        for ( size_t sent = 0; sent < frame.size(); )
+            sent += socket.send(frame.data() + sent, frame.size() - sent);
+    } catch ( ... ) {
+        failure = std::current_exception();
+        throw;
+    }
+
+    started = true;
+    counters.wire_sent += frame.size();
+}
+
+void CompressedSocket::flush_loop() {
+    std::unique_lock<std::mutex> lock(send_mutex);
+
+    while ( !stopping ) {
+        if ( block.empty() || failure ) {
+            send_wake.wait(lock);
+            continue;
+        }
+
+        clock::time_point due = block_start + std::chrono::milliseconds(options.flush_interval);
+        if ( clock::now() < due ) {
+            send_wake.wait_until(lock, due);
+            continue;
+        }
+
+        // A failure is kept, and reported by the next send
+        try {
+            flush_locked();
+        } catch ( ... ) {}
+    }
+}
+
+CompressionStats CompressedSocket::stats() const {
+    std::scoped_lock lock(send_mutex, receive_mutex);
+    return counters;
+}
+
+bool CompressedSocket::connected() const {
+    return socket.connected();
+}
+
+size_t CompressedSocket::bytes_available() const {
+    std::lock_guard<std::mutex> lock(receive_mutex);
+    Decoder& d = *decoder;
+
+    // Decode a block if one has arrived - the caller can then receive all of it without blocking
+    if ( d.output_size == 0 && !d.next_block(counters) ) {
+        if ( socket.bytes_available() > 0 && d.fill(socket, 0, counters) )
+            d.next_block(counters);
+    }
+    return d.output_size;
+}
+
+size_t CompressedSocket::send(const char* buf, size_t size) {
+    std::unique_lock<std::mutex> lock(send_mutex);
+    if ( failure )
+        std::rethrow_exception(failure);
+
+    counters.raw_sent += size;
+    bool wake = false;
+
+    for ( size_t taken = 0; taken < size; ) {
+        if ( block.empty() ) {
+            block_start = clock::now();
+            wake = true;
+        }
+
+        size_t n = std::min(size - taken, options.block_size - block.size());
+        block.append(buf + taken, n);
+        taken += n;
+
+        if ( block.size() >= options.block_size ) {
+            flush_locked();
+            wake = false;
+        }
+    }
+
+    if ( options.flush_interval == 0 ) {
+        flush_locked();
+    } else if ( wake && !block.empty() ) {
+        lock.unlock();
+        send_wake.notify_one();
+    }
+    return size;
+}
+
+size_t CompressedSocket::send(const std::string& packet) {
+    return send(packet.data(), packet.size());
+}
+
+size_t CompressedSocket::take(char* buf, size_t size, uint64_t timeout, bool peek) {
+    // The peer may be waiting for what was sent before it replies
+    flush();
+
+    std::lock_guard<std::mutex> lock(receive_mutex);
+    Decoder& d = *decoder;
+    if ( size == 0 )
+        return 0;
+
+    Deadline deadline = Deadline::clock::now() + std::chrono::milliseconds(std::min<uint64_t>(timeout, INT_MAX));
+    while ( d.output_size == 0 && !d.next_block(counters) ) {
+        if ( !d.fill(socket, timeout == UINT64_MAX ? UINT64_MAX : timeout_until(deadline), counters) )
+            return 0;
+    }
+
+    size_t n = std::min(size, d.output_size);
+    std::memcpy(buf, d.output, n);
+    if ( !peek ) {
+        d.output      += n;
+        d.output_size -= n;
+    }
+    return n;
+}
+
+size_t CompressedSocket::receive(char* buf, size_t size, uint64_t timeout) {
+    return take(buf, size, timeout, false);
+}
+
+std::string CompressedSocket::receive(size_t size, uint64_t timeout) {
+    std::string buffer(size, '\0');
+    buffer.resize(receive(&buffer[0], size, timeout));
+    return buffer;
+}
+
+size_t CompressedSocket::peek(char* buf, size_t size, uint64_t timeout) {
+    return take(buf, size, timeout, true);
+}
+
+std::string CompressedSocket::peek(size_t size, uint64_t timeout) {
+    std::string buffer(size, '\0');
+    buffer.resize(peek(&buffer[0], size, timeout));
+    return buffer;
+}
+}
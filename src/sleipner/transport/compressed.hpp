@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file compressed.hpp
+ * @brief Socket decorator compressing the data sent, and decompressing the data received
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_COMPRESSED_HPP_
+#define _SLEIPNER_TRANSPORT_COMPRESSED_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <cstdint>
+
+#include "sleipner/transport/isocket.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Options for @b CompressedSocket - both ends must use the same codec and dictionary
+ */
+struct CompressionOptions {
+    enum Codec : uint8_t {
+        /// @brief LZ4 - fast, for links of hundreds of Mbit/s and up
+        Lz4  = 1,
+        /// @brief Zstandard - smaller output, for slower links
+        Zstd = 2
+    };
+
+    /// @brief The codec to compress with
+    Codec codec = Lz4;
+
+    /**
+     * @brief Compression level, 0 for the codec's default
+     *
+     * For LZ4, levels above 0 use LZ4 HC, and levels below 0 trade ratio for speed. For
+     * Zstandard, 1 to 22, or negative for its fast levels.
+     */
+    int level = 0;
+
+    /// @brief Data typical of the stream, e.g. a sample of messages, to compress the first blocks well
+    std::string dictionary;
+
+    /// @brief Bytes of sent data to compress as one block - a full block is sent at once
+    size_t block_size = 64 << 10;
+
+    /**
+     * @brief Milliseconds a partial block may wait for more data before it is sent anyway, 0 to
+     *        send every call to @b send as its own block
+     */
+    uint32_t flush_interval = 5;
+};
+
+/**
+ * @brief Bytes through a @b CompressedSocket, before and after compression
+ */
+struct CompressionStats {
+    /// @brief Bytes given to @b send
+    uint64_t raw_sent = 0;
+
+    /// @brief Bytes sent on the wrapped socket, including the block headers
+    uint64_t wire_sent = 0;
+
+    /// @brief Bytes decompressed from the received blocks
+    uint64_t raw_received = 0;
+
+    /// @brief Bytes received on the wrapped socket
+    uint64_t wire_received = 0;
+};
+
+/**
+ * @brief Compresses the data sent on a socket in blocks, and decompresses the data received
+ *
+ * Wraps a connected socket, and compresses the data given to @b send into blocks. A block is
+ * sent once it is full, once the oldest byte in it has waited @b flush_interval, on @b flush,
+ * and before a receive waits for data - so request/response exchanges are not held up. The
+ * codec keeps its history across blocks, so small messages repeating earlier ones, e.g.
+ * telemetry records, compress well even in small blocks.
+ *
+ * @b receive, @b peek and @b bytes_available see the decompressed stream, as if it had been
+ * sent uncompressed.
+ *
+ * Basic usage example:
+ * @code
+ * TcpClient socket;
+ * socket.connect(resolve_ip("collector.example.com", 9000));
+ *
+ * CompressionOptions options;
+ * options.codec = CompressionOptions::Zstd;
+ *
+ * CompressedSocket link(socket, options);
+ * for ( const Record& record: records )
+ *     link.send(record.serialize());
+ * link.flush();
+ * @endcode
+ *
+ * @note Send and receive are thread-safe with respect to each other. Partial blocks are sent
+ *       from a background thread, so the wrapped socket's @b send must be safe to call while
+ *       another thread receives on it, as it is for @b TcpClient.
+ */
+class CompressedSocket: public ISocket {
+public:
+    /**
+     * @param [in] socket A connected socket, must outlive the decorator
+     * @param [in] options Codec, level, dictionary and block boundaries
+     * @throws std::invalid_argument If the codec is not available in this build, or the options are not valid
+     */
+    explicit CompressedSocket(ISocket& socket, const CompressionOptions& options = CompressionOptions());
+
+    /**
+     * @brief Sends the partial block, ignoring failures
+     */
+    ~CompressedSocket();
+
+    CompressedSocket(const CompressedSocket&) = delete;
+    CompressedSocket& operator=(const CompressedSocket&) = delete;
+
+    /**
+     * @brief Check if the codec was available when the library was built
+     */
+    static bool supports(CompressionOptions::Codec codec) noexcept;
+
+    /**
+     * @brief Compress and send the partial block now
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    void flush();
+
+    /**
+     * @brief Retrieve the bytes sent and received, before and after compression
+     */
+    CompressionStats stats() const;
+
+    // Deadline and memory resource overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
+    /// @copydoc ISocket::connected()
+    bool connected() const override;
+
+    /**
+     * @brief Retrieve the decompressed bytes that can be received without blocking
+     *
+     * @throws ProtocolError If the peer sent data that is not a valid compressed stream
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    size_t bytes_available() const override;
+
+    /**
+     * @brief Add the data to the current block, sending the block if full
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return size_t Number of bytes taken, always all of them
+     */
+    size_t send(const char* buf, size_t size) override;
+
+    /// @copydoc send(const char*, size_t)
+    size_t send(const std::string& packet) override;
+
+    /**
+     * @brief Receive decompressed data, sending the partial block first
+     *
+     * @throws ProtocolError If the peer sent data that is not a valid compressed stream
+     * @see ISocket::receive(char*, size_t, uint64_t)
+     */
+    size_t receive(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc receive(char*, size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) override;
+
+    /**
+     * @brief Peek at decompressed data, sending the partial block first
+     *
+     * @throws ProtocolError If the peer sent data that is not a valid compressed stream
+     * @see ISocket::peek(char*, size_t, uint64_t)
+     */
+    size_t peek(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc peek(char*, size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) override;
+
+protected:
+    struct Encoder;
+    struct Decoder;
+    struct EncoderCleanup { void operator()(Encoder* ptr) const; };
+    struct DecoderCleanup { void operator()(Decoder* ptr) const; };
+
+    typedef std::chrono::steady_clock clock;
+
+    ISocket&                 socket;
+    const CompressionOptions options;
+
+    // Sending side: the partial block, and when its first byte was added. A failed block send
+    // leaves the stream broken, and is reported by every send after it
+    mutable std::mutex       send_mutex;
+    std::condition_variable  send_wake;
+    std::unique_ptr<Encoder, EncoderCleanup> encoder;
+    std::string              block;
+    std::string              frame;
+    clock::time_point        block_start;
+    std::exception_ptr       failure;
+    bool                     started  = false;
+    bool                     stopping = false;
+    std::thread              flusher;
+
+    // Receiving side: the received blocks, and the decompressed data not yet received
+    mutable std::mutex       receive_mutex;
+    std::unique_ptr<Decoder, DecoderCleanup> decoder;
+
+    // Sent counters under the send lock, received under the receive lock
+    mutable CompressionStats counters;
+
+    void flush_locked();
+    void flush_loop();
+    size_t take(char* buf, size_t size, uint64_t timeout, bool peek);
+};
+}
+
+#endif
@@ -11,4 +11,8 @@ SetupError::SetupError(const std::string& msg): std::logic_error(msg) {}
 SocketDisconnection::SocketDisconnection(const std::string& msg): std::runtime_error(msg) {}
 
 ConnectionFailure::ConnectionFailure(const std::string& msg): std::runtime_error(msg) {}
+
+ProtocolError::ProtocolError(const std::string& msg): std::runtime_error(msg) {}
+
+RequestTimeout::RequestTimeout(const std::string& msg): std::runtime_error(msg) {}
 }
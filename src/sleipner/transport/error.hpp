@@ -38,6 +38,22 @@ class ConnectionFailure: public std::runtime_error {
     public:
         explicit ConnectionFailure(const std::string& msg);
 };
+
+/**
+ * @brief The peer sent data that does not follow the protocol spoken on the connection.
+ */
+class ProtocolError: public std::runtime_error {
+    public:
+        explicit ProtocolError(const std::string& msg);
+};
+
+/**
+ * @brief No reply to a request arrived within its timeout.
+ */
+class RequestTimeout: public std::runtime_error {
+    public:
+        explicit RequestTimeout(const std::string& msg);
+};
 }
 
 #endif
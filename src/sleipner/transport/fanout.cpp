@@ -0,0 +1,207 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/fanout.hpp"
+#include "sleipner/sys/error.hpp"
+#include "sleipner/sys/native.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace sleipner::transport {
+// Payloads written by one call - enough to fill a socket buffer with small messages
+static constexpr size_t MAX_BUFFERS = 64;
+
+/********************************************/
+/* FanOutPublisher                          */
+/********************************************/
+FanOutPublisher::FanOutPublisher(runtime::Reactor& reactor, const FanOutOptions& options):
+        reactor(reactor), options(options), inbox(std::make_shared<Inbox>()) {
+    if ( options.max_backlog == 0 )
+        throw std::invalid_argument("Backlog can't be 0!");
+    inbox->owner = this;
+}
+
+FanOutPublisher::~FanOutPublisher() {
+    {
+        std::lock_guard lock(inbox->mutex);
+        inbox->owner = nullptr;
+    }
+
+    for ( auto& subscriber: subscriber_list )
+        detach(*subscriber);
+}
+
+void FanOutPublisher::subscribe(TcpClient& client) {
+    sys::native_socket_t socket = client.native_handle();
+
+    for ( auto& subscriber: subscriber_list )
+        if ( subscriber->client == &client )
+            throw std::invalid_argument("Client already subscribed!");
+
+    bool was_blocking = !sys::is_non_blocking((sys::socket_t) socket);
+    if ( was_blocking && !sys::set_non_blocking((sys::socket_t) socket, true) )
+        throw error::SystemApiError(sys::last_socket_error());
+
+    std::unique_ptr<Subscriber> subscriber(new Subscriber());
+    subscriber->client       = &client;
+    subscriber->socket       = socket;
+    subscriber->was_blocking = was_blocking;
+    subscriber_list.push_back(std::move(subscriber));
+}
+
+void FanOutPublisher::unsubscribe(TcpClient& client) noexcept {
+    auto it = std::find_if(subscriber_list.begin(), subscriber_list.end(), [&](auto& s) { return s->client == &client; });
+    if ( it == subscriber_list.end() )
+        return;
+
+    detach(**it);
+    subscriber_list.erase(it);
+}
+
+void FanOutPublisher::publish(Payload payload) {
+    std::shared_ptr<Inbox> shared = inbox;
+    bool first;
+    {
+        std::lock_guard lock(shared->mutex);
+        first = shared->payloads.empty();
+        shared->payloads.push_back(std::move(payload));
+    }
+
+    // One task delivers everything published until it runs, so a burst costs one wake-up
+    if ( first ) {
+        reactor.post([shared] {
+            FanOutPublisher* owner;
+            {
+                std::lock_guard lock(shared->mutex);
+                owner = shared->owner;
+            }
+            // The publisher is only destroyed on the loop thread, so it can not go away from here on
+            if ( owner )
+                owner->deliver();
+        });
+    }
+}
+
+void FanOutPublisher::on_drop(DropHandler handler) {
+    drop_handler = std::move(handler);
+}
+
+size_t FanOutPublisher::subscribers() const noexcept {
+    return subscriber_list.size();
+}
+
+uint64_t FanOutPublisher::dropped() const noexcept {
+    return dropped_count;
+}
+
+void FanOutPublisher::deliver() {
+    {
+        std::lock_guard lock(inbox->mutex);
+        pending.swap(inbox->payloads);
+    }
+
+    std::vector<Subscriber*> failed;
+
+    for ( auto& subscriber: subscriber_list ) {
+        bool overflow = false;
+
+        for ( auto& payload: pending ) {
+            if ( subscriber->queue.size() < options.max_backlog ) {
+                subscriber->queue.push_back(payload);
+            } else if ( options.policy == SlowConsumerPolicy::Drop ) {
+                dropped_count++;
+            } else {
+                overflow = true;
+                break;
+            }
+        }
+
+        // A subscriber waiting for writability is flushed by its handler
+        if ( overflow || (!subscriber->watching && !flush(*subscriber)) )
+            failed.push_back(subscriber.get());
+    }
+
+    // Keep the capacity for the next delivery
+    pending.clear();
+
+    for ( Subscriber* subscriber: failed )
+        drop(subscriber);
+}
+
+bool FanOutPublisher::flush(Subscriber& subscriber) {
+    sys::socket_t socket = (sys::socket_t) subscriber.socket;
+    sys::iobuf_t buffers[MAX_BUFFERS];
+
+    while ( !subscriber.queue.empty() ) {
+        size_t count = std::min(subscriber.queue.size(), MAX_BUFFERS);
+        for ( size_t i = 0; i < count; i++ ) {
+            const std::string& data = *subscriber.queue[i];
+            size_t skip = i == 0 ? subscriber.offset : 0;
+            sys::set_iobuf(buffers[i], data.data() + skip, data.size() - skip);
+        }
+
+        int64_t sent = sys::send_buffers(socket, buffers, count);
+        if ( sent < 0 && !sys::would_block(sys::last_socket_error()) )
+            return false;
+
+        // Release the payloads sent in full, and empty payloads along the way
+        size_t left = sent < 0 ? 0 : (size_t) sent;
+        while ( !subscriber.queue.empty() ) {
+            size_t remaining = subscriber.queue.front()->size() - subscriber.offset;
+            if ( left < remaining ) {
+                subscriber.offset += left;
+                break;
+            }
+
+            left -= remaining;
+            subscriber.queue.pop_front();
+            subscriber.offset = 0;
+        }
+
+        // Socket buffer full - carry on once the subscriber has caught up
+        if ( sent <= 0 && !subscriber.queue.empty() ) {
+            if ( !subscriber.watching ) {
+                Subscriber* waiting = &subscriber;
+                reactor.add(subscriber.socket, runtime::Reactor::Writable, [this, waiting](int events) {
+                    if ( (events & runtime::Reactor::Error) || !flush(*waiting) )
+                        drop(waiting);
+                });
+                subscriber.watching = true;
+            }
+            return true;
+        }
+    }
+
+    if ( subscriber.watching ) {
+        reactor.remove(subscriber.socket);
+        subscriber.watching = false;
+    }
+    return true;
+}
+
+void FanOutPublisher::drop(Subscriber* subscriber) {
+    auto it = std::find_if(subscriber_list.begin(), subscriber_list.end(), [&](auto& s) { return s.get() == subscriber; });
+    if ( it == subscriber_list.end() )
+        return;
+
+    TcpClient& client = *subscriber->client;
+    detach(*subscriber);
+    subscriber_list.erase(it);
+
+    if ( drop_handler )
+        drop_handler(client);
+}
+
+void FanOutPublisher::detach(Subscriber& subscriber) noexcept {
+    if ( subscriber.watching )
+        reactor.remove(subscriber.socket);
+    subscriber.watching = false;
+    subscriber.queue.clear();
+
+    if ( subscriber.was_blocking )
+        sys::set_non_blocking((sys::socket_t) subscriber.socket, false);
+}
+}
@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file fanout.hpp
+ * @brief Publishing of one payload to many TCP subscribers through an event loop
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_FANOUT_HPP_
+#define _SLEIPNER_TRANSPORT_FANOUT_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/sys/socket.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Immutable, reference-counted message, shared by the queues of all subscribers
+ */
+typedef std::shared_ptr<const std::string> Payload;
+
+/**
+ * @brief Wrap the data in a payload, without copying it
+ */
+inline Payload make_payload(std::string data) {
+    return std::make_shared<const std::string>(std::move(data));
+}
+
+/**
+ * @brief What to do with a subscriber whose backlog is full
+ */
+enum class SlowConsumerPolicy {
+    /// @brief Skip the new message for the subscriber, keeping the connection
+    Drop,
+    /// @brief Unsubscribe the subscriber, and report it to the drop handler
+    Disconnect
+};
+
+/**
+ * @brief Options for @b FanOutPublisher
+ */
+struct FanOutOptions {
+    /// @brief Maximum number of messages queued for one subscriber
+    size_t max_backlog = 1024;
+
+    /// @brief What to do when a message does not fit in the backlog of a subscriber
+    SlowConsumerPolicy policy = SlowConsumerPolicy::Drop;
+};
+
+/**
+ * @brief Sends every published payload to all subscribers, without blocking on any of them
+ *
+ * Each subscriber has its own queue of references to the payloads, flushed with vectored,
+ * non-blocking writes. A subscriber that can not keep up only fills its own queue - it is
+ * watched for writability by the reactor, while the others carry on. Once its backlog is
+ * full, the @b SlowConsumerPolicy decides what happens to it. The payload is never copied
+ * in user space, only by the kernel into each socket.
+ *
+ * The subscribed sockets are switched to non-blocking mode, and written to directly - the
+ * subscribers should not be sent to by other means while subscribed.
+ *
+ * Basic usage example:
+ * @code
+ * Reactor reactor;
+ * FanOutPublisher publisher(reactor);
+ * publisher.on_drop([](TcpClient& client) { client.close(); });
+ *
+ * for ( auto& client: clients )
+ *     publisher.subscribe(client);
+ * std::thread loop([&] { reactor.run(); });
+ *
+ * // From any thread
+ * publisher.publish(make_payload(encode(tick)));
+ * @endcode
+ *
+ * @note @b subscribe and @b unsubscribe may only be used from the loop thread, or while the
+ *       loop is not running, as may the destructor. @b publish is safe from any thread.
+ */
+class FanOutPublisher {
+public:
+    /// @brief Called on the loop thread, after a subscriber was unsubscribed for being too slow or failing
+    typedef std::function<void(TcpClient&)> DropHandler;
+
+    /**
+     * @param [in] reactor The event loop to flush the subscribers from
+     * @param [in] options Backlog limits
+     * @throws std::invalid_argument If the backlog is 0
+     */
+    explicit FanOutPublisher(runtime::Reactor& reactor, const FanOutOptions& options = FanOutOptions());
+
+    /**
+     * @brief Unsubscribes all subscribers, dropping the messages they have not been sent
+     */
+    ~FanOutPublisher();
+
+    FanOutPublisher(const FanOutPublisher&) = delete;
+    FanOutPublisher& operator=(const FanOutPublisher&) = delete;
+
+    /**
+     * @brief Start sending the payloads published from now on to the client
+     *
+     * The publisher watches the socket of the client in the reactor while it can not be
+     * written to, so the client must not be watched by the reactor otherwise.
+     *
+     * @param [in] client A connected client, must stay connected until unsubscribed
+     * @throws SetupError If the client is not connected
+     * @throws std::invalid_argument If the client is already subscribed
+     * @throws SystemApiError
+     */
+    void subscribe(TcpClient& client);
+
+    /**
+     * @brief Stop sending to the client, dropping the messages it has not been sent
+     *
+     * The socket is switched back to the mode it was in when subscribed. Does nothing if the
+     * client is not subscribed.
+     *
+     * @warning A message may have been sent in part, leaving the stream in the middle of it
+     */
+    void unsubscribe(TcpClient& client) noexcept;
+
+    /**
+     * @brief Queue the payload to every subscriber - safe to call from any thread
+     *
+     * @param [in] payload The message, not copied
+     */
+    void publish(Payload payload);
+
+    /**
+     * @brief Set the handler called when a subscriber is dropped
+     */
+    void on_drop(DropHandler handler);
+
+    /**
+     * @brief Retrieve the number of subscribers
+     */
+    size_t subscribers() const noexcept;
+
+    /**
+     * @brief Retrieve the number of messages skipped for slow subscribers under @b SlowConsumerPolicy::Drop
+     */
+    uint64_t dropped() const noexcept;
+
+protected:
+    struct Subscriber {
+        TcpClient*           client;
+        sys::native_socket_t socket;
+        std::deque<Payload>  queue;
+        // Bytes of the front payload already sent
+        size_t               offset       = 0;
+        bool                 watching     = false;
+        // Mode to restore once unsubscribed
+        bool                 was_blocking = false;
+    };
+
+    // Shared with the tasks posted to the reactor, which may outlive the publisher
+    struct Inbox {
+        std::mutex           mutex;
+        std::vector<Payload> payloads;
+        FanOutPublisher*     owner = nullptr;
+    };
+
+    runtime::Reactor&                        reactor;
+    const FanOutOptions                      options;
+    std::shared_ptr<Inbox>                   inbox;
+    std::vector<Payload>                     pending;
+    std::vector<std::unique_ptr<Subscriber>> subscriber_list;
+    DropHandler                              drop_handler;
+    uint64_t                                 dropped_count = 0;
+
+    void deliver();
+    bool flush(Subscriber& subscriber);
+    void drop(Subscriber* subscriber);
+    void detach(Subscriber& subscriber) noexcept;
+};
+}
+
+#endif
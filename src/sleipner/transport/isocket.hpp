@@ -11,10 +11,19 @@
 #ifndef _SLEIPNER_ISOCKET_HPP_
 #define _SLEIPNER_ISOCKET_HPP_
 
+#include <chrono>
+#include <memory_resource>
 #include <string>
 #include <cstdint>
 
 namespace sleipner::transport {
+/**
+ * @brief An absolute point in time by which an operation must be done
+ *
+ * Passing the same deadline to a chain of operations makes them share one time budget.
+ */
+typedef std::chrono::steady_clock::time_point Deadline;
+
 /**
  * @brief Interface for a socket client.
  *
@@ -134,6 +143,112 @@ public:
      * @return std::string Bytes received
      */
     virtual std::string peek(size_t size, uint64_t timeout) = 0;
+
+    /**
+     * @brief Receive data from the connection, blocking no later than the deadline
+     *
+     * @param [inout] buf Byte buffer to store the data
+     * @param [in] size Size of the buffer/max number of bytes to receive
+     * @param [in] deadline Time by which to give up if no data is available
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return size_t Number of bytes received
+     */
+    size_t receive(char* buf, size_t size, Deadline deadline) {
+        return receive(buf, size, timeout_until(deadline));
+    }
+
+    /**
+     * @brief Receive data from the connection, blocking no later than the deadline
+     *
+     * @param [in] size Max number of bytes to receive
+     * @param [in] deadline Time by which to give up if no data is available
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return std::string Bytes received
+     */
+    std::string receive(size_t size, Deadline deadline) {
+        return receive(size, timeout_until(deadline));
+    }
+
+    /**
+     * @brief Peek data from the connection, blocking no later than the deadline
+     *
+     * @param [in] buf Byte buffer to store the data
+     * @param [in] size Size of the buffer/max number of bytes to receive
+     * @param [in] deadline Time by which to give up if no data is available
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return size_t Number of bytes peeked
+     */
+    size_t peek(char* buf, size_t size, Deadline deadline) {
+        return peek(buf, size, timeout_until(deadline));
+    }
+
+    /**
+     * @brief Peek data from the connection, blocking no later than the deadline
+     *
+     * @param [in] size Max number of bytes to receive
+     * @param [in] deadline Time by which to give up if no data is available
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return std::string Bytes received
+     */
+    std::string peek(size_t size, Deadline deadline) {
+        return peek(size, timeout_until(deadline));
+    }
+
+    /**
+     * @brief Receive data from the connection into a string allocated from the memory resource
+     *
+     * @param [in] size Max number of bytes to receive
+     * @param [in] timeout Milliseconds to block if no data is available
+     * @param [in] resource Memory resource for the string, e.g. a per-request @b runtime::Arena
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return std::pmr::string Bytes received
+     */
+    std::pmr::string receive(size_t size, uint64_t timeout, std::pmr::memory_resource* resource) {
+        std::pmr::string data(size, '\0', resource);
+        data.resize(receive(&data[0], size, timeout));
+        return data;
+    }
+
+    /**
+     * @brief Peek data from the connection into a string allocated from the memory resource
+     *
+     * @param [in] size Max number of bytes to peek
+     * @param [in] timeout Milliseconds to block if no data is available
+     * @param [in] resource Memory resource for the string, e.g. a per-request @b runtime::Arena
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return std::pmr::string Bytes peeked
+     */
+    std::pmr::string peek(size_t size, uint64_t timeout, std::pmr::memory_resource* resource) {
+        std::pmr::string data(size, '\0', resource);
+        data.resize(peek(&data[0], size, timeout));
+        return data;
+    }
+
+    /**
+     * @brief Milliseconds left until the deadline, rounded up, 0 if it has passed, or @b UINT64_MAX
+     *        to wait indefinitely for @b Deadline::max()
+     */
+    static uint64_t timeout_until(Deadline deadline) noexcept {
+        if ( deadline == Deadline::max() )
+            return UINT64_MAX;
+
+        Deadline now = Deadline::clock::now();
+        if ( deadline <= now )
+            return 0;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now + std::chrono::milliseconds(1) - Deadline::duration(1)).count();
+    }
 };
 }
 
@@ -0,0 +1,324 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/multiplexer.hpp"
+#include "sleipner/transport/error.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace sleipner::transport {
+/********************************************/
+/* Frame format                             */
+/********************************************/
+static constexpr size_t   HEADER     = 8;
+static constexpr uint32_t REPLY_BIT  = 0x80000000u;
+// Frames are packed into one write up to this size, larger payloads are queued as they are
+static constexpr size_t   BATCH_SIZE = 64 << 10;
+// Room kept free in the input buffer for every receive
+static constexpr size_t   READ_SIZE  = 64 << 10;
+
+static void _put_header(char* p, uint32_t length, uint32_t id) noexcept {
+    for ( size_t i = 0; i < 4; i++ ) {
+        p[i]     = (char) (length >> (24 - 8 * i));
+        p[4 + i] = (char) (id >> (24 - 8 * i));
+    }
+}
+
+static uint32_t _get_u32(const char* p) noexcept {
+    return (uint32_t) (unsigned char) p[0] << 24 | (uint32_t) (unsigned char) p[1] << 16
+         | (uint32_t) (unsigned char) p[2] << 8  | (uint32_t) (unsigned char) p[3];
+}
+
+/********************************************/
+/* Multiplexer                              */
+/********************************************/
+Multiplexer::Multiplexer(runtime::Reactor& reactor, TcpClient& client, const MultiplexerOptions& options):
+        reactor(reactor), client(client), options(options), queue(reactor, client, options.queue),
+        inbox(std::make_shared<Inbox>()) {
+    if ( options.timeout.count() <= 0 )
+        throw std::invalid_argument("Timeout must be positive!");
+    if ( options.max_outstanding == 0 || options.max_frame == 0 )
+        throw std::invalid_argument("Limits can't be 0!");
+
+    inbox->owner = this;
+    queue.on_error([this](std::exception_ptr error) { fail(error); });
+    queue.on_readable([this](int) { receive(); });
+}
+
+Multiplexer::~Multiplexer() {
+    {
+        std::lock_guard lock(inbox->mutex);
+        inbox->owner = nullptr;
+    }
+
+    for ( auto& entry: pending )
+        reactor.timers().cancel(entry.second.timer);
+}
+
+void Multiplexer::request(std::string payload, ReplyHandler handler, std::chrono::milliseconds timeout) {
+    submit(Outgoing{std::move(payload), std::move(handler), timeout, 0, false});
+}
+
+void Multiplexer::request(std::string payload, ReplyHandler handler) {
+    request(std::move(payload), std::move(handler), options.timeout);
+}
+
+std::future<std::string> Multiplexer::request(std::string payload, std::chrono::milliseconds timeout) {
+    auto promise = std::make_shared<std::promise<std::string>>();
+    std::future<std::string> reply = promise->get_future();
+
+    request(std::move(payload), [promise](std::exception_ptr error, std::string data) {
+        if ( error )
+            promise->set_exception(error);
+        else
+            promise->set_value(std::move(data));
+    }, timeout);
+
+    return reply;
+}
+
+std::future<std::string> Multiplexer::request(std::string payload) {
+    return request(std::move(payload), options.timeout);
+}
+
+void Multiplexer::reply(RequestId id, std::string payload) {
+    submit(Outgoing{std::move(payload), nullptr, std::chrono::milliseconds(0), id, true});
+}
+
+void Multiplexer::on_request(RequestHandler handler) {
+    request_handler = std::move(handler);
+}
+
+void Multiplexer::on_error(ErrorHandler handler) {
+    error_handler = std::move(handler);
+}
+
+size_t Multiplexer::outstanding() const noexcept {
+    return pending.size();
+}
+
+bool Multiplexer::failed() const noexcept {
+    return (bool) failure;
+}
+
+void Multiplexer::submit(Outgoing outgoing) {
+    std::shared_ptr<Inbox> shared = inbox;
+    bool first;
+    {
+        std::lock_guard lock(shared->mutex);
+        first = shared->outgoing.empty();
+        shared->outgoing.push_back(std::move(outgoing));
+    }
+
+    // One task frames everything submitted until it runs, so a burst costs one wake-up and one write
+    if ( first ) {
+        reactor.post([shared] {
+            Multiplexer* owner;
+            {
+                std::lock_guard lock(shared->mutex);
+                owner = shared->owner;
+            }
+            // The multiplexer is only destroyed on the loop thread, so it can not go away from here on
+            if ( owner )
+                owner->deliver();
+        });
+    }
+}
+
+void Multiplexer::deliver() {
+    {
+        std::lock_guard lock(inbox->mutex);
+        submitted.swap(inbox->outgoing);
+    }
+
+    for ( auto& outgoing: submitted ) {
+        if ( outgoing.is_reply ) {
+            if ( !failure && outgoing.payload.size() <= UINT32_MAX )
+                frame(outgoing.reply_to | REPLY_BIT, outgoing.payload);
+            continue;
+        }
+
+        if ( failure ) {
+            outgoing.handler(failure, std::string());
+            continue;
+        }
+        if ( pending.size() >= options.max_outstanding ) {
+            outgoing.handler(std::make_exception_ptr(std::length_error("Too many outstanding requests!")), std::string());
+            continue;
+        }
+        if ( outgoing.payload.size() > UINT32_MAX ) {
+            outgoing.handler(std::make_exception_ptr(std::length_error("Request too large to frame!")), std::string());
+            continue;
+        }
+
+        // Skip the IDs still awaiting a reply once the counter wraps around
+        do {
+            next_id = (next_id + 1) & ~REPLY_BIT;
+        } while ( next_id == 0 || pending.count(next_id) );
+
+        RequestId id = next_id;
+        if ( !frame(id, outgoing.payload) ) {
+            outgoing.handler(std::make_exception_ptr(std::length_error("Write queue full!")), std::string());
+            continue;
+        }
+        // Failed while writing a large request
+        if ( failure ) {
+            outgoing.handler(failure, std::string());
+            continue;
+        }
+
+        Pending& entry = pending[id];
+        entry.handler  = std::move(outgoing.handler);
+        entry.timer    = reactor.timers().add(runtime::TimerWheel::clock::now() + outgoing.timeout, [this, id] {
+            expire(id);
+        });
+    }
+
+    submitted.clear();
+    write_batch();
+}
+
+bool Multiplexer::frame(RequestId id, std::string& payload) {
+    if ( queue.queued() + batch.size() + HEADER + payload.size() > options.queue.limit )
+        return false;
+
+    char header[HEADER];
+    _put_header(header, (uint32_t) payload.size(), id);
+
+    if ( payload.size() < BATCH_SIZE ) {
+        batch.append(header, HEADER);
+        batch.append(payload);
+        if ( batch.size() >= BATCH_SIZE )
+            write_batch();
+        return true;
+    }
+
+    // Large - keep the order of the frames, but queue the payload without copying it
+    batch.append(header, HEADER);
+    write_batch();
+    try {
+        queue.write(std::move(payload));
+    } catch ( error::SocketDisconnection& ) {
+        /* Reported through the error handler of the queue */
+    }
+    return true;
+}
+
+void Multiplexer::write_batch() {
+    if ( batch.empty() )
+        return;
+
+    try {
+        queue.write(batch.data(), batch.size());
+    } catch ( error::SocketDisconnection& ) {
+        /* Reported through the error handler of the queue */
+    }
+    batch.clear();
+}
+
+void Multiplexer::receive() {
+    if ( failure )
+        return;
+
+    size_t space;
+    size_t received;
+
+    // Keep reading while the reads fill the buffer, as more is likely waiting
+    do {
+        if ( input.size() < input_used + READ_SIZE )
+            input.resize(input_used + READ_SIZE);
+        space = input.size() - input_used;
+
+        try {
+            received = client.receive(&input[input_used], space, 0);
+        } catch ( error::SocketDisconnection& ) {
+            fail(std::current_exception());
+            return;
+        }
+        input_used += received;
+
+        size_t start = 0;
+        while ( input_used - start >= HEADER ) {
+            uint32_t length = _get_u32(&input[start]);
+            if ( length > options.max_frame ) {
+                fail(std::make_exception_ptr(error::ProtocolError("Frame of " + std::to_string(length) + " bytes exceeds the limit!")));
+                return;
+            }
+            if ( input_used - start - HEADER < length )
+                break;
+
+            dispatch(_get_u32(&input[start + 4]), std::string(&input[start + HEADER], length));
+            start += HEADER + length;
+        }
+
+        if ( start ) {
+            std::memmove(&input[0], &input[start], input_used - start);
+            input_used -= start;
+        }
+    } while ( received == space && !failure );
+}
+
+void Multiplexer::dispatch(RequestId id, std::string payload) {
+    if ( !(id & REPLY_BIT) ) {
+        if ( request_handler )
+            request_handler(id, std::move(payload));
+        return;
+    }
+
+    // A reply to a request that timed out is no longer pending
+    auto it = pending.find(id & ~REPLY_BIT);
+    if ( it == pending.end() )
+        return;
+
+    ReplyHandler handler = std::move(it->second.handler);
+    reactor.timers().cancel(it->second.timer);
+    pending.erase(it);
+
+    handler(nullptr, std::move(payload));
+}
+
+void Multiplexer::expire(RequestId id) {
+    auto it = pending.find(id);
+    if ( it == pending.end() )
+        return;
+
+    ReplyHandler handler = std::move(it->second.handler);
+    pending.erase(it);
+
+    handler(std::make_exception_ptr(error::RequestTimeout("No reply within the timeout!")), std::string());
+}
+
+void Multiplexer::fail(std::exception_ptr error) {
+    if ( failure )
+        return;
+
+    failure = error;
+    batch.clear();
+
+    // Stop reading once back in the loop - this may be running inside the read handler
+    std::shared_ptr<Inbox> shared = inbox;
+    reactor.post([shared] {
+        Multiplexer* owner;
+        {
+            std::lock_guard lock(shared->mutex);
+            owner = shared->owner;
+        }
+        if ( owner )
+            owner->queue.on_readable(nullptr);
+    });
+
+    std::unordered_map<RequestId, Pending> failed;
+    failed.swap(pending);
+    for ( auto& entry: failed ) {
+        reactor.timers().cancel(entry.second.timer);
+        entry.second.handler(failure, std::string());
+    }
+
+    if ( error_handler )
+        error_handler(failure);
+}
+}
@@ -0,0 +1,235 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file multiplexer.hpp
+ * @brief Many concurrent requests over one connection, correlated to their replies by ID
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_MULTIPLEXER_HPP_
+#define _SLEIPNER_TRANSPORT_MULTIPLEXER_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/writequeue.hpp"
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/runtime/timer.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Options for @b Multiplexer
+ */
+struct MultiplexerOptions {
+    /// @brief Time to wait for a reply, for requests that do not set their own timeout
+    std::chrono::milliseconds timeout = std::chrono::seconds(30);
+
+    /// @brief Requests awaiting a reply at once, beyond which new requests fail right away
+    size_t max_outstanding = 65536;
+
+    /// @brief Largest frame payload accepted from the peer - a larger one fails the connection
+    size_t max_frame = 16 << 20;
+
+    /// @brief Watermarks and limit of the queue the frames are sent through
+    WriteQueueOptions queue;
+};
+
+/**
+ * @brief Sends requests over one connection without waiting for the replies to earlier ones
+ *
+ * Every message is framed with its length and a correlation ID, so any number of requests
+ * can be in flight at once, and the replies can arrive in any order. Each reply completes
+ * the callback, or future, of the request with the same ID. Requests that get no reply in
+ * time fail with @b RequestTimeout, and a reply arriving after that is discarded.
+ *
+ * Both ends of the connection use a multiplexer: the serving end sets a handler with
+ * @b on_request, and answers each request with @b reply, right away or later from any
+ * thread. Either end may send requests, as replies are told apart from requests by a flag.
+ *
+ * Frame format, all integers big-endian:
+ *  - Length of the payload (4 bytes)
+ *  - ID (4 bytes), top bit set on replies
+ *  - Payload
+ *
+ * Requests submitted together are packed into one write, so a burst of small requests
+ * costs one system call rather than one each.
+ *
+ * Basic usage example:
+ * @code
+ * Multiplexer rpc(reactor, client);
+ * std::thread loop([&] { reactor.run(); });
+ *
+ * // From any thread
+ * std::future<std::string> balance = rpc.request(encode(BalanceQuery{account}));
+ * rpc.request(encode(Order{...}), [](std::exception_ptr error, std::string reply) {
+ *     // On the loop thread
+ * });
+ * @endcode
+ *
+ * @note @b request and @b reply are safe from any thread. The other methods, and the
+ *       destructor, may only be used from the loop thread, or while the loop is not running.
+ *       All handlers are called on the loop thread.
+ */
+class Multiplexer {
+public:
+    /// @brief Identifies a request to @b reply to
+    typedef uint32_t RequestId;
+
+    /// @brief Called with the reply, or with the exception the request failed with and an empty reply
+    typedef std::function<void(std::exception_ptr error, std::string reply)> ReplyHandler;
+
+    /// @brief Called for every request from the peer, to be answered with @b reply
+    typedef std::function<void(RequestId id, std::string request)> RequestHandler;
+
+    /// @brief Called once the connection failed, with the exception describing the failure
+    typedef std::function<void(std::exception_ptr)> ErrorHandler;
+
+    /**
+     * @brief Take over sending and receiving on the client
+     *
+     * @param [in] reactor The event loop to send and receive from
+     * @param [in] client A connected client, must stay connected and outlive the multiplexer
+     * @param [in] options Timeouts and limits
+     * @throws std::invalid_argument If the options are invalid
+     * @throws SetupError If the client is not connected
+     * @throws SystemApiError
+     */
+    Multiplexer(runtime::Reactor& reactor, TcpClient& client, const MultiplexerOptions& options = MultiplexerOptions());
+
+    /**
+     * @brief Drops the outstanding requests without calling their handlers
+     *
+     * The futures of dropped requests fail with @b std::future_error.
+     */
+    ~Multiplexer();
+
+    Multiplexer(const Multiplexer&) = delete;
+    Multiplexer& operator=(const Multiplexer&) = delete;
+
+    /**
+     * @brief Send a request, calling the handler with its reply - safe to call from any thread
+     *
+     * The handler is called with @b RequestTimeout if no reply arrives within the timeout,
+     * with @b std::length_error if too many requests are outstanding or queued, and with
+     * the failure of the connection if it fails before the reply arrives.
+     *
+     * @param [in] payload The request
+     * @param [in] handler Called once, on the loop thread
+     * @param [in] timeout Time to wait for the reply
+     */
+    void request(std::string payload, ReplyHandler handler, std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Send a request with the default timeout, calling the handler with its reply
+     *
+     * @see request(std::string, ReplyHandler, std::chrono::milliseconds)
+     */
+    void request(std::string payload, ReplyHandler handler);
+
+    /**
+     * @brief Send a request, returning a future of its reply - safe to call from any thread
+     *
+     * @see request(std::string, ReplyHandler, std::chrono::milliseconds)
+     */
+    std::future<std::string> request(std::string payload, std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Send a request with the default timeout, returning a future of its reply
+     *
+     * @see request(std::string, ReplyHandler, std::chrono::milliseconds)
+     */
+    std::future<std::string> request(std::string payload);
+
+    /**
+     * @brief Answer a request from the peer - safe to call from any thread
+     *
+     * Does nothing if the connection has failed.
+     *
+     * @param [in] id The ID the request handler was called with
+     * @param [in] payload The reply
+     */
+    void reply(RequestId id, std::string payload);
+
+    /**
+     * @brief Set the handler called for requests from the peer - without one, they are discarded
+     */
+    void on_request(RequestHandler handler);
+
+    /**
+     * @brief Set the handler called once the connection fails, after the outstanding requests were failed
+     */
+    void on_error(ErrorHandler handler);
+
+    /**
+     * @brief Retrieve the number of requests awaiting a reply
+     */
+    size_t outstanding() const noexcept;
+
+    /**
+     * @brief Check if the connection has failed
+     */
+    bool failed() const noexcept;
+
+protected:
+    // A request or reply submitted from any thread, framed on the loop thread
+    struct Outgoing {
+        std::string               payload;
+        ReplyHandler              handler;
+        std::chrono::milliseconds timeout;
+        RequestId                 reply_to;
+        bool                      is_reply;
+    };
+
+    struct Pending {
+        ReplyHandler         handler;
+        runtime::TimerHandle timer;
+    };
+
+    // Shared with the tasks posted to the reactor, which may outlive the multiplexer
+    struct Inbox {
+        std::mutex            mutex;
+        std::vector<Outgoing> outgoing;
+        Multiplexer*          owner = nullptr;
+    };
+
+    runtime::Reactor&                      reactor;
+    TcpClient&                             client;
+    const MultiplexerOptions               options;
+    WriteQueue                             queue;
+    std::shared_ptr<Inbox>                 inbox;
+    std::vector<Outgoing>                  submitted;
+    std::unordered_map<RequestId, Pending> pending;
+    RequestId                              next_id = 0;
+
+    // Frames not yet written, and received data not yet dispatched
+    std::string                            batch;
+    std::string                            input;
+    size_t                                 input_used = 0;
+
+    RequestHandler                         request_handler;
+    ErrorHandler                           error_handler;
+    std::exception_ptr                     failure;
+
+    void submit(Outgoing outgoing);
+    void deliver();
+    bool frame(RequestId id, std::string& payload);
+    void write_batch();
+    void receive();
+    void dispatch(RequestId id, std::string payload);
+    void expire(RequestId id);
+    void fail(std::exception_ptr error);
+};
+}
+
+#endif
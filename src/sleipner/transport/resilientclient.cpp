@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/resilientclient.hpp"
+#include "sleipner/transport/error.hpp"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace sleipner::transport {
+// Connect a new client to the address, throwing as TcpClient::connect
+static std::unique_ptr<TcpClient> _open(const net::IpAddress& address) {
+    std::unique_ptr<TcpClient> client(new TcpClient());
+    client->connect(address);
+    return client;
+}
+
+// A standby may have been dropped by the peer while waiting
+static bool _alive(const TcpClient& client) noexcept {
+    try {
+        return client.connected();
+    } catch ( std::exception& ) {
+        return false;
+    }
+}
+
+/********************************************/
+/* ResilientClient                          */
+/********************************************/
+ResilientClient::ResilientClient(const ResilientOptions& options): options(options) {
+    if ( options.backoff_min.count() <= 0 || options.backoff_max < options.backoff_min )
+        throw std::invalid_argument("Invalid backoff range!");
+}
+
+ResilientClient::~ResilientClient() {
+    close();
+}
+
+void ResilientClient::connect(const std::vector<net::IpAddress>& new_addresses) {
+    std::lock_guard io_lock(io_mutex);
+    if ( active )
+        throw error::SetupError("ResilientClient already connected!");
+    if ( new_addresses.empty() )
+        throw std::invalid_argument("No addresses to connect to!");
+
+    size_t index = 0;
+    for ( ; !primary; index++ ) {
+        try {
+            primary = _open(new_addresses[index]);
+            break;
+        } catch ( error::ConnectionFailure& ) {
+            if ( index + 1 == new_addresses.size() )
+                throw error::ConnectionFailure("Could not connect to any given address!");
+        }
+    }
+
+    {
+        std::lock_guard pool_lock(pool_mutex);
+        addresses       = new_addresses;
+        primary_address = index;
+        next_address    = index + 1;
+        stopping        = false;
+    }
+
+    active = true;
+    if ( options.standbys )
+        refill_thread = std::thread([this] { refill(); });
+}
+
+void ResilientClient::close() noexcept {
+    std::lock_guard io_lock(io_mutex);
+    {
+        std::lock_guard pool_lock(pool_mutex);
+        stopping = true;
+        pool_cv.notify_all();
+    }
+
+    if ( refill_thread.joinable() )
+        refill_thread.join();
+
+    pool.clear();
+    addresses.clear();
+    primary.reset();
+    active = false;
+}
+
+void ResilientClient::on_failover(FailoverHandler handler) {
+    std::lock_guard io_lock(io_mutex);
+    failover_handler = std::move(handler);
+}
+
+size_t ResilientClient::standbys() const {
+    std::lock_guard pool_lock(pool_mutex);
+    return pool.size();
+}
+
+uint64_t ResilientClient::failovers() const noexcept {
+    return failover_count.load();
+}
+
+void ResilientClient::refill() {
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_real_distribution<double> jitter(0.5, 1.5);
+    unsigned failures = 0;
+
+    std::unique_lock pool_lock(pool_mutex);
+
+    for ( ;; ) {
+        pool_cv.wait(pool_lock, [this] { return stopping || pool.size() < options.standbys; });
+        if ( stopping )
+            return;
+
+        // Prefer the addresses the active connection is not using, so one host going down does not take out both
+        size_t index = next_address++ % addresses.size();
+        if ( index == primary_address && addresses.size() > 1 )
+            index = next_address++ % addresses.size();
+        net::IpAddress address = addresses[index];
+
+        std::unique_ptr<TcpClient> client;
+        pool_lock.unlock();
+        try {
+            client = _open(address);
+        } catch ( std::exception& ) {
+            /* Back off below */
+        }
+        pool_lock.lock();
+
+        if ( client ) {
+            failures = 0;
+            pool.push_back(Standby{std::move(client), index});
+            continue;
+        }
+
+        // Exponential backoff with jitter, so many clients do not reconnect in lockstep after an outage
+        std::chrono::milliseconds delay = options.backoff_min * (1 << std::min(failures++, 16u));
+        delay = std::min(delay, options.backoff_max);
+        delay = std::chrono::duration_cast<std::chrono::milliseconds>(delay * jitter(rng));
+        pool_cv.wait_for(pool_lock, delay, [this] { return stopping; });
+    }
+}
+
+void ResilientClient::promote() {
+    std::unique_ptr<TcpClient> next;
+    {
+        std::lock_guard pool_lock(pool_mutex);
+        while ( !pool.empty() && !next ) {
+            Standby standby = std::move(pool.front());
+            pool.pop_front();
+
+            if ( _alive(*standby.client) ) {
+                next            = std::move(standby.client);
+                primary_address = standby.address;
+            }
+        }
+        pool_cv.notify_all();
+    }
+
+    primary.reset();
+    if ( !next )
+        throw error::SocketDisconnection("Connection lost, and no standby connection ready!");
+
+    primary = std::move(next);
+    failover_count.fetch_add(1);
+
+    if ( failover_handler )
+        failover_handler();
+}
+
+template<typename Op>
+auto ResilientClient::with_failover(Op op) -> decltype(op(std::declval<TcpClient&>())) {
+    std::lock_guard io_lock(io_mutex);
+    if ( !active )
+        throw error::SetupError("ResilientClient not connected!");
+
+    // The last failover found no standby - one may have been connected since
+    if ( !primary )
+        promote();
+
+    try {
+        return op(*primary);
+    } catch ( error::SocketDisconnection& ) {
+        promote();
+        return op(*primary);
+    }
+}
+
+bool ResilientClient::connected() const {
+    std::lock_guard io_lock(io_mutex);
+    if ( !active )
+        throw error::SetupError("ResilientClient not connected!");
+
+    if ( primary && primary->connected() )
+        return true;
+
+    try {
+        const_cast<ResilientClient*>(this)->promote();
+        return true;
+    } catch ( error::SocketDisconnection& ) {
+        return false;
+    }
+}
+
+size_t ResilientClient::bytes_available() const {
+    return const_cast<ResilientClient*>(this)->with_failover([](TcpClient& c) { return c.bytes_available(); });
+}
+
+size_t ResilientClient::send(const char* buf, size_t size) {
+    return with_failover([&](TcpClient& c) { return c.send(buf, size); });
+}
+
+size_t ResilientClient::send(const std::string& packet) {
+    return with_failover([&](TcpClient& c) { return c.send(packet); });
+}
+
+size_t ResilientClient::receive(char* buf, size_t size, uint64_t timeout) {
+    return with_failover([&](TcpClient& c) { return c.receive(buf, size, timeout); });
+}
+
+std::string ResilientClient::receive(size_t size, uint64_t timeout) {
+    return with_failover([&](TcpClient& c) { return c.receive(size, timeout); });
+}
+
+size_t ResilientClient::peek(char* buf, size_t size, uint64_t timeout) {
+    return with_failover([&](TcpClient& c) { return c.peek(buf, size, timeout); });
+}
+
+std::string ResilientClient::peek(size_t size, uint64_t timeout) {
+    return with_failover([&](TcpClient& c) { return c.peek(size, timeout); });
+}
+}
@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file resilientclient.hpp
+ * @brief Implements a TCP socket client failing over to pre-connected standby connections
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_RESILIENTCLIENT_HPP_
+#define _SLEIPNER_TRANSPORT_RESILIENTCLIENT_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "sleipner/transport/isocket.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/net/ip.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Options for @b ResilientClient
+ */
+struct ResilientOptions {
+    /// @brief Number of standby connections to keep ready
+    size_t standbys = 1;
+
+    /// @brief Delay before retrying after the first failed standby connect
+    std::chrono::milliseconds backoff_min = std::chrono::milliseconds(50);
+
+    /// @brief Upper limit of the delay, which doubles with every failed connect in a row
+    std::chrono::milliseconds backoff_max = std::chrono::milliseconds(5000);
+};
+
+/**
+ * @brief TCP client that keeps standby connections, and swaps to one when the connection drops
+ *
+ * Re-connecting after a drop puts name resolution, the handshake and slow start on the
+ * critical path. Instead, @b ResilientClient keeps a number of connections to the
+ * alternative addresses ready, and swaps one in the moment the active connection throws
+ * @b SocketDisconnection, retrying the failed operation on it once. A background thread
+ * refills the standbys, backing off with jitter while the hosts can not be reached.
+ *
+ * Basic usage example:
+ * @code
+ * ResilientClient client;
+ * client.on_failover([&] { client.send(subscribe_request); });
+ * client.connect(resolve_ip("feed.example.com", 9000));
+ *
+ * for ( ;; )
+ *     handle(client.receive(4096, 1000));
+ * @endcode
+ *
+ * @warning Data in flight on the dropped connection is lost. Use @b on_failover to bring the
+ *          new connection up to the state of the old one, e.g. by re-subscribing.
+ */
+class ResilientClient: public ISocket {
+public:
+    /// @brief Called on the thread of the failed operation, after the swap, before the retry
+    typedef std::function<void()> FailoverHandler;
+
+    /**
+     * @brief Default constructor does not allow any operations to be carried out, except @b connect
+     */
+    explicit ResilientClient(const ResilientOptions& options = ResilientOptions());
+
+    /**
+     * @brief Stops refilling, and closes all connections
+     */
+    ~ResilientClient();
+
+    /**
+     * @brief Connect to the first connectable address, and start filling the standbys
+     *
+     * Standbys prefer the addresses other than the active connection's.
+     *
+     * @param addresses The addresses to connect to
+     * @throws std::invalid_argument If any address tried is obviously malformed, or none are given
+     * @throws SetupError If already connected
+     * @throws ConnectionFailure
+     * @throws SystemApiError
+     */
+    void connect(const std::vector<net::IpAddress>& addresses);
+
+    /**
+     * @brief Close the active and standby connections, and stop refilling
+     */
+    void close() noexcept;
+
+    /**
+     * @brief Set the handler called after every swap to a standby
+     */
+    void on_failover(FailoverHandler handler);
+
+    /**
+     * @brief Retrieve the number of standby connections ready
+     */
+    size_t standbys() const;
+
+    /**
+     * @brief Retrieve the number of swaps to a standby since construction
+     */
+    uint64_t failovers() const noexcept;
+
+    // Deadline overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
+    /// @copydoc ISocket::connected()
+    bool connected() const override;
+
+    /// @copydoc ISocket::bytes_available()
+    size_t bytes_available() const override;
+
+    /// @copydoc ISocket::send(const char*, size_t)
+    size_t send(const char* buf, size_t size) override;
+
+    /// @copydoc ISocket::send(const std::string&)
+    size_t send(const std::string& packet) override;
+
+    /// @copydoc ISocket::receive(char*, size_t, uint64_t)
+    size_t receive(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::receive(size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(char*, size_t, uint64_t)
+    size_t peek(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) override;
+
+protected:
+    struct Standby {
+        std::unique_ptr<TcpClient> client;
+        size_t                     address;
+    };
+
+    const ResilientOptions options;
+
+    // Serialises the operations, and guards the active connection
+    mutable std::recursive_mutex   io_mutex;
+    std::unique_ptr<TcpClient>     primary;
+    bool                           active          = false;
+    FailoverHandler                failover_handler;
+    std::atomic<uint64_t>          failover_count  = {0};
+
+    // Guards the standbys and the addresses, shared with the refill thread
+    mutable std::mutex             pool_mutex;
+    std::condition_variable        pool_cv;
+    std::deque<Standby>            pool;
+    std::vector<net::IpAddress>    addresses;
+    size_t                         primary_address = 0;
+    size_t                         next_address    = 0;
+    bool                           stopping        = false;
+    std::thread                    refill_thread;
+
+    void refill();
+    void promote();
+
+    template<typename Op>
+    auto with_failover(Op op) -> decltype(op(std::declval<TcpClient&>()));
+};
+}
+
+#endif
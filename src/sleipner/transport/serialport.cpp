@@ -0,0 +1,586 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/serialport.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/sys/error.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/ioctl.h>
+    #include <termios.h>
+    #include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(_WIN32)
+// The kernel's termios with separate speed fields, for rates without a B constant. Declared
+// here, as <asm/termbits.h> clashes with <termios.h>
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t     c_line;
+    cc_t     c_cc[19];
+    speed_t  c_ispeed;
+    speed_t  c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#endif
+
+namespace sleipner::transport {
+/********************************************/
+/* System specific port methods             */
+/********************************************/
+#ifdef _WIN32
+    typedef HANDLE file_t;
+    static const file_t INVALID_FILE = INVALID_HANDLE_VALUE;
+
+    static int _last_error() noexcept {
+        return (int) ::GetLastError();
+    }
+
+    // The errors of a port whose device is gone, e.g. a USB adapter unplugged
+    static bool _disconnected(int err) noexcept {
+        return err == ERROR_ACCESS_DENIED || err == ERROR_BAD_COMMAND || err == ERROR_OPERATION_ABORTED
+            || err == ERROR_DEVICE_NOT_CONNECTED || err == ERROR_FILE_NOT_FOUND;
+    }
+#else
+    typedef int file_t;
+    static const file_t INVALID_FILE = -1;
+
+    static int _last_error() noexcept {
+        return errno;
+    }
+
+    static bool _disconnected(int err) noexcept {
+        return err == EIO || err == ENXIO || err == ENODEV;
+    }
+#endif
+
+[[noreturn]] static void _fail(int err) {
+    if ( _disconnected(err) )
+        throw error::SocketDisconnection(sys::error_message(err));
+    throw error::SystemApiError(err);
+}
+
+static void _validate(const SerialOptions& options) {
+    if ( options.baud_rate == 0 )
+        throw std::invalid_argument("Baud rate must be positive!");
+    if ( options.data_bits < 5 || options.data_bits > 8 )
+        throw std::invalid_argument("Data bits must be 5 to 8!");
+    if ( options.stop_bits != 1 && options.stop_bits != 2 )
+        throw std::invalid_argument("Stop bits must be 1 or 2!");
+    if ( options.parity > SerialOptions::EvenParity )
+        throw std::invalid_argument("Invalid parity!");
+}
+
+#ifndef _WIN32
+// The B constant of a standard rate, or B0 if it has none
+static speed_t _standard_speed(uint32_t rate) noexcept {
+    switch ( rate ) {
+        case 50:      return B50;
+        case 75:      return B75;
+        case 110:     return B110;
+        case 134:     return B134;
+        case 150:     return B150;
+        case 200:     return B200;
+        case 300:     return B300;
+        case 600:     return B600;
+        case 1200:    return B1200;
+        case 1800:    return B1800;
+        case 2400:    return B2400;
+        case 4800:    return B4800;
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        #ifdef B460800
+        case 460800:  return B460800;
+        #endif
+        #ifdef B921600
+        case 921600:  return B921600;
+        #endif
+        #ifdef B1000000
+        case 1000000: return B1000000;
+        #endif
+        #ifdef B2000000
+        case 2000000: return B2000000;
+        #endif
+        #ifdef B3000000
+        case 3000000: return B3000000;
+        #endif
+        #ifdef B4000000
+        case 4000000: return B4000000;
+        #endif
+        default:      return B0;
+    }
+}
+#endif
+
+static void _configure(file_t file, const SerialOptions& options) {
+    _validate(options);
+
+    #ifdef _WIN32
+        DCB dcb {};
+        dcb.DCBlength = sizeof(dcb);
+        if ( !::GetCommState(file, &dcb) )
+            throw error::SystemApiError(_last_error());
+
+        // The driver takes any rate it can generate
+        dcb.BaudRate     = options.baud_rate;
+        dcb.ByteSize     = options.data_bits;
+        dcb.Parity       = options.parity == SerialOptions::OddParity ? ODDPARITY
+                         : options.parity == SerialOptions::EvenParity ? EVENPARITY : NOPARITY;
+        dcb.StopBits     = options.stop_bits == 2 ? TWOSTOPBITS : ONESTOPBIT;
+        dcb.fBinary      = TRUE;
+        dcb.fParity      = options.parity != SerialOptions::NoParity;
+        dcb.fOutxCtsFlow = options.hardware_flow_control;
+        dcb.fRtsControl  = options.hardware_flow_control ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
+        dcb.fOutxDsrFlow = FALSE;
+        dcb.fDtrControl  = DTR_CONTROL_ENABLE;
+        dcb.fOutX        = FALSE;
+        dcb.fInX         = FALSE;
+        dcb.fNull        = FALSE;
+        dcb.fAbortOnError = FALSE;
+
+        if ( !::SetCommState(file, &dcb) ) {
+            if ( _last_error() == ERROR_INVALID_PARAMETER )
+                throw std::invalid_argument("Line settings not supported by the port!");
+            throw error::SystemApiError(_last_error());
+        }
+    #else
+        ::termios tio {};
+        if ( ::tcgetattr(file, &tio) < 0 )
+            throw error::SystemApiError(_last_error());
+
+        ::cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+
+        tio.c_cflag &= ~CSIZE;
+        switch ( options.data_bits ) {
+            case 5:  tio.c_cflag |= CS5; break;
+            case 6:  tio.c_cflag |= CS6; break;
+            case 7:  tio.c_cflag |= CS7; break;
+            default: tio.c_cflag |= CS8; break;
+        }
+
+        tio.c_cflag &= ~(PARENB | PARODD);
+        if ( options.parity != SerialOptions::NoParity )
+            tio.c_cflag |= options.parity == SerialOptions::OddParity ? PARENB | PARODD : PARENB;
+
+        if ( options.stop_bits == 2 )
+            tio.c_cflag |= CSTOPB;
+        else
+            tio.c_cflag &= ~CSTOPB;
+
+        #ifdef CRTSCTS
+        if ( options.hardware_flow_control )
+            tio.c_cflag |= CRTSCTS;
+        else
+            tio.c_cflag &= ~CRTSCTS;
+        #else
+        if ( options.hardware_flow_control )
+            throw std::invalid_argument("Hardware flow control not supported!");
+        #endif
+
+        // Reads return what is there at once, as the port is non-blocking and waited on with poll.
+        // VMIN 1 rather than 0, so no data reads as EAGAIN, and only a hang-up as end of file
+        tio.c_cc[VMIN]  = 1;
+        tio.c_cc[VTIME] = 0;
+
+        speed_t speed = _standard_speed(options.baud_rate);
+        #ifdef __linux__
+            if ( speed == B0 ) {
+                // Set the rest first, then the rate itself through the kernel's termios2
+                if ( ::tcsetattr(file, TCSANOW, &tio) < 0 )
+                    throw error::SystemApiError(_last_error());
+
+                ::termios2 tio2 {};
+                if ( ::ioctl(file, TCGETS2, &tio2) < 0 )
+                    throw error::SystemApiError(_last_error());
+
+                tio2.c_cflag &= ~CBAUD;
+                tio2.c_cflag |= BOTHER;
+                tio2.c_ispeed = options.baud_rate;
+                tio2.c_ospeed = options.baud_rate;
+
+                if ( ::ioctl(file, TCSETS2, &tio2) < 0 ) {
+                    if ( _last_error() == EINVAL )
+                        throw std::invalid_argument("Baud rate not supported by the port!");
+                    throw error::SystemApiError(_last_error());
+                }
+                return;
+            }
+        #else
+            if ( speed == B0 )
+                throw std::invalid_argument("Only the standard baud rates are supported on this system!");
+        #endif
+
+        ::cfsetispeed(&tio, speed);
+        ::cfsetospeed(&tio, speed);
+
+        if ( ::tcsetattr(file, TCSANOW, &tio) < 0 ) {
+            if ( _last_error() == EINVAL )
+                throw std::invalid_argument("Line settings not supported by the port!");
+            throw error::SystemApiError(_last_error());
+        }
+    #endif
+}
+
+static file_t _open(const std::string& path, const SerialOptions& options) {
+    _validate(options);
+
+    #ifdef _WIN32
+        // Ports above COM9 are only reachable through the device namespace
+        std::string device = path.rfind("\\\\", 0) == 0 ? path : "\\\\.\\" + path;
+        // Ports are always opened for exclusive access
+        file_t file = ::CreateFileA(device.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if ( file == INVALID_FILE )
+            throw error::SystemApiError(_last_error());
+    #else
+        // Non-blocking, as all waits are done with poll, and not the controlling terminal of the process
+        file_t file = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if ( file == INVALID_FILE )
+            throw error::SystemApiError(_last_error());
+
+        #ifdef TIOCEXCL
+        if ( options.exclusive && ::ioctl(file, TIOCEXCL) < 0 ) {
+            int err = _last_error();
+            ::close(file);
+            throw error::SystemApiError(err);
+        }
+        #endif
+    #endif
+
+    try {
+        _configure(file, options);
+    } catch ( ... ) {
+        #ifdef _WIN32
+            ::CloseHandle(file);
+        #else
+            ::close(file);
+        #endif
+        throw;
+    }
+    return file;
+}
+
+static void _close(file_t& file) noexcept {
+    if ( file == INVALID_FILE )
+        return;
+
+    #ifdef _WIN32
+        ::CloseHandle(file);
+    #else
+        ::close(file);
+    #endif
+    file = INVALID_FILE;
+}
+
+
+/********************************************/
+/* SerialPort::Impl                         */
+/********************************************/
+struct SerialPort::Impl {
+    typedef std::chrono::steady_clock clock;
+
+    file_t   file      = INVALID_FILE;
+    uint32_t frame_gap = 0;
+
+    // Data read by peek, and not yet received
+    std::string pending;
+
+    #ifdef _WIN32
+        // Read timeout the port is set to, to only change it when it differs
+        DWORD read_timeout = 0;
+        bool  timeouts_set = false;
+    #endif
+
+    ~Impl() {
+        _close(file);
+    }
+
+    // Read what is there, waiting up to the timeout for the first bytes - 0 on timeout. UINT64_MAX waits indefinitely
+    size_t read_some(char* buf, size_t size, uint64_t timeout) {
+        #ifdef _WIN32
+            // Return as soon as any byte arrived, or after the constant timeout if none did
+            DWORD constant = timeout >= MAXDWORD ? MAXDWORD - 1 : (DWORD) timeout;
+            if ( !timeouts_set || constant != read_timeout ) {
+                ::COMMTIMEOUTS timeouts {};
+                timeouts.ReadIntervalTimeout        = MAXDWORD;
+                timeouts.ReadTotalTimeoutMultiplier = timeout ? MAXDWORD : 0;
+                timeouts.ReadTotalTimeoutConstant   = constant;
+                if ( !::SetCommTimeouts(file, &timeouts) )
+                    _fail(_last_error());
+
+                read_timeout = constant;
+                timeouts_set = true;
+            }
+
+            DWORD received = 0;
+            if ( !::ReadFile(file, buf, (DWORD) std::min<size_t>(size, MAXDWORD), &received, nullptr) )
+                _fail(_last_error());
+            return received;
+        #else
+            ::pollfd fd {};
+            fd.fd     = file;
+            fd.events = POLLIN;
+
+            clock::time_point deadline = clock::now() + std::chrono::milliseconds(std::min<uint64_t>(timeout, INT_MAX));
+
+            for ( ;; ) {
+                ssize_t res = ::read(file, buf, size);
+                if ( res > 0 )
+                    return (size_t) res;
+                // A hung-up terminal reads as end of file
+                if ( res == 0 && size )
+                    throw error::SocketDisconnection("Serial port hung up!");
+                if ( res < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+                    _fail(_last_error());
+                if ( !size )
+                    return 0;
+
+                int wait = -1;
+                if ( timeout != UINT64_MAX )
+                    wait = (int) std::min<uint64_t>(ISocket::timeout_until(deadline), INT_MAX);
+
+                int ready = ::poll(&fd, 1, wait);
+                if ( ready < 0 && errno != EINTR )
+                    throw error::SystemApiError(_last_error());
+                if ( ready == 0 )
+                    return 0;
+                if ( ready > 0 && (fd.revents & (POLLHUP | POLLERR | POLLNVAL)) && !(fd.revents & POLLIN) )
+                    throw error::SocketDisconnection("Serial port hung up!");
+            }
+        #endif
+    }
+
+    // Read the first bytes within the timeout, then on until the line is quiet for the frame gap
+    size_t read_frame(char* buf, size_t size, uint64_t timeout) {
+        size_t received = read_some(buf, size, timeout);
+        if ( !received || !frame_gap )
+            return received;
+
+        while ( received < size ) {
+            size_t more = read_some(buf + received, size - received, frame_gap);
+            if ( !more )
+                break;
+            received += more;
+        }
+        return received;
+    }
+
+    size_t receive(char* buf, size_t size, uint64_t timeout) {
+        if ( pending.empty() )
+            return read_frame(buf, size, timeout);
+
+        size_t taken = std::min(size, pending.size());
+        std::memcpy(buf, pending.data(), taken);
+        pending.erase(0, taken);
+        return taken;
+    }
+
+    size_t peek(char* buf, size_t size, uint64_t timeout) {
+        if ( pending.empty() ) {
+            pending.resize(size);
+            pending.resize(read_frame(&pending[0], size, timeout));
+        }
+
+        size_t peeked = std::min(size, pending.size());
+        std::memcpy(buf, pending.data(), peeked);
+        return peeked;
+    }
+
+    size_t send(const char* buf, size_t size) {
+        size_t sent = 0;
+
+        while ( sent < size ) {
+            #ifdef _WIN32
+                // Write timeouts are left at 0, so a write blocks until it is handed to the driver
+                DWORD res = 0;
+                if ( !::WriteFile(file, buf + sent, (DWORD) std::min<size_t>(size - sent, MAXDWORD), &res, nullptr) )
+                    _fail(_last_error());
+                sent += res;
+            #else
+                ssize_t res = ::write(file, buf + sent, size - sent);
+                if ( res >= 0 ) {
+                    sent += (size_t) res;
+                    continue;
+                }
+                if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+                    _fail(_last_error());
+
+                // The output buffer is full, e.g. held back by flow control
+                ::pollfd fd {};
+                fd.fd     = file;
+                fd.events = POLLOUT;
+                if ( ::poll(&fd, 1, -1) < 0 && errno != EINTR )
+                    throw error::SystemApiError(_last_error());
+                if ( fd.revents & (POLLHUP | POLLERR | POLLNVAL) )
+                    throw error::SocketDisconnection("Serial port hung up!");
+            #endif
+        }
+        return sent;
+    }
+
+    size_t bytes_available() const {
+        #ifdef _WIN32
+            DWORD errors = 0;
+            ::COMSTAT status {};
+            if ( !::ClearCommError(file, &errors, &status) )
+                _fail(_last_error());
+            return pending.size() + status.cbInQue;
+        #else
+            int available = 0;
+            if ( ::ioctl(file, FIONREAD, &available) < 0 )
+                _fail(_last_error());
+            return pending.size() + (size_t) available;
+        #endif
+    }
+
+    bool connected() const {
+        #ifdef _WIN32
+            DWORD errors = 0;
+            ::COMSTAT status {};
+            return ::ClearCommError(file, &errors, &status) || !_disconnected(_last_error());
+        #else
+            ::pollfd fd {};
+            fd.fd     = file;
+            fd.events = 0;
+            if ( ::poll(&fd, 1, 0) > 0 && (fd.revents & (POLLHUP | POLLERR | POLLNVAL)) )
+                return false;
+            return true;
+        #endif
+    }
+};
+
+void SerialPort::ImplCleanup::operator()(Impl* ptr) const {
+    delete ptr;
+}
+
+
+/********************************************/
+/* SerialPort                               */
+/********************************************/
+SerialPort::~SerialPort() {
+    close();
+}
+
+SerialPort::Impl& SerialPort::open_impl() const {
+    if ( !pimpl || pimpl->file == INVALID_FILE )
+        throw error::SetupError("Serial port not open!");
+    return *pimpl;
+}
+
+void SerialPort::open(const std::string& path, const SerialOptions& options) {
+    if ( pimpl && pimpl->file != INVALID_FILE )
+        throw error::SetupError("Serial port already open!");
+
+    if ( !pimpl )
+        pimpl.reset(new Impl());
+
+    pimpl->file      = _open(path, options);
+    pimpl->frame_gap = options.frame_gap;
+    pimpl->pending.clear();
+}
+
+void SerialPort::close() noexcept {
+    if ( !pimpl )
+        return;
+
+    _close(pimpl->file);
+    pimpl->pending.clear();
+    #ifdef _WIN32
+        pimpl->timeouts_set = false;
+    #endif
+}
+
+void SerialPort::configure(const SerialOptions& options) {
+    Impl& impl = open_impl();
+    _configure(impl.file, options);
+    impl.frame_gap = options.frame_gap;
+}
+
+void SerialPort::drain() {
+    Impl& impl = open_impl();
+    #ifdef _WIN32
+        if ( !::FlushFileBuffers(impl.file) )
+            _fail(_last_error());
+    #else
+        while ( ::tcdrain(impl.file) < 0 ) {
+            if ( errno != EINTR )
+                _fail(_last_error());
+        }
+    #endif
+}
+
+void SerialPort::discard() {
+    Impl& impl = open_impl();
+    impl.pending.clear();
+    #ifdef _WIN32
+        if ( !::PurgeComm(impl.file, PURGE_RXCLEAR | PURGE_TXCLEAR) )
+            _fail(_last_error());
+    #else
+        if ( ::tcflush(impl.file, TCIOFLUSH) < 0 )
+            _fail(_last_error());
+    #endif
+}
+
+sys::native_socket_t SerialPort::native_handle() const {
+    return (sys::native_socket_t) open_impl().file;
+}
+
+bool SerialPort::connected() const {
+    return open_impl().connected();
+}
+
+size_t SerialPort::bytes_available() const {
+    return open_impl().bytes_available();
+}
+
+size_t SerialPort::send(const char* buf, size_t size) {
+    return open_impl().send(buf, size);
+}
+
+size_t SerialPort::send(const std::string& packet) {
+    return send(packet.data(), packet.size());
+}
+
+size_t SerialPort::receive(char* buf, size_t size, uint64_t timeout) {
+    return open_impl().receive(buf, size, timeout);
+}
+
+std::string SerialPort::receive(size_t size, uint64_t timeout) {
+    std::string buffer(size, '\0');
+    buffer.resize(receive(&buffer[0], buffer.size(), timeout));
+    return buffer;
+}
+
+size_t SerialPort::peek(char* buf, size_t size, uint64_t timeout) {
+    return open_impl().peek(buf, size, timeout);
+}
+
+std::string SerialPort::peek(size_t size, uint64_t timeout) {
+    std::string buffer(size, '\0');
+    buffer.resize(peek(&buffer[0], buffer.size(), timeout));
+    return buffer;
+}
+}
@@ -0,0 +1,196 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file serialport.hpp
+ * @brief Implements a socket for serial (COM) ports
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_SERIALPORT_HPP_
+#define _SLEIPNER_TRANSPORT_SERIALPORT_HPP_
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "sleipner/transport/isocket.hpp"
+#include "sleipner/sys/socket.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Line settings for @b SerialPort::open
+ */
+struct SerialOptions {
+    enum Parity : uint8_t {
+        NoParity,
+        OddParity,
+        EvenParity
+    };
+
+    /// @brief Bits per second - any rate the device supports, not only the standard ones
+    uint32_t baud_rate = 115200;
+
+    /// @brief Data bits per character, 5 to 8
+    uint8_t data_bits = 8;
+
+    /// @brief Parity bit sent with every character
+    Parity parity = NoParity;
+
+    /// @brief Stop bits per character, 1 or 2
+    uint8_t stop_bits = 1;
+
+    /// @brief Use RTS/CTS hardware flow control
+    bool hardware_flow_control = false;
+
+    /**
+     * @brief Milliseconds of silence on the line that end a frame, 0 to return from @b receive
+     *        as soon as any data arrived
+     *
+     * Once the first bytes arrive, a receive keeps reading until the line is silent for this
+     * long, or the buffer is full. A frame sent by a device is then received whole, rather
+     * than in the pieces the driver happens to hand over, e.g. byte by byte at low baud rates.
+     */
+    uint32_t frame_gap = 0;
+
+    /// @brief Lock the port against being opened by other processes. Ignored where the system always does
+    bool exclusive = true;
+};
+
+/**
+ * @brief Socket for serial ports, e.g. @b /dev/ttyUSB0 or @b COM3
+ *
+ * The port is set to raw mode: bytes are passed through as they are, without echo, line
+ * editing or translation of line endings.
+ *
+ * Receives wait for data with the system (@b poll on POSIX), and never spin. Many ports can
+ * be served from one thread by watching @b native_handle with a @b Reactor on POSIX, and
+ * calling @b receive with a zero timeout when it is readable.
+ *
+ * Basic usage example:
+ * @code
+ * SerialOptions options;
+ * options.baud_rate = 9600;
+ * options.frame_gap = 5;
+ *
+ * SerialPort port;
+ * port.open("/dev/ttyUSB0", options);
+ *
+ * port.send("MEAS?\r\n");
+ * std::string reply = port.receive(256, 1000);
+ * @endcode
+ *
+ * @note Not thread-safe
+ */
+class SerialPort: public ISocket {
+protected:
+    struct Impl;
+    struct ImplCleanup { void operator()(Impl* ptr) const; };
+
+    std::unique_ptr<Impl, ImplCleanup> pimpl;
+
+    // The Impl of the open port - throws if not open
+    Impl& open_impl() const;
+
+public:
+    /**
+     * @brief Default constructor does not allow any operations to be carried out, except @b open
+     */
+    SerialPort() = default;
+
+    /**
+     * @brief Closes the port, if open
+     */
+    ~SerialPort();
+
+    SerialPort(SerialPort&& other) noexcept = default;
+    SerialPort& operator=(SerialPort&& other) noexcept = default;
+
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+
+    /**
+     * @brief Open the port and configure the line
+     *
+     * @param [in] path The device, e.g. "/dev/ttyUSB0" on POSIX or "COM3" on Windows
+     * @param [in] options Line settings
+     * @throws std::invalid_argument If the settings are not valid, or the baud rate is not supported
+     * @throws SetupError If the port is already open
+     * @throws SystemApiError If the device can not be opened or configured
+     */
+    void open(const std::string& path, const SerialOptions& options = SerialOptions());
+
+    /**
+     * @brief Close the port. It can be opened again.
+     */
+    void close() noexcept;
+
+    /**
+     * @brief Change the line settings of the open port
+     *
+     * @throws std::invalid_argument If the settings are not valid
+     * @throws SetupError If the port is not open
+     * @throws SystemApiError
+     */
+    void configure(const SerialOptions& options);
+
+    /**
+     * @brief Wait until all sent data has been transmitted on the line
+     *
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    void drain();
+
+    /**
+     * @brief Discard the data received and not yet read, and the data sent and not yet transmitted
+     *
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    void discard();
+
+    /**
+     * @brief Retrieve the system handle of the port - a file descriptor on POSIX, which can be
+     *        watched by a @b Reactor, and a @b HANDLE on Windows
+     *
+     * @throws SetupError
+     */
+    sys::native_socket_t native_handle() const;
+
+    /**
+     * @brief Check if the port is open, and the device was not removed
+     *
+     * @throws SetupError
+     */
+    bool connected() const override;
+
+    /// @copydoc ISocket::bytes_available()
+    size_t bytes_available() const override;
+
+    /// @copydoc ISocket::send(const char*, size_t)
+    size_t send(const char* buf, size_t size) override;
+
+    /// @copydoc ISocket::send(const std::string&)
+    size_t send(const std::string& packet) override;
+
+    // Deadline and memory resource overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
+    /// @copydoc ISocket::receive(char*, size_t, uint64_t)
+    size_t receive(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::receive(size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(char*, size_t, uint64_t)
+    size_t peek(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) override;
+};
+}
+
+#endif
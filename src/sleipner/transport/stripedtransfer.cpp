@@ -0,0 +1,613 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/stripedtransfer.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/sys/native.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace sleipner::transport {
+/********************************************/
+/* Wire format                              */
+/********************************************/
+// Every connection opens with a hello: magic, version, transfer id, total size, chunk size, reorder window
+static constexpr char     MAGIC[4]    = {'S', 'L', 'S', 'T'};
+static constexpr uint32_t VERSION     = 2;
+static constexpr size_t   HELLO_SIZE  = 4 + 4 + 8 + 8 + 4 + 4;
+// Followed by any number of chunks: sequence number, length, data
+static constexpr size_t   HEADER_SIZE = 8 + 4;
+// The receiver answers every chunk stored with its sequence number
+static constexpr size_t   ACK_SIZE    = 8;
+
+// Readers wake up this often to check if the transfer is over
+static constexpr uint64_t POLL_INTERVAL = 100;
+
+static void _put(char* p, uint64_t value, size_t bytes) noexcept {
+    for ( size_t i = 0; i < bytes; i++ )
+        p[i] = (char) (value >> (8 * i));
+}
+
+static uint64_t _get(const char* p, size_t bytes) noexcept {
+    uint64_t value = 0;
+    for ( size_t i = 0; i < bytes; i++ )
+        value |= (uint64_t) (unsigned char) p[i] << (8 * i);
+    return value;
+}
+
+static void _send_all(TcpClient& client, const char* data, size_t size) {
+    while ( size ) {
+        size_t sent = client.send(data, size);
+        data += sent;
+        size -= sent;
+    }
+}
+
+// Without Nagle's algorithm - an acknowledgement must not wait for TCP to acknowledge the one before it
+static void _no_delay(const TcpClient& client) {
+    int enable = 1;
+    ::setsockopt(client.native_handle(), IPPROTO_TCP, TCP_NODELAY, (const char*)&enable, sizeof(enable));
+}
+
+// Returns false if stopped before all bytes arrived
+static bool _receive_all(TcpClient& client, char* buf, size_t size, const std::atomic<bool>& stopping) {
+    while ( size ) {
+        size_t received = client.receive(buf, size, POLL_INTERVAL);
+        if ( received == 0 && stopping.load() )
+            return false;
+        buf  += received;
+        size -= received;
+    }
+    return true;
+}
+
+/********************************************/
+/* Sending                                  */
+/********************************************/
+namespace {
+struct SendState {
+    net::IpAddress address;
+    const char*    data;    // Null when sending a file
+    std::string    path;
+    uint64_t       size;
+    uint64_t       chunks;
+    uint32_t       chunk_size;
+    uint32_t       window;
+    uint64_t       id;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::condition_variable claimable;  // Chunks acknowledged, or put back to retry
+    std::deque<uint64_t>    retry;
+    std::vector<bool>       acked;
+    uint64_t                base    = 0;    // First chunk not acknowledged
+    uint64_t                next    = 0;
+    uint64_t                done    = 0;
+    size_t                  live    = 0;
+    size_t                  retries = 0;
+    std::exception_ptr      error;
+    std::atomic<uint64_t>   bytes   = {0};
+
+    enum Claim { Claimed, Blocked, Finished };
+
+    Claim claim(uint64_t& seq) {
+        std::lock_guard lock(mutex);
+        if ( !retry.empty() ) {
+            seq = retry.front();
+            retry.pop_front();
+            return Claimed;
+        }
+        if ( next == chunks )
+            return Finished;
+        // The receiver holds at most a window of chunks after the first one it is missing
+        if ( next >= base + window )
+            return Blocked;
+        seq = next++;
+        return Claimed;
+    }
+
+    // Called with the state locked
+    void acknowledge(uint64_t seq) {
+        if ( acked[seq] )
+            return;
+
+        acked[seq] = true;
+        bytes.fetch_add(std::min<uint64_t>(chunk_size, size - seq * chunk_size));
+        while ( base < chunks && acked[base] )
+            base++;
+
+        if ( ++done == chunks )
+            cv.notify_all();
+        claimable.notify_all();
+    }
+
+    bool work_left() const noexcept {
+        return !retry.empty() || next < chunks;
+    }
+};
+
+struct Stream {
+    std::thread       thread;
+    std::atomic<bool> retire   = {false};
+    std::atomic<bool> finished = {false};
+};
+}
+
+static void _send_stream(SendState& state, Stream& stream) {
+    std::ifstream file;
+    std::string   scratch;
+    char          ack[ACK_SIZE];
+    size_t        ack_bytes = 0;
+
+    // Chunks sent on this connection and not acknowledged yet, in the order sent
+    std::deque<uint64_t> unacked;
+
+    try {
+        TcpClient client;
+        client.connect(state.address);
+        _no_delay(client);
+
+        char hello[HELLO_SIZE];
+        std::copy(MAGIC, MAGIC + 4, hello);
+        _put(hello + 4, VERSION, 4);
+        _put(hello + 8, state.id, 8);
+        _put(hello + 16, state.size, 8);
+        _put(hello + 24, state.chunk_size, 4);
+        _put(hello + 28, state.window, 4);
+        _send_all(client, hello, HELLO_SIZE);
+
+        // Take the acknowledgements that have arrived, waiting up to the timeout for the first
+        auto receive_acks = [&](uint64_t timeout) {
+            for ( ;; ) {
+                size_t received = client.receive(ack + ack_bytes, ACK_SIZE - ack_bytes, timeout);
+                if ( received == 0 )
+                    return;
+
+                timeout    = 0;
+                ack_bytes += received;
+                if ( ack_bytes < ACK_SIZE )
+                    continue;
+                ack_bytes = 0;
+
+                // The receiver reads, and so acknowledges, the chunks of a connection in order
+                uint64_t seq = _get(ack, 8);
+                if ( unacked.empty() || unacked.front() != seq )
+                    throw error::ProtocolError("Unexpected acknowledgement!");
+                unacked.pop_front();
+
+                std::lock_guard lock(state.mutex);
+                state.acknowledge(seq);
+            }
+        };
+
+        for ( ;; ) {
+            uint64_t seq = 0;
+            SendState::Claim claim = stream.retire.load() ? SendState::Finished : state.claim(seq);
+
+            if ( claim == SendState::Blocked || (claim == SendState::Finished && !unacked.empty()) ) {
+                if ( !unacked.empty() ) {
+                    receive_acks(POLL_INTERVAL);
+                } else {
+                    // Waiting for the chunks of other connections to be acknowledged
+                    std::unique_lock lock(state.mutex);
+                    state.claimable.wait_for(lock, std::chrono::milliseconds(POLL_INTERVAL));
+                }
+                continue;
+            }
+
+            if ( claim == SendState::Finished )
+                break;
+
+            unacked.push_back(seq);
+
+            uint64_t offset = seq * state.chunk_size;
+            size_t   length = (size_t) std::min<uint64_t>(state.chunk_size, state.size - offset);
+            const char* payload;
+
+            if ( state.data ) {
+                payload = state.data + offset;
+            } else {
+                if ( !file.is_open() ) {
+                    file.open(state.path, std::ios::binary);
+                    if ( !file )
+                        throw std::invalid_argument("Could not open file: " + state.path);
+                }
+                scratch.resize(length);
+                file.seekg((std::streamoff) offset);
+                if ( !file.read(&scratch[0], (std::streamsize) length) )
+                    throw std::invalid_argument("Could not read file: " + state.path);
+                payload = scratch.data();
+            }
+
+            char header[HEADER_SIZE];
+            _put(header, seq, 8);
+            _put(header + 8, length, 4);
+            _send_all(client, header, HEADER_SIZE);
+            _send_all(client, payload, length);
+
+            receive_acks(0);
+        }
+    } catch ( ... ) {
+        std::lock_guard lock(state.mutex);
+        // Sent or not, the receiver may not have what it did not acknowledge
+        for ( uint64_t seq: unacked )
+            state.retry.push_back(seq);
+        state.retries += unacked.size();
+        state.error = std::current_exception();
+        state.claimable.notify_all();
+    }
+
+    std::lock_guard lock(state.mutex);
+    state.live--;
+    stream.finished.store(true);
+    state.cv.notify_all();
+}
+
+/********************************************/
+/* Receiving                                */
+/********************************************/
+namespace {
+struct ReceiveState {
+    std::mutex              mutex;
+    std::condition_variable cv;
+    bool                    started    = false;
+    uint64_t                id         = 0;
+    uint64_t                size       = 0;
+    uint64_t                chunks     = 0;
+    uint32_t                chunk_size = 0;
+    uint32_t                window     = 0;
+    uint64_t                next       = 0;
+    std::map<uint64_t, std::string> pending;
+    std::exception_ptr      error;
+    std::atomic<bool>       stopping   = {false};
+};
+}
+
+static void _receive_stream(ReceiveState& state, std::shared_ptr<TcpClient> client) {
+    try {
+        _no_delay(*client);
+
+        char hello[HELLO_SIZE];
+        if ( !_receive_all(*client, hello, HELLO_SIZE, state.stopping) )
+            return;
+
+        // Not part of a striped transfer - drop the connection
+        if ( !std::equal(MAGIC, MAGIC + 4, hello) || _get(hello + 4, 4) != VERSION || _get(hello + 24, 4) == 0 )
+            return;
+
+        // The sender would get further ahead than the receiver can hold
+        if ( _get(hello + 28, 4) > state.window )
+            return;
+
+        {
+            std::lock_guard lock(state.mutex);
+            if ( !state.started ) {
+                state.started    = true;
+                state.id         = _get(hello + 8, 8);
+                state.size       = _get(hello + 16, 8);
+                state.chunk_size = (uint32_t) _get(hello + 24, 4);
+                state.chunks     = (state.size + state.chunk_size - 1) / state.chunk_size;
+                state.cv.notify_all();
+            } else if ( state.id != _get(hello + 8, 8) ) {
+                return;
+            }
+        }
+
+        for ( ;; ) {
+            char header[HEADER_SIZE];
+            if ( !_receive_all(*client, header, HEADER_SIZE, state.stopping) )
+                return;
+
+            uint64_t seq    = _get(header, 8);
+            size_t   length = (size_t) _get(header + 8, 4);
+
+            if ( seq >= state.chunks || length != std::min<uint64_t>(state.chunk_size, state.size - seq * state.chunk_size) )
+                return;
+
+            {
+                // Stop reading from a connection that is too far ahead, until the chunks before it are in
+                std::unique_lock lock(state.mutex);
+                while ( seq >= state.next + state.window ) {
+                    if ( state.stopping.load() )
+                        return;
+                    state.cv.wait_for(lock, std::chrono::milliseconds(POLL_INTERVAL));
+                }
+            }
+
+            std::string chunk(length, '\0');
+            if ( !_receive_all(*client, &chunk[0], length, state.stopping) )
+                return;
+
+            {
+                std::lock_guard lock(state.mutex);
+                // A chunk resent after a drop may have arrived already
+                if ( seq >= state.next && state.pending.emplace(seq, std::move(chunk)).second && seq == state.next )
+                    state.cv.notify_all();
+            }
+
+            // Acknowledged once stored, whether it was new or not
+            char ack[ACK_SIZE];
+            _put(ack, seq, 8);
+            _send_all(*client, ack, ACK_SIZE);
+        }
+    } catch ( error::SocketDisconnection& ) {
+        /* The sender closes connections it no longer needs */
+    } catch ( ... ) {
+        std::lock_guard lock(state.mutex);
+        state.error = std::current_exception();
+        state.cv.notify_all();
+    }
+}
+
+/********************************************/
+/* StripedTransfer                          */
+/********************************************/
+StripedTransfer::StripedTransfer(const StripeOptions& options): options(options) {
+    if ( options.min_streams == 0 || options.min_streams > options.max_streams )
+        throw std::invalid_argument("Invalid range of streams!");
+    if ( options.streams < options.min_streams || options.streams > options.max_streams )
+        throw std::invalid_argument("Initial streams out of range!");
+    if ( options.chunk_size == 0 )
+        throw std::invalid_argument("Chunk size must be positive!");
+    if ( options.reorder_window == 0 )
+        throw std::invalid_argument("Reorder window must be positive!");
+    if ( options.probe_interval.count() <= 0 )
+        throw std::invalid_argument("Probe interval must be positive!");
+}
+
+TransferStats StripedTransfer::send(const net::IpAddress& address, const char* data, size_t size) {
+    if ( !data && size )
+        throw std::invalid_argument("Null data!");
+    return send(address, data ? data : "", nullptr, size);
+}
+
+TransferStats StripedTransfer::send(const net::IpAddress& address, const std::string& data) {
+    return send(address, data.data(), nullptr, data.size());
+}
+
+TransferStats StripedTransfer::send_file(const net::IpAddress& address, const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if ( !file )
+        throw std::invalid_argument("Could not open file: " + path);
+
+    return send(address, nullptr, &path, (uint64_t) file.tellg());
+}
+
+TransferStats StripedTransfer::send(const net::IpAddress& address, const char* data, const std::string* path, uint64_t size) {
+    SendState state;
+    state.address    = address;
+    state.data       = data;
+    state.path       = path ? *path : std::string();
+    state.size       = size;
+    state.chunk_size = options.chunk_size;
+    state.window     = options.reorder_window;
+    state.chunks     = (size + options.chunk_size - 1) / options.chunk_size;
+    state.acked.resize(state.chunks);
+    state.id         = ((uint64_t) std::random_device{}() << 32) | std::random_device{}();
+
+    TransferStats stats;
+    std::vector<std::unique_ptr<Stream>> streams;
+
+    auto active = [&] {
+        return (size_t) std::count_if(streams.begin(), streams.end(), [](const std::unique_ptr<Stream>& s) {
+            return !s->retire.load() && !s->finished.load();
+        });
+    };
+
+    // Called with the state locked
+    auto spawn = [&] {
+        streams.emplace_back(new Stream());
+        Stream& stream = *streams.back();
+        state.live++;
+        try {
+            stream.thread = std::thread([&state, &stream] { _send_stream(state, stream); });
+        } catch ( ... ) {
+            state.live--;
+            stream.finished.store(true);
+            throw;
+        }
+        stats.peak_streams = std::max(stats.peak_streams, active());
+    };
+
+    auto join = [&] {
+        for ( auto& stream: streams )
+            if ( stream->thread.joinable() )
+                stream->thread.join();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        std::unique_lock lock(state.mutex);
+
+        // A hello is sent even for an empty transfer, so the receiver completes
+        for ( size_t i = 0; i < std::max<uint64_t>(1, std::min<uint64_t>(options.streams, state.chunks)); i++ )
+            spawn();
+
+        auto     probe_start = start;
+        uint64_t probe_bytes = 0;
+        double   last_rate   = 0;
+        int      direction   = 1;
+        uint64_t done_at_respawn = UINT64_MAX;
+
+        while ( state.done < state.chunks || state.live > 0 ) {
+            state.cv.wait_for(lock, options.probe_interval);
+
+            if ( state.done == state.chunks ) {
+                if ( state.live == 0 )
+                    break;
+                continue;
+            }
+
+            // Every connection is gone with work left - start over on a new one, unless that made no progress either
+            if ( active() == 0 && state.work_left() ) {
+                if ( state.done == done_at_respawn )
+                    break;
+                done_at_respawn = state.done;
+                spawn();
+                continue;
+            }
+
+            auto     now   = std::chrono::steady_clock::now();
+            uint64_t bytes = state.bytes.load();
+            double   rate  = (double) (bytes - probe_bytes) / std::chrono::duration<double>(now - probe_start).count();
+            probe_start = now;
+            probe_bytes = bytes;
+
+            // Hill climbing - keep adding (or removing) connections while it raises the throughput
+            if ( rate < last_rate * 0.95 )
+                direction = -direction;
+            else if ( rate <= last_rate * 1.05 ) {
+                last_rate = rate;
+                continue;
+            }
+            last_rate = rate;
+
+            size_t current = active();
+            if ( direction > 0 && current < options.max_streams && state.work_left() )
+                spawn();
+            else if ( direction < 0 && current > options.min_streams ) {
+                for ( auto it = streams.rbegin(); it != streams.rend(); it++ )
+                    if ( !(*it)->retire.load() && !(*it)->finished.load() ) {
+                        (*it)->retire.store(true);
+                        break;
+                    }
+            }
+        }
+
+        stats.final_streams = active();
+    } catch ( ... ) {
+        {
+            std::lock_guard lock(state.mutex);
+            for ( auto& stream: streams )
+                stream->retire.store(true);
+        }
+        join();
+        throw;
+    }
+
+    join();
+
+    if ( state.done < state.chunks ) {
+        if ( state.error )
+            std::rethrow_exception(state.error);
+        throw error::SocketDisconnection("Transfer interrupted!");
+    }
+
+    if ( state.chunks == 0 && state.error )
+        std::rethrow_exception(state.error);
+
+    stats.bytes   = size;
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+    stats.retries = state.retries;
+    return stats;
+}
+
+bool StripedTransfer::receive(TcpListener& listener, const Sink& sink, uint64_t timeout) {
+    ReceiveState             state;
+    std::vector<std::thread> readers;
+    state.window = options.reorder_window;
+
+    std::thread acceptor([&] {
+        try {
+            while ( !state.stopping.load() ) {
+                std::shared_ptr<TcpClient> client(new TcpClient());
+                if ( listener.accept(*client, POLL_INTERVAL) )
+                    readers.emplace_back(_receive_stream, std::ref(state), client);
+            }
+        } catch ( ... ) {
+            std::lock_guard lock(state.mutex);
+            state.error = std::current_exception();
+            state.cv.notify_all();
+        }
+    });
+
+    auto stop = [&] {
+        state.stopping.store(true);
+        acceptor.join();
+        for ( auto& reader: readers )
+            reader.join();
+    };
+
+    bool complete = false;
+
+    try {
+        std::unique_lock lock(state.mutex);
+
+        auto ready = [&] {
+            return state.error || (state.started && (state.next == state.chunks || state.pending.count(state.next)));
+        };
+
+        for ( ;; ) {
+            if ( !state.cv.wait_for(lock, std::chrono::milliseconds(timeout), ready) )
+                break;
+
+            if ( state.error )
+                break;
+
+            if ( state.next == state.chunks ) {
+                complete = true;
+                break;
+            }
+
+            // Hand over every chunk that is now in order
+            auto it = state.pending.begin();
+            while ( it != state.pending.end() && it->first == state.next ) {
+                std::string chunk = std::move(it->second);
+                state.pending.erase(it);
+                state.next++;
+
+                lock.unlock();
+                sink(chunk.data(), chunk.size());
+                lock.lock();
+
+                it = state.pending.begin();
+            }
+
+            // Readers waiting for room in the window
+            state.cv.notify_all();
+        }
+    } catch ( ... ) {
+        stop();
+        throw;
+    }
+
+    stop();
+
+    if ( state.error )
+        std::rethrow_exception(state.error);
+
+    return complete;
+}
+
+bool StripedTransfer::receive(TcpListener& listener, std::string& data, uint64_t timeout) {
+    data.clear();
+    return receive(listener, [&](const char* chunk, size_t size) { data.append(chunk, size); }, timeout);
+}
+
+bool StripedTransfer::receive_file(TcpListener& listener, const std::string& path, uint64_t timeout) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if ( !file )
+        throw std::invalid_argument("Could not open file: " + path);
+
+    return receive(listener, [&](const char* chunk, size_t size) {
+        if ( !file.write(chunk, (std::streamsize) size) )
+            throw std::invalid_argument("Could not write file: " + path);
+    }, timeout);
+}
+}
@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file stripedtransfer.hpp
+ * @brief Bulk transfers striped over several parallel TCP connections
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_STRIPEDTRANSFER_HPP_
+#define _SLEIPNER_TRANSPORT_STRIPEDTRANSFER_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "sleipner/transport/tcplistener.hpp"
+#include "sleipner/net/ip.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Options for @b StripedTransfer
+ */
+struct StripeOptions {
+    /// @brief Number of connections to start a transfer with
+    size_t streams = 4;
+
+    /// @brief Lower limit of connections, when shrinking
+    size_t min_streams = 1;
+
+    /// @brief Upper limit of connections, when growing
+    size_t max_streams = 16;
+
+    /// @brief Size of the sequence-numbered chunks the data is split into
+    uint32_t chunk_size = 1 << 20;
+
+    /**
+     * @brief Most chunks the receiver holds while waiting for an earlier one
+     *
+     * Bounds the memory of the receiver to about @b reorder_window * @b chunk_size. The sender
+     * keeps within its window, and the receiver drops connections of a sender with a larger
+     * window than its own.
+     */
+    uint32_t reorder_window = 64;
+
+    /// @brief How often to measure the throughput, and add or remove a connection
+    std::chrono::milliseconds probe_interval = std::chrono::milliseconds(200);
+};
+
+/**
+ * @brief Summary of a completed transfer
+ */
+struct TransferStats {
+    /// @brief Bytes of data transferred, excluding framing
+    uint64_t bytes = 0;
+
+    /// @brief Time from the first connect until the last chunk was acknowledged
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::duration::zero();
+
+    /// @brief Largest number of connections used at once
+    size_t peak_streams = 0;
+
+    /// @brief Number of connections in use when the transfer finished
+    size_t final_streams = 0;
+
+    /// @brief Number of chunks sent again after their connection dropped before they were acknowledged
+    size_t retries = 0;
+};
+
+/**
+ * @brief Splits bulk transfers over several TCP connections to the same endpoint
+ *
+ * On links with a long round-trip time, the throughput of a single connection is limited
+ * by its congestion window. Striping the data over K connections gives K windows, filling
+ * the link without touching the congestion control settings of the system.
+ *
+ * The data is split into sequence-numbered chunks, which idle connections take in turn,
+ * so a slow connection simply carries fewer chunks. The receiver reassembles them, and
+ * hands the data over in order. While sending, the throughput is measured every probe
+ * interval, and connections are added while that helps, and removed when it hurts.
+ *
+ * The receiver acknowledges every chunk it has stored, and a chunk only counts as sent
+ * once acknowledged - the chunks a dropped connection had not had acknowledged are sent
+ * again on another one. The sender stays at most @b reorder_window chunks ahead of the
+ * first one not acknowledged, so the receiver never holds more than that out of order.
+ *
+ * Basic usage example:
+ * @code
+ * // Receiver
+ * TcpListener listener;
+ * listener.listen(resolve_ip("0.0.0.0", 9000).front());
+ * StripedTransfer().receive_file(listener, "backup.tar", 10000);
+ *
+ * // Sender
+ * TransferStats stats = StripedTransfer().send_file(resolve_ip("backup.example.com", 9000).front(), "backup.tar");
+ * @endcode
+ *
+ * @note A listener should be used by one receiving transfer at a time
+ */
+class StripedTransfer {
+public:
+    /// @brief Called with the received data, in order
+    typedef std::function<void(const char* data, size_t size)> Sink;
+
+    /**
+     * @throws std::invalid_argument If the options are inconsistent
+     */
+    explicit StripedTransfer(const StripeOptions& options = StripeOptions());
+
+    /**
+     * @brief Send the buffer, striped over several connections to the address
+     *
+     * @param [in] address The address of the receiver
+     * @param [in] data The data to send, must stay valid until the call returns
+     * @param [in] size Number of bytes to send
+     * @throws std::invalid_argument If the address is obviously malformed
+     * @throws ConnectionFailure If no connection could be made
+     * @throws SocketDisconnection If every connection dropped before the transfer was done
+     * @throws SystemApiError
+     * @return TransferStats Summary of the transfer
+     */
+    TransferStats send(const net::IpAddress& address, const char* data, size_t size);
+
+    /// @copydoc StripedTransfer::send(const net::IpAddress&, const char*, size_t)
+    TransferStats send(const net::IpAddress& address, const std::string& data);
+
+    /**
+     * @brief Send the contents of a file, striped over several connections to the address
+     *
+     * Every connection reads its own chunks from the file.
+     *
+     * @throws std::invalid_argument If the file can not be read
+     * @copydetails StripedTransfer::send(const net::IpAddress&, const char*, size_t)
+     */
+    TransferStats send_file(const net::IpAddress& address, const std::string& path);
+
+    /**
+     * @brief Accept the connections of one transfer, and pass its data to the sink in order
+     *
+     * @param [in] listener A listening socket the sender connects to
+     * @param [in] sink Called with the data, in order, on the calling thread
+     * @param [in] timeout Milliseconds to wait for the transfer to make progress
+     * @throws SetupError If the listener is not listening
+     * @throws SystemApiError
+     * @return bool True if the transfer completed, false if it stalled for longer than the timeout
+     */
+    bool receive(TcpListener& listener, const Sink& sink, uint64_t timeout);
+
+    /**
+     * @brief Receive one transfer into a string
+     *
+     * @param [out] data Replaced with the data received
+     * @copydetails StripedTransfer::receive(TcpListener&, const Sink&, uint64_t)
+     */
+    bool receive(TcpListener& listener, std::string& data, uint64_t timeout);
+
+    /**
+     * @brief Receive one transfer into a file
+     *
+     * @param [in] path The file to write, replaced if it exists
+     * @throws std::invalid_argument If the file can not be written
+     * @copydetails StripedTransfer::receive(TcpListener&, const Sink&, uint64_t)
+     */
+    bool receive_file(TcpListener& listener, const std::string& path, uint64_t timeout);
+
+protected:
+    const StripeOptions options;
+
+    TransferStats send(const net::IpAddress& address, const char* data, const std::string* path, uint64_t size);
+};
+}
+
+#endif
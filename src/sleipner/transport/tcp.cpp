@@ -3,49 +3,27 @@
  * This software is provided under the MIT License.
  * See LICENSE file for details
  */
-#ifndef _WIN32
-#error "tcpclient.cpp Not yet implemented!"
-#endif
-
 #include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/basicsocket.hpp"
+#include "sleipner/transport/tcplistener.hpp"
 #include "sleipner/transport/error.hpp"
 #include "sleipner/sys/error.hpp"
+#include "sleipner/sys/native.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
 
 #ifdef _WIN32
-    #include <WinSock2.h>
-    #include <WS2tcpip.h>
     #include "sleipner/sys/winsock.hpp"
+#endif
 
-    #ifndef VALIDATE_SOCKET
-    #define VALIDATE_SOCKET(socket) (socket != INVALID_SOCKET)
-    #endif
-
-    #ifndef SOCKET_FAILURE
-    #define SOCKET_FAILURE(res) (res == SOCKET_ERROR)
-    #endif
-
-#else
-    #error "Still not implemented..."
-
-    #ifndef INVALID_SOCKET
-    #define INVALID_SOCKET -1
-    #endif
-
-    #ifndef VALIDATE_SOCKET
-    #define VALIDATE_SOCKET(socket) (socket >= 0)
-    #endif
-
-    #ifndef SOCKET_FAILURE
-    #define SOCKET_FAILURE(res) (res < 0)
-    #endif
+#ifdef __linux__
+    #include <linux/filter.h>
 #endif
 
 namespace sleipner::transport {
-#ifdef _WIN32
-    typedef SOCKET socket_t;
-#else
-    typedef int socket_t;
-#endif
+using sys::socket_t;
 
 /********************************************/
 /* System specific socket methods           */
@@ -57,7 +35,12 @@ static void _new_socket(socket_t& socket, int family) {
     if ( family != AF_INET && family != AF_INET6 )
         throw std::invalid_argument("Invalid address family!");
 
-    socket = ::socket(family, SOCK_STREAM, 0);
+    #ifdef _WIN32
+        socket = ::socket(family, SOCK_STREAM, 0);
+    #else
+        // Waits are done with poll, so the socket never has to block - and must not leak into children
+        socket = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    #endif
 
     // Should not fail - all socket inputs are guaranteed to be valid...
     if ( !VALIDATE_SOCKET(socket) )
@@ -66,160 +49,302 @@ static void _new_socket(socket_t& socket, int family) {
 
 static void _close_socket(socket_t& socket) noexcept {
     // Ignore errors in closing...
-    if ( VALIDATE_SOCKET(socket) )
-        #ifdef _WIN32
-            ::closesocket(socket);
-        #else
-            ::close(socket);
-        #endif
-    socket = INVALID_SOCKET;
+    sys::close_socket(socket);
 }
 
-static void _connect(socket_t& socket, const net::IpAddress& address) {
-    if ( address.addr.size() != sizeof(::sockaddr_in) && address.addr.size() != sizeof(::sockaddr_in6) )
-        throw std::invalid_argument("Invalid address structure!");
+// Wait until the socket is readable, or writable, or has failed - false on timeout. UINT64_MAX waits indefinitely
+static bool _wait(const socket_t& socket, bool write, uint64_t timeout) {
+    #ifdef _WIN32
+        ::fd_set fds;
+        ::fd_set failed;
+        ::timeval tv {0};
 
-    ::sockaddr* addr = reinterpret_cast<::sockaddr*>(const_cast<char*>(address.addr.data()));
+        tv.tv_sec  = (long) (timeout / 1000);
+        tv.tv_usec = (long) (timeout % 1000) * 1000;
+
+        FD_ZERO(&fds);
+        FD_SET(socket, &fds);
+        FD_ZERO(&failed);
+        FD_SET(socket, &failed);
 
-    int res = ::connect(socket, addr, address.addr.size());
+        // A failed connect is only reported in the exception set
+        int res = ::select(0, write ? nullptr : &fds, write ? &fds : nullptr, write ? &failed : nullptr,
+                           timeout == UINT64_MAX ? nullptr : &tv);
+    #else
+        // poll has no limit on the descriptor number, unlike select with FD_SETSIZE
+        ::pollfd fd {};
+        fd.fd     = socket;
+        fd.events = write ? POLLOUT : POLLIN;
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::min<uint64_t>(timeout, INT_MAX));
+        int res;
+
+        for ( ;; ) {
+            int wait = -1;
+            if ( timeout != UINT64_MAX )
+                wait = (int) std::min<uint64_t>(ISocket::timeout_until(deadline), INT_MAX);
+
+            res = ::poll(&fd, 1, wait);
+            if ( !(SOCKET_FAILURE(res) && errno == EINTR) )
+                break;
+        }
+    #endif
 
+    /// @todo - Map "valid" errors
     if ( SOCKET_FAILURE(res) ) {
         int err = ::WSAGetLastError();
-        _close_socket(socket);
 
         switch ( err ) {
-            case WSAEWOULDBLOCK:   // Pending completion
-                /// @todo...
-                throw std::runtime_error("Incomplete handling not yet implemented!");
-
-            case WSAENETDOWN:      // Dead network
-            case WSAEADDRINUSE:    // Address "occupied"
-            case WSAEINTR:         // Interrupted by blocking call -> try again
-            case WSAEINPROGRESS:   // Blocking operation currently executing
-            case WSAEALREADY:      // Socket already has active operation
-            case WSAEADDRNOTAVAIL: // Address not valid
-            case WSAECONNREFUSED:  // Connection rejected
-            case WSAENETUNREACH:   // Unreachable network
-            case WSAEHOSTUNREACH:  // Unreachable host
-            case WSAETIMEDOUT:     // No response within reasonable time
+            case WSAENETDOWN:
                 throw error::ConnectionFailure(sys::error_message(err));
 
-            case WSAEAFNOSUPPORT:  // Address incompatible with protocol - should not happen...
-            case WSAEFAULT:        // Invalid address pointer
-            case WSAEINVAL:        // Invalid argument
-                throw std::invalid_argument(sys::error_message(err));
+            case WSAEINPROGRESS:
+                throw std::runtime_error("Incomplete handling/retry not yet implemented!");
 
-            // case WSANOTINITIALIZED:
-            // case WSAEISCONN:       // Socket already connected -> Should not happen
-            // case WSAENOBUFS:       // Buffer/queue full
-            // case WSAENOTSOCK:      // Operation on something that is not a socket
-            // case WSAEACCES:        // Access forbidden
+            // case WSAENOTSOCK:
+            // case WSAEINTR: // Interrupted through WSACancelBlockingCall
+            // case WSAEFAULT:
+            // case WSANOTINITIALISED:
             default:
                 throw error::SystemApiError(err);
         }
     }
+
+    return res > 0;
 }
 
-static size_t _send(socket_t& socket, const char* data, size_t size) {
-    if ( !VALIDATE_SOCKET(socket) )
-        throw error::SetupError("TCP socket not connected!");
+[[noreturn]] static void _throw_connect_error(int err) {
+    switch ( err ) {
+        case WSAEWOULDBLOCK:   // Pending completion
+            /// @todo...
+            throw std::runtime_error("Incomplete handling not yet implemented!");
+
+        case WSAENETDOWN:      // Dead network
+        case WSAEADDRINUSE:    // Address "occupied"
+        case WSAEINTR:         // Interrupted by blocking call -> try again
+        case WSAEINPROGRESS:   // Blocking operation currently executing
+        case WSAEALREADY:      // Socket already has active operation
+        case WSAEADDRNOTAVAIL: // Address not valid
+        case WSAECONNREFUSED:  // Connection rejected
+        case WSAENETUNREACH:   // Unreachable network
+        case WSAEHOSTUNREACH:  // Unreachable host
+        case WSAETIMEDOUT:     // No response within reasonable time
+            throw error::ConnectionFailure(sys::error_message(err));
+
+        case WSAEAFNOSUPPORT:  // Address incompatible with protocol - should not happen...
+        case WSAEFAULT:        // Invalid address pointer
+        case WSAEINVAL:        // Invalid argument
+            throw std::invalid_argument(sys::error_message(err));
+
+        // case WSANOTINITIALIZED:
+        // case WSAEISCONN:       // Socket already connected -> Should not happen
+        // case WSAENOBUFS:       // Buffer/queue full
+        // case WSAENOTSOCK:      // Operation on something that is not a socket
+        // case WSAEACCES:        // Access forbidden
+        default:
+            throw error::SystemApiError(err);
+    }
+}
 
-    int res = ::send(socket, data, size, 0);
+static bool _start_connect(socket_t& socket, const net::IpAddress& address);
+static void _finish_connect(socket_t& socket);
 
-    if ( SOCKET_FAILURE(res) ) {
-        int err = ::WSAGetLastError();
+static void _connect(socket_t& socket, const net::IpAddress& address, Deadline deadline = Deadline::max()) {
+    #ifdef _WIN32
+        // Without a deadline, a blocking connect will do - with one, connect as on POSIX
+        if ( deadline == Deadline::max() ) {
+            if ( address.addr.size() != sizeof(::sockaddr_in) && address.addr.size() != sizeof(::sockaddr_in6) )
+                throw std::invalid_argument("Invalid address structure!");
 
-        switch ( err ) {
-            case WSAENETDOWN:
-            case WSAENETRESET:
-            case WSAENOTCONN:
-            case WSAEHOSTUNREACH:
-            case WSAECONNABORTED:
-            case WSAECONNRESET:
-            case WSAETIMEDOUT:
-                throw error::SocketDisconnection(sys::error_message(err));
+            ::sockaddr* addr = reinterpret_cast<::sockaddr*>(const_cast<char*>(address.addr.data()));
 
-            case WSAEMSGSIZE:
-                throw std::overflow_error(sys::error_message(err));
+            int res = ::connect(socket, addr, address.addr.size());
 
-            case WSAEWOULDBLOCK:
-                throw std::runtime_error("Incomplete handling/retries not yet implemented!");
+            if ( SOCKET_FAILURE(res) ) {
+                int err = ::WSAGetLastError();
+                _close_socket(socket);
+                _throw_connect_error(err);
+            }
+            return;
+        }
+    #endif
 
-            // case WSAEINVAL:
-            // case WSAESHUTDOWN:
-            // case WSAEOPNOTSUPP:
-            // case WSAENOTSOCK:
-            // case WSAENOBUFS:
-            // case WSAEFAULT:
-            // case WSAEINTR: // Interrupted through WSACancelBlockingCall
-            // case WSANOTINITIALISED:
-            // case WSAEACCES:
-            default:
-                throw error::SystemApiError(err);
+    // The socket is non-blocking - wait for the handshake as a blocking connect would, up to the deadline
+    if ( !_start_connect(socket, address) ) {
+        bool ready;
+        try {
+            ready = _wait(socket, true, ISocket::timeout_until(deadline));
+        } catch ( ... ) {
+            _close_socket(socket);
+            throw;
+        }
+
+        if ( !ready ) {
+            _close_socket(socket);
+            throw error::ConnectionFailure("Connect timed out!");
         }
     }
+    _finish_connect(socket);
+}
 
-    return (unsigned int) res;
+// Start a non-blocking connect - returns true if it completed at once, false if it is pending
+static bool _start_connect(socket_t& socket, const net::IpAddress& address) {
+    if ( address.addr.size() != sizeof(::sockaddr_in) && address.addr.size() != sizeof(::sockaddr_in6) ) {
+        _close_socket(socket);
+        throw std::invalid_argument("Invalid address structure!");
+    }
+
+    #ifdef _WIN32
+        if ( !sys::set_non_blocking(socket, true) ) {
+            int err = ::WSAGetLastError();
+            _close_socket(socket);
+            throw error::SystemApiError(err);
+        }
+    #endif
+
+    ::sockaddr* addr = reinterpret_cast<::sockaddr*>(const_cast<char*>(address.addr.data()));
+
+    if ( SOCKET_FAILURE(::connect(socket, addr, address.addr.size())) ) {
+        int err = ::WSAGetLastError();
+        if ( err == WSAEWOULDBLOCK || err == WSAEINPROGRESS )
+            return false;
+
+        _close_socket(socket);
+        _throw_connect_error(err);
+    }
+
+    return true;
 }
 
-static unsigned int _select(const socket_t& socket, uint64_t timeout) {
+// Complete a connect started by _start_connect, once the socket polls writable or with an error
+static void _finish_connect(socket_t& socket) {
+    int err = 0;
     #ifdef _WIN32
-        int nfd = 0;
+        int len = sizeof(err);
     #else
-        int nfd = socket + 1;
+        ::socklen_t len = sizeof(err);
+    #endif
+
+    if ( SOCKET_FAILURE(::getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&err, &len)) )
+        err = ::WSAGetLastError();
+
+    if ( err ) {
+        _close_socket(socket);
+        _throw_connect_error(err);
+    }
+
+    // Sockets are only non-blocking on Windows while connecting
+    #ifdef _WIN32
+        if ( !sys::set_non_blocking(socket, false) ) {
+            err = ::WSAGetLastError();
+            _close_socket(socket);
+            throw error::SystemApiError(err);
+        }
     #endif
+}
 
-    ::fd_set readfds;
-    ::timeval tv {0};
+// Defer the handshake of the next connect to the first send, so it can carry data - false if not supported
+static bool _enable_fast_open_connect(socket_t& socket) noexcept {
+    #if defined(__linux__) && defined(TCP_FASTOPEN_CONNECT)
+        int enable = 1;
+        return !SOCKET_FAILURE(::setsockopt(socket, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (const char*)&enable, sizeof(enable)));
+    #else
+        (void) socket;
+        return false;
+    #endif
+}
 
-    tv.tv_sec  = timeout / 1000;
-    tv.tv_usec = (timeout % 1000) * 1000;
+[[noreturn]] static void _throw_send_error(int err) {
+    switch ( err ) {
+        case WSAENETDOWN:
+        case WSAENETRESET:
+        case WSAENOTCONN:
+        case WSAEHOSTUNREACH:
+        case WSAECONNABORTED:
+        case WSAECONNRESET:
+        case WSAETIMEDOUT:
+        #ifndef _WIN32
+        case EPIPE:
+        #endif
+            throw error::SocketDisconnection(sys::error_message(err));
+
+        case WSAEMSGSIZE:
+            throw std::overflow_error(sys::error_message(err));
+
+        // case WSAEINVAL:
+        // case WSAESHUTDOWN:
+        // case WSAEOPNOTSUPP:
+        // case WSAENOTSOCK:
+        // case WSAENOBUFS:
+        // case WSAEFAULT:
+        // case WSAEINTR: // Interrupted through WSACancelBlockingCall
+        // case WSANOTINITIALISED:
+        // case WSAEACCES:
+        default:
+            throw error::SystemApiError(err);
+    }
+}
 
-    FD_ZERO(&readfds);
-    FD_SET(socket, &readfds);
+// True if the send should be retried once the socket is writable
+static bool _send_would_block(int err) noexcept {
+    switch ( err ) {
+        #ifndef _WIN32
+        case EINPROGRESS: // Fast Open handshake without a cookie still under way
+        case EINTR:
+        #endif
+        case WSAEWOULDBLOCK: // Non-blocking socket with a full send buffer
+            return true;
 
-    int res = ::select(nfd, &readfds, nullptr, nullptr, &tv);
+        default:
+            return false;
+    }
+}
 
-    /// @todo - Map "valid" errors
-    if ( SOCKET_FAILURE(res) ) {
-        int err = ::WSAGetLastError();
+// With wait, blocks until all is sent or the deadline passes, as on a blocking socket - otherwise returns what fit in the send buffer
+static size_t _send(socket_t& socket, const char* data, size_t size, bool wait, Deadline deadline = Deadline::max()) {
+    if ( !VALIDATE_SOCKET(socket) )
+        throw error::SetupError("TCP socket not connected!");
 
-        switch ( err ) {
-            case WSAENETDOWN:
-                throw error::ConnectionFailure(sys::error_message(err));
+    size_t sent = 0;
 
-            case WSAEINPROGRESS:
-                throw std::runtime_error("Incomplete handling/retry not yet implemented!");
+    do {
+        #ifdef _WIN32
+            int res = ::send(socket, data + sent, (int) (size - sent), 0);
+        #else
+            // A peer gone must not raise SIGPIPE
+            ssize_t res = ::send(socket, data + sent, size - sent, MSG_NOSIGNAL);
+        #endif
 
-            // case WSAENOTSOCK:
-            // case WSAEINTR: // Interrupted through WSACancelBlockingCall
-            // case WSAEFAULT:
-            // case WSANOTINITIALISED:
-            default:
-                throw error::SystemApiError(err);
+        if ( SOCKET_FAILURE(res) ) {
+            int err = ::WSAGetLastError();
+            if ( !_send_would_block(err) )
+                _throw_send_error(err);
+            if ( !wait || !_wait(socket, true, ISocket::timeout_until(deadline)) )
+                return sent;
+            continue;
         }
-    }
 
-    return res;
+        sent += (size_t) res;
+    } while ( wait && sent < size );
+
+    return sent;
 }
 
 static bool _connected(const socket_t& socket) {
-    #ifdef _WIN32
-        int nfd = 0;
-    #else
-        int nfd = socket + 1;
-    #endif
-
-    unsigned int s;
+    bool readable;
     try {
-        s = _select(socket, 0);
-    } catch ( error::ConnectionFailure ) {
+        readable = _wait(socket, false, 0);
+    } catch ( error::ConnectionFailure& ) {
         return false;
     }
 
-    if ( s > 0 ) {
+    if ( readable ) {
         char buf;
-        int res = ::recv(socket, &buf, 1, MSG_PEEK);
+        #ifdef _WIN32
+            int res = ::recv(socket, &buf, 1, MSG_PEEK);
+        #else
+            ssize_t res = ::recv(socket, &buf, 1, MSG_PEEK | MSG_DONTWAIT);
+        #endif
 
         if ( SOCKET_FAILURE(res) ) {
             int err = ::WSAGetLastError();
@@ -277,19 +402,14 @@ static bool _connected(const socket_t& socket) {
 }
 
 static size_t _bytes_available(const socket_t& socket, uint64_t timeout) {
-    #ifdef _WIN32
-        int nfd = 0;
-    #else
-        int nfd = socket + 1;
-    #endif
-
-    if ( _select(socket, timeout) == 0 )
+    if ( !_wait(socket, false, timeout) )
         return 0;
 
-    unsigned long bytes_avail = 0;
     #ifdef _WIN32
+        unsigned long bytes_avail = 0;
         int res = ::ioctlsocket(socket, FIONREAD, &bytes_avail);
     #else
+        int bytes_avail = 0;
         int res = ::ioctl(socket, FIONREAD, &bytes_avail);
     #endif
 
@@ -311,112 +431,553 @@ static size_t _bytes_available(const socket_t& socket, uint64_t timeout) {
         }
     }
 
-    return bytes_avail;
+    return (size_t) bytes_avail;
+}
+
+// Map a failed receive - returns 0 where no data is available yet, and throws otherwise
+static size_t _recv_error(int err) {
+    switch ( err ) {
+        case WSAENETDOWN:
+        case WSAENOTCONN:
+        case WSAENETRESET:
+        case WSAECONNABORTED:
+        case WSAETIMEDOUT:
+        case WSAECONNRESET:
+            throw error::SocketDisconnection(sys::error_message(err));
+
+        case WSAEMSGSIZE: // Buffer not big enough for all data... - truncated data retrieved
+            throw std::overflow_error(sys::error_message(err));
+
+        #ifndef _WIN32
+        case EINTR:
+        #endif
+        case WSAEWOULDBLOCK: // Nothing arrived after all, or a non-blocking socket
+            return 0;
+
+        case WSAEINPROGRESS:
+            throw std::runtime_error("Incomplete/retry handling not implemented!");
+
+        // throw WSAEINVAL:
+        // case WSAESHUTDOWN:
+        // case WSAEOPTNOTSUPP:
+        // case WSAENOTSOCK:
+        // case WSAEINTR:
+        // case WSAEFAULT:
+        // case WSANOTINITIALISED:
+        default:
+            throw error::SystemApiError(err);
+    }
+}
+
+// Returns 0 if no data is available yet, unless size is 0
+static size_t _recv_ready(socket_t& socket, char* buf, size_t size, bool peek) {
+    #ifdef _WIN32
+        int res = ::recv(socket, buf, (int) size, peek ? MSG_PEEK : 0);
+    #else
+        // Never blocks, whatever the mode of the socket
+        ssize_t res = ::recv(socket, buf, size, (peek ? MSG_PEEK : 0) | MSG_DONTWAIT);
+    #endif
+
+    if ( SOCKET_FAILURE(res) )
+        return _recv_error(::WSAGetLastError());
+
+    if ( res == 0 && size != 0 )
+        throw error::SocketDisconnection("Socket disconnected gracefully!");
+
+    return (unsigned int) res;
 }
 
 static size_t _recv(socket_t& socket, char* buf, size_t size, uint64_t timeout, bool peek) {
     if ( !VALIDATE_SOCKET(socket) )
         throw error::SetupError("TCP socket not connected!");
 
-    if ( _select(socket, timeout) == 0 )
+    #ifndef _WIN32
+        // Data has usually arrived already - only wait if the read would block
+        if ( size ) {
+            size_t res = _recv_ready(socket, buf, size, peek);
+            if ( res )
+                return res;
+        }
+    #endif
+
+    if ( !_wait(socket, false, timeout) )
         return 0;
 
-    int res = ::recv(socket, buf, size, peek ? MSG_PEEK : 0);
+    return _recv_ready(socket, buf, size, peek);
+}
+
+static bool _spin(const socket_t& socket, std::chrono::steady_clock::time_point until) {
+    // Zero-timeout poll never parks the thread, so the wake-up latency is only the poll itself
+    do {
+        if ( _wait(socket, false, 0) )
+            return true;
+    } while ( std::chrono::steady_clock::now() < until );
+
+    return false;
+}
+
+static void _set_busy_poll(socket_t& socket, uint32_t usec) {
+    #ifdef SO_BUSY_POLL
+        int value = (int) usec;
+        int res = ::setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, (const char*)&value, sizeof(value));
+
+        if ( SOCKET_FAILURE(res) ) {
+            int err = errno;
+            // Raising it above net.core.busy_read takes CAP_NET_ADMIN - fall back to the plain policy, as where not supported
+            if ( err == EPERM || err == ENOPROTOOPT || err == EINVAL )
+                return;
+            throw error::SystemApiError(err);
+        }
+    #else
+        (void) socket;
+        (void) usec;
+    #endif
+}
+
+
+static void _listen(socket_t& socket, const net::IpAddress& address, const ListenOptions& options) {
+    if ( address.addr.size() != sizeof(::sockaddr_in) && address.addr.size() != sizeof(::sockaddr_in6) )
+        throw std::invalid_argument("Invalid address structure!");
+
+    int enable = 1;
+
+    if ( options.reuse_address )
+        ::setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&enable, sizeof(enable));
+
+    #ifdef SO_REUSEPORT
+        if ( options.reuse_port )
+            ::setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, (const char*)&enable, sizeof(enable));
+    #endif
+
+    #ifdef TCP_FASTOPEN
+        if ( options.fast_open_queue > 0 ) {
+            #ifdef _WIN32
+                // Windows only takes an on/off switch, and sizes the queue itself
+                ::setsockopt(socket, IPPROTO_TCP, TCP_FASTOPEN, (const char*)&enable, sizeof(enable));
+            #else
+                ::setsockopt(socket, IPPROTO_TCP, TCP_FASTOPEN, (const char*)&options.fast_open_queue, sizeof(options.fast_open_queue));
+            #endif
+        }
+    #endif
+
+    ::sockaddr* addr = reinterpret_cast<::sockaddr*>(const_cast<char*>(address.addr.data()));
+
+    int res = ::bind(socket, addr, address.addr.size());
+
+    if ( !SOCKET_FAILURE(res) )
+        res = ::listen(socket, options.backlog);
 
     if ( SOCKET_FAILURE(res) ) {
         int err = ::WSAGetLastError();
+        _close_socket(socket);
 
         switch ( err ) {
-            case WSAENETDOWN:
-            case WSAENOTCONN:
-            case WSAENETRESET:
-            case WSAECONNABORTED:
-            case WSAETIMEDOUT:
-            case WSAECONNRESET:
-                throw error::SocketDisconnection(sys::error_message(err));
-
-            case WSAEMSGSIZE: // Buffer not big enough for all data... - truncated data retrieved
-                throw std::overflow_error(sys::error_message(err));
+            case WSAENETDOWN:      // Dead network
+            case WSAEADDRINUSE:    // Address occupied
+            case WSAEADDRNOTAVAIL: // Address not local
+            case WSAEACCES:        // Privileged port
+                throw error::ConnectionFailure(sys::error_message(err));
 
-            case WSAEWOULDBLOCK:
-            case WSAEINPROGRESS:
-                throw std::runtime_error("Incomplete/retry handling not implemented!");
+            case WSAEAFNOSUPPORT:
+            case WSAEFAULT:
+            case WSAEINVAL:
+                throw std::invalid_argument(sys::error_message(err));
 
-            // throw WSAEINVAL:
-            // case WSAESHUTDOWN:
-            // case WSAEOPTNOTSUPP:
+            // case WSAENOBUFS:
+            // case WSAEMFILE:
             // case WSAENOTSOCK:
-            // case WSAEINTR:
-            // case WSAEFAULT:
-            // case WSANOTINITIALISED:
             default:
                 throw error::SystemApiError(err);
         }
     }
-
-    if ( res == 0 && size != 0 )
-        throw error::SocketDisconnection("Socket disconnected gracefully!");
-
-    return (unsigned int) res;
 }
 
+static socket_t _accept(socket_t& socket, uint64_t timeout) {
+    if ( !VALIDATE_SOCKET(socket) )
+        throw error::SetupError("TCP listener not listening!");
 
-/********************************************/
-/* TcpClient::Impl                          */
-/********************************************/
-struct TcpClient::Impl {
-    protected:
-        socket_t socket = INVALID_SOCKET;
-
-        #ifdef _WIN32
-            sys::WinsockLoader wsl;
-        #endif
+    #ifdef _WIN32
+        if ( !_wait(socket, false, timeout) )
+            return INVALID_SOCKET;
 
-    public:
-        void connect(const net::IpAddress& address) {
-            _new_socket(socket, address.family);
-            _connect(socket, address);
-        }
+        socket_t res = ::accept(socket, nullptr, nullptr);
+    #else
+        // The listener is non-blocking - try first, and only wait if nothing is pending
+        socket_t res = ::accept4(socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-        void connect(const std::vector<net::IpAddress>& addresses) {
-            for ( auto a: addresses ) {
-                try {
-                    _new_socket(socket, a.family);
-                    _connect(socket, a);
-                    return;
-                } catch ( error::ConnectionFailure& e ) {
-                    /* Try next address */
-                }
-            }
-            throw error::ConnectionFailure("Could not connect to any given address!");
+        if ( !VALIDATE_SOCKET(res) && sys::would_block(errno) ) {
+            if ( !_wait(socket, false, timeout) )
+                return INVALID_SOCKET;
+            res = ::accept4(socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
         }
+    #endif
 
-        void close() noexcept {
-            _close_socket(socket);
-        }
+    if ( !VALIDATE_SOCKET(res) ) {
+        int err = ::WSAGetLastError();
 
-        bool connected() const {
-            return _connected(socket);
+        switch ( err ) {
+            case WSAECONNRESET:   // Reset by the peer before it was accepted
+            case WSAECONNABORTED: // Same, as reported by Linux
+            case WSAEWOULDBLOCK:  // Taken by another thread
+            #ifndef _WIN32
+            case EINTR:
+            #endif
+                return INVALID_SOCKET;
+
+            // case WSAENETDOWN:
+            // case WSAEMFILE:
+            // case WSAENOBUFS:
+            // case WSAEINTR:
+            // case WSAEINVAL:
+            default:
+                throw error::SystemApiError(err);
         }
+    }
 
-        size_t bytes_available() const {
-            return _bytes_available(socket, 0);
-        }
+    return res;
+}
 
-        size_t send(const char* buf, size_t size) {
-            return _send(socket, buf, size);
-        }
+static net::IpAddress _local_address(const socket_t& socket) {
+    ::sockaddr_storage storage {0};
+    #ifdef _WIN32
+        int len = sizeof(storage);
+    #else
+        ::socklen_t len = sizeof(storage);
+    #endif
 
-        size_t receive(char* buf, size_t size, uint64_t timeout) {
-            return _recv(socket, buf, size, timeout, false);
-        }
+    if ( SOCKET_FAILURE(::getsockname(socket, reinterpret_cast<::sockaddr*>(&storage), &len)) )
+        throw error::SystemApiError(::WSAGetLastError());
 
-        size_t peek(char* buf, size_t size, uint64_t timeout) {
-            return _recv(socket, buf, size, timeout, true);
-        }
+    net::IpAddress address;
+    address.family = storage.ss_family;
+    address.addr   = {reinterpret_cast<char*>(&storage), (size_t) len};
+    return address;
+}
+
+static void _check_stream(const socket_t& socket) {
+    int type = 0;
+    #ifdef _WIN32
+        int len = sizeof(type);
+    #else
+        ::socklen_t len = sizeof(type);
+    #endif
+
+    if ( SOCKET_FAILURE(::getsockopt(socket, SOL_SOCKET, SO_TYPE, (char*)&type, &len)) ) {
+        int err = ::WSAGetLastError();
+
+        switch ( err ) {
+            case WSAENOTSOCK:
+                throw std::invalid_argument("Not a socket!");
+
+            default:
+                throw error::SystemApiError(err);
+        }
+    }
+
+    if ( type != SOCK_STREAM )
+        throw std::invalid_argument("Not a TCP socket!");
+}
+
+#ifdef __linux__
+    // Fields the kernel appended to tcp_info after glibc's copy of the structure ends
+    struct _tcp_info_ext {
+        ::tcp_info base;
+        uint64_t   pacing_rate;
+        uint64_t   max_pacing_rate;
+        uint64_t   bytes_acked;
+        uint64_t   bytes_received;
+        uint32_t   segs_out;
+        uint32_t   segs_in;
+        uint32_t   notsent_bytes;
+        uint32_t   min_rtt;
+        uint32_t   data_segs_in;
+        uint32_t   data_segs_out;
+        uint64_t   delivery_rate;
+    };
+#endif
+
+static TcpInfo _tcp_info(const socket_t& socket) {
+    TcpInfo info;
+
+    #if defined(__linux__)
+        _tcp_info_ext raw {};
+        ::socklen_t len = sizeof(raw);
+
+        if ( SOCKET_FAILURE(::getsockopt(socket, IPPROTO_TCP, TCP_INFO, &raw, &len)) )
+            throw error::SystemApiError(::WSAGetLastError());
+
+        // Older kernels fill less of the structure - the rest stays 0
+        const ::tcp_info& base = raw.base;
+        uint32_t in_flight = base.tcpi_unacked + base.tcpi_retrans - std::min(base.tcpi_unacked, base.tcpi_sacked + base.tcpi_lost);
+
+        info.srtt            = std::chrono::microseconds(base.tcpi_rtt);
+        info.rttvar          = std::chrono::microseconds(base.tcpi_rttvar);
+        info.mss             = base.tcpi_snd_mss;
+        info.cwnd            = (uint64_t) base.tcpi_snd_cwnd * base.tcpi_snd_mss;
+        info.retransmits     = base.tcpi_total_retrans;
+        info.bytes_in_flight = (uint64_t) in_flight * base.tcpi_snd_mss;
+        info.unacked         = base.tcpi_unacked;
+        info.unsent_bytes    = raw.notsent_bytes;
+        info.delivery_rate   = raw.delivery_rate;
+    #elif defined(_WIN32) && defined(SIO_TCP_INFO)
+        DWORD version = 0;
+        ::TCP_INFO_v0 raw {};
+        DWORD len = 0;
+
+        if ( SOCKET_FAILURE(::WSAIoctl(socket, SIO_TCP_INFO, &version, sizeof(version), &raw, sizeof(raw), &len, nullptr, nullptr)) )
+            throw error::SystemApiError(::WSAGetLastError());
+
+        info.srtt            = std::chrono::microseconds(raw.RttUs);
+        info.mss             = raw.Mss;
+        info.cwnd            = raw.Cwnd;
+        info.retransmits     = raw.Mss ? raw.BytesRetrans / raw.Mss : 0;
+        info.bytes_in_flight = raw.BytesInFlight;
+        info.unacked         = raw.Mss ? (uint32_t) ((raw.BytesInFlight + raw.Mss - 1) / raw.Mss) : 0;
+    #else
+        (void) socket;
+        throw error::SystemApiError(WSAEOPNOTSUPP);
+    #endif
+
+    return info;
+}
+
+static bool _steer_by_cpu(socket_t& socket, unsigned group_size) {
+    if ( group_size == 0 )
+        throw std::invalid_argument("Group size can't be 0!");
+
+    #if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+        // return cpu % group_size - the index of the listener in the reuseport group
+        ::sock_filter code[] = {
+            { BPF_LD  | BPF_W | BPF_ABS, 0, 0, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU) },
+            { BPF_ALU | BPF_MOD | BPF_K, 0, 0, group_size },
+            { BPF_RET | BPF_A, 0, 0, 0 }
+        };
+        ::sock_fprog program = { sizeof(code) / sizeof(code[0]), code };
+
+        if ( SOCKET_FAILURE(::setsockopt(socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program))) )
+            throw error::SystemApiError(::WSAGetLastError());
+
+        return true;
+    #else
+        (void) socket;
+        return false;
+    #endif
+}
+
+
+/********************************************/
+/* TcpClient::Impl                          */
+/********************************************/
+struct TcpClient::Impl {
+    protected:
+        typedef std::chrono::steady_clock clock;
+
+        socket_t socket = INVALID_SOCKET;
+
+        // Sockets set up by the library get blocking sends - adopted ones keep the mode they were given
+        bool blocking_send = true;
+
+        ReceivePolicy policy;
+
+        // Adaptive receive state: time of the last arrival and a moving average of the gap between arrivals
+        clock::time_point last_arrival;
+        uint64_t arrival_gap = 0; // microseconds, 0 until two arrivals were observed
+
+        /**
+         * @brief Microseconds to spin before blocking, 0 if the call should block immediately
+         */
+        uint64_t spin_budget(uint64_t timeout) const {
+            // A timeout of 0 is already a non-blocking poll
+            if ( policy.spin_budget == 0 || timeout == 0 )
+                return 0;
+
+            uint64_t budget = std::min<uint64_t>(policy.spin_budget, timeout * 1000);
+
+            if ( policy.adaptive && arrival_gap ) {
+                uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - last_arrival).count();
+
+                // Next message is not expected within the budget - spinning would only burn CPU
+                if ( arrival_gap > elapsed + budget )
+                    return 0;
+            }
+
+            return budget;
+        }
+
+        void record_arrival() {
+            if ( !policy.adaptive )
+                return;
+
+            clock::time_point now = clock::now();
+
+            if ( last_arrival != clock::time_point() ) {
+                uint64_t gap = std::chrono::duration_cast<std::chrono::microseconds>(now - last_arrival).count();
+
+                // EWMA with a weight of 1/8, as used for TCP's smoothed RTT
+                if ( arrival_gap == 0 )
+                    arrival_gap = std::max<uint64_t>(gap, 1);
+                else
+                    arrival_gap = std::max<uint64_t>(arrival_gap - arrival_gap / 8 + gap / 8, 1);
+            }
+
+            last_arrival = now;
+        }
+
+        size_t wait_and_recv(char* buf, size_t size, uint64_t timeout, bool peek) {
+            if ( !VALIDATE_SOCKET(socket) )
+                throw error::SetupError("TCP socket not connected!");
+
+            uint64_t spin = spin_budget(timeout);
+
+            if ( spin ) {
+                clock::time_point start = clock::now();
+
+                if ( _spin(socket, start + std::chrono::microseconds(spin)) ) {
+                    size_t res = _recv_ready(socket, buf, size, peek);
+                    if ( !peek )
+                        record_arrival();
+                    return res;
+                }
+
+                // Spin budget exhausted, block for whatever is left of the timeout
+                uint64_t spent = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+                timeout -= std::min(timeout, spent);
+            }
+
+            size_t res = _recv(socket, buf, size, timeout, peek);
+            if ( res && !peek )
+                record_arrival();
+            return res;
+        }
 
     public:
-        Impl() = default;
+        void connect(const net::IpAddress& address, Deadline deadline = Deadline::max()) {
+            _new_socket(socket, address.family);
+            blocking_send = true;
+            try {
+                _connect(socket, address, deadline);
+                apply_policy();
+            } catch ( ... ) {
+                // Leave the Impl ready for the next connect
+                close();
+                throw;
+            }
+        }
+
+        size_t connect_and_send(const net::IpAddress& address, const char* buf, size_t size) {
+            _new_socket(socket, address.family);
+            blocking_send = true;
+            try {
+                // With Fast Open, connect returns at once and the handshake goes out with the data
+                bool fast_open = _enable_fast_open_connect(socket);
+                _connect(socket, address);
+                apply_policy();
+
+                if ( !fast_open )
+                    return _send(socket, buf, size, true);
+
+                try {
+                    return _send(socket, buf, size, true);
+                } catch ( error::SystemApiError& e ) {
+                    // Handshake failures surface on the send - report them as connect would have
+                    _throw_connect_error(e.code().value());
+                }
+            } catch ( ... ) {
+                // Leave the Impl ready for the next connect
+                close();
+                throw;
+            }
+        }
+
+        void connect(const std::vector<net::IpAddress>& addresses, Deadline deadline = Deadline::max()) {
+            for ( const auto& a: addresses ) {
+                try {
+                    connect(a, deadline);
+                    return;
+                } catch ( error::ConnectionFailure& e ) {
+                    /* Try next address */
+                }
+            }
+            throw error::ConnectionFailure("Could not connect to any given address!");
+        }
+
+        void adopt(socket_t accepted, bool owned = true) {
+            if ( VALIDATE_SOCKET(socket) )
+                throw error::SetupError("TCP socket already setup!");
+            socket        = accepted;
+            blocking_send = owned;
+            try {
+                apply_policy();
+            } catch ( ... ) {
+                // A socket from the caller stays the caller's to close if adopting it fails
+                if ( !owned )
+                    socket = INVALID_SOCKET;
+                throw;
+            }
+        }
+
+        socket_t handle() const noexcept {
+            return socket;
+        }
+
+        socket_t release() noexcept {
+            socket_t released = socket;
+            socket = INVALID_SOCKET;
+            return released;
+        }
+
+        TcpInfo tcp_info() const {
+            return _tcp_info(socket);
+        }
+
+        bool is_open() const noexcept {
+            return VALIDATE_SOCKET(socket);
+        }
+
+        void set_policy(const ReceivePolicy& p) {
+            // Set on the socket first, so a refused busy poll leaves the previous policy in place
+            if ( VALIDATE_SOCKET(socket) && p.busy_poll != policy.busy_poll )
+                _set_busy_poll(socket, p.busy_poll);
+            policy = p;
+            arrival_gap = 0;
+            last_arrival = clock::time_point();
+        }
+
+        void apply_policy() {
+            if ( VALIDATE_SOCKET(socket) && policy.busy_poll )
+                _set_busy_poll(socket, policy.busy_poll);
+        }
+
+        void close() noexcept {
+            _close_socket(socket);
+        }
+
+        bool connected() const {
+            return _connected(socket);
+        }
+
+        size_t bytes_available() const {
+            return _bytes_available(socket, 0);
+        }
+
+        size_t send(const char* buf, size_t size, Deadline deadline = Deadline::max()) {
+            return _send(socket, buf, size, blocking_send, deadline);
+        }
+
+        size_t receive(char* buf, size_t size, uint64_t timeout) {
+            return wait_and_recv(buf, size, timeout, false);
+        }
+
+        size_t peek(char* buf, size_t size, uint64_t timeout) {
+            return wait_and_recv(buf, size, timeout, true);
+        }
+
+    public:
+        Impl() {
+            #ifdef _WIN32
+                sys::winsock_init();
+            #endif
+        }
         ~Impl() {
             close();
         }
@@ -424,66 +985,174 @@ struct TcpClient::Impl {
 
 
 void TcpClient::ImplCleanup::operator()(Impl* ptr) const {
-    if ( ptr )
+    if ( !ptr )
+        return;
+
+    if ( resource ) {
+        ptr->~Impl();
+        resource->deallocate(ptr, sizeof(Impl), alignof(Impl));
+    } else {
         delete ptr;
+    }
 }
 
 /********************************************/
 /* TcpClient                                */
 /********************************************/
+TcpClient::TcpClient(std::pmr::memory_resource* resource): pimpl(nullptr, ImplCleanup{resource}) {}
+
 TcpClient::~TcpClient() = default;
 
+TcpClient::TcpClient(TcpClient&& other) noexcept {
+    std::lock_guard lock(other.mutex);
+    pimpl  = std::move(other.pimpl);
+    policy = other.policy;
+}
+
+TcpClient& TcpClient::operator=(TcpClient&& other) noexcept {
+    if ( this != &other ) {
+        std::scoped_lock lock(mutex, other.mutex);
+        pimpl  = std::move(other.pimpl);
+        policy = other.policy;
+    }
+    return *this;
+}
+
+TcpClient TcpClient::adopt(sys::native_socket_t socket, const ReceivePolicy& policy) {
+    socket_t adopted = (socket_t) socket;
+    if ( !VALIDATE_SOCKET(adopted) )
+        throw std::invalid_argument("Invalid socket!");
+
+    _check_stream(adopted);
+
+    TcpClient client;
+    client.policy = policy;
+    client.reuse_impl().adopt(adopted, false);
+    return client;
+}
+
+TcpClient::Impl& TcpClient::reuse_impl() {
+    if ( pimpl && pimpl->is_open() )
+        throw error::SetupError("TcpClient already connected!");
+
+    // Allocated by the first connect, and kept by close, so reconnecting does not allocate
+    if ( !pimpl ) {
+        std::pmr::memory_resource* resource = pimpl.get_deleter().resource;
+        if ( resource ) {
+            void* storage = resource->allocate(sizeof(Impl), alignof(Impl));
+            try {
+                pimpl.reset(new (storage) Impl());
+            } catch ( ... ) {
+                resource->deallocate(storage, sizeof(Impl), alignof(Impl));
+                throw;
+            }
+        } else {
+            pimpl.reset(new Impl());
+        }
+    }
+    pimpl->set_policy(policy);
+    return *pimpl;
+}
+
+TcpClient::Impl& TcpClient::open_impl() const {
+    if ( !pimpl || !pimpl->is_open() )
+        throw error::SetupError("TcpClient not connected!");
+    return *pimpl;
+}
+
 void TcpClient::connect(const net::IpAddress& address) {
     std::lock_guard lock(mutex);
-    if ( pimpl )
-        throw error::SetupError("TcpClient already connected!");
-    pimpl.reset(new Impl());
-    pimpl->connect(address);
+    reuse_impl().connect(address);
 }
 
 void TcpClient::connect(const std::vector<net::IpAddress>& addresses) {
     std::lock_guard lock(mutex);
-    if ( pimpl )
-        throw error::SetupError("TcpClient already connected!");
-    pimpl.reset(new Impl());
-    pimpl->connect(addresses);
+    reuse_impl().connect(addresses);
+}
+
+void TcpClient::connect(const net::IpAddress& address, Deadline deadline) {
+    std::lock_guard lock(mutex);
+    reuse_impl().connect(address, deadline);
+}
+
+void TcpClient::connect(const std::vector<net::IpAddress>& addresses, Deadline deadline) {
+    std::lock_guard lock(mutex);
+    reuse_impl().connect(addresses, deadline);
+}
+
+size_t TcpClient::connect_and_send(const net::IpAddress& address, const char* buf, size_t size) {
+    std::lock_guard lock(mutex);
+    return reuse_impl().connect_and_send(address, buf, size);
+}
+
+size_t TcpClient::connect_and_send(const net::IpAddress& address, const std::string& packet) {
+    return connect_and_send(address, packet.data(), packet.size());
 }
 
 void TcpClient::close() noexcept {
     std::lock_guard lock(mutex);
-    pimpl.reset(nullptr);
+    if ( pimpl )
+        pimpl->close();
+}
+
+sys::native_socket_t TcpClient::native_handle() const {
+    std::lock_guard lock(mutex);
+    return open_impl().handle();
+}
+
+sys::native_socket_t TcpClient::release() {
+    std::lock_guard lock(mutex);
+    return open_impl().release();
+}
+
+TcpInfo TcpClient::tcp_info() const {
+    std::lock_guard lock(mutex);
+    return open_impl().tcp_info();
+}
+
+void TcpClient::set_receive_policy(const ReceivePolicy& new_policy) {
+    std::lock_guard lock(mutex);
+    if ( pimpl && pimpl->is_open() )
+        pimpl->set_policy(new_policy);
+    policy = new_policy;
+}
+
+ReceivePolicy TcpClient::receive_policy() const {
+    std::lock_guard lock(mutex);
+    return policy;
 }
 
 bool TcpClient::connected() const {
     std::lock_guard lock(mutex);
-    if ( !pimpl )
-        throw error::SetupError("TcpClient not connected!");
-    return pimpl->connected();
+    return open_impl().connected();
 }
 
 size_t TcpClient::bytes_available() const {
     std::lock_guard lock(mutex);
-    if ( !pimpl )
-        throw error::SetupError("TcpClient not connected!");
-    return pimpl->bytes_available();
+    return open_impl().bytes_available();
 }
 
 size_t TcpClient::send(const char* buf, size_t size) {
     std::lock_guard lock(mutex);
-    if ( !pimpl )
-        throw error::SetupError("TcpClient not connected!");
-    return pimpl->send(buf, size);
+    return open_impl().send(buf, size);
 }
 
 size_t TcpClient::send(const std::string& buf) {
     return send(buf.data(), buf.size());
 }
 
+size_t TcpClient::send(const char* buf, size_t size, Deadline deadline) {
+    std::lock_guard lock(mutex);
+    return open_impl().send(buf, size, deadline);
+}
+
+size_t TcpClient::send(const std::string& buf, Deadline deadline) {
+    return send(buf.data(), buf.size(), deadline);
+}
+
 size_t TcpClient::receive(char* buf, size_t size, uint64_t timeout) {
     std::lock_guard lock(mutex);
-    if ( !pimpl )
-        throw error::SetupError("TcpClient not connected!");
-    return pimpl->receive(buf, size, timeout);
+    return open_impl().receive(buf, size, timeout);
 }
 
 std::string TcpClient::receive(size_t size, uint64_t timeout) {
@@ -496,9 +1165,7 @@ std::string TcpClient::receive(size_t size, uint64_t timeout) {
 
 size_t TcpClient::peek(char* buf, size_t size, uint64_t timeout) {
     std::lock_guard lock(mutex);
-    if ( !pimpl )
-        throw error::SetupError("TcpClient not connected!");
-    return pimpl->peek(buf, size, timeout);
+    return open_impl().peek(buf, size, timeout);
 }
 
 std::string TcpClient::peek(size_t size, uint64_t timeout) {
@@ -508,4 +1175,330 @@ std::string TcpClient::peek(size_t size, uint64_t timeout) {
         return std::move(buffer);
     return buffer.substr(0, r);
 }
+
+
+TcpInfo tcp_info(sys::native_socket_t socket) {
+    return _tcp_info((socket_t) socket);
+}
+
+
+/********************************************/
+/* TcpBackend                               */
+/********************************************/
+TcpBackend::TcpBackend(TcpClient&& client): socket(client.release()) {}
+
+TcpBackend::~TcpBackend() {
+    close();
+}
+
+TcpBackend::TcpBackend(TcpBackend&& other) noexcept: socket(other.socket) {
+    other.socket = sys::invalid_native_socket;
+}
+
+TcpBackend& TcpBackend::operator=(TcpBackend&& other) noexcept {
+    if ( this != &other ) {
+        close();
+        socket       = other.socket;
+        other.socket = sys::invalid_native_socket;
+    }
+    return *this;
+}
+
+void TcpBackend::connect(const net::IpAddress& address) {
+    #ifdef _WIN32
+        sys::winsock_init();
+    #endif
+
+    socket_t connecting = (socket_t) socket;
+    _new_socket(connecting, address.family);
+    _connect(connecting, address);
+    socket = (sys::native_socket_t) connecting;
+}
+
+void TcpBackend::connect(const std::vector<net::IpAddress>& addresses) {
+    for ( const auto& a: addresses ) {
+        try {
+            connect(a);
+            return;
+        } catch ( error::ConnectionFailure& e ) {
+            /* Try next address */
+        }
+    }
+    throw error::ConnectionFailure("Could not connect to any given address!");
+}
+
+void TcpBackend::close() noexcept {
+    socket_t closing = (socket_t) socket;
+    _close_socket(closing);
+    socket = sys::invalid_native_socket;
+}
+
+bool TcpBackend::connected() const {
+    if ( !VALIDATE_SOCKET((socket_t) socket) )
+        throw error::SetupError("TCP socket not connected!");
+    return _connected((socket_t) socket);
+}
+
+size_t TcpBackend::bytes_available() const {
+    if ( !VALIDATE_SOCKET((socket_t) socket) )
+        throw error::SetupError("TCP socket not connected!");
+    return _bytes_available((socket_t) socket, 0);
+}
+
+bool TcpBackend::wait(bool write, uint64_t timeout) const {
+    if ( !VALIDATE_SOCKET((socket_t) socket) )
+        throw error::SetupError("TCP socket not connected!");
+    return _wait((socket_t) socket, write, timeout);
+}
+
+size_t TcpBackend::send_failed(int err) const {
+    if ( !VALIDATE_SOCKET((socket_t) socket) )
+        throw error::SetupError("TCP socket not connected!");
+    if ( _send_would_block(err) )
+        return 0;
+    _throw_send_error(err);
+}
+
+size_t TcpBackend::receive_failed(int err, size_t size) const {
+    if ( !VALIDATE_SOCKET((socket_t) socket) )
+        throw error::SetupError("TCP socket not connected!");
+
+    // recv returned 0 - the peer closed, unless nothing was asked for
+    if ( err == 0 ) {
+        if ( size != 0 )
+            throw error::SocketDisconnection("Socket disconnected gracefully!");
+        return 0;
+    }
+    return _recv_error(err);
+}
+
+#ifdef _WIN32
+    size_t TcpBackend::send_native(const char* buf, size_t size) {
+        socket_t s = (socket_t) socket;
+        return _send(s, buf, size, false);
+    }
+
+    size_t TcpBackend::receive_native(char* buf, size_t size, bool peek) {
+        socket_t s = (socket_t) socket;
+        if ( !VALIDATE_SOCKET(s) )
+            throw error::SetupError("TCP socket not connected!");
+        if ( !_wait(s, false, 0) )
+            return 0;
+        return _recv_ready(s, buf, size, peek);
+    }
+#endif
+
+/********************************************/
+/* connect_all                              */
+/********************************************/
+std::vector<ConnectResult> connect_all(const std::vector<net::IpAddress>& endpoints, size_t concurrency, Deadline deadline) {
+    std::vector<ConnectResult> results(endpoints.size());
+    if ( concurrency == 0 )
+        concurrency = endpoints.size();
+
+    #ifdef _WIN32
+        sys::winsock_init();
+    #endif
+
+    // Connects in flight, and the index of the endpoint of each
+    std::vector<sys::pollfd_t> fds;
+    std::vector<size_t>        owners;
+    fds.reserve(std::min(concurrency, endpoints.size()));
+    owners.reserve(fds.capacity());
+
+    auto connected = [&](size_t index, socket_t socket) {
+        try {
+            results[index].client.reuse_impl().adopt(socket);
+        } catch ( ... ) {
+            results[index].error = std::current_exception();
+        }
+    };
+
+    size_t next = 0;
+
+    try {
+        while ( (next < endpoints.size() || !fds.empty()) && Deadline::clock::now() < deadline ) {
+            while ( next < endpoints.size() && fds.size() < concurrency ) {
+                size_t   index  = next++;
+                socket_t socket = INVALID_SOCKET;
+
+                try {
+                    _new_socket(socket, endpoints[index].family);
+                    if ( _start_connect(socket, endpoints[index]) ) {
+                        _finish_connect(socket);
+                        connected(index, socket);
+                    } else {
+                        sys::pollfd_t fd {};
+                        fd.fd     = socket;
+                        fd.events = POLLOUT;
+                        fds.push_back(fd);
+                        owners.push_back(index);
+                    }
+                } catch ( ... ) {
+                    results[index].error = std::current_exception();
+                }
+            }
+
+            if ( fds.empty() )
+                continue;
+
+            uint64_t timeout = ISocket::timeout_until(deadline);
+            int res = sys::poll(fds.data(), fds.size(), (int) std::min<uint64_t>(timeout, INT_MAX));
+
+            if ( res < 0 ) {
+                int err = sys::last_socket_error();
+                if ( err == WSAEINTR )
+                    continue;
+                throw error::SystemApiError(err);
+            }
+
+            // Failed connects report an error or hang-up rather than writable - _finish_connect tells which
+            for ( size_t i = 0; i < fds.size(); ) {
+                if ( fds[i].revents == 0 ) {
+                    i++;
+                    continue;
+                }
+
+                size_t   index  = owners[i];
+                socket_t socket = fds[i].fd;
+                fds[i]    = fds.back();
+                owners[i] = owners.back();
+                fds.pop_back();
+                owners.pop_back();
+
+                try {
+                    _finish_connect(socket);
+                    connected(index, socket);
+                } catch ( ... ) {
+                    results[index].error = std::current_exception();
+                }
+            }
+        }
+    } catch ( ... ) {
+        for ( auto& fd: fds ) {
+            socket_t socket = fd.fd;
+            _close_socket(socket);
+        }
+        throw;
+    }
+
+    // Past the deadline - give up on the connects still in flight, and those never started
+    for ( size_t i = 0; i < fds.size(); i++ ) {
+        socket_t socket = fds[i].fd;
+        _close_socket(socket);
+        results[owners[i]].error = std::make_exception_ptr(error::ConnectionFailure("Connect timed out!"));
+    }
+
+    for ( ; next < endpoints.size(); next++ )
+        results[next].error = std::make_exception_ptr(error::ConnectionFailure("Connect timed out!"));
+
+    return results;
+}
+
+
+/********************************************/
+/* TcpListener::Impl                        */
+/********************************************/
+struct TcpListener::Impl {
+    protected:
+        socket_t socket = INVALID_SOCKET;
+
+    public:
+        void listen(const net::IpAddress& address, const ListenOptions& options) {
+            _new_socket(socket, address.family);
+            _listen(socket, address, options);
+        }
+
+        void close() noexcept {
+            _close_socket(socket);
+        }
+
+        socket_t accept(uint64_t timeout) {
+            return _accept(socket, timeout);
+        }
+
+        net::IpAddress local_address() const {
+            return _local_address(socket);
+        }
+
+        bool steer_by_cpu(unsigned group_size) {
+            return _steer_by_cpu(socket, group_size);
+        }
+
+        socket_t handle() const noexcept {
+            return socket;
+        }
+
+    public:
+        Impl() {
+            #ifdef _WIN32
+                sys::winsock_init();
+            #endif
+        }
+        ~Impl() {
+            close();
+        }
+};
+
+void TcpListener::ImplCleanup::operator()(Impl* ptr) const {
+    if ( ptr )
+        delete ptr;
+}
+
+/********************************************/
+/* TcpListener                              */
+/********************************************/
+TcpListener::~TcpListener() = default;
+
+void TcpListener::listen(const net::IpAddress& address, const ListenOptions& options) {
+    std::lock_guard lock(mutex);
+    if ( pimpl )
+        throw error::SetupError("TcpListener already listening!");
+
+    std::unique_ptr<Impl, ImplCleanup> listener(new Impl());
+    listener->listen(address, options);
+    pimpl = std::move(listener);
+}
+
+void TcpListener::close() noexcept {
+    std::lock_guard lock(mutex);
+    pimpl.reset(nullptr);
+}
+
+bool TcpListener::accept(TcpClient& client, uint64_t timeout) {
+    std::lock_guard lock(mutex);
+    if ( !pimpl )
+        throw error::SetupError("TcpListener not listening!");
+
+    std::lock_guard client_lock(client.mutex);
+    TcpClient::Impl& impl = client.reuse_impl();
+
+    socket_t accepted = pimpl->accept(timeout);
+    if ( !VALIDATE_SOCKET(accepted) )
+        return false;
+
+    impl.adopt(accepted); // Owns the socket from here, even if applying the policy fails
+    return true;
+}
+
+net::IpAddress TcpListener::local_address() const {
+    std::lock_guard lock(mutex);
+    if ( !pimpl )
+        throw error::SetupError("TcpListener not listening!");
+    return pimpl->local_address();
+}
+
+sys::native_socket_t TcpListener::native_handle() const {
+    std::lock_guard lock(mutex);
+    if ( !pimpl )
+        throw error::SetupError("TcpListener not listening!");
+    return pimpl->handle();
+}
+
+bool TcpListener::steer_by_cpu(unsigned group_size) {
+    std::lock_guard lock(mutex);
+    if ( !pimpl )
+        throw error::SetupError("TcpListener not listening!");
+    return pimpl->steer_by_cpu(group_size);
+}
 }
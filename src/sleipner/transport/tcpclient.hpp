@@ -11,15 +11,87 @@
 #ifndef _SLEIPNER_TRANSPORT_TCPCLIENT_HPP_
 #define _SLEIPNER_TRANSPORT_TCPCLIENT_HPP_
 
+#include <chrono>
+#include <exception>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <string>
+#include <vector>
 #include <cstdint>
 
 #include "sleipner/transport/isocket.hpp"
 #include "sleipner/net/ip.hpp"
+#include "sleipner/sys/socket.hpp"
 
 namespace sleipner::transport {
+/**
+ * @brief Controls how @b receive and @b peek wait for data to arrive
+ *
+ * By default a receive with a timeout parks the thread in the system until data arrives,
+ * paying the scheduler wake-up latency on every message. With a spin budget, the socket is
+ * busy-polled for up to @b spin_budget microseconds first, and only then does the call block
+ * for the remainder of its timeout.
+ *
+ * @note Spinning trades CPU time for latency, and is only worth it for latency-critical
+ *       consumers with a dedicated core.
+ */
+struct ReceivePolicy {
+    /// @brief Microseconds to busy-poll before blocking, 0 to always block immediately
+    uint32_t spin_budget = 0;
+
+    /**
+     * @brief Skip spinning when the next message is not expected within the spin budget
+     *
+     * The expectation is a moving average of the observed inter-arrival times.
+     */
+    bool adaptive = false;
+
+    /**
+     * @brief Value for @b SO_BUSY_POLL in microseconds, 0 to leave it unset
+     *
+     * Ignored where not supported, or not permitted - values above @b net.core.busy_read need
+     * @b CAP_NET_ADMIN on Linux.
+     */
+    uint32_t busy_poll = 0;
+};
+
+/**
+ * @brief Snapshot of the kernel's view of a TCP connection, from @b TcpClient::tcp_info
+ *
+ * Fields the system does not report are 0.
+ */
+struct TcpInfo {
+    /// @brief Smoothed round-trip time
+    std::chrono::microseconds srtt = std::chrono::microseconds(0);
+
+    /// @brief Variation of the round-trip time
+    std::chrono::microseconds rttvar = std::chrono::microseconds(0);
+
+    /// @brief Congestion window in bytes
+    uint64_t cwnd = 0;
+
+    /// @brief Maximum segment size sent
+    uint32_t mss = 0;
+
+    /// @brief Segments retransmitted over the lifetime of the connection
+    uint64_t retransmits = 0;
+
+    /// @brief Recent delivery rate estimate in bytes per second
+    uint64_t delivery_rate = 0;
+
+    /// @brief Bytes sent and not yet acknowledged or known lost
+    uint64_t bytes_in_flight = 0;
+
+    /// @brief Segments sent and not yet acknowledged
+    uint32_t unacked = 0;
+
+    /// @brief Bytes in the send buffer not yet sent, e.g. held back by a slow consumer
+    uint64_t unsent_bytes = 0;
+};
+
+struct ConnectResult;
+
 /**
  * @brief Client implementation for TCP network communication
  *
@@ -44,11 +116,24 @@ namespace sleipner::transport {
 class TcpClient: public ISocket {
 protected:
     struct Impl;
-    struct ImplCleanup { void operator()(Impl* ptr) const; };
+    struct ImplCleanup {
+        // Resource the Impl is allocated from, null (as value-initialised by unique_ptr) for the global heap
+        std::pmr::memory_resource* resource;
+        void operator()(Impl* ptr) const;
+    };
     // struct ImplCleanup { void operator()(Impl* ptr) const; };
 
     std::unique_ptr<Impl, ImplCleanup> pimpl;
     mutable std::mutex    mutex;
+    ReceivePolicy         policy;
+
+    friend class TcpListener;
+    friend std::vector<ConnectResult> connect_all(const std::vector<net::IpAddress>&, size_t, Deadline);
+
+    // The Impl to connect, allocated once and reused after close - throws if connected
+    Impl& reuse_impl();
+    // The Impl of the open connection - throws if not connected
+    Impl& open_impl() const;
 
 public:
     /**
@@ -59,11 +144,75 @@ public:
      */
     TcpClient() = default;
 
+    /**
+     * @brief Constructor allocating the internal state from the memory resource, rather than the global heap
+     *
+     * The state is allocated by the first @b connect, and kept until destruction. Combined
+     * with the @b std::pmr overloads of @b receive and @b peek, a client can run without
+     * touching the global heap.
+     *
+     * @param [in] resource Memory resource to allocate from, must outlive the client
+     */
+    explicit TcpClient(std::pmr::memory_resource* resource);
+
     /**
      * @brief Default destructor cleans up all resources used
      */
     ~TcpClient();
 
+    /**
+     * @brief Take over the connection and receive policy of another client
+     *
+     * The other client is left as if @b connect was never called.
+     */
+    TcpClient(TcpClient&& other) noexcept;
+
+    /**
+     * @brief Close the connection, and take over the connection and receive policy of another client
+     *
+     * The other client is left as if @b connect was never called.
+     */
+    TcpClient& operator=(TcpClient&& other) noexcept;
+
+    TcpClient(const TcpClient&) = delete;
+    TcpClient& operator=(const TcpClient&) = delete;
+
+    /**
+     * @brief Wrap a connected TCP socket created elsewhere, e.g. accepted by another event loop
+     *
+     * The client owns the socket from here, and closes it with itself. The blocking mode of
+     * the socket is left as is - @b receive and @b peek wait for data before reading either
+     * way, but @b send on a non-blocking socket only sends what fits in the send buffer, and
+     * returns 0 if it is full. Use @b WriteQueue to have the rest sent as the buffer drains.
+     *
+     * @param [in] socket A connected TCP socket
+     * @param [in] policy How @b receive and @b peek wait for data
+     * @throws std::invalid_argument If the socket is not a TCP socket
+     * @throws SystemApiError If the policy could not be applied - the socket is then left open, and still the caller's
+     * @return TcpClient Client owning the socket
+     */
+    static TcpClient adopt(sys::native_socket_t socket, const ReceivePolicy& policy = ReceivePolicy());
+
+    /**
+     * @brief Retrieve the system socket, e.g. to wait for data in an event loop
+     *
+     * @note The socket is still owned by the client, and is closed with it
+     *
+     * @throws SetupError
+     */
+    sys::native_socket_t native_handle() const;
+
+    /**
+     * @brief Give up ownership of the system socket, without closing it
+     *
+     * Afterwards, the client behaves as if @b close was called, and the caller is
+     * responsible for closing the socket.
+     *
+     * @throws SetupError
+     * @return sys::native_socket_t The connected socket
+     */
+    sys::native_socket_t release();
+
     /**
      * @brief Establish TCP connection to host at the desired address
      *
@@ -84,14 +233,102 @@ public:
      */
     void connect(const std::vector<net::IpAddress>& addresses);
 
+    /**
+     * @brief Establish TCP connection to host at the desired address, giving up at the deadline
+     *
+     * @param [in] address The address of the host
+     * @param [in] deadline Time by which the handshake must be done
+     * @throw std::invalid_argument If the address is obviously malformed
+     * @throws ConnectionFailure If the host could not be reached, or the deadline passed first
+     * @throws SystemApiError
+     */
+    void connect(const net::IpAddress& address, Deadline deadline);
+
+    /**
+     * @brief Establish TCP connection to first connectable host at the desired address, giving up at the deadline
+     *
+     * All attempts share the deadline - an unreachable address can use it up for the ones after it.
+     *
+     * @param [in] addresses The addresses to try to connect to
+     * @param [in] deadline Time by which a handshake must be done
+     * @throws std::invalid_argument If any address tried is obviously malformed
+     * @throws ConnectionFailure
+     * @throws SystemApiError
+     */
+    void connect(const std::vector<net::IpAddress>& addresses, Deadline deadline);
+
+    /**
+     * @brief Establish TCP connection to host at the desired address, carrying the data in the handshake
+     *
+     * Uses TCP Fast Open where the system supports it: with a cookie from an earlier
+     * connection to the host, the data rides in the SYN, and the response can arrive
+     * one round trip earlier than with @b connect followed by @b send. Without a cookie,
+     * or without Fast Open support, this falls back to a regular handshake followed by
+     * the send, at no extra cost.
+     *
+     * The server must have Fast Open enabled, see @b ListenOptions::fast_open_queue.
+     * On Linux, the client side also needs bit 1 of the @b net.ipv4.tcp_fastopen sysctl.
+     *
+     * @param [in] address The address of the host
+     * @param [in] buf The data to send
+     * @param [in] size Number of bytes to send
+     * @throw std::invalid_argument If the address is obviously malformed
+     * @throws ConnectionFailure
+     * @throws SocketDisconnection
+     * @throws SystemApiError
+     * @return size_t Number of bytes sent
+     */
+    size_t connect_and_send(const net::IpAddress& address, const char* buf, size_t size);
+
+    /**
+     * @brief Establish TCP connection to host at the desired address, carrying the data in the handshake
+     *
+     * @see connect_and_send(const net::IpAddress&, const char*, size_t)
+     */
+    size_t connect_and_send(const net::IpAddress& address, const std::string& packet);
+
     /**
      * @brief Closes the TCP connection
      *
      * After calling @b close, the client will behave as if @b connect was never
      * called, and @b SetupError will be thrown as in an un-connected instance
+     *
+     * The internal state is kept for the next @b connect, so a client reconnected
+     * over and over only allocates on its first connect.
      */
     void close() noexcept;
 
+    /**
+     * @brief Set how @b receive and @b peek wait for data
+     *
+     * The policy is kept across @b close and @b connect.
+     *
+     * @param [in] policy The policy to use
+     * @throws SystemApiError if @b busy_poll failed on the connected socket for other reasons than
+     *         lacking support or permission - the previous policy is then kept
+     */
+    void set_receive_policy(const ReceivePolicy& policy);
+
+    /**
+     * @brief Retrieve the current receive policy
+     */
+    ReceivePolicy receive_policy() const;
+
+    /**
+     * @brief Retrieve the kernel's statistics of the connection, in one system call
+     *
+     * Uses @b TCP_INFO on Linux and @b SIO_TCP_INFO on Windows.
+     *
+     * @throws SetupError
+     * @throws SystemApiError If the system does not provide the statistics
+     * @return TcpInfo The current statistics
+     */
+    TcpInfo tcp_info() const;
+
+    // Deadline overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
     /// @copydoc ISocket::connected()
     bool connected() const override;
 
@@ -104,6 +341,25 @@ public:
     /// @copydoc ISocket::send(const std::string&)
     size_t send(const std::string& packet) override;
 
+    /**
+     * @brief Send data over the connection, blocking no later than the deadline
+     *
+     * Passing the deadline of the @b connect before it, and of the @b receive after it, makes
+     * a whole exchange share one time budget.
+     *
+     * @param [in] buf The data to send
+     * @param [in] size Number of bytes to send
+     * @param [in] deadline Time by which to stop waiting for room in the send buffer
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return size_t Number of bytes sent - fewer than @a size if the deadline passed first
+     */
+    size_t send(const char* buf, size_t size, Deadline deadline);
+
+    /// @copydoc send(const char*, size_t, Deadline)
+    size_t send(const std::string& packet, Deadline deadline);
+
     /// @copydoc ISocket::receive(char*, size_t, uint64_t)
     size_t receive(char* buf, size_t size, uint64_t timeout) override;
 
@@ -116,6 +372,50 @@ public:
     /// @copydoc ISocket::peek(size_t, uint64_t)
     std::string peek(size_t size, uint64_t timeout) override;
 };
+
+/**
+ * @brief Retrieve the kernel's statistics of a connected TCP socket, e.g. one of an event loop
+ *
+ * @param [in] socket A connected TCP socket
+ * @throws SystemApiError If the socket is invalid, or the system does not provide the statistics
+ * @return TcpInfo The current statistics
+ */
+TcpInfo tcp_info(sys::native_socket_t socket);
+
+/**
+ * @brief Outcome of connecting to one endpoint with @b connect_all
+ */
+struct ConnectResult {
+    /// @brief The connected client, or an unconnected client if the connect failed
+    TcpClient client;
+
+    /// @brief The exception @b TcpClient::connect would have thrown, or null on success
+    std::exception_ptr error;
+};
+
+/**
+ * @brief Connect to many endpoints at once, e.g. to reconnect a fleet after a restart
+ *
+ * Starts non-blocking connects and waits for all of them through one poller, so thousands
+ * of connections take about as long as the slowest handshake, rather than the sum of them,
+ * and without a thread per connection.
+ *
+ * Basic usage example:
+ * @code
+ * std::vector<ConnectResult> results = connect_all(endpoints, 512, std::chrono::steady_clock::now() + std::chrono::seconds(10));
+ *
+ * for ( auto& result: results )
+ *     if ( !result.error )
+ *         clients.push_back(std::move(result.client));
+ * @endcode
+ *
+ * @param [in] endpoints The addresses to connect to, one connection each
+ * @param [in] concurrency Maximum number of connects in flight, 0 for no limit
+ * @param [in] deadline Connects not done by then fail with @b ConnectionFailure
+ * @throws SystemApiError If waiting for the connects fails
+ * @return std::vector<ConnectResult> One result per endpoint, in the same order
+ */
+std::vector<ConnectResult> connect_all(const std::vector<net::IpAddress>& endpoints, size_t concurrency, Deadline deadline);
 }
 
 #endif
@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file tcplistener.hpp
+ * @brief Implements a listener accepting incoming TCP connections into TcpClients
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_TCPLISTENER_HPP_
+#define _SLEIPNER_TRANSPORT_TCPLISTENER_HPP_
+
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/net/ip.hpp"
+#include "sleipner/sys/socket.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Options for @b TcpListener::listen
+ */
+struct ListenOptions {
+    /// @brief Maximum number of connections waiting to be accepted
+    int backlog = 128;
+
+    /// @brief Allow binding while old connections on the address are in TIME_WAIT
+    bool reuse_address = true;
+
+    /**
+     * @brief Allow several listeners to bind the same address, sharing the incoming connections
+     *
+     * Ignored where @b SO_REUSEPORT is not supported.
+     */
+    bool reuse_port = false;
+
+    /**
+     * @brief Maximum number of pending TCP Fast Open requests, 0 to disable Fast Open
+     *
+     * With Fast Open, clients using @b TcpClient::connect_and_send can carry their first
+     * request in the SYN, saving a round trip on short-lived connections. On Linux, the
+     * server side also needs bit 2 of the @b net.ipv4.tcp_fastopen sysctl.
+     *
+     * Ignored where @b TCP_FASTOPEN is not supported.
+     */
+    int fast_open_queue = 0;
+};
+
+/**
+ * @brief Listener for incoming TCP connections
+ *
+ * The listener is not an @b ISocket, as it never sends or receives data itself. Instead,
+ * each accepted connection is handed over to a @b TcpClient, which is used as if it had
+ * been connected with @b TcpClient::connect.
+ *
+ * Basic usage example:
+ * @code
+ * TcpListener listener;
+ * listener.listen(resolve_ip("localhost", 8080).front());
+ *
+ * TcpClient client;
+ * if ( listener.accept(client, 5000) )
+ *     client.send("Hello!");
+ * @endcode
+ */
+class TcpListener {
+protected:
+    struct Impl;
+    struct ImplCleanup { void operator()(Impl* ptr) const; };
+
+    std::unique_ptr<Impl, ImplCleanup> pimpl;
+    mutable std::mutex    mutex;
+
+public:
+    /**
+     * @brief Default constructor does not allow any operations to be carried out, except @b listen
+     */
+    TcpListener() = default;
+
+    /**
+     * @brief Default destructor stops listening and cleans up all resources used
+     */
+    ~TcpListener();
+
+    /**
+     * @brief Bind to the address and start listening for connections
+     *
+     * @param [in] address The local address to listen on - use port 0 for any free port
+     * @param [in] options Socket options for the listener
+     * @throws std::invalid_argument If the address is obviously malformed
+     * @throws SetupError If already listening
+     * @throws ConnectionFailure If the address can not be bound, e.g. it is in use
+     * @throws SystemApiError
+     */
+    void listen(const net::IpAddress& address, const ListenOptions& options = ListenOptions());
+
+    /**
+     * @brief Stops listening - connections not yet accepted are reset
+     */
+    void close() noexcept;
+
+    /**
+     * @brief Accept the next incoming connection into the client
+     *
+     * @param [out] client An unconnected client to hand the connection to
+     * @param [in] timeout Milliseconds to block if no connection is pending
+     * @throws SetupError If not listening, or the client is already connected
+     * @throws SystemApiError
+     * @return bool True if a connection was accepted, false on timeout
+     */
+    bool accept(TcpClient& client, uint64_t timeout);
+
+    /**
+     * @brief Retrieve the address the listener is bound to, including the port chosen by the system
+     *
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    net::IpAddress local_address() const;
+
+    /**
+     * @brief Retrieve the system socket, e.g. to wait for connections in an event loop
+     *
+     * @throws SetupError
+     */
+    sys::native_socket_t native_handle() const;
+
+    /**
+     * @brief Steer each incoming connection to the listener of the CPU that received it
+     *
+     * Attaches a program to the @b SO_REUSEPORT group of this listener, selecting listener
+     * number @a cpu % @a group_size for a connection whose packets are processed on @a cpu.
+     * The listeners in the group are numbered in the order they were bound.
+     *
+     * @param [in] group_size Number of listeners in the group
+     * @throws SetupError
+     * @throws SystemApiError
+     * @return bool False if steering is not supported on this system
+     */
+    bool steer_by_cpu(unsigned group_size);
+};
+}
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/tcpsampler.hpp"
+#include "sleipner/transport/error.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace sleipner::transport {
+/********************************************/
+/* TcpInfoSampler                           */
+/********************************************/
+TcpInfoSampler::TcpInfoSampler(const SamplerOptions& options): options(options) {
+    if ( options.interval.count() <= 0 )
+        throw std::invalid_argument("Sampling interval must be positive!");
+}
+
+TcpInfoSampler::~TcpInfoSampler() {
+    stop();
+}
+
+void TcpInfoSampler::add(TcpClient& client) {
+    sys::native_socket_t socket = client.native_handle();
+
+    std::lock_guard lock(mutex);
+    auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.client == &client; });
+
+    // Re-adding a reconnected client picks up its new socket
+    if ( it != entries.end() ) {
+        it->socket  = socket;
+        it->sampled = false;
+        return;
+    }
+
+    entries.push_back(Entry{&client, socket, Sample{&client, TcpInfo(), {}}, false});
+}
+
+void TcpInfoSampler::remove(TcpClient& client) {
+    std::lock_guard lock(mutex);
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.client == &client; }), entries.end());
+}
+
+void TcpInfoSampler::on_sample(SampleHandler new_handler) {
+    std::lock_guard lock(mutex);
+    handler = std::move(new_handler);
+}
+
+void TcpInfoSampler::start() {
+    std::lock_guard lock(thread_mutex);
+    if ( thread.joinable() )
+        throw error::SetupError("TcpInfoSampler already started!");
+
+    stopping = false;
+    thread = std::thread([this] { run(); });
+}
+
+void TcpInfoSampler::stop() noexcept {
+    {
+        std::lock_guard lock(thread_mutex);
+        stopping = true;
+        thread_cv.notify_all();
+    }
+
+    if ( thread.joinable() )
+        thread.join();
+}
+
+size_t TcpInfoSampler::sample() {
+    std::lock_guard lock(mutex);
+    size_t count = 0;
+
+    for ( auto& entry: entries ) {
+        try {
+            entry.sample.info = tcp_info(entry.socket);
+        } catch ( std::exception& ) {
+            continue;
+        }
+
+        entry.sample.time = std::chrono::steady_clock::now();
+        entry.sampled     = true;
+        count++;
+
+        if ( handler )
+            handler(*entry.client, entry.sample.info);
+    }
+
+    return count;
+}
+
+std::vector<TcpInfoSampler::Sample> TcpInfoSampler::latest() const {
+    std::lock_guard lock(mutex);
+    std::vector<Sample> samples;
+    samples.reserve(entries.size());
+
+    for ( auto& entry: entries )
+        if ( entry.sampled )
+            samples.push_back(entry.sample);
+
+    return samples;
+}
+
+void TcpInfoSampler::run() {
+    auto next = std::chrono::steady_clock::now();
+    std::unique_lock lock(thread_mutex);
+
+    while ( !stopping ) {
+        lock.unlock();
+        try {
+            sample();
+        } catch ( std::exception& ) {
+            /* Thrown by the handler - keep sampling */
+        }
+        lock.lock();
+
+        // Keep to the schedule, instead of drifting by the length of each pass
+        next += options.interval;
+        thread_cv.wait_until(lock, next, [this] { return stopping; });
+    }
+}
+}
@@ -0,0 +1,154 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file tcpsampler.hpp
+ * @brief Periodic collection of kernel TCP statistics across many connections
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_TCPSAMPLER_HPP_
+#define _SLEIPNER_TRANSPORT_TCPSAMPLER_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/sys/socket.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Options for @b TcpInfoSampler
+ */
+struct SamplerOptions {
+    /// @brief Time between the start of two sampling passes
+    std::chrono::milliseconds interval = std::chrono::milliseconds(1000);
+};
+
+/**
+ * @brief Samples the @b TcpInfo of a set of clients on a schedule
+ *
+ * Each pass costs one system call per client. The sampler reads the system socket of a
+ * client directly, rather than through the client, so a client blocked in @b receive
+ * does not hold up the pass.
+ *
+ * Basic usage example:
+ * @code
+ * TcpInfoSampler sampler;
+ * sampler.on_sample([&](TcpClient& client, const TcpInfo& info) {
+ *     // Consumer not keeping up - stop routing to it
+ *     if ( info.unsent_bytes > (1 << 20) || info.srtt > std::chrono::milliseconds(50) )
+ *         router.demote(client);
+ * });
+ *
+ * for ( auto& client: clients )
+ *     sampler.add(client);
+ * sampler.start();
+ * @endcode
+ *
+ * @warning A client must be removed before it is closed, moved from or destroyed, as its
+ *          system socket may otherwise be reused by another connection.
+ */
+class TcpInfoSampler {
+public:
+    /// @brief Called on the sampling thread for every client sampled
+    typedef std::function<void(TcpClient&, const TcpInfo&)> SampleHandler;
+
+    /**
+     * @brief Latest statistics of one client
+     */
+    struct Sample {
+        TcpClient*                            client;
+        TcpInfo                               info;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    /**
+     * @throws std::invalid_argument If the interval is not positive
+     */
+    explicit TcpInfoSampler(const SamplerOptions& options = SamplerOptions());
+
+    /**
+     * @brief Stops sampling
+     */
+    ~TcpInfoSampler();
+
+    TcpInfoSampler(const TcpInfoSampler&) = delete;
+    TcpInfoSampler& operator=(const TcpInfoSampler&) = delete;
+
+    /**
+     * @brief Start sampling the client, from the next pass
+     *
+     * @param [in] client A connected client
+     * @throws SetupError If the client is not connected
+     */
+    void add(TcpClient& client);
+
+    /**
+     * @brief Stop sampling the client - once this returns, it is not in any pass
+     */
+    void remove(TcpClient& client);
+
+    /**
+     * @brief Set the handler called with every sample
+     *
+     * @note The handler runs with the client set locked, so it must not call @b add or @b remove
+     */
+    void on_sample(SampleHandler handler);
+
+    /**
+     * @brief Start the sampling thread
+     *
+     * @throws SetupError If already started
+     */
+    void start();
+
+    /**
+     * @brief Stop the sampling thread, waiting for a pass in progress
+     */
+    void stop() noexcept;
+
+    /**
+     * @brief Sample every client once, on the calling thread, e.g. from an event loop's timer
+     *
+     * Clients whose statistics can not be read are skipped.
+     *
+     * @return size_t Number of clients sampled
+     */
+    size_t sample();
+
+    /**
+     * @brief Retrieve the latest sample of every client sampled at least once
+     */
+    std::vector<Sample> latest() const;
+
+protected:
+    struct Entry {
+        TcpClient*           client;
+        sys::native_socket_t socket;
+        Sample               sample;
+        bool                 sampled;
+    };
+
+    const SamplerOptions options;
+
+    // Guards the clients and the handler
+    mutable std::mutex      mutex;
+    std::vector<Entry>      entries;
+    SampleHandler           handler;
+
+    std::mutex              thread_mutex;
+    std::condition_variable thread_cv;
+    bool                    stopping = false;
+    std::thread             thread;
+
+    void run();
+};
+}
+
+#endif
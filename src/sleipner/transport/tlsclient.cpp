@@ -0,0 +1,599 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/tlsclient.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/sys/error.hpp"
+#include "sleipner/sys/mmap.hpp"
+#include "sleipner/sys/native.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <list>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#if defined(__linux__) && !defined(_WIN32)
+    #include <sys/stat.h>
+#endif
+
+// SSL_sendfile needs kernel TLS, which OpenSSL only offers on Linux from 3.0
+#if defined(__linux__) && defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send) && !defined(OPENSSL_NO_KTLS)
+    #define SLEIPNER_KTLS_SENDFILE
+#endif
+
+namespace sleipner::transport {
+/********************************************/
+/* Helpers                                  */
+/********************************************/
+// The reason of the oldest queued OpenSSL error, clearing the queue
+static std::string _openssl_error() {
+    unsigned long code = ::ERR_get_error();
+    ::ERR_clear_error();
+    if ( !code )
+        return "Unknown TLS error";
+
+    char message[256];
+    ::ERR_error_string_n(code, message, sizeof(message));
+    return message;
+}
+
+// Wait until the socket is readable or writable, as the TLS call asked - false on timeout. UINT64_MAX waits indefinitely
+static bool _wait(sys::socket_t socket, bool write, uint64_t timeout) {
+    sys::pollfd_t fd {};
+    fd.fd     = socket;
+    fd.events = write ? POLLOUT : POLLIN;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::min<uint64_t>(timeout, INT_MAX));
+
+    for ( ;; ) {
+        int wait = -1;
+        if ( timeout != UINT64_MAX )
+            wait = (int) std::min<uint64_t>(ISocket::timeout_until(deadline), INT_MAX);
+
+        int res = sys::poll(&fd, 1, wait);
+        if ( res > 0 )
+            return true;
+        if ( res == 0 )
+            return false;
+        if ( !sys::would_block(sys::last_socket_error()) )
+            throw error::SystemApiError(sys::last_socket_error());
+    }
+}
+
+// Throw the exception matching the failed TLS call
+[[noreturn]] static void _fail(SSL* ssl, int ret) {
+    int err = ::SSL_get_error(ssl, ret);
+
+    switch ( err ) {
+        case SSL_ERROR_ZERO_RETURN:
+            ::ERR_clear_error();
+            throw error::SocketDisconnection("TLS connection closed by peer!");
+
+        case SSL_ERROR_SYSCALL: {
+            int code = sys::last_socket_error();
+            ::ERR_clear_error();
+            switch ( code ) {
+                case 0: // End of file without a close notification
+                case WSAECONNRESET:
+                case WSAECONNABORTED:
+                case WSAENETRESET:
+                case WSAENOTCONN:
+                case WSAETIMEDOUT:
+                #ifndef _WIN32
+                case EPIPE:
+                #endif
+                    throw error::SocketDisconnection(code ? sys::error_message(code) : "TLS connection closed by peer!");
+                default:
+                    throw error::SystemApiError(code);
+            }
+        }
+
+        default:
+            throw error::ProtocolError(_openssl_error());
+    }
+}
+
+// Check if the name is an IP address literal, which is verified against the certificate's IP entries, and never sent with SNI
+static bool _is_ip_literal(const std::string& name) {
+    ASN1_OCTET_STRING* ip = ::a2i_IPADDRESS(name.c_str());
+    if ( !ip )
+        return false;
+    ::ASN1_OCTET_STRING_free(ip);
+    return true;
+}
+
+
+/********************************************/
+/* TlsContext                               */
+/********************************************/
+struct TlsContext::Impl {
+    TlsOptions options;
+    SSL_CTX*   ctx = nullptr;
+    // ALPN protocols in wire format, length-prefixed
+    std::string alpn;
+
+    // The latest session of every server, by "name:port", and the servers least recently stored first
+    struct CachedSession {
+        SSL_SESSION*                     session;
+        std::list<std::string>::iterator position;
+    };
+    std::mutex mutex;
+    std::unordered_map<std::string, CachedSession> sessions;
+    std::list<std::string> order;
+
+    ~Impl() {
+        clear();
+        if ( ctx )
+            ::SSL_CTX_free(ctx);
+    }
+
+    void clear() noexcept {
+        std::lock_guard lock(mutex);
+        for ( auto& entry: sessions )
+            ::SSL_SESSION_free(entry.second.session);
+        sessions.clear();
+        order.clear();
+    }
+
+    // Keep the session, taking over the reference
+    void store(const std::string& key, SSL_SESSION* session) {
+        std::lock_guard lock(mutex);
+
+        auto it = sessions.find(key);
+        if ( it != sessions.end() ) {
+            ::SSL_SESSION_free(it->second.session);
+            it->second.session = session;
+            order.splice(order.end(), order, it->second.position);
+            return;
+        }
+
+        // Forget the least recently stored server once full
+        while ( sessions.size() >= std::max<size_t>(options.session_cache_size, 1) ) {
+            auto oldest = sessions.find(order.front());
+            ::SSL_SESSION_free(oldest->second.session);
+            sessions.erase(oldest);
+            order.pop_front();
+        }
+
+        order.push_back(key);
+        try {
+            sessions.emplace(key, CachedSession{session, std::prev(order.end())});
+        } catch ( ... ) {
+            order.pop_back();
+            throw;
+        }
+    }
+
+    // Take the session out of the cache, as TLS 1.3 tickets should be used once - null if none
+    SSL_SESSION* take(const std::string& key) {
+        std::lock_guard lock(mutex);
+
+        auto it = sessions.find(key);
+        if ( it == sessions.end() )
+            return nullptr;
+
+        SSL_SESSION* session = it->second.session;
+        order.erase(it->second.position);
+        sessions.erase(it);
+        return session;
+    }
+};
+
+void TlsContext::ImplCleanup::operator()(Impl* ptr) const {
+    delete ptr;
+}
+
+TlsContext::TlsContext(const TlsOptions& options): pimpl(new Impl()) {
+    pimpl->options = options;
+
+    pimpl->ctx = ::SSL_CTX_new(::TLS_client_method());
+    if ( !pimpl->ctx )
+        throw std::bad_alloc();
+    SSL_CTX* ctx = pimpl->ctx;
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    // Writes are retried on a non-blocking socket, from wherever the caller's buffer is
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    long flags = 0;
+    #ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        // A peer closing without a close notification reads as a disconnection, not a protocol error
+        flags |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+    #endif
+    #ifdef SSL_OP_ENABLE_KTLS
+        if ( options.kernel_tls )
+            flags |= SSL_OP_ENABLE_KTLS;
+    #endif
+    ::SSL_CTX_set_options(ctx, flags);
+
+    if ( options.verify_peer ) {
+        bool loaded = options.ca_file.empty() && options.ca_path.empty()
+            ? ::SSL_CTX_set_default_verify_paths(ctx)
+            : ::SSL_CTX_load_verify_locations(ctx, options.ca_file.empty() ? nullptr : options.ca_file.c_str(),
+                                                   options.ca_path.empty() ? nullptr : options.ca_path.c_str());
+        if ( !loaded )
+            throw error::SystemApiError(0, "Could not load the trusted certificates: " + _openssl_error());
+
+        ::SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    }
+
+    for ( const std::string& protocol: options.alpn ) {
+        if ( protocol.empty() || protocol.size() > 255 )
+            throw std::invalid_argument("ALPN protocol names must be 1 to 255 bytes!");
+        pimpl->alpn.push_back((char) protocol.size());
+        pimpl->alpn += protocol;
+    }
+
+    if ( options.resume_sessions ) {
+        // Sessions are kept by the context itself, by server rather than by session ID
+        ::SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_set_app_data(ctx, pimpl.get());
+        ::SSL_CTX_sess_set_new_cb(ctx, [](SSL* ssl, SSL_SESSION* session) -> int {
+            auto* impl = (TlsContext::Impl*) SSL_CTX_get_app_data(::SSL_get_SSL_CTX(ssl));
+            auto* key  = (const std::string*) SSL_get_app_data(ssl);
+            if ( !impl || !key || !::SSL_SESSION_is_resumable(session) )
+                return 0;
+
+            impl->store(*key, session);
+            return 1;
+        });
+    }
+}
+
+TlsContext::~TlsContext() = default;
+
+std::shared_ptr<TlsContext> TlsContext::default_context() {
+    static std::mutex mutex;
+    static std::shared_ptr<TlsContext> context;
+
+    std::lock_guard lock(mutex);
+    if ( !context )
+        context = std::make_shared<TlsContext>();
+    return context;
+}
+
+void TlsContext::clear_sessions() noexcept {
+    pimpl->clear();
+}
+
+const TlsOptions& TlsContext::options() const noexcept {
+    return pimpl->options;
+}
+
+
+/********************************************/
+/* TlsClient::Impl                          */
+/********************************************/
+struct TlsClient::Impl {
+    SSL*          ssl    = nullptr;
+    sys::socket_t socket = INVALID_SOCKET;
+    // Key of the server in the session cache, pointed to by the SSL's app data
+    std::string   session_key;
+
+    ~Impl() {
+        if ( ssl )
+            ::SSL_free(ssl);
+    }
+
+    // Run the TLS call until it completes, waiting on the socket as it asks - false on timeout
+    template<typename Call>
+    bool run(Call&& call, uint64_t timeout) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::min<uint64_t>(timeout, INT_MAX));
+
+        for ( ;; ) {
+            ::ERR_clear_error();
+            int ret = call();
+            if ( ret > 0 )
+                return true;
+
+            int err = ::SSL_get_error(ssl, ret);
+            if ( err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE )
+                _fail(ssl, ret);
+
+            uint64_t left = timeout == UINT64_MAX ? UINT64_MAX : ISocket::timeout_until(deadline);
+            if ( !_wait(socket, err == SSL_ERROR_WANT_WRITE, left) )
+                return false;
+        }
+    }
+
+    size_t write(const char* buf, size_t size) {
+        size_t sent = 0;
+
+        while ( sent < size ) {
+            size_t written = 0;
+            run([&] { return ::SSL_write_ex(ssl, buf + sent, size - sent, &written); }, UINT64_MAX);
+            sent += written;
+        }
+        return sent;
+    }
+
+    size_t read(char* buf, size_t size, uint64_t timeout, bool peek) {
+        if ( !size )
+            return 0;
+
+        size_t received = 0;
+        bool done = run([&] {
+            return peek ? ::SSL_peek_ex(ssl, buf, size, &received) : ::SSL_read_ex(ssl, buf, size, &received);
+        }, timeout);
+
+        return done ? received : 0;
+    }
+};
+
+void TlsClient::ImplCleanup::operator()(Impl* ptr) const {
+    delete ptr;
+}
+
+
+/********************************************/
+/* TlsClient                                */
+/********************************************/
+TlsClient::TlsClient(): TlsClient(TlsContext::default_context()) {}
+
+TlsClient::TlsClient(std::shared_ptr<TlsContext> context): context(std::move(context)) {
+    if ( !this->context )
+        throw std::invalid_argument("TlsClient needs a context!");
+}
+
+TlsClient::~TlsClient() {
+    close();
+}
+
+TlsClient::Impl& TlsClient::open_impl() const {
+    if ( !pimpl || !pimpl->ssl )
+        throw error::SetupError("TLS client not connected!");
+    return *pimpl;
+}
+
+void TlsClient::connect(const net::IpAddress& address, const std::string& server_name) {
+    std::lock_guard lock(mutex);
+    if ( pimpl && pimpl->ssl )
+        throw error::SetupError("TLS client already connected!");
+
+    tcp.connect(address);
+    handshake(server_name, net::get_port(address));
+}
+
+void TlsClient::connect(const std::vector<net::IpAddress>& addresses, const std::string& server_name) {
+    std::lock_guard lock(mutex);
+    if ( pimpl && pimpl->ssl )
+        throw error::SetupError("TLS client already connected!");
+    if ( addresses.empty() )
+        throw std::invalid_argument("No addresses to connect to!");
+
+    tcp.connect(addresses);
+    handshake(server_name, net::get_port(addresses.front()));
+}
+
+void TlsClient::handshake(const std::string& server_name, uint16_t port) {
+    TlsContext::Impl& ctx = *context->pimpl;
+    std::string session_key = server_name + ":" + std::to_string(port);
+
+    if ( !pimpl )
+        pimpl.reset(new Impl());
+    Impl& impl = *pimpl;
+
+    try {
+        impl.socket      = (sys::socket_t) tcp.native_handle();
+        impl.session_key = session_key;
+
+        // All waits are done with poll, with the timeouts of the calls
+        if ( !sys::set_non_blocking(impl.socket, true) )
+            throw error::SystemApiError(sys::last_socket_error());
+
+        impl.ssl = ::SSL_new(ctx.ctx);
+        if ( !impl.ssl )
+            throw std::bad_alloc();
+
+        SSL_set_app_data(impl.ssl, &impl.session_key);
+        if ( !::SSL_set_fd(impl.ssl, (int) impl.socket) )
+            throw error::SystemApiError(0, _openssl_error());
+
+        if ( _is_ip_literal(server_name) ) {
+            if ( ctx.options.verify_peer )
+                ::X509_VERIFY_PARAM_set1_ip_asc(::SSL_get0_param(impl.ssl), server_name.c_str());
+        } else {
+            SSL_set_tlsext_host_name(impl.ssl, server_name.c_str());
+            if ( ctx.options.verify_peer )
+                ::SSL_set1_host(impl.ssl, server_name.c_str());
+        }
+
+        if ( !ctx.alpn.empty() )
+            ::SSL_set_alpn_protos(impl.ssl, (const unsigned char*) ctx.alpn.data(), (unsigned) ctx.alpn.size());
+
+        if ( ctx.options.resume_sessions ) {
+            if ( SSL_SESSION* session = ctx.take(session_key) ) {
+                ::SSL_set_session(impl.ssl, session);
+                ::SSL_SESSION_free(session);
+            }
+        }
+
+        bool done;
+        try {
+            done = impl.run([&] { return ::SSL_connect(impl.ssl); }, ctx.options.handshake_timeout);
+        } catch ( error::ProtocolError& e ) {
+            long verify = ::SSL_get_verify_result(impl.ssl);
+            if ( verify != X509_V_OK )
+                throw error::ConnectionFailure(std::string("Certificate verification failed: ") + ::X509_verify_cert_error_string(verify));
+            throw error::ConnectionFailure(std::string("TLS handshake failed: ") + e.what());
+        }
+
+        if ( !done )
+            throw error::RequestTimeout("TLS handshake timed out!");
+    } catch ( ... ) {
+        if ( impl.ssl ) {
+            ::SSL_free(impl.ssl);
+            impl.ssl = nullptr;
+        }
+        tcp.close();
+        throw;
+    }
+}
+
+void TlsClient::close() noexcept {
+    std::lock_guard lock(mutex);
+    if ( !pimpl || !pimpl->ssl )
+        return;
+
+    // Pick up session tickets already received, then notify the server without waiting for its reply
+    if ( context->options().resume_sessions && !::SSL_pending(pimpl->ssl) ) {
+        char byte;
+        size_t peeked;
+        ::SSL_peek_ex(pimpl->ssl, &byte, 1, &peeked);
+    }
+    ::SSL_shutdown(pimpl->ssl);
+    ::ERR_clear_error();
+
+    ::SSL_free(pimpl->ssl);
+    pimpl->ssl = nullptr;
+    tcp.close();
+}
+
+bool TlsClient::resumed() const {
+    std::lock_guard lock(mutex);
+    return ::SSL_session_reused(open_impl().ssl);
+}
+
+bool TlsClient::kernel_tls_send() const {
+    std::lock_guard lock(mutex);
+    #ifdef BIO_get_ktls_send
+        return BIO_get_ktls_send(::SSL_get_wbio(open_impl().ssl));
+    #else
+        // OpenSSL before 3.0 has no kernel TLS
+        open_impl();
+        return false;
+    #endif
+}
+
+bool TlsClient::kernel_tls_receive() const {
+    std::lock_guard lock(mutex);
+    #ifdef BIO_get_ktls_recv
+        return BIO_get_ktls_recv(::SSL_get_rbio(open_impl().ssl));
+    #else
+        open_impl();
+        return false;
+    #endif
+}
+
+std::string TlsClient::alpn() const {
+    std::lock_guard lock(mutex);
+
+    const unsigned char* protocol = nullptr;
+    unsigned int length = 0;
+    ::SSL_get0_alpn_selected(open_impl().ssl, &protocol, &length);
+    return std::string((const char*) protocol, protocol ? length : 0);
+}
+
+sys::native_socket_t TlsClient::native_handle() const {
+    std::lock_guard lock(mutex);
+    return (sys::native_socket_t) open_impl().socket;
+}
+
+size_t TlsClient::send_file(const std::string& path, uint64_t offset, size_t size) {
+    std::lock_guard lock(mutex);
+    Impl& impl = open_impl();
+
+    #ifdef SLEIPNER_KTLS_SENDFILE
+        if ( BIO_get_ktls_send(::SSL_get_wbio(impl.ssl)) ) {
+            int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if ( file < 0 )
+                throw error::SystemApiError(errno);
+
+            size_t sent = 0;
+            try {
+                struct ::stat info {};
+                if ( ::fstat(file, &info) < 0 )
+                    throw error::SystemApiError(errno);
+                if ( offset > (uint64_t) info.st_size )
+                    throw std::invalid_argument("Offset past the end of the file!");
+                size = (size_t) std::min<uint64_t>(size, (uint64_t) info.st_size - offset);
+
+                // The kernel reads the file and encrypts it into the socket, with no copy through user space
+                while ( sent < size ) {
+                    ossl_ssize_t res = 0;
+                    impl.run([&] {
+                        res = ::SSL_sendfile(impl.ssl, file, (off_t) (offset + sent), size - sent, 0);
+                        return res > 0 ? 1 : (int) res;
+                    }, UINT64_MAX);
+                    sent += (size_t) res;
+                }
+            } catch ( ... ) {
+                ::close(file);
+                throw;
+            }
+
+            ::close(file);
+            return sent;
+        }
+    #endif
+
+    // Encrypted straight from the page cache through the mapping, rather than read into a buffer first
+    sys::MappedFile file;
+    file.open(path, sys::MappedFile::ReadOnly);
+    if ( offset > file.size() )
+        throw std::invalid_argument("Offset past the end of the file!");
+
+    size = std::min<size_t>(size, file.size() - (size_t) offset);
+    return impl.write(file.data() + offset, size);
+}
+
+bool TlsClient::connected() const {
+    std::lock_guard lock(mutex);
+    Impl& impl = open_impl();
+
+    if ( ::SSL_get_shutdown(impl.ssl) & SSL_RECEIVED_SHUTDOWN )
+        return false;
+    return tcp.connected();
+}
+
+size_t TlsClient::bytes_available() const {
+    std::lock_guard lock(mutex);
+    Impl& impl = open_impl();
+
+    // Decrypt the next record if it has arrived, so its payload counts
+    if ( !::SSL_pending(impl.ssl) ) {
+        char byte;
+        impl.read(&byte, 1, 0, true);
+    }
+    return (size_t) ::SSL_pending(impl.ssl);
+}
+
+size_t TlsClient::send(const char* buf, size_t size) {
+    std::lock_guard lock(mutex);
+    return open_impl().write(buf, size);
+}
+
+size_t TlsClient::send(const std::string& packet) {
+    return send(packet.data(), packet.size());
+}
+
+size_t TlsClient::receive(char* buf, size_t size, uint64_t timeout) {
+    std::lock_guard lock(mutex);
+    return open_impl().read(buf, size, timeout, false);
+}
+
+std::string TlsClient::receive(size_t size, uint64_t timeout) {
+    std::string buffer(size, '\0');
+    buffer.resize(receive(&buffer[0], buffer.size(), timeout));
+    return buffer;
+}
+
+size_t TlsClient::peek(char* buf, size_t size, uint64_t timeout) {
+    std::lock_guard lock(mutex);
+    return open_impl().read(buf, size, timeout, true);
+}
+
+std::string TlsClient::peek(size_t size, uint64_t timeout) {
+    std::string buffer(size, '\0');
+    buffer.resize(peek(&buffer[0], buffer.size(), timeout));
+    return buffer;
+}
+}
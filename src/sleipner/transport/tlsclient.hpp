@@ -0,0 +1,271 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file tlsclient.hpp
+ * @brief Implements an encrypted socket client over TCP, using OpenSSL
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_TLSCLIENT_HPP_
+#define _SLEIPNER_TRANSPORT_TLSCLIENT_HPP_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "sleipner/transport/isocket.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/net/ip.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Options for @b TlsContext
+ */
+struct TlsOptions {
+    /// @brief Verify the server's certificate chain and host name
+    bool verify_peer = true;
+
+    /// @brief File of trusted CA certificates in PEM format, empty for the system's defaults
+    std::string ca_file;
+
+    /// @brief Directory of trusted CA certificates, empty for the system's defaults
+    std::string ca_path;
+
+    /// @brief Protocols to offer with ALPN, in order of preference, e.g. "h2" and "http/1.1"
+    std::vector<std::string> alpn;
+
+    /// @brief Keep session tickets, and resume the session when connecting to the same server again
+    bool resume_sessions = true;
+
+    /// @brief Maximum number of servers to keep a session for
+    size_t session_cache_size = 1024;
+
+    /// @brief Hand encryption to the kernel (kTLS) after the handshake, where the system supports it
+    bool kernel_tls = true;
+
+    /// @brief Milliseconds to wait for the handshake to complete
+    uint64_t handshake_timeout = 10000;
+};
+
+/**
+ * @brief Configuration and session cache shared by the @b TlsClient instances using it
+ *
+ * Loading the trusted certificates is expensive, so one context should be shared by all
+ * clients with the same options. The context keeps the latest session ticket of every
+ * server, so a client reconnecting to a server resumes its session rather than doing a
+ * full handshake.
+ *
+ * @note Thread-safe
+ */
+class TlsContext {
+public:
+    /**
+     * @param [in] options Verification, ALPN, session and kernel offload settings
+     * @throws SystemApiError If the trusted certificates can not be loaded
+     */
+    explicit TlsContext(const TlsOptions& options = TlsOptions());
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    /**
+     * @brief Retrieve the context with the default options, shared by the clients not given one
+     */
+    static std::shared_ptr<TlsContext> default_context();
+
+    /**
+     * @brief Forget the kept sessions, so the next connections do full handshakes
+     */
+    void clear_sessions() noexcept;
+
+    /**
+     * @brief Retrieve the options the context was made with
+     */
+    const TlsOptions& options() const noexcept;
+
+protected:
+    struct Impl;
+    struct ImplCleanup { void operator()(Impl* ptr) const; };
+
+    std::unique_ptr<Impl, ImplCleanup> pimpl;
+
+    friend class TlsClient;
+};
+
+/**
+ * @brief Client implementation for TLS over TCP
+ *
+ * Connects over TCP, and does the TLS handshake with the server, verifying its certificate
+ * for the server name given. TLS 1.3 session tickets are kept by the @b TlsContext, so the
+ * next connection to the same server resumes the session, skipping the certificate exchange
+ * and verification.
+ *
+ * With kernel TLS enabled, and supported by the system, the records are encrypted and
+ * decrypted by the kernel after the handshake. @b send then costs as little as on a plain
+ * @b TcpClient, and @b send_file sends a file without it ever being copied into user space.
+ *
+ * Basic usage example:
+ * @code
+ * TlsClient client;
+ * client.connect(resolve_ip("www.example.com", 443), "www.example.com");
+ *
+ * client.send("GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: close\r\n\r\n");
+ * std::cout << client.receive(4096, 5000) << std::endl;
+ * @endcode
+ *
+ * @note Thread-safe, though each operation holds the connection for its duration
+ */
+class TlsClient: public ISocket {
+protected:
+    struct Impl;
+    struct ImplCleanup { void operator()(Impl* ptr) const; };
+
+    std::shared_ptr<TlsContext>        context;
+    TcpClient                          tcp;
+    std::unique_ptr<Impl, ImplCleanup> pimpl;
+    mutable std::mutex                 mutex;
+
+    // The Impl of the open connection - throws if not connected
+    Impl& open_impl() const;
+    // Do the handshake on the connected TCP socket
+    void handshake(const std::string& server_name, uint16_t port);
+
+public:
+    /**
+     * @brief Uses the default context. Until @b connect is called, all other operations result in @b SetupError.
+     */
+    TlsClient();
+
+    /**
+     * @param [in] context Configuration and session cache, shared with other clients
+     * @throws std::invalid_argument If the context is null
+     */
+    explicit TlsClient(std::shared_ptr<TlsContext> context);
+
+    /**
+     * @brief Closes the connection without waiting for the server
+     */
+    ~TlsClient();
+
+    TlsClient(const TlsClient&) = delete;
+    TlsClient& operator=(const TlsClient&) = delete;
+
+    /**
+     * @brief Connect to the address and do the handshake
+     *
+     * @param [in] address The server's address
+     * @param [in] server_name The name to send with SNI, and verify the certificate for
+     * @throws std::invalid_argument If the address is malformed
+     * @throws SetupError If already connected
+     * @throws ConnectionFailure If the connection or the handshake fails, e.g. the certificate is not trusted
+     * @throws RequestTimeout If the handshake does not complete within the timeout
+     * @throws SystemApiError
+     */
+    void connect(const net::IpAddress& address, const std::string& server_name);
+
+    /**
+     * @brief Connect to the first connectable address and do the handshake
+     *
+     * @see connect(const net::IpAddress&, const std::string&)
+     */
+    void connect(const std::vector<net::IpAddress>& addresses, const std::string& server_name);
+
+    /**
+     * @brief Send a close notification, and close the connection
+     */
+    void close() noexcept;
+
+    /**
+     * @brief Check if the handshake resumed an earlier session
+     *
+     * @throws SetupError
+     */
+    bool resumed() const;
+
+    /**
+     * @brief Check if the kernel encrypts the data sent
+     *
+     * @throws SetupError
+     */
+    bool kernel_tls_send() const;
+
+    /**
+     * @brief Check if the kernel decrypts the data received
+     *
+     * @throws SetupError
+     */
+    bool kernel_tls_receive() const;
+
+    /**
+     * @brief Retrieve the protocol chosen with ALPN, or an empty string if none
+     *
+     * @throws SetupError
+     */
+    std::string alpn() const;
+
+    /**
+     * @brief Retrieve the TCP socket - for waiting on readiness, not for sending or receiving
+     *
+     * @throws SetupError
+     */
+    sys::native_socket_t native_handle() const;
+
+    /**
+     * @brief Send part of a file
+     *
+     * With kernel TLS the kernel reads, encrypts and sends the file itself. Otherwise the
+     * file is mapped, and encrypted from the mapping.
+     *
+     * @param [in] path The file to send
+     * @param [in] offset Byte of the file to start at
+     * @param [in] size Bytes to send, or up to the end of the file if larger
+     * @throws std::invalid_argument If the offset is past the end of the file
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError If the file can not be read
+     * @return size_t Number of bytes sent
+     */
+    size_t send_file(const std::string& path, uint64_t offset = 0, size_t size = SIZE_MAX);
+
+    // Deadline and memory resource overloads of receive and peek
+    using ISocket::receive;
+    using ISocket::peek;
+
+    /// @copydoc ISocket::connected()
+    bool connected() const override;
+
+    /**
+     * @brief Retrieve the decrypted bytes that can be received without blocking
+     *
+     * @throws SocketDisconnection
+     * @throws SetupError
+     * @throws SystemApiError
+     */
+    size_t bytes_available() const override;
+
+    /// @copydoc ISocket::send(const char*, size_t)
+    size_t send(const char* buf, size_t size) override;
+
+    /// @copydoc ISocket::send(const std::string&)
+    size_t send(const std::string& packet) override;
+
+    /// @copydoc ISocket::receive(char*, size_t, uint64_t)
+    size_t receive(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::receive(size_t, uint64_t)
+    std::string receive(size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(char*, size_t, uint64_t)
+    size_t peek(char* buf, size_t size, uint64_t timeout) override;
+
+    /// @copydoc ISocket::peek(size_t, uint64_t)
+    std::string peek(size_t size, uint64_t timeout) override;
+};
+}
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+#include "sleipner/transport/writequeue.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/sys/error.hpp"
+#include "sleipner/sys/native.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace sleipner::transport {
+// Small writes are packed into chunks of this size, larger writes are queued as they are
+static constexpr size_t CHUNK_SIZE  = 64 << 10;
+// Chunks written by one call
+static constexpr size_t MAX_BUFFERS = 64;
+
+/********************************************/
+/* WriteQueue                               */
+/********************************************/
+WriteQueue::WriteQueue(runtime::Reactor& reactor, TcpClient& client, const WriteQueueOptions& options):
+        reactor(reactor), options(options) {
+    if ( options.low_watermark >= options.high_watermark || options.high_watermark > options.limit )
+        throw std::invalid_argument("Watermarks must be low < high <= limit!");
+
+    socket       = client.native_handle();
+    was_blocking = !sys::is_non_blocking((sys::socket_t) socket);
+    if ( was_blocking && !sys::set_non_blocking((sys::socket_t) socket, true) )
+        throw error::SystemApiError(sys::last_socket_error());
+}
+
+WriteQueue::~WriteQueue() {
+    if ( watched )
+        reactor.remove(socket);
+    if ( was_blocking )
+        sys::set_non_blocking((sys::socket_t) socket, false);
+}
+
+bool WriteQueue::write(const char* data, size_t size) {
+    if ( has_failed )
+        throw error::SocketDisconnection("Write queue failed!");
+    if ( bytes + size > options.limit )
+        return false;
+
+    // Nothing waiting - straight to the socket, and only queue what did not fit
+    size_t sent = chunks.empty() ? send_now(data, size) : 0;
+    if ( has_failed )
+        throw error::SocketDisconnection("Write queue failed!");
+
+    if ( sent < size ) {
+        enqueue(data + sent, size - sent);
+        queued_more();
+    }
+    return true;
+}
+
+bool WriteQueue::write(std::string data) {
+    if ( data.size() < CHUNK_SIZE )
+        return write(data.data(), data.size());
+
+    if ( has_failed )
+        throw error::SocketDisconnection("Write queue failed!");
+    if ( bytes + data.size() > options.limit )
+        return false;
+
+    size_t sent = chunks.empty() ? send_now(data.data(), data.size()) : 0;
+    if ( has_failed )
+        throw error::SocketDisconnection("Write queue failed!");
+
+    // Large - keep the string instead of copying it, resuming from what was sent if it is the front
+    if ( sent < data.size() ) {
+        if ( chunks.empty() )
+            offset = sent;
+        bytes      += data.size() - sent;
+        packed_back = false;
+        chunks.push_back(std::move(data));
+        queued_more();
+    }
+    return true;
+}
+
+void WriteQueue::on_high_watermark(WatermarkHandler handler) {
+    high_handler = std::move(handler);
+}
+
+void WriteQueue::on_low_watermark(WatermarkHandler handler) {
+    low_handler = std::move(handler);
+}
+
+void WriteQueue::on_error(ErrorHandler handler) {
+    error_handler = std::move(handler);
+}
+
+void WriteQueue::on_readable(runtime::Reactor::Handler handler) {
+    read_handler = std::move(handler);
+    update_watch();
+}
+
+size_t WriteQueue::queued() const noexcept {
+    return bytes;
+}
+
+bool WriteQueue::above_high_watermark() const noexcept {
+    return above_high;
+}
+
+bool WriteQueue::failed() const noexcept {
+    return has_failed;
+}
+
+size_t WriteQueue::send_now(const char* data, size_t size) {
+    sys::iobuf_t buffer;
+    sys::set_iobuf(buffer, data, size);
+
+    int64_t sent = sys::send_buffers((sys::socket_t) socket, &buffer, 1);
+    if ( sent < 0 ) {
+        int err = sys::last_socket_error();
+        if ( !sys::would_block(err) )
+            fail(err);
+        return 0;
+    }
+    return (size_t) sent;
+}
+
+void WriteQueue::enqueue(const char* data, size_t size) {
+    bytes += size;
+
+    // Top up the last chunk, unless a large write has it to itself
+    if ( packed_back ) {
+        std::string& back = chunks.back();
+        size_t fits = std::min(size, CHUNK_SIZE - back.size());
+        back.append(data, fits);
+        data += fits;
+        size -= fits;
+    }
+
+    if ( size == 0 )
+        return;
+
+    if ( size >= CHUNK_SIZE ) {
+        chunks.emplace_back(data, size);
+        packed_back = false;
+        return;
+    }
+
+    // Reuse the last chunk sent, so a queue cycling through steady state does not allocate
+    std::string chunk = std::move(spare);
+    spare = std::string();
+    chunk.clear();
+    chunk.reserve(CHUNK_SIZE);
+    chunk.append(data, size);
+
+    chunks.push_back(std::move(chunk));
+    packed_back = true;
+}
+
+void WriteQueue::flush() {
+    sys::iobuf_t buffers[MAX_BUFFERS];
+
+    while ( !chunks.empty() ) {
+        size_t count     = std::min(chunks.size(), MAX_BUFFERS);
+        size_t attempted = 0;
+        for ( size_t i = 0; i < count; i++ ) {
+            size_t skip = i == 0 ? offset : 0;
+            sys::set_iobuf(buffers[i], chunks[i].data() + skip, chunks[i].size() - skip);
+            attempted += chunks[i].size() - skip;
+        }
+
+        int64_t sent = sys::send_buffers((sys::socket_t) socket, buffers, count);
+        if ( sent < 0 ) {
+            int err = sys::last_socket_error();
+            if ( !sys::would_block(err) )
+                fail(err);
+            break;
+        }
+
+        bytes -= (size_t) sent;
+        size_t left = (size_t) sent;
+        while ( left ) {
+            size_t remaining = chunks.front().size() - offset;
+            if ( left < remaining ) {
+                offset += left;
+                break;
+            }
+
+            left -= remaining;
+            if ( chunks.front().capacity() >= CHUNK_SIZE && chunks.front().capacity() < 2 * CHUNK_SIZE )
+                spare = std::move(chunks.front());
+            chunks.pop_front();
+            offset = 0;
+        }
+
+        if ( chunks.empty() )
+            packed_back = false;
+
+        // Socket buffer full
+        if ( (size_t) sent < attempted )
+            break;
+    }
+
+    if ( above_high && bytes <= options.low_watermark ) {
+        above_high = false;
+        if ( low_handler )
+            low_handler();
+    }
+
+    update_watch();
+}
+
+void WriteQueue::fail(int err) {
+    has_failed  = true;
+    chunks.clear();
+    bytes       = 0;
+    offset      = 0;
+    packed_back = false;
+    update_watch();
+
+    if ( error_handler )
+        error_handler(std::make_exception_ptr(error::SocketDisconnection(sys::error_message(err))));
+}
+
+void WriteQueue::queued_more() {
+    update_watch();
+
+    if ( !above_high && bytes >= options.high_watermark ) {
+        above_high = true;
+        if ( high_handler )
+            high_handler();
+    }
+}
+
+void WriteQueue::update_watch() {
+    int events = (read_handler ? runtime::Reactor::Readable : 0)
+               | (!chunks.empty() ? runtime::Reactor::Writable : 0);
+    if ( events == watched )
+        return;
+
+    if ( events == 0 )
+        reactor.remove(socket);
+    else if ( watched == 0 )
+        reactor.add(socket, events, [this](int ready) {
+            if ( (ready & (runtime::Reactor::Writable | runtime::Reactor::Error)) && !chunks.empty() )
+                flush();
+            if ( (ready & (runtime::Reactor::Readable | runtime::Reactor::Error)) && read_handler )
+                read_handler(ready);
+        });
+    else
+        reactor.modify(socket, events);
+
+    watched = events;
+}
+}
@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file writequeue.hpp
+ * @brief Non-blocking sending through an event loop, with watermarks for backpressure
+ * @author Ferdinand Tonby-Strandborg
+ */
+#ifndef _SLEIPNER_TRANSPORT_WRITEQUEUE_HPP_
+#define _SLEIPNER_TRANSPORT_WRITEQUEUE_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <string>
+
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/sys/socket.hpp"
+
+namespace sleipner::transport {
+/**
+ * @brief Options for @b WriteQueue
+ */
+struct WriteQueueOptions {
+    /// @brief Bytes queued at which producers are told to pause
+    size_t high_watermark = 1 << 20;
+
+    /// @brief Bytes queued at which paused producers are told to resume
+    size_t low_watermark = 256 << 10;
+
+    /// @brief Bytes queued beyond which writes are refused, bounding the memory used for a stalled peer
+    size_t limit = 16 << 20;
+};
+
+/**
+ * @brief Sends data on a client without blocking, queueing what the socket can not take yet
+ *
+ * A write first goes straight to the socket. Whatever does not fit in the socket buffer is
+ * queued, and sent with vectored writes as the reactor reports the socket writable. So a
+ * fast peer sees every write sent right away, while a slow peer only grows the queue.
+ *
+ * Producers throttle on the watermarks: once the queue reaches the high watermark, the
+ * high watermark handler is called, and once it has drained to the low watermark, the low
+ * watermark handler. The hard @b limit bounds the memory of a producer ignoring them.
+ *
+ * The queue owns the reactor watch of the socket, as a socket can only be watched once.
+ * Set a handler with @b on_readable to also receive from the client in the event loop.
+ *
+ * Basic usage example:
+ * @code
+ * WriteQueue queue(reactor, client);
+ * queue.on_high_watermark([&] { source.pause(); });
+ * queue.on_low_watermark([&] { source.resume(); });
+ * queue.on_error([&](std::exception_ptr) { client.close(); });
+ *
+ * source.on_data([&](std::string data) { queue.write(std::move(data)); });
+ * @endcode
+ *
+ * @note All methods, and the destructor, may only be used from the loop thread, or while
+ *       the loop is not running. All handlers are called on the loop thread.
+ */
+class WriteQueue {
+public:
+    /// @brief Called when the queue crosses a watermark
+    typedef std::function<void()> WatermarkHandler;
+
+    /// @brief Called once the connection failed, with the exception describing the failure
+    typedef std::function<void(std::exception_ptr)> ErrorHandler;
+
+    /**
+     * @brief Take over sending on the client, switching its socket to non-blocking mode
+     *
+     * @param [in] reactor The event loop to drain the queue from
+     * @param [in] client A connected client, must stay connected and outlive the queue
+     * @param [in] options Watermarks and limit
+     * @throws std::invalid_argument If the watermarks are not low < high <= limit
+     * @throws SetupError If the client is not connected
+     * @throws SystemApiError
+     */
+    WriteQueue(runtime::Reactor& reactor, TcpClient& client, const WriteQueueOptions& options = WriteQueueOptions());
+
+    /**
+     * @brief Drops the data still queued, and switches the socket back to the mode it was in when taken over
+     */
+    ~WriteQueue();
+
+    WriteQueue(const WriteQueue&) = delete;
+    WriteQueue& operator=(const WriteQueue&) = delete;
+
+    /**
+     * @brief Send the data, or queue it to be sent once the socket is writable
+     *
+     * @param [in] data Bytes to send
+     * @param [in] size Number of bytes to send
+     * @throws SocketDisconnection If the connection has failed
+     * @return bool False if the data would take the queue beyond its limit - then nothing is queued
+     */
+    bool write(const char* data, size_t size);
+
+    /**
+     * @brief Send the data, or queue it to be sent once the socket is writable
+     *
+     * Large strings are queued as they are, without copying.
+     *
+     * @see write(const char*, size_t)
+     */
+    bool write(std::string data);
+
+    /**
+     * @brief Set the handler called when the queue reaches the high watermark
+     */
+    void on_high_watermark(WatermarkHandler handler);
+
+    /**
+     * @brief Set the handler called when the queue has drained to the low watermark, after reaching the high one
+     */
+    void on_low_watermark(WatermarkHandler handler);
+
+    /**
+     * @brief Set the handler called once sending fails, after which the queue is empty and writes throw
+     */
+    void on_error(ErrorHandler handler);
+
+    /**
+     * @brief Set the handler called when the client is readable or has failed, null to stop watching for reads
+     */
+    void on_readable(runtime::Reactor::Handler handler);
+
+    /**
+     * @brief Retrieve the number of bytes queued
+     */
+    size_t queued() const noexcept;
+
+    /**
+     * @brief Check if the high watermark was reached, and the low one not yet since
+     */
+    bool above_high_watermark() const noexcept;
+
+    /**
+     * @brief Check if sending has failed
+     */
+    bool failed() const noexcept;
+
+protected:
+    runtime::Reactor&         reactor;
+    const WriteQueueOptions   options;
+    sys::native_socket_t      socket;
+    bool                      was_blocking;
+
+    // Queued data - small writes are packed into chunks, and the front chunk is sent from offset
+    std::deque<std::string>   chunks;
+    std::string               spare;
+    size_t                    offset      = 0;
+    size_t                    bytes       = 0;
+    bool                      packed_back = false;
+    bool                      above_high  = false;
+    bool                      has_failed  = false;
+    int                       watched     = 0;
+
+    WatermarkHandler          high_handler;
+    WatermarkHandler          low_handler;
+    ErrorHandler              error_handler;
+    runtime::Reactor::Handler read_handler;
+
+    size_t send_now(const char* data, size_t size);
+    void enqueue(const char* data, size_t size);
+    void flush();
+    void fail(int err);
+    void queued_more();
+    void update_watch();
+};
+}
+
+#endif
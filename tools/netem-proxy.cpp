@@ -0,0 +1,535 @@
+/**
+ * Copyright (c) 2024 Ferdinand Tonby-Strandborg
+ * This software is provided under the MIT License.
+ * See LICENSE file for details
+ */
+/**
+ * @file netem-proxy.cpp
+ * @brief TCP proxy emulating the delay, jitter, bandwidth, loss, reordering and resets of a real network
+ * @author Ferdinand Tonby-Strandborg
+ *
+ * Sits between two local endpoints, and delivers the bytes of each direction as a network with
+ * the given conditions would. Data is cut into segments, each one leaving once the bandwidth
+ * allows, and arriving after the delay plus jitter. A TCP receiver only ever sees a stream in
+ * order, so a lost segment shows as a stall of one retransmission timeout, and a reordered one
+ * as a shorter stall - both holding back the data behind them. Resets drop a connection without
+ * notice, optionally after it went silent for a while.
+ *
+ * Queued data is bounded, so a sender faster than the emulated link is held back by TCP flow
+ * control, as by a real bottleneck.
+ *
+ * e.g. 50 ms RTT with 1% loss in front of a server on port 8080:
+ *      `netem-proxy --delay 25 --jitter 2 --loss 1 127.0.0.1 9080 127.0.0.1 8080`
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sleipner/net/ip.hpp"
+#include "sleipner/runtime/reactor.hpp"
+#include "sleipner/transport/basicsocket.hpp"
+#include "sleipner/transport/error.hpp"
+#include "sleipner/transport/tcpclient.hpp"
+#include "sleipner/transport/tcplistener.hpp"
+
+using sleipner::runtime::Reactor;
+using sleipner::runtime::TimerHandle;
+using sleipner::runtime::TimerWheel;
+using sleipner::transport::TcpBackend;
+
+typedef TimerWheel::clock clock_type;
+typedef std::chrono::microseconds usec;
+
+// Bytes read from a socket at a time
+static constexpr size_t READ_SIZE = 64 << 10;
+
+// Pending error of the socket, clearing it
+static int _socket_error(int socket) noexcept {
+    int err = 0;
+    ::socklen_t len = sizeof(err);
+    if ( ::getsockopt(socket, SOL_SOCKET, SO_ERROR, &err, &len) < 0 )
+        return errno;
+    return err;
+}
+
+/********************************************/
+/* Conditions                               */
+/********************************************/
+struct Conditions {
+    // One-way delay, and the most it varies by either way
+    usec delay  = usec(0);
+    usec jitter = usec(0);
+
+    // Bytes per second each way, 0 for unlimited
+    uint64_t rate = 0;
+
+    // Chance per segment, 0 to 1
+    double loss    = 0;
+    double reorder = 0;
+
+    // Stall of a lost segment, and of a reordered one
+    usec rto           = usec(200000);
+    usec reorder_delay = usec(5000);
+
+    // Mean seconds between resets of a connection, 0 for never, and how long it is silent first
+    double reset_interval = 0;
+    usec   reset_stall    = usec(0);
+
+    // Bytes per segment, and the most queued each way before the sender is held back
+    size_t segment = 1448;
+    size_t buffer  = 1 << 20;
+};
+
+/********************************************/
+/* Session                                  */
+/********************************************/
+struct Segment {
+    clock_type::time_point due;
+    size_t                 size;
+};
+
+// One direction of a proxied connection
+struct Pipe {
+    TcpBackend* source = nullptr;
+    TcpBackend* sink   = nullptr;
+
+    // bytes[head..] holds the segments arrived, and after them those in flight
+    std::string         bytes;
+    size_t              head    = 0;
+    size_t              arrived = 0;
+    std::deque<Segment> in_flight;
+
+    clock_type::time_point link_free;
+    clock_type::time_point last_due;
+    TimerHandle            timer;
+
+    bool eof  = false;
+    bool shut = false;
+
+    uint64_t forwarded = 0;
+    uint64_t lost      = 0;
+    uint64_t reordered = 0;
+
+    size_t queued() const noexcept {
+        return bytes.size() - head;
+    }
+};
+
+struct Session {
+    uint64_t    id = 0;
+    TcpBackend  client;
+    TcpBackend  server;
+    Pipe        up;
+    Pipe        down;
+    TimerHandle reset;
+    int         connecting = -1;    // Socket to the target while its handshake is under way
+    bool        stalled    = false;
+    bool        closed     = false;
+};
+
+/********************************************/
+/* Proxy                                    */
+/********************************************/
+class Proxy {
+public:
+    Proxy(const Conditions& conditions, const sleipner::net::IpAddress& listen_address,
+          std::vector<sleipner::net::IpAddress> target, uint64_t seed):
+        conditions(conditions),
+        target(std::move(target)),
+        random(seed) {
+        listener.listen(listen_address);
+        reactor.add(listener.native_handle(), Reactor::Readable, [this](int) { accept(); });
+    }
+
+    void run() {
+        reactor.run();
+    }
+
+protected:
+    const Conditions                        conditions;
+    const std::vector<sleipner::net::IpAddress> target;
+    std::mt19937_64                         random;
+
+    Reactor                                 reactor;
+    sleipner::transport::TcpListener        listener;
+    std::map<uint64_t, std::unique_ptr<Session>> sessions;
+    uint64_t                                next_id = 1;
+
+    double uniform() {
+        return std::uniform_real_distribution<double>(0.0, 1.0)(random);
+    }
+
+    void accept() {
+        for ( ;; ) {
+            sleipner::transport::TcpClient client;
+            if ( !listener.accept(client, 0) )
+                return;
+
+            auto session = std::make_unique<Session>();
+            Session* s   = session.get();
+            s->id     = next_id++;
+            s->client = TcpBackend(std::move(client));
+            sessions[s->id] = std::move(session);
+
+            // The target may be slow to answer, or not at all - the other sessions carry on meanwhile
+            connect(s, 0, 0);
+        }
+    }
+
+    // Start a non-blocking connect to the first target address from the index on that takes one - err is why the last one failed
+    void connect(Session* s, size_t index, int err) {
+        for ( ; index < target.size(); index++ ) {
+            const sleipner::net::IpAddress& address = target[index];
+
+            int socket = ::socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if ( socket < 0 ) {
+                err = errno;
+                continue;
+            }
+
+            if ( ::connect(socket, (const ::sockaddr*) address.addr.data(), (::socklen_t) address.addr.size()) == 0 || errno == EINPROGRESS ) {
+                s->connecting = socket;
+                reactor.add(socket, Reactor::Writable, [this, s, index](int) { connected(s, index); });
+                return;
+            }
+
+            err = errno;
+            ::close(socket);
+        }
+
+        std::cout << "[" << s->id << "] Target unreachable: " << std::strerror(err) << std::endl;
+        close(s, true);
+    }
+
+    void connected(Session* s, size_t index) {
+        int socket = s->connecting;
+        int err    = _socket_error(socket);
+
+        reactor.remove(socket);
+        s->connecting = -1;
+
+        if ( err ) {
+            ::close(socket);
+            connect(s, index + 1, err);
+            return;
+        }
+
+        s->server = TcpBackend(sleipner::transport::TcpClient::adopt(socket));
+        s->up.source   = &s->client;
+        s->up.sink     = &s->server;
+        s->down.source = &s->server;
+        s->down.sink   = &s->client;
+
+        // Segments go out as they arrive - Nagle's algorithm would add delay of its own
+        int enable = 1;
+        ::setsockopt(s->client.native_handle(), IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        ::setsockopt(s->server.native_handle(), IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        reactor.add(s->client.native_handle(), Reactor::Readable, [this, s](int events) { ready(s, s->client, events); });
+        reactor.add(s->server.native_handle(), Reactor::Readable, [this, s](int events) { ready(s, s->server, events); });
+
+        if ( conditions.reset_interval > 0 ) {
+            double seconds = std::exponential_distribution<double>(1.0 / conditions.reset_interval)(random);
+            s->reset = reactor.timers().add(clock_type::now() + usec((int64_t) (seconds * 1e6)), [this, s] { stall(s); });
+        }
+
+        std::cout << "[" << s->id << "] Connected" << std::endl;
+    }
+
+    void ready(Session* s, TcpBackend& socket, int events) {
+        if ( s->closed )
+            return;
+
+        Pipe& outgoing = &socket == &s->client ? s->up : s->down;
+        Pipe& incoming = &socket == &s->client ? s->down : s->up;
+
+        // An error or hang-up is reported whatever is waited for, so it is dealt with now, or the loop spins
+        bool hung_up = false;
+        if ( events & Reactor::Error ) {
+            int err = _socket_error(socket.native_handle());
+
+            // Reset, nothing more to read, or about to be reset anyway - a write would fail too, or never be woken
+            if ( err || outgoing.eof || s->stalled ) {
+                close(s, err || !(s->up.shut && s->down.shut));
+                return;
+            }
+            hung_up = true;
+        }
+
+        try {
+            if ( events & (Reactor::Readable | Reactor::Error) )
+                read(s, outgoing, hung_up);
+            if ( events & Reactor::Writable )
+                write(incoming);
+        } catch ( sleipner::error::SocketDisconnection& ) {
+            // The sink is gone - the other end has to find out the hard way
+            close(s, true);
+            return;
+        }
+
+        if ( s->up.shut && s->down.shut )
+            close(s, false);
+        else
+            update(s);
+    }
+
+    // A source that hung up is read past the queue bound - it can send no more than its socket holds
+    void read(Session* s, Pipe& pipe, bool hung_up) {
+        if ( pipe.eof || s->stalled || (!hung_up && pipe.queued() >= conditions.buffer) )
+            return;
+
+        size_t offset = pipe.bytes.size();
+        size_t wanted = hung_up ? READ_SIZE : std::min(READ_SIZE, conditions.buffer - pipe.queued());
+        pipe.bytes.resize(offset + wanted);
+
+        size_t received;
+        try {
+            received = pipe.source->receive_some(&pipe.bytes[offset], wanted, false);
+        } catch ( sleipner::error::SocketDisconnection& ) {
+            // Closed or reset - either way, deliver what was sent, then close the other side
+            pipe.bytes.resize(offset);
+            pipe.eof = true;
+            finish(pipe);
+            return;
+        }
+        pipe.bytes.resize(offset + received);
+
+        for ( size_t sent = 0; sent < received; sent += conditions.segment )
+            transmit(s, pipe, std::min(conditions.segment, received - sent));
+        write(pipe);
+    }
+
+    // Put one segment on the emulated link
+    void transmit(Session* s, Pipe& pipe, size_t size) {
+        clock_type::time_point now = clock_type::now();
+        clock_type::time_point departure = now;
+
+        // Segments queue behind each other for the bandwidth
+        if ( conditions.rate ) {
+            pipe.link_free = std::max(pipe.link_free, now) + usec((int64_t) (size * 1000000 / conditions.rate));
+            departure = pipe.link_free;
+        }
+
+        clock_type::time_point due = departure + conditions.delay;
+        if ( conditions.jitter.count() ) {
+            int64_t range = conditions.jitter.count();
+            due += usec(std::uniform_int_distribution<int64_t>(-range, range)(random));
+        }
+
+        if ( conditions.loss > 0 && uniform() < conditions.loss ) {
+            due += conditions.rto;
+            pipe.lost++;
+        } else if ( conditions.reorder > 0 && uniform() < conditions.reorder ) {
+            due += conditions.reorder_delay;
+            pipe.reordered++;
+        }
+
+        // In order, as TCP hands it to the application
+        due = std::max({due, pipe.last_due, now});
+        pipe.last_due = due;
+
+        // Due already, e.g. with no delay - the timers would add up to a tick
+        if ( due == now && pipe.in_flight.empty() ) {
+            pipe.arrived += size;
+            return;
+        }
+
+        pipe.in_flight.push_back({due, size});
+        if ( pipe.in_flight.size() == 1 )
+            pipe.timer = reactor.timers().add(due, [this, s, &pipe] { arrive(s, pipe); });
+    }
+
+    void arrive(Session* s, Pipe& pipe) {
+        clock_type::time_point now = clock_type::now();
+        while ( !pipe.in_flight.empty() && pipe.in_flight.front().due <= now ) {
+            pipe.arrived += pipe.in_flight.front().size;
+            pipe.in_flight.pop_front();
+        }
+
+        if ( !pipe.in_flight.empty() )
+            pipe.timer = reactor.timers().add(pipe.in_flight.front().due, [this, s, &pipe] { arrive(s, pipe); });
+
+        if ( s->stalled )
+            return;
+
+        try {
+            write(pipe);
+        } catch ( sleipner::error::SocketDisconnection& ) {
+            close(s, true);
+            return;
+        }
+        update(s);
+    }
+
+    void write(Pipe& pipe) {
+        if ( pipe.arrived ) {
+            size_t sent = pipe.sink->send_some(&pipe.bytes[pipe.head], pipe.arrived);
+            pipe.head      += sent;
+            pipe.arrived   -= sent;
+            pipe.forwarded += sent;
+
+            // Reclaim the front once it is the larger part
+            if ( pipe.head > pipe.bytes.size() / 2 ) {
+                pipe.bytes.erase(0, pipe.head);
+                pipe.head = 0;
+            }
+        }
+        finish(pipe);
+    }
+
+    // Pass the end of the stream on once everything before it was delivered
+    void finish(Pipe& pipe) {
+        if ( pipe.eof && !pipe.shut && pipe.queued() == 0 ) {
+            ::shutdown(pipe.sink->native_handle(), SHUT_WR);
+            pipe.shut = true;
+        }
+    }
+
+    // Read while there is room to queue, and wait to write while segments have arrived
+    void update(Session* s) {
+        int client_events = 0;
+        int server_events = 0;
+
+        if ( !s->stalled ) {
+            if ( !s->up.eof && s->up.queued() < conditions.buffer )
+                client_events |= Reactor::Readable;
+            if ( !s->down.eof && s->down.queued() < conditions.buffer )
+                server_events |= Reactor::Readable;
+            if ( s->down.arrived )
+                client_events |= Reactor::Writable;
+            if ( s->up.arrived )
+                server_events |= Reactor::Writable;
+        }
+
+        reactor.modify(s->client.native_handle(), client_events);
+        reactor.modify(s->server.native_handle(), server_events);
+    }
+
+    void stall(Session* s) {
+        if ( conditions.reset_stall.count() == 0 ) {
+            close(s, true);
+            return;
+        }
+
+        std::cout << "[" << s->id << "] Going silent before a reset" << std::endl;
+        s->stalled = true;
+        update(s);
+        s->reset = reactor.timers().add(clock_type::now() + conditions.reset_stall, [this, s] { close(s, true); });
+    }
+
+    void close(Session* s, bool reset) {
+        if ( s->closed )
+            return;
+        s->closed = true;
+
+        std::cout << "[" << s->id << "] " << (reset ? "Reset" : "Closed")
+                  << " - up " << s->up.forwarded << " bytes (" << s->up.lost << " lost, " << s->up.reordered << " reordered)"
+                  << ", down " << s->down.forwarded << " bytes (" << s->down.lost << " lost, " << s->down.reordered << " reordered)"
+                  << std::endl;
+
+        reactor.remove(s->client.native_handle());
+        reactor.remove(s->server.native_handle());
+        reactor.timers().cancel(s->up.timer);
+        reactor.timers().cancel(s->down.timer);
+        reactor.timers().cancel(s->reset);
+
+        // A zero linger time makes close send a reset rather than a graceful close
+        if ( reset ) {
+            ::linger hard = {1, 0};
+            ::setsockopt(s->client.native_handle(), SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+            ::setsockopt(s->server.native_handle(), SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+        }
+        s->client.close();
+        s->server.close();
+
+        // Released once the handler that got here has returned
+        uint64_t id = s->id;
+        reactor.post([this, id] { sessions.erase(id); });
+    }
+};
+
+/********************************************/
+/* main                                     */
+/********************************************/
+static void usage() {
+    std::cout << "Usage: netem-proxy [options] <listen host> <listen port> <target host> <target port>\n"
+                 "  --delay MS           One-way delay, half the round-trip time\n"
+                 "  --jitter MS          Most the delay varies by, either way\n"
+                 "  --rate MBIT          Bandwidth each way in Mbit/s\n"
+                 "  --loss PCT           Segments lost, each stalling the stream for one RTO\n"
+                 "  --rto MS             Stall of a lost segment (200)\n"
+                 "  --reorder PCT        Segments arriving late, after others sent later\n"
+                 "  --reorder-delay MS   How late a reordered segment arrives (5)\n"
+                 "  --reset-interval S   Mean seconds between resets of each connection\n"
+                 "  --reset-stall MS     How long a connection goes silent before it is reset\n"
+                 "  --segment BYTES      Segment size (1448)\n"
+                 "  --buffer KIB         Most data queued each way (1024)\n"
+                 "  --seed N             Seed for the random conditions, for repeatable runs\n";
+}
+
+static usec _ms(const char* value) {
+    return usec((int64_t) (std::stod(value) * 1000));
+}
+
+int main(int argc, char* argv[]) {
+    Conditions conditions;
+    std::vector<std::string> positional;
+    uint64_t seed = std::random_device()();
+
+    for ( int i = 1; i < argc; i++ ) {
+        std::string arg = argv[i];
+        if ( arg.compare(0, 2, "--") != 0 ) {
+            positional.push_back(arg);
+            continue;
+        }
+        if ( i + 1 >= argc ) {
+            usage();
+            return 1;
+        }
+
+        const char* value = argv[++i];
+        if ( arg == "--delay" )               conditions.delay          = _ms(value);
+        else if ( arg == "--jitter" )         conditions.jitter         = _ms(value);
+        else if ( arg == "--rate" )           conditions.rate           = (uint64_t) (std::stod(value) * 1e6 / 8);
+        else if ( arg == "--loss" )           conditions.loss           = std::stod(value) / 100;
+        else if ( arg == "--rto" )            conditions.rto            = _ms(value);
+        else if ( arg == "--reorder" )        conditions.reorder        = std::stod(value) / 100;
+        else if ( arg == "--reorder-delay" )  conditions.reorder_delay  = _ms(value);
+        else if ( arg == "--reset-interval" ) conditions.reset_interval = std::stod(value);
+        else if ( arg == "--reset-stall" )    conditions.reset_stall    = _ms(value);
+        else if ( arg == "--segment" )        conditions.segment        = std::max<size_t>(1, std::stoul(value));
+        else if ( arg == "--buffer" )         conditions.buffer         = std::max<size_t>(1, std::stoul(value)) << 10;
+        else if ( arg == "--seed" )           seed                      = std::stoull(value);
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if ( positional.size() != 4 ) {
+        usage();
+        return 1;
+    }
+
+    auto listen_address = sleipner::net::resolve_ip(positional[0], (uint16_t) std::stoi(positional[1])).front();
+    auto target         = sleipner::net::resolve_ip(positional[2], (uint16_t) std::stoi(positional[3]));
+
+    Proxy proxy(conditions, listen_address, target, seed);
+    std::cout << "Proxying " << positional[0] << ":" << positional[1] << " to "
+              << positional[2] << ":" << positional[3] << ", seed " << seed << std::endl;
+    proxy.run();
+    return 0;
+}